@@ -23,6 +23,8 @@ cd ..
 # This is a dirty hack to guarantee that I can use the fatfs-sdk submodule
 echo "Patching the fatfs-sdk... to use chmod"
 sed -i.bak 's/#define FF_USE_CHMOD[[:space:]]*0/#define FF_USE_CHMOD 1/' fatfs-sdk/src/ff15/source/ffconf.h && mv fatfs-sdk/src/ff15/source/ffconf.h.bak .
+echo "Patching the fatfs-sdk... to match the short names with f_findfirst"
+sed -i 's/#define FF_USE_FIND[[:space:]]*1/#define FF_USE_FIND 2/' fatfs-sdk/src/ff15/source/ffconf.h
 
 # Set the environment variables of the SDKs
 export FATFS_SDK_PATH=$PWD/fatfs-sdk
@@ -0,0 +1,469 @@
+/**
+ * File: catalog.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Push parser of the ROM and floppy catalogs downloaded. The catalogs are
+ * parsed as the HTTP body arrives, and the records are stored in a fixed size arena.
+ */
+
+#include "include/catalog.h"
+
+/**
+ * @brief Allocates the memory of an arena.
+ *
+ * @param arena The arena.
+ * @param size The bytes of the arena.
+ *
+ * @return true if the memory was allocated.
+ */
+bool catalog_arena_init(CatalogArena *arena, uint32_t size)
+{
+    arena->base = malloc(size);
+    arena->size = arena->base ? size : 0;
+    arena->used = 0;
+    return arena->base != NULL;
+}
+
+/**
+ * @brief Allocates zeroed, 32 bit aligned memory from an arena.
+ *
+ * Nothing is released until the whole arena is released with free(arena->base).
+ *
+ * @param arena The arena.
+ * @param size The bytes to allocate.
+ *
+ * @return A pointer to the memory, or NULL if the arena is full.
+ */
+void *catalog_arena_alloc(CatalogArena *arena, uint32_t size)
+{
+    uint32_t start = (arena->used + 3) & ~3;
+    if (start + size > arena->size)
+    {
+        return NULL;
+    }
+    arena->used = start + size;
+    memset(arena->base + start, 0, size);
+    return arena->base + start;
+}
+
+/**
+ * @brief Copies a string in an arena.
+ *
+ * @param arena The arena.
+ * @param value The string. It does not need to be terminated.
+ * @param len The length of the string.
+ *
+ * @return The copy, or NULL if the arena is full.
+ */
+char *catalog_arena_strndup(CatalogArena *arena, const char *value, uint16_t len)
+{
+    if (arena->used + len + 1 > arena->size)
+    {
+        return NULL;
+    }
+    char *copy = (char *)arena->base + arena->used;
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+    arena->used += len + 1;
+    return copy;
+}
+
+/**
+ * @brief Initializes a parser of separated values.
+ *
+ * Fields can be quoted. Inside a quoted field the separators and new lines are part of the
+ * value, and two quotes are an escaped quote.
+ *
+ * @param parser The parser.
+ * @param separator The separator of the fields.
+ * @param max_fields The fields of a record. 0 if the records only end with a new line.
+ * @param skip_header true if the first record is the header and must be ignored.
+ * @param field_fn Called at the end of each field with the terminated value.
+ * @param record_fn Called at the end of each record with the number of fields read.
+ */
+void catalog_parser_init(CatalogParser *parser, char separator, uint8_t max_fields, bool skip_header,
+                         CatalogFieldCallback field_fn, CatalogRecordCallback record_fn)
+{
+    memset(parser, 0, sizeof(CatalogParser));
+    parser->separator = separator;
+    parser->max_fields = max_fields;
+    parser->skip_header = skip_header;
+    parser->field_fn = field_fn;
+    parser->record_fn = record_fn;
+}
+
+static void catalog_end_record(CatalogParser *parser)
+{
+    if (parser->skip_header)
+    {
+        parser->skip_header = false;
+    }
+    else if (parser->record_fn)
+    {
+        parser->record_fn(parser->field);
+    }
+    parser->field = 0;
+    parser->in_record = false;
+}
+
+static void catalog_end_field(CatalogParser *parser)
+{
+    parser->value[parser->len] = '\0';
+    if (!parser->skip_header && parser->field_fn)
+    {
+        parser->field_fn(parser->field, parser->value, parser->len);
+    }
+    parser->field++;
+    parser->len = 0;
+    parser->quoted = false;
+    if ((parser->max_fields > 0) && (parser->field >= parser->max_fields))
+    {
+        catalog_end_record(parser);
+    }
+}
+
+/**
+ * @brief Parses the next bytes of the catalog.
+ *
+ * @param parser The parser.
+ * @param data The bytes. They can split a field or a record anywhere.
+ * @param len The number of bytes.
+ */
+void catalog_parser_feed(CatalogParser *parser, const char *data, uint16_t len)
+{
+    for (uint16_t i = 0; i < len; i++)
+    {
+        char c = data[i];
+        if (parser->quoted)
+        {
+            if (parser->quote_pending)
+            {
+                parser->quote_pending = false;
+                if (c == '"')
+                {
+                    // Escaped quote
+                    if (parser->len < CATALOG_FIELD_SIZE - 1)
+                    {
+                        parser->value[parser->len++] = c;
+                    }
+                    continue;
+                }
+                // Closing quote. The character after it is read as outside the quotes
+                parser->quoted = false;
+            }
+            else
+            {
+                if (c == '"')
+                {
+                    parser->quote_pending = true;
+                }
+                else if (parser->len < CATALOG_FIELD_SIZE - 1)
+                {
+                    parser->value[parser->len++] = c;
+                }
+                continue;
+            }
+        }
+        if (c == '\r')
+        {
+            continue;
+        }
+        if (c == '\n')
+        {
+            if (parser->in_record)
+            {
+                catalog_end_field(parser);
+                if (parser->in_record)
+                {
+                    catalog_end_record(parser);
+                }
+            }
+            continue;
+        }
+        parser->in_record = true;
+        if (c == parser->separator)
+        {
+            catalog_end_field(parser);
+            parser->in_record = parser->field > 0;
+        }
+        else if ((c == '"') && (parser->len == 0))
+        {
+            parser->quoted = true;
+        }
+        else if ((parser->len > 0) || !isspace((unsigned char)c))
+        {
+            // The spaces before a field are ignored
+            if (parser->len < CATALOG_FIELD_SIZE - 1)
+            {
+                parser->value[parser->len++] = c;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Ends the last record of a catalog without a new line at the end.
+ *
+ * @param parser The parser.
+ */
+void catalog_parser_finish(CatalogParser *parser)
+{
+    if (parser->quote_pending)
+    {
+        parser->quote_pending = false;
+        parser->quoted = false;
+    }
+    if (parser->in_record)
+    {
+        catalog_end_field(parser);
+        if (parser->in_record)
+        {
+            catalog_end_record(parser);
+        }
+    }
+}
+
+// Time of the last validation of the indexes used recently, by the CRC32 of their path
+static uint32_t catalog_recent_hash[CATALOG_INDEX_RECENT];
+static uint64_t catalog_recent_time[CATALOG_INDEX_RECENT];
+static uint8_t catalog_recent_next = 0;
+
+static uint32_t catalog_hash(const char *value)
+{
+    return zip_crc32(0, (const uint8_t *)value, strlen(value));
+}
+
+/**
+ * @brief Builds the path of the index of a catalog.
+ *
+ * @param path The path. At least CATALOG_INDEX_PATH_SIZE bytes.
+ * @param name The name of the catalog.
+ */
+void catalog_index_path(char *path, const char *name)
+{
+    snprintf(path, CATALOG_INDEX_PATH_SIZE, "%s/%s%s", CATALOG_INDEX_FOLDER, name, CATALOG_INDEX_EXTENSION);
+}
+
+/**
+ * @brief Reads the header of an index.
+ *
+ * @param path The path of the index.
+ * @param url The URL of the catalog. The index of another URL is not valid.
+ * @param header The header read.
+ *
+ * @return true if the index is complete and belongs to the URL.
+ */
+bool catalog_index_header(const char *path, const char *url, CatalogIndexHeader *header)
+{
+    FIL file;
+    UINT br = 0;
+    if (f_open(&file, path, FA_READ) != FR_OK)
+    {
+        return false;
+    }
+    FRESULT fr = f_read(&file, header, sizeof(CatalogIndexHeader), &br);
+    f_close(&file);
+    if ((fr != FR_OK) || (br != sizeof(CatalogIndexHeader)))
+    {
+        return false;
+    }
+    header->etag[CATALOG_VALIDATOR_SIZE - 1] = '\0';
+    header->last_modified[CATALOG_VALIDATOR_SIZE - 1] = '\0';
+    return (header->magic == CATALOG_INDEX_MAGIC) && (header->url_hash == catalog_hash(url));
+}
+
+/**
+ * @brief Feeds the records of an index to a parser.
+ *
+ * The parser must use CATALOG_INDEX_SEPARATOR and no header.
+ *
+ * @param path The path of the index.
+ * @param parser The parser.
+ *
+ * @return true if the index was read.
+ */
+bool catalog_index_load(const char *path, CatalogParser *parser)
+{
+    FIL file;
+    char buffer[CATALOG_INDEX_BUFFER_SIZE];
+    UINT br = 0;
+    if (f_open(&file, path, FA_READ) != FR_OK)
+    {
+        return false;
+    }
+    FRESULT fr = f_lseek(&file, sizeof(CatalogIndexHeader));
+    while ((fr == FR_OK) && ((fr = f_read(&file, buffer, sizeof(buffer), &br)) == FR_OK) && (br > 0))
+    {
+        catalog_parser_feed(parser, buffer, br);
+    }
+    f_close(&file);
+    catalog_parser_finish(parser);
+    return fr == FR_OK;
+}
+
+static void catalog_index_flush(CatalogIndexWriter *writer)
+{
+    UINT bw = 0;
+    if ((writer->len > 0) && !writer->error)
+    {
+        writer->error = (f_write(&writer->file, writer->buffer, writer->len, &bw) != FR_OK) || (bw != writer->len);
+    }
+    writer->len = 0;
+}
+
+static void catalog_index_put(CatalogIndexWriter *writer, char c)
+{
+    if (writer->len == CATALOG_INDEX_BUFFER_SIZE)
+    {
+        catalog_index_flush(writer);
+    }
+    writer->buffer[writer->len++] = c;
+}
+
+/**
+ * @brief Creates the index of a catalog.
+ *
+ * The header is written incomplete, so the index is not valid until catalog_index_close().
+ *
+ * @param writer The writer of the index.
+ * @param path The path of the index.
+ * @param url The URL of the catalog.
+ * @param etag The ETag of the catalog, or NULL.
+ * @param last_modified The Last-Modified of the catalog, or NULL.
+ *
+ * @return true if the index was created.
+ */
+bool catalog_index_create(CatalogIndexWriter *writer, const char *path, const char *url, const char *etag, const char *last_modified)
+{
+    UINT bw = 0;
+    memset(&writer->header, 0, sizeof(CatalogIndexHeader));
+    writer->header.url_hash = catalog_hash(url);
+    strncpy(writer->header.etag, etag ? etag : "", CATALOG_VALIDATOR_SIZE - 1);
+    strncpy(writer->header.last_modified, last_modified ? last_modified : "", CATALOG_VALIDATOR_SIZE - 1);
+    writer->fields = 0;
+    writer->len = 0;
+    writer->error = false;
+
+    FRESULT fr = f_mkdir(CATALOG_INDEX_FOLDER);
+    if ((fr != FR_OK) && (fr != FR_EXIST))
+    {
+        DPRINTF("Cannot create the folder %s: %s (%d)\n", CATALOG_INDEX_FOLDER, FRESULT_str(fr), fr);
+        return false;
+    }
+    fr = f_open(&writer->file, path, FA_CREATE_ALWAYS | FA_WRITE);
+    if (fr != FR_OK)
+    {
+        DPRINTF("Cannot create the index %s: %s (%d)\n", path, FRESULT_str(fr), fr);
+        return false;
+    }
+    if ((f_write(&writer->file, &writer->header, sizeof(CatalogIndexHeader), &bw) != FR_OK) || (bw != sizeof(CatalogIndexHeader)))
+    {
+        f_close(&writer->file);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes a field of the current record, quoted.
+ *
+ * @param writer The writer of the index.
+ * @param value The value. NULL is written as an empty field.
+ */
+void catalog_index_field(CatalogIndexWriter *writer, const char *value)
+{
+    if (writer->fields++ > 0)
+    {
+        catalog_index_put(writer, CATALOG_INDEX_SEPARATOR);
+    }
+    catalog_index_put(writer, '"');
+    for (const char *c = value ? value : ""; *c; c++)
+    {
+        if (*c == '"')
+        {
+            catalog_index_put(writer, '"'); // Escaped quote
+        }
+        catalog_index_put(writer, *c);
+    }
+    catalog_index_put(writer, '"');
+}
+
+/**
+ * @brief Ends the current record.
+ *
+ * @param writer The writer of the index.
+ */
+void catalog_index_end_record(CatalogIndexWriter *writer)
+{
+    catalog_index_put(writer, '\n');
+    writer->fields = 0;
+    writer->header.count++;
+}
+
+/**
+ * @brief Writes the pending records and the final header, and closes the index.
+ *
+ * @param writer The writer of the index.
+ *
+ * @return true if the index is complete.
+ */
+bool catalog_index_close(CatalogIndexWriter *writer)
+{
+    UINT bw = 0;
+    catalog_index_flush(writer);
+    if (!writer->error)
+    {
+        writer->header.magic = CATALOG_INDEX_MAGIC;
+        writer->error = (f_lseek(&writer->file, 0) != FR_OK) ||
+                        (f_write(&writer->file, &writer->header, sizeof(CatalogIndexHeader), &bw) != FR_OK) ||
+                        (bw != sizeof(CatalogIndexHeader));
+    }
+    writer->error |= (f_close(&writer->file) != FR_OK);
+    return !writer->error;
+}
+
+/**
+ * @brief Checks if an index was validated with the server in the last CATALOG_REVALIDATE_MINUTES.
+ *
+ * @param path The path of the index.
+ *
+ * @return true if the index can be used without asking the server.
+ */
+bool catalog_index_fresh(const char *path)
+{
+    uint32_t hash = catalog_hash(path);
+    for (int i = 0; i < CATALOG_INDEX_RECENT; i++)
+    {
+        if ((catalog_recent_time[i] != 0) && (catalog_recent_hash[i] == hash))
+        {
+            return (time_us_64() - catalog_recent_time[i]) < ((uint64_t)CATALOG_REVALIDATE_MINUTES * 60 * 1000000);
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Records that an index has been validated with the server now.
+ *
+ * @param path The path of the index.
+ */
+void catalog_index_validated(const char *path)
+{
+    uint32_t hash = catalog_hash(path);
+    int slot = catalog_recent_next;
+    for (int i = 0; i < CATALOG_INDEX_RECENT; i++)
+    {
+        if ((catalog_recent_time[i] != 0) && (catalog_recent_hash[i] == hash))
+        {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == catalog_recent_next)
+    {
+        catalog_recent_next = (catalog_recent_next + 1) % CATALOG_INDEX_RECENT;
+    }
+    catalog_recent_hash[slot] = hash;
+    catalog_recent_time[slot] = time_us_64();
+}
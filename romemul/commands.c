@@ -75,7 +75,8 @@ const CommandName commandStr[] = {
     {GEMDRVEMUL_WRITE_BUFF_CALL, "GEMDRVEMUL_WRITE_BUFF_CALL"},
     {GEMDRVEMUL_WRITE_BUFF_CHECK, "GEMDRVEMUL_WRITE_BUFF_CHECK"},
     {GEMDRVEMUL_DTA_EXIST_CALL, "GEMDRVEMUL_DTA_EXIST_CALL"},
-    {GEMDRVEMUL_DTA_RELEASE_CALL, "GEMDRVEMUL_DTA_RELEASE_CALL"}};
+    {GEMDRVEMUL_DTA_RELEASE_CALL, "GEMDRVEMUL_DTA_RELEASE_CALL"},
+    {GEMDRVEMUL_FUNZIP_CALL, "GEMDRVEMUL_FUNZIP_CALL"}};
 
 const int numCommands = sizeof(commandStr) / sizeof(commandStr[0]);
 #endif
\ No newline at end of file
@@ -3,57 +3,59 @@
 // We should define ALWAYS the default entries with valid values.
 // DONT FORGET TO CHANGE MAX_ENTRIES if the number of value changes!
 static ConfigEntry defaultEntries[MAX_ENTRIES] = {
-    {PARAM_BOOT_FEATURE, TYPE_STRING, "CONFIGURATOR"},
-    {PARAM_CONFIGURATOR_DARK, TYPE_BOOL, "false"},
-    {PARAM_DELAY_ROM_EMULATION, TYPE_BOOL, "false"},
-    {PARAM_DOWNLOAD_TIMEOUT_SEC, TYPE_INT, "60"},
-    {PARAM_FILE_COUNT_ENABLED, TYPE_BOOL, "false"},
-    {PARAM_FLOPPIES_FOLDER, TYPE_STRING, "/floppies"},
-    {PARAM_FLOPPY_BOOT_ENABLED, TYPE_BOOL, "true"},
-    {PARAM_FLOPPY_BUFFER_TYPE, TYPE_INT, "0"},
-    {PARAM_FLOPPY_DB_URL, TYPE_STRING, "http://ataristdb.sidecartridge.com"},
-    {PARAM_FLOPPY_IMAGE_A, TYPE_STRING, ""},
-    {PARAM_FLOPPY_IMAGE_B, TYPE_STRING, ""},
-    {PARAM_FLOPPY_NET_ENABLED, TYPE_BOOL, "false"},
-    {PARAM_FLOPPY_NET_TOUT_SEC, TYPE_INT, "45"},
-    {PARAM_FLOPPY_XBIOS_ENABLED, TYPE_BOOL, "true"},
-    {PARAM_GEMDRIVE_BUFF_TYPE, TYPE_INT, "0"},
-    {PARAM_GEMDRIVE_DRIVE, TYPE_STRING, "C"},
-    {PARAM_GEMDRIVE_FOLDERS, TYPE_STRING, "/hd"},
-    {PARAM_GEMDRIVE_RTC, TYPE_BOOL, "true"},
-    {PARAM_GEMDRIVE_TIMEOUT_SEC, TYPE_INT, "45"},
-    {PARAM_GEMDRIVE_FAKEFLOPPY, TYPE_BOOL, "true"},
-    {PARAM_HOSTNAME, TYPE_STRING, "sidecart"},
-    {PARAM_LASTEST_RELEASE_URL, TYPE_STRING, LATEST_RELEASE_URL},
-    {PARAM_MENU_REFRESH_SEC, TYPE_INT, "3"},
-    {PARAM_NETWORK_STATUS_SEC, TYPE_INT, NETWORK_POLL_INTERVAL_STR},
-    {PARAM_ROMS_CSV_URL, TYPE_STRING, "http://roms.sidecartridge.com/roms.csv"},
-    {PARAM_ROMS_FOLDER, TYPE_STRING, "/roms"},
-    {PARAM_ROMS_YAML_URL, TYPE_STRING, "http://roms.sidecartridge.com/roms.json"},
-    {PARAM_RTC_NTP_SERVER_HOST, TYPE_STRING, "pool.ntp.org"},
-    {PARAM_RTC_NTP_SERVER_PORT, TYPE_INT, "123"},
-    {PARAM_RTC_TYPE, TYPE_STRING, "SIDECART"},
-    {PARAM_RTC_UTC_OFFSET, TYPE_STRING, "+1"},
-    {PARAM_RTC_Y2K_PATCH, TYPE_BOOL, "true"},
-    {PARAM_SAFE_CONFIG_REBOOT, TYPE_BOOL, "true"},
-    {PARAM_SD_MASS_STORAGE, TYPE_BOOL, "true"},
-    {PARAM_SD_BAUD_RATE_KB, TYPE_INT, "12500"},
-    {PARAM_WIFI_AUTH, TYPE_INT, ""},
-    {PARAM_WIFI_CONNECT_TIMEOUT, TYPE_INT, "30"},
-    {PARAM_WIFI_COUNTRY, TYPE_STRING, ""},
-    {PARAM_WIFI_DHCP, TYPE_BOOL, "true"},
-    {PARAM_WIFI_DNS, TYPE_STRING, "8.8.8.8"},
-    {PARAM_WIFI_GATEWAY, TYPE_STRING, ""},
-    {PARAM_WIFI_IP, TYPE_STRING, ""},
-    {PARAM_WIFI_NETMASK, TYPE_STRING, ""},
-    {PARAM_WIFI_PASSWORD, TYPE_STRING, ""},
-    {PARAM_WIFI_POWER, TYPE_INT, "0"},
-    {PARAM_WIFI_RSSI, TYPE_BOOL, "false"},
-    {PARAM_WIFI_SCAN_SECONDS, TYPE_INT, WIFI_SCAN_POLL_COUNTER_STR},
-    {PARAM_WIFI_SSID, TYPE_STRING, ""}};
+#define CONFIG_DEFAULT_ENTRY(name, type, value) {PARAM_##name, type, value},
+    CONFIG_ENTRIES(CONFIG_DEFAULT_ENTRY)
+#undef CONFIG_DEFAULT_ENTRY
+};
+
+_Static_assert(CONFIG_KEY_COUNT == MAX_ENTRIES, "CONFIG_ENTRIES and MAX_ENTRIES do not match");
+
+// Bytes of a journal with every entry different from its default, and with the longest value
+#define CONFIG_RECORD_MAX_SIZE(name, type, value) +(sizeof(ConfigJournalRecord) + sizeof(PARAM_##name) - 1 + MAX_STRING_VALUE_LENGTH)
+#define CONFIG_JOURNAL_WORST_CASE (sizeof(ConfigJournalHeader) CONFIG_ENTRIES(CONFIG_RECORD_MAX_SIZE))
+_Static_assert(CONFIG_JOURNAL_STAGING_OFFSET + CONFIG_JOURNAL_WORST_CASE <= FLASH_SECTOR_SIZE, "The config does not fit in a journal sector");
 
 ConfigData configData;
 
+// Values of the entries parsed once, and the functions notified when they change
+static int config_ints[CONFIG_KEY_COUNT];
+static bool config_bools[CONFIG_KEY_COUNT];
+static struct
+{
+    ConfigKey key;
+    ConfigChangeCallback callback;
+} config_listeners[CONFIG_MAX_LISTENERS];
+static int config_listeners_count = 0;
+
+static void parse_entry(size_t index)
+{
+    if (index < CONFIG_KEY_COUNT)
+    {
+        const char *value = configData.entries[index].value;
+        config_ints[index] = atoi(value);
+        config_bools[index] = (value[0] == 't' || value[0] == 'T');
+    }
+}
+
+static void parse_all_entries()
+{
+    for (size_t i = 0; i < CONFIG_KEY_COUNT; i++)
+    {
+        parse_entry(i);
+    }
+}
+
+static void notify_change(size_t index)
+{
+    for (int i = 0; i < config_listeners_count; i++)
+    {
+        if (config_listeners[i].key == index)
+        {
+            config_listeners[i].callback((ConfigKey)index);
+        }
+    }
+}
+
 static ConfigEntry read_entry(uint8_t **addressOffset)
 {
     ConfigEntry entry;
@@ -87,6 +89,7 @@ static void load_default_entries()
     {
         DPRINTF("WARNING: MAX_ENTRIES is %d but %d entries were loaded.\n", MAX_ENTRIES, configData.count);
     }
+    parse_all_entries();
 }
 
 static void replace_bad_domain_entries()
@@ -113,12 +116,292 @@ static void replace_bad_domain_entries()
     }
 }
 
-void load_all_entries()
+// Active sector of the journal, or -1 if the flash has no journal yet
+static int journal_sector = -1;
+static uint32_t journal_sequence = 0;
+// Offset in the active sector where the next record goes
+static uint32_t journal_free = 0;
+// Offset in the active sector of the last record of each entry. 0 if the entry has the default value
+static uint16_t journal_records[MAX_ENTRIES];
+
+static const uint8_t *journal_address(int sector)
 {
+    return (const uint8_t *)(XIP_BASE + CONFIG_FLASH_OFFSET + sector * FLASH_SECTOR_SIZE);
+}
 
-    // First, load default entries
-    load_default_entries();
+static uint8_t journal_checksum(const uint8_t *data, size_t len)
+{
+    uint8_t sum = 0x5A;
+    for (size_t i = 0; i < len; i++)
+    {
+        sum = ((sum << 1) | (sum >> 7)) ^ data[i];
+    }
+    return sum;
+}
+
+// Returns the offset after the record at offset, or 0 if there is no valid record there
+static uint32_t journal_next(const uint8_t *sector, uint32_t offset)
+{
+    if (offset + sizeof(ConfigJournalRecord) + 1 > FLASH_SECTOR_SIZE)
+    {
+        return 0;
+    }
+    const ConfigJournalRecord *record = (const ConfigJournalRecord *)(sector + offset);
+    if ((record->tag != CONFIG_JOURNAL_TAG) || (record->key_len == 0) || (record->key_len > MAX_KEY_LENGTH) ||
+        (record->value_len >= MAX_STRING_VALUE_LENGTH))
+    {
+        return 0;
+    }
+    uint32_t size = sizeof(ConfigJournalRecord) + record->key_len + record->value_len + 1;
+    if ((offset + size > FLASH_SECTOR_SIZE) || (journal_checksum(sector + offset, size - 1) != sector[offset + size - 1]))
+    {
+        return 0;
+    }
+    return offset + size;
+}
+
+// Builds the record of an entry. Returns its size
+static size_t journal_build(size_t index, uint8_t *buffer)
+{
+    const ConfigEntry *entry = &configData.entries[index];
+    ConfigJournalRecord *record = (ConfigJournalRecord *)buffer;
+    record->tag = CONFIG_JOURNAL_TAG;
+    record->type = (uint8_t)entry->dataType;
+    record->key_len = strnlen(entry->key, MAX_KEY_LENGTH);
+    record->value_len = strnlen(entry->value, MAX_STRING_VALUE_LENGTH - 1);
+    memcpy(buffer + sizeof(ConfigJournalRecord), entry->key, record->key_len);
+    memcpy(buffer + sizeof(ConfigJournalRecord) + record->key_len, entry->value, record->value_len);
+    size_t size = sizeof(ConfigJournalRecord) + record->key_len + record->value_len;
+    buffer[size] = journal_checksum(buffer, size);
+    return size + 1;
+}
+
+static bool is_default_entry(size_t index)
+{
+    const ConfigEntry *entry = &configData.entries[index];
+    return (entry->dataType == defaultEntries[index].dataType) &&
+           (strncmp(entry->value, defaultEntries[index].value, MAX_STRING_VALUE_LENGTH) == 0);
+}
+
+// The entry in RAM is different from the one in the journal
+static bool journal_changed(size_t index)
+{
+    if (journal_records[index] == 0)
+    {
+        return !is_default_entry(index);
+    }
+    const ConfigEntry *entry = &configData.entries[index];
+    const ConfigJournalRecord *record = (const ConfigJournalRecord *)(journal_address(journal_sector) + journal_records[index]);
+    const char *value = (const char *)(record + 1) + record->key_len;
+    return (entry->dataType != record->type) || (strnlen(entry->value, MAX_STRING_VALUE_LENGTH) != record->value_len) ||
+           (memcmp(entry->value, value, record->value_len) != 0);
+}
+
+// Apply the records of the active sector to the entries. Returns false if there is no journal
+static bool journal_replay()
+{
+    journal_sector = -1;
+    memset(journal_records, 0, sizeof(journal_records));
+    for (int i = 0; i < CONFIG_JOURNAL_SECTORS; i++)
+    {
+        const ConfigJournalHeader *header = (const ConfigJournalHeader *)journal_address(i);
+        if ((header->magic == (CONFIG_MAGIC | CONFIG_VERSION_JOURNAL)) && ((journal_sector < 0) || (header->sequence > journal_sequence)))
+        {
+            journal_sector = i;
+            journal_sequence = header->sequence;
+        }
+    }
+    uint32_t start = 0;
+    if (journal_sector < 0)
+    {
+        // The power went off migrating an old config of 8KB, after its copy was written and the
+        // first sector erased
+        const ConfigJournalHeader *copy = (const ConfigJournalHeader *)(journal_address(1) + CONFIG_JOURNAL_STAGING_OFFSET);
+        if ((*(const uint32_t *)journal_address(0) == (CONFIG_MAGIC | CONFIG_VERSION)) ||
+            (copy->magic != (CONFIG_MAGIC | CONFIG_VERSION_JOURNAL)))
+        {
+            return false;
+        }
+        DPRINTF("Config loaded from the copy of an interrupted migration\n");
+        journal_sector = 1;
+        journal_sequence = copy->sequence;
+        start = CONFIG_JOURNAL_STAGING_OFFSET;
+    }
+
+    const uint8_t *sector = journal_address(journal_sector);
+    uint32_t offset = start + sizeof(ConfigJournalHeader);
+    uint32_t next;
+    while ((next = journal_next(sector, offset)) != 0)
+    {
+        const ConfigJournalRecord *record = (const ConfigJournalRecord *)(sector + offset);
+        const char *key = (const char *)(record + 1);
+        for (size_t i = 0; i < configData.count; i++)
+        {
+            ConfigEntry *entry = &configData.entries[i];
+            if ((strnlen(entry->key, MAX_KEY_LENGTH) == record->key_len) && (memcmp(entry->key, key, record->key_len) == 0))
+            {
+                entry->dataType = record->type;
+                memcpy(entry->value, key + record->key_len, record->value_len);
+                entry->value[record->value_len] = '\0';
+                journal_records[i] = offset;
+                break;
+            }
+        }
+        offset = next;
+    }
+    journal_free = offset;
+    if ((offset < FLASH_SECTOR_SIZE) && (sector[offset] != 0xFF))
+    {
+        // A record interrupted by a power off. Compact on the next write
+        DPRINTF("Config journal damaged at offset %d\n", offset);
+        journal_free = FLASH_SECTOR_SIZE;
+    }
+    if (start > 0)
+    {
+        // Finish the migration on the next write
+        journal_free = FLASH_SECTOR_SIZE;
+    }
+    DPRINTF("Config journal in sector %d, sequence %d, %d bytes used\n", journal_sector, journal_sequence, offset);
+    return true;
+}
+
+// Program the record of an entry after the last one. Only the pages of the record are programmed:
+// the 0xFF bytes around it leave the flash as it is
+static bool journal_append(size_t index)
+{
+    uint8_t record[sizeof(ConfigJournalRecord) + MAX_KEY_LENGTH + MAX_STRING_VALUE_LENGTH + 1];
+    size_t size = journal_build(index, record);
+    if ((journal_sector < 0) || (journal_free + size > FLASH_SECTOR_SIZE))
+    {
+        return false;
+    }
+    uint32_t offset = CONFIG_FLASH_OFFSET + journal_sector * FLASH_SECTOR_SIZE + journal_free;
+    uint32_t page_start = offset & ~(FLASH_PAGE_SIZE - 1);
+    uint32_t page_end = (offset + size + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+    uint8_t pages[2 * FLASH_PAGE_SIZE];
+    memset(pages, 0xFF, page_end - page_start);
+    memcpy(pages + (offset - page_start), record, size);
+
+    flash_write_program(page_start, pages, page_end - page_start);
+
+    journal_records[index] = journal_free;
+    journal_free += size;
+    return true;
+}
+
+// Copy the bytes of the journal at offset that fall in the page at page_start
+static void journal_render_bytes(uint8_t *page, uint32_t page_start, uint32_t offset, const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if ((offset + i >= page_start) && (offset + i < page_start + FLASH_PAGE_SIZE))
+        {
+            page[offset + i - page_start] = data[i];
+        }
+    }
+}
+
+// Build the page at page_start of a journal of the entries different from the defaults that starts
+// at start. The bytes outside the journal are 0xFF, so programming them leaves the flash as it is.
+// Returns the offset after the last record, and the offset of the record of each entry in records
+static uint32_t journal_render(uint32_t start, uint32_t sequence, uint32_t page_start, uint8_t *page, uint16_t *records)
+{
+    uint8_t record[sizeof(ConfigJournalRecord) + MAX_KEY_LENGTH + MAX_STRING_VALUE_LENGTH + 1];
+    ConfigJournalHeader header = {
+        .magic = CONFIG_MAGIC | CONFIG_VERSION_JOURNAL,
+        .sequence = sequence};
+    memset(page, 0xFF, FLASH_PAGE_SIZE);
+    journal_render_bytes(page, page_start, start, (const uint8_t *)&header, sizeof(header));
+    uint32_t offset = start + sizeof(header);
+    for (size_t i = 0; i < configData.count; i++)
+    {
+        records[i] = 0;
+        if (!is_default_entry(i))
+        {
+            size_t size = journal_build(i, record);
+            journal_render_bytes(page, page_start, offset, record, size);
+            records[i] = offset;
+            offset += size;
+        }
+    }
+    return offset;
+}
+
+// Program a journal at offset start of the sector, erased from there. The page with the header goes
+// last: if the power goes off before, the journal is not valid. Returns the offset after the last record
+static uint32_t journal_program(int sector, uint32_t start, uint32_t sequence, uint16_t *records)
+{
+    uint8_t page[FLASH_PAGE_SIZE];
+    uint32_t flash_offset = CONFIG_FLASH_OFFSET + sector * FLASH_SECTOR_SIZE;
+    uint32_t header_page = start & ~(FLASH_PAGE_SIZE - 1);
+    uint32_t end = journal_render(start, sequence, header_page, page, records);
+    for (uint32_t page_start = header_page + FLASH_PAGE_SIZE; page_start < end; page_start += FLASH_PAGE_SIZE)
+    {
+        journal_render(start, sequence, page_start, page, records);
+        flash_write_program(flash_offset + page_start, page, FLASH_PAGE_SIZE);
+    }
+    journal_render(start, sequence, header_page, page, records);
+    flash_write_program(flash_offset + header_page, page, FLASH_PAGE_SIZE);
+    return end;
+}
+
+// Write the entries different from the defaults in the other sector, and make it the active one.
+// CONFIG_JOURNAL_WORST_CASE guarantees that they fit
+static void journal_compact()
+{
+    int sector = (journal_sector == 0) ? 1 : 0;
+    uint16_t records[MAX_ENTRIES] = {0};
+    flash_write_erase(CONFIG_FLASH_OFFSET + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    uint32_t offset = journal_program(sector, 0, journal_sequence + 1, records);
+
+    journal_sector = sector;
+    journal_sequence++;
+    journal_free = offset;
+    memcpy(journal_records, records, sizeof(journal_records));
+    DPRINTF("Config journal compacted in sector %d, sequence %d, %d bytes used\n", journal_sector, journal_sequence, offset);
+}
 
+// The bytes of the sector from offset are erased
+static bool journal_erased(int sector, uint32_t offset)
+{
+    const uint8_t *address = journal_address(sector);
+    for (uint32_t i = offset; i < FLASH_SECTOR_SIZE; i++)
+    {
+        if (address[i] != 0xFF)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Write the first journal over the config of the previous versions of the firmware. It goes in the
+// first sector, so an old config of 4KB in the second one is still there if the power goes off.
+// An old config of 8KB fills the first sector and the beginning of the second, so before erasing
+// anything a copy of the journal is programmed in the erased space after it
+static void journal_migrate()
+{
+    if (*(const uint32_t *)journal_address(0) == (CONFIG_MAGIC | CONFIG_VERSION))
+    {
+        if (journal_erased(1, CONFIG_JOURNAL_STAGING_OFFSET))
+        {
+            uint16_t records[MAX_ENTRIES] = {0};
+            journal_program(1, CONFIG_JOURNAL_STAGING_OFFSET, journal_sequence + 1, records);
+            journal_sequence++;
+            DPRINTF("Config copied after the old config\n");
+        }
+        else
+        {
+            DPRINTF("WARNING: No room to copy the config before migrating it\n");
+        }
+    }
+    journal_sector = -1;
+    journal_compact();
+}
+
+// Config stored as a copy of configData by the previous versions of the firmware
+static void load_legacy_entries()
+{
     uint8_t count = 0;
     uint16_t max_entries = MAX_ENTRIES;
     uint8_t *currentAddress = NULL;
@@ -170,7 +453,19 @@ void load_all_entries()
         // No else part here since we know every memory entry has a default
         count++;
     }
+}
+
+void load_all_entries()
+{
+    // First, load default entries
+    load_default_entries();
+
+    if (!journal_replay())
+    {
+        load_legacy_entries();
+    }
     replace_bad_domain_entries();
+    parse_all_entries();
 }
 
 ConfigEntry *find_entry(const char key[MAX_KEY_LENGTH])
@@ -186,6 +481,63 @@ ConfigEntry *find_entry(const char key[MAX_KEY_LENGTH])
     return NULL;
 }
 
+/**
+ * @brief Returns the value of an entry as a string.
+ *
+ * @param key The entry.
+ *
+ * @return The value. It must not be modified: use put_string() instead.
+ */
+const char *config_string(ConfigKey key)
+{
+    return configData.entries[key].value;
+}
+
+/**
+ * @brief Returns the value of an entry as an integer, parsed when the entry was loaded or changed.
+ *
+ * @param key The entry.
+ *
+ * @return The value, or 0 if it is not a number.
+ */
+int config_int(ConfigKey key)
+{
+    return config_ints[key];
+}
+
+/**
+ * @brief Returns the value of an entry as a boolean, parsed when the entry was loaded or changed.
+ *
+ * @param key The entry.
+ *
+ * @return true if the value starts with 't' or 'T'.
+ */
+bool config_bool(ConfigKey key)
+{
+    return config_bools[key];
+}
+
+/**
+ * @brief Registers a function called each time put_string(), put_integer() or put_bool()
+ * changes the value of an entry.
+ *
+ * @param key The entry.
+ * @param callback The function to call. It receives the key of the entry.
+ *
+ * @return 0 if registered, -1 if there is no room left for more functions.
+ */
+int config_subscribe(ConfigKey key, ConfigChangeCallback callback)
+{
+    if (config_listeners_count >= CONFIG_MAX_LISTENERS)
+    {
+        return -1;
+    }
+    config_listeners[config_listeners_count].key = key;
+    config_listeners[config_listeners_count].callback = callback;
+    config_listeners_count++;
+    return 0;
+}
+
 // ConfigEntry* entry = findConfigEntry("desired_key");
 // if (entry != NULL) {
 //     // Access the entry's data using entry->value, entry->dataType, etc.
@@ -207,10 +559,16 @@ static int add_entry(const char key[MAX_KEY_LENGTH], DataType dataType, char val
         if (strncmp(configData.entries[i].key, key, MAX_KEY_LENGTH) == 0)
         {
             // Key already exists. Update its value and dataType
+            bool changed = (strncmp(configData.entries[i].value, value, MAX_STRING_VALUE_LENGTH - 1) != 0);
             configData.entries[i].dataType = dataType;
             strncpy(configData.entries[i].value, value, MAX_STRING_VALUE_LENGTH - 1);
             configData.entries[i].value[MAX_STRING_VALUE_LENGTH - 1] = '\0'; // Ensure null-termination
-            return 0;                                                        // Successfully updated existing entry
+            parse_entry(i);
+            if (changed)
+            {
+                notify_change(i);
+            }
+            return 0; // Successfully updated existing entry
         }
     }
 
@@ -283,46 +641,44 @@ int put_integer(const char key[MAX_KEY_LENGTH], int value)
 //     return 0; // Successfully removed the entry
 // }
 
+// Save the entries in the flash. All of them fit, see CONFIG_JOURNAL_WORST_CASE
 int write_all_entries()
 {
+    print_config_table();
 
-    uint8_t *address = (uint8_t *)(CONFIG_FLASH_OFFSET + XIP_BASE);
-
-    // Ensure we don't exceed the reserved space
-    if (configData.count * sizeof(ConfigEntry) > CONFIG_FLASH_SIZE)
+    // Append the entries changed. Compact when the sector is full, or migrate when there is no journal yet
+    bool migrate = (journal_sector < 0);
+    bool compact = migrate;
+    int appended = 0;
+    for (size_t i = 0; (i < configData.count) && !compact; i++)
     {
-        return -1; // Error: Config size exceeds reserved space
+        if (journal_changed(i))
+        {
+            compact = !journal_append(i);
+            appended++;
+        }
     }
-    print_config_table();
-    DPRINTF("Writing %d entries to FLASH.\n", configData.count);
-    DPRINTF("Size of ConfigData: %d\n", sizeof(ConfigData));
-    DPRINTF("Size of ConfigEntry: %d\n", sizeof(ConfigEntry));
-    DPRINTF("Size of entries: %d\n", configData.count * sizeof(ConfigEntry));
-
-    uint32_t ints = save_and_disable_interrupts();
-
-    // Erase the content before writing the configuration
-    // overwriting it's not enough
-    flash_range_erase(CONFIG_FLASH_OFFSET, CONFIG_FLASH_SIZE); // 4 Kbytes
-
-    // Transfer config to FLASH
-    flash_range_program(CONFIG_FLASH_OFFSET, (uint8_t *)&configData, sizeof(configData));
-
-    restore_interrupts(ints);
-
+    DPRINTF("%d entries appended to the config journal\n", appended);
+    if (migrate)
+    {
+        journal_migrate();
+    }
+    else if (compact)
+    {
+        journal_compact();
+    }
+    flash_write_report("config");
     return 0; // Successful write
 }
 
 int reset_config_default()
 {
-    uint32_t ints = save_and_disable_interrupts();
-
     // Erase the content before writing the configuration
     // overwriting it's not enough
-    flash_range_erase(CONFIG_FLASH_OFFSET, CONFIG_FLASH_SIZE);
-
-    restore_interrupts(ints);
+    flash_write_erase(CONFIG_FLASH_OFFSET, CONFIG_FLASH_SIZE);
 
+    journal_sector = -1;
+    journal_sequence = 0;
     load_default_entries();
 
     write_all_entries();
@@ -335,6 +691,7 @@ int reset_config_default()
 void clear_config(void)
 {
     memset(&configData, 0, sizeof(ConfigData));
+    parse_all_entries();
 }
 
 size_t get_config_size()
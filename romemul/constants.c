@@ -33,6 +33,7 @@ const uint32_t CONFIG_FLASH_SIZE = 8192;
 const uint32_t CONFIG_FLASH_OFFSET = FLASH_ROM_LOAD_OFFSET - CONFIG_FLASH_SIZE; // Offset FLASH where the config is stored. Survives a reset or poweroff.
 const uint32_t CONFIG_VERSION_4KB = 0x00000001;                                  // Version of the config with only 4Kbytes of config memory.
 const uint32_t CONFIG_VERSION = 0x00000002;                                     // Version of the config. Used to check if the config is compatible with the current code.
+const uint32_t CONFIG_VERSION_JOURNAL = 0x00000003;                             // Version of the config stored as a journal of changed entries.
 const uint32_t CONFIG_MAGIC = 0x12340000;                                       // Magic number to check if the config exists in FLASH.
 
 // Atari ST constants.
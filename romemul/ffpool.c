@@ -0,0 +1,77 @@
+/**
+ * File: ffpool.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Pool of FatFs long file name working buffers
+ */
+
+#include "include/ffpool.h"
+
+// FF_USE_LFN 3 asks for a working buffer on each call with a path. The malloc based
+// ff_memalloc() and ff_memfree() of the FatFs library are wrapped by the linker with these ones
+static uint8_t ff_pool_buffers[NUM_CORES][FF_POOL_BUFFERS_PER_CORE][FF_POOL_BUFFER_SIZE] __attribute__((aligned(4)));
+static volatile bool ff_pool_busy[NUM_CORES][FF_POOL_BUFFERS_PER_CORE];
+static FfPoolStats ff_pool_counters[NUM_CORES];
+
+/**
+ * @brief Allocates a FatFs working buffer from the pool of the current core.
+ *
+ * The pool of each core is only touched from that core, so disabling the interrupts is
+ * enough to take a buffer. The heap is used when the pool is in use or the buffer does not fit.
+ *
+ * @param msize The size of the buffer in bytes.
+ *
+ * @return A pointer to the buffer, or NULL if there is not enough memory.
+ */
+void *__wrap_ff_memalloc(UINT msize)
+{
+    uint core = get_core_num();
+    if (msize > FF_POOL_BUFFER_SIZE)
+    {
+        ff_pool_counters[core].oversized++;
+        return malloc(msize);
+    }
+    uint32_t ints = save_and_disable_interrupts();
+    for (int i = 0; i < FF_POOL_BUFFERS_PER_CORE; i++)
+    {
+        if (!ff_pool_busy[core][i])
+        {
+            ff_pool_busy[core][i] = true;
+            restore_interrupts(ints);
+            ff_pool_counters[core].pooled++;
+            return ff_pool_buffers[core][i];
+        }
+    }
+    ff_pool_counters[core].contended++;
+    restore_interrupts(ints);
+    return malloc(msize);
+}
+
+/**
+ * @brief Releases a FatFs working buffer taken with __wrap_ff_memalloc().
+ *
+ * @param mblock The buffer. It can be NULL.
+ */
+void __wrap_ff_memfree(void *mblock)
+{
+    uint8_t *ptr = (uint8_t *)mblock;
+    if ((ptr >= &ff_pool_buffers[0][0][0]) && (ptr < &ff_pool_buffers[NUM_CORES][0][0]))
+    {
+        size_t index = (ptr - &ff_pool_buffers[0][0][0]) / FF_POOL_BUFFER_SIZE;
+        ff_pool_busy[index / FF_POOL_BUFFERS_PER_CORE][index % FF_POOL_BUFFERS_PER_CORE] = false;
+        return;
+    }
+    free(mblock);
+}
+
+/**
+ * @brief Returns the usage counters of the pool of a core.
+ *
+ * @param core The core, 0 or 1.
+ * @param stats The counters.
+ */
+void ff_pool_stats(uint core, FfPoolStats *stats)
+{
+    *stats = ff_pool_counters[core];
+}
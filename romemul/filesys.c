@@ -832,6 +832,269 @@ uint32_t calculate_folder_count(const char *path)
     return totalSize;
 }
 
+static FolderCount folder_counts[FOLDER_COUNT_FOLDERS];
+static bool folder_counts_loaded = false;
+static bool folder_counts_dirty = false;
+static FolderCountWalk folder_walk = {.index = -1};
+
+// Date and time of a folder. Zero if it does not exist
+static void folder_count_stamp(const char *path, uint16_t *fdate, uint16_t *ftime)
+{
+    FILINFO fno;
+    if (f_stat(path, &fno) == FR_OK)
+    {
+        *fdate = fno.fdate;
+        *ftime = fno.ftime;
+    }
+    else
+    {
+        *fdate = 0;
+        *ftime = 0;
+    }
+}
+
+static void folder_count_save()
+{
+    FIL fil;
+    UINT bw;
+    uint32_t magic = FOLDER_COUNT_MAGIC;
+    folder_counts_dirty = false;
+    if (f_open(&fil, FOLDER_COUNT_FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        DPRINTF("ERROR: Could not write %s\n", FOLDER_COUNT_FILE_NAME);
+        return;
+    }
+    f_write(&fil, &magic, sizeof(magic), &bw);
+    f_write(&fil, folder_counts, sizeof(folder_counts), &bw);
+    f_close(&fil);
+}
+
+// Read the counts of the last session. They are served until the folders are counted again
+static void folder_count_load()
+{
+    FIL fil;
+    UINT br = 0;
+    uint32_t magic = 0;
+    folder_counts_loaded = true;
+    memset(folder_counts, 0, sizeof(folder_counts));
+    if (f_open(&fil, FOLDER_COUNT_FILE_NAME, FA_READ) == FR_OK)
+    {
+        if ((f_read(&fil, &magic, sizeof(magic), &br) != FR_OK) || (magic != FOLDER_COUNT_MAGIC) ||
+            (f_read(&fil, folder_counts, sizeof(folder_counts), &br) != FR_OK) || (br != sizeof(folder_counts)))
+        {
+            memset(folder_counts, 0, sizeof(folder_counts));
+        }
+        f_close(&fil);
+    }
+    for (int i = 0; i < FOLDER_COUNT_FOLDERS; i++)
+    {
+        FolderCount *fc = &folder_counts[i];
+        uint16_t fdate, ftime;
+        fc->path[MAX_FOLDER_LENGTH - 1] = '\0';
+        folder_count_stamp(fc->path, &fdate, &ftime);
+        if ((fdate != fc->fdate) || (ftime != fc->ftime))
+        {
+            fc->valid = 0;
+        }
+        // The card could have been changed from a computer. Count once per session
+        fc->pending = 1;
+    }
+}
+
+static void folder_count_stop()
+{
+    while (folder_walk.depth > 0)
+    {
+        f_closedir(&folder_walk.dirs[--folder_walk.depth]);
+    }
+    folder_walk.index = -1;
+}
+
+// Read one directory entry of the folder being counted. Returns false when there is nothing left to count
+static bool folder_count_step()
+{
+    FILINFO fno;
+    if (folder_walk.index < 0)
+    {
+        int i = 0;
+        while ((i < FOLDER_COUNT_FOLDERS) && !(folder_counts[i].pending && folder_counts[i].path[0]))
+        {
+            i++;
+        }
+        if (i == FOLDER_COUNT_FOLDERS)
+        {
+            return false;
+        }
+        FolderCount *fc = &folder_counts[i];
+        fc->pending = 0;
+        strcpy(folder_walk.path, fc->path);
+        folder_walk.count = 0;
+        if (f_opendir(&folder_walk.dirs[0], folder_walk.path) != FR_OK)
+        {
+            fc->valid = 0;
+            fc->count = 0;
+            return true;
+        }
+        folder_walk.index = i;
+        folder_walk.depth = 1;
+        return true;
+    }
+
+    DIR *dir = &folder_walk.dirs[folder_walk.depth - 1];
+    FRESULT res = f_readdir(dir, &fno);
+    if (res != FR_OK)
+    {
+        // The card was mounted again and the directories open are not valid anymore
+        folder_counts[folder_walk.index].pending = 1;
+        folder_count_stop();
+        return true;
+    }
+    if (fno.fname[0] == 0)
+    {
+        f_closedir(dir);
+        if (--folder_walk.depth > 0)
+        {
+            *strrchr(folder_walk.path, '/') = '\0';
+            return true;
+        }
+        FolderCount *fc = &folder_counts[folder_walk.index];
+        if (!fc->valid || (fc->count != folder_walk.count))
+        {
+            folder_counts_dirty = true;
+        }
+        fc->count = folder_walk.count;
+        fc->valid = 1;
+        folder_count_stamp(fc->path, &fc->fdate, &fc->ftime);
+        folder_walk.index = -1;
+        DPRINTF("Folder %s has %lu files\n", fc->path, fc->count);
+        return true;
+    }
+    if (fno.fattrib & AM_DIR)
+    {
+        size_t len = strlen(folder_walk.path);
+        if ((folder_walk.depth < FOLDER_COUNT_MAX_DEPTH) && (len + strlen(fno.fname) + 2 <= sizeof(folder_walk.path)))
+        {
+            sprintf(folder_walk.path + len, "/%s", fno.fname);
+            if (f_opendir(&folder_walk.dirs[folder_walk.depth], folder_walk.path) == FR_OK)
+            {
+                folder_walk.depth++;
+            }
+            else
+            {
+                folder_walk.path[len] = '\0';
+            }
+        }
+    }
+    else
+    {
+        folder_walk.count++;
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the number of files in a folder and its subfolders, as counted in the background.
+ *
+ * The counts are kept in the FOLDER_COUNT_FILE_NAME file of the microSD card, so they are
+ * available at once after a reset. Each folder is counted again by folder_count_task() once
+ * per session, and when the path of the folder changes.
+ *
+ * @param index The folder of the SdCardData structure.
+ * @param path The path of the folder.
+ *
+ * @return The number of files, or 0 until the folder has been counted.
+ */
+uint32_t folder_count_get(FolderCountIndex index, const char *path)
+{
+    if (!folder_counts_loaded)
+    {
+        folder_count_load();
+    }
+    FolderCount *fc = &folder_counts[index];
+    if (strncmp(fc->path, path, MAX_FOLDER_LENGTH - 1) != 0)
+    {
+        if (folder_walk.index == index)
+        {
+            folder_count_stop();
+        }
+        strncpy(fc->path, path, MAX_FOLDER_LENGTH - 1);
+        fc->path[MAX_FOLDER_LENGTH - 1] = '\0';
+        fc->count = 0;
+        fc->valid = 0;
+        fc->pending = 1;
+    }
+    return fc->valid ? fc->count : 0;
+}
+
+/**
+ * @brief Updates the count of the folder containing a file created or deleted by the firmware.
+ *
+ * @param file_path The full path of the file.
+ * @param delta 1 if the file was created, -1 if it was deleted.
+ */
+void folder_count_adjust(const char *file_path, int32_t delta)
+{
+    if (!folder_counts_loaded)
+    {
+        folder_count_load();
+    }
+    for (int i = 0; i < FOLDER_COUNT_FOLDERS; i++)
+    {
+        FolderCount *fc = &folder_counts[i];
+        size_t len = strlen(fc->path);
+        if ((len == 0) || (strncmp(file_path, fc->path, len) != 0) || (file_path[len] != '/'))
+        {
+            continue;
+        }
+        if (folder_walk.index == i)
+        {
+            // The file could be counted or not. Count again
+            folder_count_stop();
+            fc->pending = 1;
+        }
+        if (fc->valid && ((delta > 0) || (fc->count > 0)))
+        {
+            fc->count += delta;
+            folder_counts_dirty = true;
+        }
+    }
+    if (folder_counts_dirty && (folder_walk.index < 0))
+    {
+        folder_count_save();
+    }
+}
+
+/**
+ * @brief Counts the files of the folders in the background, for up to budget_ms milliseconds.
+ *
+ * Called from the main loop. The directories are walked one entry at a time, so the loop is
+ * never blocked by big folders. The counts are saved when all the folders have been counted.
+ *
+ * @param budget_ms The time to spend counting files.
+ *
+ * @return true if all the folders are counted.
+ */
+bool folder_count_task(uint32_t budget_ms)
+{
+    if (!folder_counts_loaded)
+    {
+        return true;
+    }
+    absolute_time_t deadline = make_timeout_time_ms(budget_ms);
+    while (folder_count_step())
+    {
+        if (time_reached(deadline))
+        {
+            return false;
+        }
+    }
+    if (folder_counts_dirty)
+    {
+        folder_count_save();
+    }
+    return true;
+}
+
 /**
  * @brief Checks if the SD card is mounted.
  *
@@ -869,13 +1132,13 @@ void get_sdcard_data(FATFS *fs, SdCardData *sd_data, const SdCardData *sd_data_s
     bool is_card_mounted = is_sdcard_mounted(fs);
 
     sd_data->status = is_card_mounted ? SD_CARD_MOUNTED : SD_CARD_NOT_MOUNTED; // SD card status
-    strncpy(sd_data->floppies_folder, find_entry(PARAM_FLOPPIES_FOLDER)->value, MAX_FOLDER_LENGTH - 1);
+    strncpy(sd_data->floppies_folder, config_string(CONFIG_KEY_FLOPPIES_FOLDER), MAX_FOLDER_LENGTH - 1);
     sd_data->floppies_folder[MAX_FOLDER_LENGTH - 1] = '\0'; // Ensure null termination
 
-    strncpy(sd_data->roms_folder, find_entry(PARAM_ROMS_FOLDER)->value, MAX_FOLDER_LENGTH - 1);
+    strncpy(sd_data->roms_folder, config_string(CONFIG_KEY_ROMS_FOLDER), MAX_FOLDER_LENGTH - 1);
     sd_data->roms_folder[MAX_FOLDER_LENGTH - 1] = '\0'; // Ensure null termination
 
-    strncpy(sd_data->harddisks_folder, find_entry(PARAM_GEMDRIVE_FOLDERS)->value, MAX_FOLDER_LENGTH - 1);
+    strncpy(sd_data->harddisks_folder, config_string(CONFIG_KEY_GEMDRIVE_FOLDERS), MAX_FOLDER_LENGTH - 1);
     sd_data->harddisks_folder[MAX_FOLDER_LENGTH - 1] = '\0'; // Ensure null termination
 
     if (is_card_mounted)
@@ -890,32 +1153,18 @@ void get_sdcard_data(FATFS *fs, SdCardData *sd_data, const SdCardData *sd_data_s
         sd_data->sd_size = total;
         sd_data->sd_free_space = freeSpace;
 
-        if (sd_data_src && sd_data_src->roms_folder_count == 0 && is_fcount_enabled)
+        if (is_fcount_enabled)
         {
-            // If the ROMs folder count is zero, recalculate the folder count
-            sd_data->roms_folder_count = calculate_folder_count(sd_data->roms_folder);
+            // Counted in the background by folder_count_task()
+            sd_data->roms_folder_count = folder_count_get(FOLDER_COUNT_ROMS, sd_data->roms_folder);
+            sd_data->floppies_folder_count = folder_count_get(FOLDER_COUNT_FLOPPIES, sd_data->floppies_folder);
+            sd_data->harddisks_folder_count = folder_count_get(FOLDER_COUNT_HARDDISKS, sd_data->harddisks_folder);
         }
         else
         {
-            sd_data->roms_folder_count = sd_data_src->roms_folder_count;
-        }
-        if (sd_data_src && sd_data_src->floppies_folder_count == 0 && is_fcount_enabled)
-        {
-            // If the floppies folder count is zero, recalculate the folder count
-            sd_data->floppies_folder_count = calculate_folder_count(sd_data->floppies_folder);
-        }
-        else
-        {
-            sd_data->floppies_folder_count = sd_data_src->floppies_folder_count;
-        }
-        if (sd_data_src && sd_data_src->harddisks_folder_count == 0 && is_fcount_enabled)
-        {
-            // If the harddisks folder count is zero, recalculate the folder count
-            sd_data->harddisks_folder_count = calculate_folder_count(sd_data->harddisks_folder);
-        }
-        else
-        {
-            sd_data->harddisks_folder_count = sd_data_src->harddisks_folder_count;
+            sd_data->roms_folder_count = sd_data_src ? sd_data_src->roms_folder_count : 0;
+            sd_data->floppies_folder_count = sd_data_src ? sd_data_src->floppies_folder_count : 0;
+            sd_data->harddisks_folder_count = sd_data_src ? sd_data_src->harddisks_folder_count : 0;
         }
     }
     else
@@ -1080,6 +1329,9 @@ bool get_dir_files(const char *dir_ptr, const char *allowed_extensions[], char *
         return false;
     }
 
+    // Show the images inside the ZIP archives too
+    zip_expand_file_list(dir_ptr, &file_list, &unfiltered_num_files, allowed_extensions, ext_count);
+
     DPRINTF("Number of files found: %d\n", unfiltered_num_files);
     // Keep only valid extension files
     *files = filter(file_list, unfiltered_num_files, num_files, allowed_extensions, ext_count);
@@ -1125,6 +1377,18 @@ void release_memory_files(char **files, int num_files)
     free(files); // Free the list itself
 }
 
+// Read the next bytes of a ROM file, either from the card or decompressed from a ZIP archive
+static FRESULT rom_read(FIL *fsrc, ZipStream *zstream, BYTE *buffer, UINT len, UINT *br)
+{
+    if (zstream == NULL)
+    {
+        return f_read(fsrc, buffer, len, br);
+    }
+    int bytes = zip_stream_read(zstream, buffer, len);
+    *br = (bytes > 0) ? bytes : 0;
+    return (bytes < 0) ? FR_INT_ERR : FR_OK;
+}
+
 /**
  * @brief Loads a ROM file from the filesystem into memory at a specified offset.
  *
@@ -1132,7 +1396,8 @@ void release_memory_files(char **files, int num_files)
  * a buffer, performs a byte order correction for endianness, and then programs it into
  * flash memory at a specified offset. It handles STEEM cartridge image peculiarities and
  * assumes certain ROM sizes for this check. The function outputs progress to a debug
- * interface and handles errors and end-of-file conditions.
+ * interface and handles errors and end-of-file conditions. A filename like "roms.zip/game.img"
+ * loads the ROM from inside a ZIP archive, decompressing it while it's written to flash.
  *
  * @param path A pointer to a string representing the directory path where the ROM file is located.
  * @param filename A pointer to a string representing the name of the ROM file to be loaded.
@@ -1151,7 +1416,7 @@ void release_memory_files(char **files, int num_files)
  *         // Handle error
  *     }
  */
-int load_rom_from_fs(char *path, char *filename, uint32_t rom_load_offset)
+int load_rom_from_fs(const char *path, char *filename, uint32_t rom_load_offset)
 {
     int BUFFER_SIZE = 4096;
     FIL fsrc;                                /* File objects */
@@ -1159,20 +1424,48 @@ int load_rom_from_fs(char *path, char *filename, uint32_t rom_load_offset)
     FRESULT fr;                              /* FatFs function common result code */
     unsigned int br = 0;                     /* File read/write count */
     unsigned int size = 0;                   // File size
+    unsigned int pending = 0;                // Bytes already in the buffer
     uint32_t dest_address = rom_load_offset; // Initialize pointer to the ROM address
+    ZipArchive zip;
+    ZipStream *zstream = NULL; // Not NULL if the ROM is inside a ZIP archive
 
     char fullpath[512]; // Assuming 512 bytes as the max path+filename length. Adjust if necessary.
     snprintf(fullpath, sizeof(fullpath), "%s/%s", path, filename);
 
     DPRINTF("Loading file '%s'  ", fullpath);
 
-    /* Open source file on the drive 0 */
-    fr = f_open(&fsrc, fullpath, FA_READ);
-    if (fr)
-        return (int)fr;
+    char zip_path[ZIP_MAX_PATH_LENGTH];
+    const char *entry_name = NULL;
+    if (zip_split_path(fullpath, zip_path, sizeof(zip_path), &entry_name))
+    {
+        // The ROM is decompressed while it's written to the flash
+        zstream = malloc(sizeof(ZipStream));
+        if (zstream == NULL)
+            return (int)FR_NOT_ENOUGH_CORE;
+        fr = zip_open(&zip, zip_path);
+        if (fr == FR_OK)
+        {
+            fr = zip_stream_open(zstream, &zip, zip_find(&zip, entry_name));
+            if (fr)
+                zip_close(&zip);
+        }
+        if (fr)
+        {
+            free(zstream);
+            return (int)fr;
+        }
+        size = zstream->entry->uncompressed_size;
+    }
+    else
+    {
+        /* Open source file on the drive 0 */
+        fr = f_open(&fsrc, fullpath, FA_READ);
+        if (fr)
+            return (int)fr;
 
-    // Get file size
-    size = f_size(&fsrc);
+        // Get file size
+        size = f_size(&fsrc);
+    }
     DPRINTF("File size: %i bytes\n", size);
 
     // If the size of the image is not 65536 or 131072 bytes, check if the file
@@ -1180,11 +1473,10 @@ int load_rom_from_fs(char *path, char *filename, uint32_t rom_load_offset)
     if ((size == ROM_SIZE_BYTES + 4) || (size == ROM_SIZE_BYTES * 2 + 4))
     {
         // Read the first 4 bytes
-        fr = f_read(&fsrc, buffer, 4, &br);
+        fr = rom_read(&fsrc, zstream, buffer, 4, &br);
         if (fr)
         {
-            f_close(&fsrc);
-            return (int)fr; // Check for error in reading
+            goto close_rom; // Check for error in reading
         }
 
         // Check if the first 4 bytes are 0x0000
@@ -1192,22 +1484,32 @@ int load_rom_from_fs(char *path, char *filename, uint32_t rom_load_offset)
         {
             DPRINTF("Skipping first 4 bytes. Looks like a STEEM cartridge image.\n");
         }
+        else if (zstream != NULL)
+        {
+            // A ZIP stream can't go back. Keep the 4 bytes read as the start of the first chunk
+            pending = br;
+        }
         else
         {
-            // Rollback the file pointer to the previous 4 bytes read
-            f_lseek(&fsrc, -4);
+            // Rollback the file pointer to the start. f_lseek() takes an absolute offset
+            fr = f_lseek(&fsrc, 0);
+            if (fr)
+            {
+                goto close_rom;
+            }
         }
     }
     /* Copy source to destination */
     size = 0;
     for (;;)
     {
-        fr = f_read(&fsrc, buffer, sizeof buffer, &br); /* Read a chunk of data from the source file */
+        fr = rom_read(&fsrc, zstream, buffer + pending, sizeof buffer - pending, &br); /* Read a chunk of data from the source file */
         if (fr)
         {
-            f_close(&fsrc);
-            return (int)fr; // Check for error in reading
+            goto close_rom; // Check for error in reading
         }
+        br += pending;
+        pending = 0;
         if (br == 0)
             break; // EOF
 
@@ -1216,9 +1518,7 @@ int load_rom_from_fs(char *path, char *filename, uint32_t rom_load_offset)
 
         // Transfer buffer to FLASH
         // WARNING! TRANSFER THE INFORMATION IN THE BUFFER AS LITTLE ENDIAN!!!!
-        uint32_t ints = save_and_disable_interrupts();
-        flash_range_program(dest_address, buffer, br);
-        restore_interrupts(ints);
+        flash_write_program(dest_address, buffer, br);
 
         dest_address += br; // Increment the pointer to the ROM address
         size += br;
@@ -1226,12 +1526,22 @@ int load_rom_from_fs(char *path, char *filename, uint32_t rom_load_offset)
         DPRINTF(".");
     }
 
-    // Close open file
-    f_close(&fsrc);
-
     DPRINTF(" %i bytes loaded\n", size);
     DPRINTF("File loaded at offset 0x%x\n", rom_load_offset);
     DPRINTF("Dest ROM address end is 0x%x\n", dest_address - 1);
+
+close_rom:
+    // Close open file
+    if (zstream != NULL)
+    {
+        zip_stream_close(zstream);
+        zip_close(&zip);
+        free(zstream);
+    }
+    else
+    {
+        f_close(&fsrc);
+    }
     return (int)fr;
 }
 
@@ -1993,40 +2303,312 @@ void extract_filename(const char *url, char filename[256])
  *
  * @param filename The name of the file to check.
  * @return True if the filename ends with ".rw", indicating a read-write floppy disk image file.
- *         False otherwise.
+ *         False otherwise. The images inside ZIP archives are always read only.
  */
 bool is_floppy_rw(const char *filename)
 {
+    char zip_path[ZIP_MAX_PATH_LENGTH];
+    const char *entry_name = NULL;
+    if (zip_split_path(filename, zip_path, sizeof(zip_path), &entry_name))
+    {
+        return false;
+    }
     return (strlen(filename) >= 3 && strcmp(filename + strlen(filename) - 3, ".rw") == 0);
 }
 
+// SPI rates of the SD card in kHz. The auto-tuning steps up from the configured rate and
+// the error recovery steps down
+static const uint32_t sd_spi_rates_kb[] = {3125, 6250, 12500, 15625, 20833, 25000};
+static sd_card_t *sd_spi_card = NULL;
+static uint32_t sd_spi_retry_count = 0;
+static bool sd_spi_probing = false;
+static block_dev_err_t (*sd_read_blocks_raw)(sd_card_t *, uint8_t *, uint64_t, uint32_t) = NULL;
+static block_dev_err_t (*sd_write_blocks_raw)(sd_card_t *, const uint8_t *, uint64_t, uint32_t) = NULL;
+
+static void sd_spi_set_rate(uint32_t rate_kb)
+{
+    spi_t *spi = sd_spi_card->spi_if_p->spi;
+    // Also used by the driver when the card is initialized again
+    spi->baud_rate = rate_kb * 1000;
+    uint actual = spi_set_baudrate(spi->hw_inst, spi->baud_rate);
+    DPRINTF("SD card SPI rate: %lu kHz (actual %u Hz)\n", rate_kb, actual);
+}
+
+static void sd_spi_step_down()
+{
+    uint32_t current_kb = sd_spi_card->spi_if_p->spi->baud_rate / 1000;
+    for (int i = count_of(sd_spi_rates_kb) - 1; i >= 0; i--)
+    {
+        if (sd_spi_rates_kb[i] < current_kb)
+        {
+            sd_spi_set_rate(sd_spi_rates_kb[i]);
+            return;
+        }
+    }
+}
+
+static block_dev_err_t sd_read_blocks_retry(sd_card_t *sd_card_p, uint8_t *buffer, uint64_t ulSectorNumber, uint32_t ulSectorCount)
+{
+    block_dev_err_t rc = sd_read_blocks_raw(sd_card_p, buffer, ulSectorNumber, ulSectorCount);
+    for (int retry = 0; (rc != SD_BLOCK_DEVICE_ERROR_NONE) && !sd_spi_probing && (retry < SD_SPI_MAX_RETRIES); retry++)
+    {
+        sd_spi_retry_count++;
+        DPRINTF("SD card read error %d at sector %llu. Retry %lu\n", rc, ulSectorNumber, sd_spi_retry_count);
+        sd_spi_step_down();
+        rc = sd_read_blocks_raw(sd_card_p, buffer, ulSectorNumber, ulSectorCount);
+    }
+    return rc;
+}
+
+static block_dev_err_t sd_write_blocks_retry(sd_card_t *sd_card_p, const uint8_t *buffer, uint64_t ulSectorNumber, uint32_t ulSectorCount)
+{
+    block_dev_err_t rc = sd_write_blocks_raw(sd_card_p, buffer, ulSectorNumber, ulSectorCount);
+    for (int retry = 0; (rc != SD_BLOCK_DEVICE_ERROR_NONE) && !sd_spi_probing && (retry < SD_SPI_MAX_RETRIES); retry++)
+    {
+        sd_spi_retry_count++;
+        DPRINTF("SD card write error %d at sector %llu. Retry %lu\n", rc, ulSectorNumber, sd_spi_retry_count);
+        sd_spi_step_down();
+        rc = sd_write_blocks_raw(sd_card_p, buffer, ulSectorNumber, ulSectorCount);
+    }
+    return rc;
+}
+
+/**
+ * @brief Returns the number of SD card transfers retried at a slower SPI rate since the boot.
+ *
+ * @return The number of retries.
+ */
+uint32_t sd_spi_retries()
+{
+    return sd_spi_retry_count;
+}
+
+/**
+ * @brief Identifies the card by the serial number of its volume and its number of sectors.
+ *
+ * @param fs Pointer to the mounted file system.
+ * @param buffer Buffer of at least one sector.
+ * @param serial Pointer to the serial number of the volume.
+ * @param sectors Pointer to the number of sectors of the card.
+ * @return true if the card was identified, false otherwise.
+ */
+static bool sd_spi_card_id(FATFS *fs, uint8_t *buffer, uint32_t *serial, uint32_t *sectors)
+{
+    LBA_t count = 0;
+    if ((disk_ioctl(fs->pdrv, GET_SECTOR_COUNT, &count) != RES_OK) || (disk_read(fs->pdrv, buffer, fs->volbase, 1) != RES_OK))
+    {
+        return false;
+    }
+    // Offset of the volume serial number in the boot sector
+    uint16_t offset = (fs->fs_type == FS_EXFAT) ? 100 : ((fs->fs_type == FS_FAT32) ? 67 : 39);
+    *serial = (uint32_t)buffer[offset] | ((uint32_t)buffer[offset + 1] << 8) | ((uint32_t)buffer[offset + 2] << 16) | ((uint32_t)buffer[offset + 3] << 24);
+    *sectors = (uint32_t)count;
+    return true;
+}
+
+/**
+ * @brief Finds the SPI rate saved for a card in the speed file.
+ *
+ * @param serial The serial number of the volume of the card.
+ * @param sectors The number of sectors of the card.
+ * @return The rate in kHz, or 0 if the card was never tuned.
+ */
+static uint32_t sd_spi_saved_rate(uint32_t serial, uint32_t sectors)
+{
+    FIL fil;
+    char line[40];
+    uint32_t rate_kb = 0;
+    if (f_open(&fil, SD_SPEED_FILE_NAME, FA_READ) != FR_OK)
+    {
+        return 0;
+    }
+    while (f_gets(line, sizeof(line), &fil))
+    {
+        unsigned long line_serial, line_sectors, line_rate_kb;
+        if ((sscanf(line, "%lx %lu %lu", &line_serial, &line_sectors, &line_rate_kb) == 3) &&
+            (line_serial == serial) && (line_sectors == sectors))
+        {
+            rate_kb = line_rate_kb;
+            break;
+        }
+    }
+    f_close(&fil);
+    return rate_kb;
+}
+
+/**
+ * @brief Saves the SPI rate of a card in the speed file, keeping the rates of the other cards.
+ *
+ * @param serial The serial number of the volume of the card.
+ * @param sectors The number of sectors of the card.
+ * @param rate_kb The fastest stable rate in kHz.
+ */
+static void sd_spi_save_rate(uint32_t serial, uint32_t sectors, uint32_t rate_kb)
+{
+    FIL fil;
+    char lines[SD_SPEED_MAX_CARDS][40];
+    int num_lines = 0;
+    snprintf(lines[num_lines++], sizeof(lines[0]), "%08lx %lu %lu\n", serial, sectors, rate_kb);
+    if (f_open(&fil, SD_SPEED_FILE_NAME, FA_READ) == FR_OK)
+    {
+        while ((num_lines < SD_SPEED_MAX_CARDS) && f_gets(lines[num_lines], sizeof(lines[0]), &fil))
+        {
+            unsigned long line_serial, line_sectors, line_rate_kb;
+            if ((sscanf(lines[num_lines], "%lx %lu %lu", &line_serial, &line_sectors, &line_rate_kb) == 3) &&
+                !((line_serial == serial) && (line_sectors == sectors)))
+            {
+                num_lines++;
+            }
+        }
+        f_close(&fil);
+    }
+    if (f_open(&fil, SD_SPEED_FILE_NAME, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        DPRINTF("ERROR: Could not save the SD card SPI rate\n");
+        return;
+    }
+    for (int i = 0; i < num_lines; i++)
+    {
+        f_puts(lines[i], &fil);
+    }
+    f_close(&fil);
+}
+
+/**
+ * @brief Reads the probe sectors at the current SPI rate and compares them with the reference.
+ *
+ * The sectors are read with a multi-block transfer. Nothing is written to the card.
+ *
+ * @param fs Pointer to the mounted file system.
+ * @param sector The first sector of the probe.
+ * @param reference The sectors read at the configured rate.
+ * @param buffer Buffer of SD_PROBE_SECTORS sectors.
+ * @return true if the sectors were read and match the reference, false otherwise.
+ */
+static bool sd_spi_probe_rate(FATFS *fs, LBA_t sector, const uint8_t *reference, uint8_t *buffer)
+{
+    memset(buffer, 0, SD_PROBE_SECTORS * FF_MIN_SS);
+    if (disk_read(fs->pdrv, buffer, sector, SD_PROBE_SECTORS) != RES_OK)
+    {
+        return false;
+    }
+    return memcmp(buffer, reference, SD_PROBE_SECTORS * FF_MIN_SS) == 0;
+}
+
+/**
+ * @brief Finds the fastest stable SPI rate of the card inserted.
+ *
+ * The rate saved for the card in the speed file is used if there is one. Otherwise the
+ * sectors of the FAT are read at the configured rate, and read again at each faster rate.
+ * The fastest rate that returned the same data is saved for the card. The probe only reads
+ * the card, and the speed file is written at the configured rate.
+ *
+ * @param base_kb The configured rate in kHz, known to work.
+ */
+static void sd_spi_autotune(uint32_t base_kb)
+{
+    FATFS *fs = malloc(sizeof(FATFS));
+    uint8_t *reference = malloc(SD_PROBE_SECTORS * FF_MIN_SS);
+    uint8_t *buffer = malloc(SD_PROBE_SECTORS * FF_MIN_SS);
+    if ((fs == NULL) || (reference == NULL) || (buffer == NULL))
+    {
+        DPRINTF("Not enough memory to tune the SD card SPI rate\n");
+    }
+    else if (f_mount(fs, "0:", 1) != FR_OK)
+    {
+        DPRINTF("Could not mount the SD card to tune the SPI rate\n");
+    }
+    else
+    {
+        uint32_t serial = 0;
+        uint32_t sectors = 0;
+        uint32_t saved_kb = 0;
+        // The FAT has the same content at any rate and it's rarely all zeros
+        LBA_t probe_sector = fs->fatbase;
+        if (!sd_spi_card_id(fs, buffer, &serial, &sectors))
+        {
+            DPRINTF("Could not identify the SD card\n");
+        }
+        else if ((saved_kb = sd_spi_saved_rate(serial, sectors)) > 0)
+        {
+            DPRINTF("SD card %08lx already tuned\n", serial);
+            sd_spi_set_rate(saved_kb);
+        }
+        else if ((probe_sector + SD_PROBE_SECTORS <= sectors) &&
+                 (disk_read(fs->pdrv, reference, probe_sector, SD_PROBE_SECTORS) == RES_OK))
+        {
+            // Errors must not be hidden by the retries while probing
+            sd_spi_probing = true;
+            uint32_t best_kb = base_kb;
+            bool base_ok = sd_spi_probe_rate(fs, probe_sector, reference, buffer);
+            bool ok = base_ok;
+            for (int i = 0; ok && (i < count_of(sd_spi_rates_kb)); i++)
+            {
+                if (sd_spi_rates_kb[i] > base_kb)
+                {
+                    sd_spi_set_rate(sd_spi_rates_kb[i]);
+                    ok = sd_spi_probe_rate(fs, probe_sector, reference, buffer);
+                    if (ok)
+                    {
+                        best_kb = sd_spi_rates_kb[i];
+                    }
+                }
+            }
+            sd_spi_probing = false;
+            DPRINTF("SD card %08lx fastest stable SPI rate: %lu kHz\n", serial, best_kb);
+            if (base_ok)
+            {
+                sd_spi_set_rate(base_kb);
+                sd_spi_save_rate(serial, sectors, best_kb);
+            }
+            sd_spi_set_rate(best_kb);
+        }
+        f_unmount("0:");
+    }
+    free(buffer);
+    free(reference);
+    free(fs);
+}
+
 /**
  * @brief Change the SPI speed for the SD card.
  *
  * This function changes the SPI speed for the SD card based on the configured baud rate.
  * It retrieves the baud rate from the configuration entry and updates the SPI baud rate accordingly.
- * If the baud rate is invalid or not found, it uses the default value.
+ * If the baud rate is invalid or not found, it uses the default value. Then the rate is tuned
+ * upwards for the card inserted, and the transfers that fail are retried at slower rates.
+ * The tuning reads the card for a while, so call it before the ROM emulation starts.
  */
 void change_spi_speed()
 {
     size_t sd_num = sd_get_num();
     if (sd_num > 0)
     {
-        ConfigEntry *sd_baud_rate_kb = find_entry(PARAM_SD_BAUD_RATE_KB);
-        if (sd_baud_rate_kb != NULL)
+        sd_card_t *sd_card = sd_get_by_num(sd_num - 1);
+        int baud_rate = config_int(CONFIG_KEY_SD_BAUD_RATE_KB);
+        if (baud_rate > 0)
         {
-            int baud_rate = atoi(sd_baud_rate_kb->value);
-            if (baud_rate > 0)
-            {
-                DPRINTF("Changing SD card baud rate to %i\n", baud_rate);
-                sd_card_t *sd_card = sd_get_by_num(sd_num - 1);
-                sd_card->spi_if_p->spi->baud_rate = baud_rate * 1000;
-            }
-            else
-            {
-                DPRINTF("Invalid baud rate. Using default value\n");
-            }
+            DPRINTF("Changing SD card baud rate to %i\n", baud_rate);
+            sd_card->spi_if_p->spi->baud_rate = baud_rate * 1000;
+        }
+        else
+        {
+            DPRINTF("Invalid baud rate. Using default value\n");
+        }
+        if (!sd_init_driver())
+        {
+            DPRINTF("ERROR: Could not initialize SD card\r\n");
+            return;
+        }
+        sd_spi_card = sd_card;
+        if (sd_read_blocks_raw == NULL)
+        {
+            sd_read_blocks_raw = sd_card->read_blocks;
+            sd_write_blocks_raw = sd_card->write_blocks;
+            sd_card->read_blocks = sd_read_blocks_retry;
+            sd_card->write_blocks = sd_write_blocks_retry;
         }
+        sd_spi_autotune(sd_card->spi_if_p->spi->baud_rate / 1000);
     }
     else
     {
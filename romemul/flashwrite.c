@@ -0,0 +1,174 @@
+/**
+ * File: flashwrite.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Erase and program the flash keeping the ROM3 protocol alive
+ */
+
+#include "include/flashwrite.h"
+
+// The XIP is not available while the flash is erased or programmed. When the DMA IRQ handler
+// of the ROM3 protocol and everything it calls run from RAM, only that IRQ is left enabled and
+// the commands it completes are queued until the flash is back. Otherwise it is masked too
+static FlashWriteStats flash_write_counters;
+static bool flash_write_protocol_irq_safe = false;
+
+/**
+ * @brief Leaves the ROM3 protocol IRQ enabled while the flash is written.
+ *
+ * Only call it with true when the DMA_IRQ_1 handler installed and all the code it reaches
+ * are RAM resident. A handler touching the flash would fault while the XIP is down.
+ *
+ * @param keep True if the protocol IRQ handler is RAM safe.
+ */
+void flash_write_keep_protocol_irq(bool keep)
+{
+    flash_write_protocol_irq_safe = keep;
+}
+
+/**
+ * @brief Masks all the IRQs but the ROM3 protocol one, if RAM safe, and queues its commands.
+ *
+ * @return The mask of the IRQs disabled, to enable them again in flash_write_end().
+ */
+static uint32_t flash_write_begin(void)
+{
+    uint32_t ints = save_and_disable_interrupts();
+    uint32_t enabled = *((volatile uint32_t *)(PPB_BASE + M0PLUS_NVIC_ISER_OFFSET));
+    uint32_t masked = enabled;
+    if (flash_write_protocol_irq_safe)
+    {
+        masked &= ~(1u << FLASH_WRITE_PROTOCOL_IRQ);
+        defer_protocol_commands(true);
+    }
+    irq_set_mask_enabled(masked, false);
+    restore_interrupts(ints);
+    return masked;
+}
+
+/**
+ * @brief Dispatches the commands queued during the flash operation and enables the IRQs masked.
+ *
+ * @param masked The mask returned by flash_write_begin().
+ * @param start_us The time when the flash operation started.
+ */
+static void flash_write_end(uint32_t masked, uint32_t start_us)
+{
+    uint32_t dispatch_us = time_us_32();
+    uint32_t ints = save_and_disable_interrupts();
+    // The callbacks expect to run in the IRQ context, so the interrupts stay disabled
+    defer_protocol_commands(false);
+    dispatch_deferred_protocol_commands();
+    irq_set_mask_enabled(masked, true);
+    restore_interrupts(ints);
+
+    uint32_t now = time_us_32();
+    uint32_t elapsed = now - start_us;
+    flash_write_counters.last_masked_us = elapsed;
+    if (elapsed > flash_write_counters.max_masked_us)
+    {
+        flash_write_counters.max_masked_us = elapsed;
+    }
+    // Kept alive, the protocol IRQ only waits while the queued commands are dispatched
+    uint32_t blackout = flash_write_protocol_irq_safe ? now - dispatch_us : elapsed;
+    if (blackout > flash_write_counters.max_blackout_us)
+    {
+        flash_write_counters.max_blackout_us = blackout;
+    }
+}
+
+// The whole range was written with the interrupts disabled before the operations were sliced
+static void flash_write_range_end(uint32_t range_start_us)
+{
+    uint32_t elapsed = time_us_32() - range_start_us;
+    if (elapsed > flash_write_counters.max_range_us)
+    {
+        flash_write_counters.max_range_us = elapsed;
+    }
+}
+
+/**
+ * @brief Erases a range of the flash one sector at a time.
+ *
+ * Each sector is erased in its own window, so the other IRQs are masked at most the time of
+ * a sector erase instead of the whole range.
+ *
+ * @param flash_offs The offset in the flash of the first sector. Multiple of FLASH_SECTOR_SIZE.
+ * @param count The bytes to erase. Rounded up to FLASH_SECTOR_SIZE.
+ */
+void flash_write_erase(uint32_t flash_offs, size_t count)
+{
+    uint32_t range_start_us = time_us_32();
+    uint32_t end = flash_offs + count;
+    for (uint32_t offset = flash_offs; offset < end; offset += FLASH_SECTOR_SIZE)
+    {
+        uint32_t masked = flash_write_begin();
+        uint32_t start_us = time_us_32();
+        flash_range_erase(offset, FLASH_SECTOR_SIZE);
+        flash_write_end(masked, start_us);
+        flash_write_counters.erases++;
+    }
+    flash_write_range_end(range_start_us);
+}
+
+/**
+ * @brief Programs a range of the flash in slices of FLASH_WRITE_PROGRAM_SLICE bytes.
+ *
+ * @param flash_offs The offset in the flash. Multiple of FLASH_PAGE_SIZE.
+ * @param data The data to program. It must be in RAM.
+ * @param count The bytes to program. Multiple of FLASH_PAGE_SIZE.
+ */
+void flash_write_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    uint32_t range_start_us = time_us_32();
+    while (count > 0)
+    {
+        size_t slice = count < FLASH_WRITE_PROGRAM_SLICE ? count : FLASH_WRITE_PROGRAM_SLICE;
+        uint32_t masked = flash_write_begin();
+        uint32_t start_us = time_us_32();
+        flash_range_program(flash_offs, data, slice);
+        flash_write_end(masked, start_us);
+        flash_write_counters.programs++;
+        flash_offs += slice;
+        data += slice;
+        count -= slice;
+    }
+    flash_write_range_end(range_start_us);
+}
+
+/**
+ * @brief Returns the counters of the flash operations.
+ *
+ * @param stats The counters.
+ */
+void flash_write_stats(FlashWriteStats *stats)
+{
+    *stats = flash_write_counters;
+    deferred_protocol_stats(&stats->deferred_commands, &stats->dropped_commands);
+}
+
+/**
+ * @brief Logs the counters of the flash operations.
+ *
+ * @param context Name of the operation that wrote the flash.
+ */
+void flash_write_report(const char *context)
+{
+    FlashWriteStats stats;
+    flash_write_stats(&stats);
+    DPRINTF("Flash write (%s): %lu erases, %lu programs, masked %lu us last, %lu us max, protocol IRQ %s, %lu deferred, %lu dropped\n",
+            context,
+            (unsigned long)stats.erases,
+            (unsigned long)stats.programs,
+            (unsigned long)stats.last_masked_us,
+            (unsigned long)stats.max_masked_us,
+            flash_write_protocol_irq_safe ? "enabled" : "masked",
+            (unsigned long)stats.deferred_commands,
+            (unsigned long)stats.dropped_commands);
+    // Before the slicing the protocol was blind during the whole range
+    DPRINTF("Flash write (%s): protocol blackout %lu us max. Whole range %lu us max\n",
+            context,
+            (unsigned long)stats.max_blackout_us,
+            (unsigned long)stats.max_range_us);
+}
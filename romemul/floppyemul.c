@@ -62,6 +62,10 @@ static uint16_t logical_sector = 0;
 static uint16_t sector_size = 512;
 static uint32_t disk_number = 0;
 
+// Images opened from inside a ZIP archive. Too big for the stack
+static ZipImage zip_image_a = {0};
+static ZipImage zip_image_b = {0};
+
 static DiskVectors disk_vectors = {
     .hdv_bpb_payload = 0,
     .hdv_rw_payload = 0,
@@ -152,10 +156,34 @@ static FRESULT floppyemul_create_BPB(FIL *fsrc, BPBData *bpb)
  * @param floppy_read_write Specifies whether the file should be opened for both reading and writing.
  * @param error Pointer to a boolean variable indicating whether an error occurred during the operation.
  * @param fsrc Pointer to a FIL structure representing the opened file.
+ * @param zip_image Pointer to the ZIP image used if the file is inside a ZIP archive. Then fsrc is its cache file.
  * @return The result of the file open operation.
  */
-static FRESULT floppyemul_open(const char *fullpath, bool floppy_read_write, FIL *fsrc)
+static FRESULT floppyemul_open(const char *fullpath, bool floppy_read_write, FIL *fsrc, ZipImage *zip_image)
 {
+    char zip_path[ZIP_MAX_PATH_LENGTH];
+    const char *entry_name = NULL;
+    zip_image->active = false;
+    if (zip_split_path(fullpath, zip_path, sizeof(zip_path), &entry_name))
+    {
+        // The sectors are decompressed on demand. The boot sector is needed now to create the BPB
+        FRESULT fr = zip_image_open(zip_image, fullpath, fsrc);
+        if (fr == FR_OK)
+        {
+            fr = zip_image_fill(zip_image, NUM_BYTES_PER_SECTOR);
+            if (fr)
+            {
+                zip_image_close(zip_image);
+            }
+        }
+        if (fr)
+        {
+            DPRINTF("ERROR: Could not open image %s in the ZIP archive (%d)\r\n", fullpath, fr);
+            return fr;
+        }
+        DPRINTF("Image size of %s: %i bytes\n", fullpath, zip_image->size);
+        return FR_OK;
+    }
     /* Open source file on the drive 0 */
     FRESULT fr = f_open(fsrc, fullpath, floppy_read_write ? FA_READ | FA_WRITE : FA_READ);
     if (fr)
@@ -190,10 +218,17 @@ static FRESULT floppyemul_open(const char *fullpath, bool floppy_read_write, FIL
  * This function closes the specified file on the floppy drive and performs any necessary cleanup operations.
  *
  * @param fsrc Pointer to a FIL structure representing the opened file.
+ * @param zip_image Pointer to the ZIP image of the file, if any.
  * @return The result of the file close operation.
  */
-static FRESULT floppyemul_close(FIL *fsrc)
+static FRESULT floppyemul_close(FIL *fsrc, ZipImage *zip_image)
 {
+    if (zip_image->active)
+    {
+        // Closes the cache file too
+        zip_image_close(zip_image);
+        return FR_OK;
+    }
     FRESULT fr = f_close(fsrc);
     if (fr)
     {
@@ -385,17 +420,17 @@ u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
     switch (iIndex)
     {
     case 0: /* "DRIVE_A" */
-        printed = snprintf(pcInsert, iInsertLen, "%s", strlen(find_entry(PARAM_FLOPPY_IMAGE_A)->value) > 0 ? find_entry(PARAM_FLOPPY_IMAGE_A)->value : "INSERT DISK");
+        printed = snprintf(pcInsert, iInsertLen, "%s", strlen(config_string(CONFIG_KEY_FLOPPY_IMAGE_A)) > 0 ? config_string(CONFIG_KEY_FLOPPY_IMAGE_A) : "INSERT DISK");
         break;
     case 1: /* "DRIVE_B" */
-        printed = snprintf(pcInsert, iInsertLen, "%s", strlen(find_entry(PARAM_FLOPPY_IMAGE_B)->value) > 0 ? find_entry(PARAM_FLOPPY_IMAGE_B)->value : "INSERT DISK");
+        printed = snprintf(pcInsert, iInsertLen, "%s", strlen(config_string(CONFIG_KEY_FLOPPY_IMAGE_B)) > 0 ? config_string(CONFIG_KEY_FLOPPY_IMAGE_B) : "INSERT DISK");
         break;
     case 2: /* "AACTION" */
     {
         char *msg = NULL;
         char *icon = NULL;
         char *url_action = NULL;
-        if (strlen(find_entry(PARAM_FLOPPY_IMAGE_A)->value) == 0)
+        if (strlen(config_string(CONFIG_KEY_FLOPPY_IMAGE_A)) == 0)
         {
             msg = "INSERT DISK\0";
             icon = "fas fa-folder-open\0";
@@ -423,7 +458,7 @@ u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
         char *msg = NULL;
         char *icon = NULL;
         char *url_action = NULL;
-        if (strlen(find_entry(PARAM_FLOPPY_IMAGE_B)->value) == 0)
+        if (strlen(config_string(CONFIG_KEY_FLOPPY_IMAGE_B)) == 0)
         {
             msg = "INSERT DISK\0";
             icon = "fas fa-folder-open\0";
@@ -447,7 +482,7 @@ u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
         break;
     }
     case 4: /* "FOLDER" */
-        printed = snprintf(pcInsert, iInsertLen, "%s", find_entry(PARAM_FLOPPIES_FOLDER)->value);
+        printed = snprintf(pcInsert, iInsertLen, "%s", config_string(CONFIG_KEY_FLOPPIES_FOLDER));
         break;
     case 5: /* "ACATALOG" */
         drv = 'a';
@@ -599,7 +634,7 @@ void __not_in_flash_func(floppyemul_dma_irq_handler_lookup_callback)(void)
 
     // Avoid priting anything inside an IRQ handled function
     // DPRINTF("DMA LOOKUP: $%x\n", addr);
-    if (addr >= ROM3_START_ADDRESS)
+    if (addr >= protocol_rom3_start_address)
     {
         parse_protocol((uint16_t)(addr & 0xFFFF), handle_protocol_command);
     }
@@ -633,30 +668,10 @@ void init_floppyemul(bool safe_config_reboot)
     memory_shared_address = ROM3_START_ADDRESS; // Start of the shared memory buffer
     memory_code_address = ROM4_START_ADDRESS;   // Start of the code memory
 
-    ConfigEntry *xbios_enabled = find_entry(PARAM_FLOPPY_XBIOS_ENABLED);
-    bool floppy_xbios_enabled = true;
-    if (xbios_enabled != NULL)
-    {
-        floppy_xbios_enabled = (xbios_enabled->value[0] == 't' || xbios_enabled->value[0] == 'T');
-    }
-    ConfigEntry *boot_enabled = find_entry(PARAM_FLOPPY_BOOT_ENABLED);
-    bool floppy_boot_enabled = true;
-    if (boot_enabled != NULL)
-    {
-        floppy_boot_enabled = (boot_enabled->value[0] == 't' || boot_enabled->value[0] == 'T');
-    }
-    ConfigEntry *buffer_type = find_entry(PARAM_FLOPPY_BUFFER_TYPE);
-    uint32_t buffer_type_value = 0;
-    if (buffer_type != NULL)
-    {
-        buffer_type_value = atoi(buffer_type->value);
-    }
-    ConfigEntry *network_enabled = find_entry(PARAM_FLOPPY_NET_ENABLED);
-    bool floppy_network_enabled = true;
-    if (network_enabled != NULL)
-    {
-        floppy_network_enabled = (network_enabled->value[0] == 't' || network_enabled->value[0] == 'T');
-    }
+    bool floppy_xbios_enabled = config_bool(CONFIG_KEY_FLOPPY_XBIOS_ENABLED);
+    bool floppy_boot_enabled = config_bool(CONFIG_KEY_FLOPPY_BOOT_ENABLED);
+    uint32_t buffer_type_value = config_int(CONFIG_KEY_FLOPPY_BUFFER_TYPE);
+    bool floppy_network_enabled = config_bool(CONFIG_KEY_FLOPPY_NET_ENABLED);
 
     SET_SHARED_VAR(SHARED_VARIABLE_BUFFER_TYPE, buffer_type_value, memory_shared_address, FLOPPYEMUL_SHARED_VARIABLES); // 0: _diskbuff, 1: heap
     SET_SHARED_PRIVATE_VAR(FLOPPYEMUL_SVAR_XBIOS_TRAP_ENABLED, floppy_xbios_enabled ? 0xFFFFFFFF : 0, memory_shared_address, FLOPPYEMUL_SHARED_VARIABLES);
@@ -675,12 +690,7 @@ void init_floppyemul(bool safe_config_reboot)
 
     // Local wifi password in the local file
     char *wifi_password_file_content = NULL;
-    ConfigEntry *floppy_network_timeout = find_entry(PARAM_FLOPPY_NET_TOUT_SEC);
-    uint32_t floppy_network_timeout_sec = 0;
-    if (floppy_network_timeout != NULL)
-    {
-        floppy_network_timeout_sec = atoi(floppy_network_timeout->value);
-    }
+    uint32_t floppy_network_timeout_sec = config_int(CONFIG_KEY_FLOPPY_NET_TOUT_SEC);
     // The ping timeout is the same as the network timeout
     SET_SHARED_PRIVATE_VAR(FLOPPYEMUL_SVAR_PING_TIMEOUT, floppy_network_timeout_sec, memory_shared_address, FLOPPYEMUL_SHARED_VARIABLES);
     floppy_network_timeout_sec = floppy_network_timeout_sec;
@@ -692,7 +702,7 @@ void init_floppyemul(bool safe_config_reboot)
     bool show_blink = true;
     // Only try to get the datetime from the network if the wifi is configured
     // and the network configuration is enabled
-    if ((strlen(find_entry(PARAM_WIFI_SSID)->value) > 0) && (floppy_network_enabled))
+    if ((strlen(config_string(CONFIG_KEY_WIFI_SSID)) > 0) && (floppy_network_enabled))
     {
         // Initialize SD card
         if (!sd_init_driver())
@@ -721,7 +731,7 @@ void init_floppyemul(bool safe_config_reboot)
         uint32_t time_to_connect_again = 1000; // 1 second
         network_ready = false;
         // Wait until timeout
-        while ((!network_ready) && (floppy_network_timeout_sec > 0) && (strlen(find_entry(PARAM_WIFI_SSID)->value) > 0))
+        while ((!network_ready) && (floppy_network_timeout_sec > 0) && (strlen(config_string(CONFIG_KEY_WIFI_SSID)) > 0))
         {
 #if PICO_CYW43_ARCH_POLL
             cyw43_arch_poll();
@@ -810,7 +820,7 @@ void init_floppyemul(bool safe_config_reboot)
     {
         // Copy the ip address and host
         char *ip_address = connection_data.ipv4_address;
-        char *host = find_entry(PARAM_HOSTNAME)->value;
+        const char *host = config_string(CONFIG_KEY_HOSTNAME);
         if (strlen(ip_address) > 0)
         {
             int ip_address_words_len = ((strlen(ip_address) / 2) + 1) * 2;
@@ -854,7 +864,7 @@ void init_floppyemul(bool safe_config_reboot)
     // Create list of floppy images
     if (!error && network_ready)
     {
-        char *dir = find_entry(PARAM_FLOPPIES_FOLDER)->value;
+        const char *dir = config_string(CONFIG_KEY_FLOPPIES_FOLDER);
         floppyemul_filelist(dir, &fs, &floppy_catalog);
     }
 
@@ -884,8 +894,8 @@ void init_floppyemul(bool safe_config_reboot)
             if (!IS_FLAG_SET(FILE_READY_A_FLAG))
             {
 
-                char *dir = find_entry(PARAM_FLOPPIES_FOLDER)->value;
-                char *filename_a = find_entry(PARAM_FLOPPY_IMAGE_A)->value;
+                const char *dir = config_string(CONFIG_KEY_FLOPPIES_FOLDER);
+                const char *filename_a = config_string(CONFIG_KEY_FLOPPY_IMAGE_A);
 
                 if (!dir || strlen(dir) == 0)
                 {
@@ -897,7 +907,7 @@ void init_floppyemul(bool safe_config_reboot)
                     DPRINTF("Error: Missing filename drive A.\n");
                     // it's ok if there is no floppy image in drive A
                 }
-                else if (strcmp(filename_a, find_entry(PARAM_FLOPPY_IMAGE_B)->value) == 0)
+                else if (strcmp(filename_a, config_string(CONFIG_KEY_FLOPPY_IMAGE_B)) == 0)
                 {
                     DPRINTF("Error: Drive A image is the same as drive B.\n");
                     error = true;
@@ -924,7 +934,7 @@ void init_floppyemul(bool safe_config_reboot)
 
                         // Invoke the function
                         dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, false);
-                        FRESULT err = floppyemul_open(fullpath_a, floppy_rw_a, &fsrc_a);
+                        FRESULT err = floppyemul_open(fullpath_a, floppy_rw_a, &fsrc_a, &zip_image_a);
                         dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, true);
                         if (err != FR_OK)
                         {
@@ -962,8 +972,8 @@ void init_floppyemul(bool safe_config_reboot)
             if (!IS_FLAG_SET(FILE_READY_B_FLAG))
             {
 
-                char *dir = find_entry(PARAM_FLOPPIES_FOLDER)->value;
-                char *filename_b = find_entry(PARAM_FLOPPY_IMAGE_B)->value;
+                const char *dir = config_string(CONFIG_KEY_FLOPPIES_FOLDER);
+                const char *filename_b = config_string(CONFIG_KEY_FLOPPY_IMAGE_B);
 
                 if (!dir || strlen(dir) == 0)
                 {
@@ -975,7 +985,7 @@ void init_floppyemul(bool safe_config_reboot)
                     DPRINTF("Error: Missing filename drive B.\n");
                     // it's ok if there is no floppy image in drive B
                 }
-                else if (strcmp(filename_b, find_entry(PARAM_FLOPPY_IMAGE_A)->value) == 0)
+                else if (strcmp(filename_b, config_string(CONFIG_KEY_FLOPPY_IMAGE_A)) == 0)
                 {
                     DPRINTF("Error: Drive B image is the same as drive A.\n");
                     error = true;
@@ -1003,7 +1013,7 @@ void init_floppyemul(bool safe_config_reboot)
 
                         // Invoke the function
                         dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, false);
-                        FRESULT err = floppyemul_open(fullpath_b, floppy_rw_b, &fsrc_b);
+                        FRESULT err = floppyemul_open(fullpath_b, floppy_rw_b, &fsrc_b, &zip_image_b);
                         dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, true);
                         if (err != FR_OK)
                         {
@@ -1040,7 +1050,7 @@ void init_floppyemul(bool safe_config_reboot)
             CLEAR_FLAG(UMOUNT_DRIVE_A_FLAG);
             // Umount the A drive
             dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, false);
-            FRESULT fr = floppyemul_close(&fsrc_a);
+            FRESULT fr = floppyemul_close(&fsrc_a, &zip_image_a);
             dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, true);
             if (fr != FR_OK)
             {
@@ -1061,7 +1071,7 @@ void init_floppyemul(bool safe_config_reboot)
             CLEAR_FLAG(UMOUNT_DRIVE_B_FLAG);
             // Umount the B drive
             dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, false);
-            FRESULT fr = floppyemul_close(&fsrc_b);
+            FRESULT fr = floppyemul_close(&fsrc_b, &zip_image_b);
             dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, true);
             if (fr != FR_OK)
             {
@@ -1166,6 +1176,16 @@ void init_floppyemul(bool safe_config_reboot)
             CLEAR_FLAG(SECTOR_READ_FLAG);
             DPRINTF("DISK %s (%d) - LSECTOR: %i / SSIZE: %i\n", disk_number == 0 ? "A:" : "B:", disk_number, logical_sector, sector_size);
 
+            // The images inside ZIP archives are decompressed up to the sector requested
+            dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, false);
+            fr = zip_image_fill(disk_number == 0 ? &zip_image_a : &zip_image_b, (logical_sector + 1) * sector_size);
+            dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, true);
+            if (fr)
+            {
+                DPRINTF("ERROR: Could not decompress sector %i (%d)\n", logical_sector, fr);
+                error = true;
+            }
+
             FIL fsrc_tmp = {0};
             char *fullpath_tmp = NULL;
             unsigned int br_tmp = {0};
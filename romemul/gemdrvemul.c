@@ -15,7 +15,7 @@ static uint16_t *payloadPtr = NULL;
 static uint32_t random_token;
 
 static char *fullpath_a = NULL;
-static char *hd_folder = NULL;
+static const char *hd_folder = NULL;
 static bool debug = false;
 static char drive_letter = 'C';
 
@@ -30,13 +30,66 @@ static uint16_t fcreate_mode = 0xFFFF;
 static char dpath_string[MAX_FOLDER_LENGTH] = {0};
 
 // Save Fsetdta variables
-static DTANode *dtaTbl[DTA_HASH_TABLE_SIZE];
+// The DTAs live in a fixed pool of slots. dtaTbl maps a DTA address to the first
+// slot of its bucket (slot index + 1, 0 = empty bucket)
+static DTANode dtaPool[DTA_POOL_SIZE];
+static uint8_t dtaTbl[DTA_HASH_TABLE_SIZE];
+static uint32_t dtaTick = 0;
+static uint32_t dtaLive = 0;
+static uint32_t dtaEvicted = 0;
+
+// Snapshots of the directories listed with Fsfirst/Fsnext
+static DirCache dirCache[DIR_CACHE_SLOTS];
+static uint32_t dirCacheTick = 0;
+static uint32_t dirCacheGeneration = 0;
+
+// Directories too big for a snapshot. They go straight to FatFs until they change
+static DirCacheLarge dirCacheLarge[DIR_CACHE_LARGE_SLOTS];
+
+// Atari ST paths already converted to FatFs paths. Relative paths depend on the default path
+static PathCacheEntry pathCache[PATH_CACHE_SLOTS];
+static uint32_t pathCacheTick = 0;
+
+// Read-ahead window of the file read sequentially
+static int read_ahead_fd = -1;               // File descriptor of the data in the window. -1 if empty
+static uint32_t read_ahead_offset = 0;       // Offset in the file of the first byte of the window
+static uint32_t read_ahead_bytes = 0;        // Bytes available in the window
+static int read_ahead_pending_fd = -1;       // File descriptor to prefetch when idle. -1 if nothing to do
+static uint32_t read_ahead_pending_offset = 0;
+
+// Write-behind buffer of the file written. Only one file at a time owns it
+static int write_behind_fd = -1;             // File descriptor of the data in the buffer. -1 if empty
+static uint32_t write_behind_offset = 0;     // Offset in the file of the first byte of the buffer
+static uint32_t write_behind_bytes = 0;      // Bytes pending to write
+static uint32_t write_behind_limit = 0;      // Bytes that fit in the buffer before flushing. Ends in a cluster boundary
+static uint32_t write_behind_last_ms = 0;    // Time of the last write added to the buffer
 
 // Structures to store the file descriptors
 static FileDescriptors *fdescriptors = NULL; // Initialize the head of the list to NULL
 static PD *pexec_pd = NULL;
 static ExecHeader *pexec_exec_header = NULL;
 
+// Free space of the volume. FatFs keeps the count of free clusters updated once it knows it, so the
+// FAT is counted when idle, a few sectors at a time, and Dfree answers from RAM
+static bool dfree_seeded = false;
+static bool dfree_scanning = false;      // A count of the free clusters is in progress
+static uint32_t dfree_scan_sector = 0;   // Next sector of the FAT, or of the exFAT bitmap, to count
+static uint32_t dfree_scan_free = 0;     // Free clusters counted so far
+static uint32_t dfree_last_scan_ms = 0;  // Time of the end of the last count
+static BYTE dfree_scan_buffer[FF_MAX_SS];
+
+// Relocation of the programs launched with Pexec. The BSS is still cleared by the ST: the cartridge
+// port is read only, so there is no way to fill the RAM of the ST from here
+static PexecRelocation pexec_reloc = {0};
+static int pexec_candidate_fd = -1; // Last file descriptor whose first bytes were a PRG header
+static bool pexec_header_saved = false;
+static bool pexec_basepage_saved = false;
+
+// Copy, move or delete of files and folders running in the RP2040. The ST polls the progress
+static FileOperation fileop = {0};
+// File operation requested from the web interface. The main loop starts it when the ST is idle
+static FileOperationRequest fileop_request = {0};
+
 // Y2K patch
 static bool y2k_patch_enabled = false;
 
@@ -66,174 +119,561 @@ static void __not_in_flash_func(nullify_dta)(uint32_t memory_shared_address)
     memset((void *)(memory_shared_address + GEMDRVEMUL_DTA_TRANSFER), 0, DTA_SIZE_ON_ST);
 }
 
-// Hash function
+// Hash function. DTA addresses are always even, so ignore the lowest bit
 static unsigned int __not_in_flash_func(hash)(uint32_t key)
 {
-    return key % DTA_HASH_TABLE_SIZE;
+    return (key >> 1) % DTA_HASH_TABLE_SIZE;
 }
 
-// Insert function
-static void __not_in_flash_func(insertDTA)(uint32_t key, DTA data, DIR *dj, FILINFO *fno, uint32_t attribs)
+// Remove a slot from its hash bucket
+static void __not_in_flash_func(unlinkDTA)(DTANode *node)
 {
-    unsigned int index = hash(key);
-    DTANode *newNode = malloc(sizeof(DTANode));
-    if (newNode == NULL)
+    unsigned int index = hash(node->key);
+    uint8_t slot = (uint8_t)(node - dtaPool) + 1;
+    uint8_t *link = &dtaTbl[index];
+    while (*link != 0)
     {
-        // Handle allocation error
-        return;
+        if (*link == slot)
+        {
+            *link = node->next;
+            break;
+        }
+        link = &dtaPool[*link - 1].next;
     }
+    node->next = 0;
+}
 
-    newNode->key = key;
-    newNode->data = data;
-    newNode->dj = dj;
-    newNode->fno = fno;
-    newNode->attribs = attribs;
-    // To copy the content of pat from dj to newNode:
-    if (dj->pat != NULL)
+// Close the search of a slot (if any) and return it to the pool
+static void __not_in_flash_func(freeDTA)(DTANode *node)
+{
+    if (node->dj != NULL)
+    {
+        f_closedir(node->dj); // Close the directory
+    }
+    unlinkDTA(node);
+    node->dj = NULL;
+    node->fno = NULL;
+    node->pat = NULL;
+    node->in_use = false;
+    dtaLive--;
+}
+
+// Get a free slot from the pool. If the pool is full, evict the least recently used DTA
+static DTANode *__not_in_flash_func(acquireDTA)()
+{
+    DTANode *lru = NULL;
+    for (int i = 0; i < DTA_POOL_SIZE; i++)
     {
-        newNode->pat = malloc(strlen(dj->pat) + 1); // +1 for the null terminator
-        if (newNode->pat != NULL)
+        DTANode *node = &dtaPool[i];
+        if (!node->in_use)
         {
-            strcpy(newNode->pat, dj->pat);
+            return node;
         }
-        else
+        if ((lru == NULL) || (node->last_used < lru->last_used))
         {
-            DPRINTF("Memory allocation failed for newNode->pat\n");
+            lru = node;
         }
     }
-    else
+    DPRINTF("DTA pool full. Evicting DTA at %x\n", lru->key);
+    freeDTA(lru);
+    dtaEvicted++;
+    return lru;
+}
+
+// Insert function. If the key already exists, its slot is reset and reused
+static DTANode *__not_in_flash_func(insertDTA)(uint32_t key, DTA data, uint32_t attribs)
+{
+    unsigned int index = hash(key);
+    uint8_t slot = dtaTbl[index];
+    while ((slot != 0) && (dtaPool[slot - 1].key != key))
     {
-        newNode->pat = NULL;
+        slot = dtaPool[slot - 1].next;
     }
-    newNode->next = NULL;
-
-    if (dtaTbl[index] == NULL)
+    DTANode *newNode = NULL;
+    if (slot != 0)
     {
-        dtaTbl[index] = newNode;
+        newNode = &dtaPool[slot - 1];
+        if (newNode->dj != NULL)
+        {
+            f_closedir(newNode->dj); // Close the previous search
+        }
     }
     else
     {
-        // Handle collision with separate chaining
+        newNode = acquireDTA();
+        newNode->key = key;
+        newNode->in_use = true;
         newNode->next = dtaTbl[index];
-        dtaTbl[index] = newNode;
+        dtaTbl[index] = (uint8_t)(newNode - dtaPool) + 1;
+        dtaLive++;
     }
+    newNode->data = data;
+    newNode->attribs = attribs;
+    newNode->dj = NULL;
+    newNode->fno = NULL;
+    newNode->pat = NULL;
+    newNode->pat_buf[0] = '\0';
+    newNode->cached = false;
+    newNode->last_used = ++dtaTick;
+    return newNode;
 }
 
 // Lookup function
 static DTANode *__not_in_flash_func(lookupDTA)(uint32_t key)
 {
-    unsigned int index = hash(key);
-    DTANode *current = dtaTbl[index];
-    DTANode *new_current = NULL;
-
-    while (current != NULL)
+    uint8_t slot = dtaTbl[hash(key)];
+    while (slot != 0)
     {
+        DTANode *current = &dtaPool[slot - 1];
         if (current->key == key)
         {
-            new_current = current;
-            new_current->dj->pat = current->pat;
+            current->last_used = ++dtaTick;
+            DPRINTF("Returning DTA key: %x\n", current->key);
+            return current;
         }
-        DPRINTF("DTA key: %x, filinfo_fname: %s, dir_obj: %x, pattern: %s\n", current->key, current->fno->fname, (void *)current->dj, current->dj->pat);
-        current = current->next;
+        slot = current->next;
+    }
+    DPRINTF("DTA key: %x not found\n", key);
+    return NULL;
+}
+
+// Release function
+static void __not_in_flash_func(releaseDTA)(uint32_t key)
+{
+    DTANode *current = lookupDTA(key);
+    if (current != NULL)
+    {
+        freeDTA(current);
+    }
+}
+
+// Count the number of elements in the hash table
+unsigned int __not_in_flash_func(countDTA)()
+{
+    return dtaLive;
+}
+
+// Initialize the hash table
+static void __not_in_flash_func(initializeDTAHashTable)()
+{
+    memset(dtaTbl, 0, sizeof(dtaTbl));
+    for (int i = 0; i < DTA_POOL_SIZE; ++i)
+    {
+        dtaPool[i].in_use = false;
+        dtaPool[i].dj = NULL;
+        dtaPool[i].fno = NULL;
+        dtaPool[i].pat = NULL;
+        dtaPool[i].next = 0;
+    }
+    dtaTick = 0;
+    dtaLive = 0;
+}
+
+// Clean the hash table
+static void __not_in_flash_func(cleanDTAHashTable)()
+{
+    for (int i = 0; i < DTA_POOL_SIZE; ++i)
+    {
+        if (dtaPool[i].in_use && (dtaPool[i].dj != NULL))
+        {
+            f_closedir(dtaPool[i].dj); // Close the directory
+        }
+    }
+    DPRINTF("DTA pool cleaned. Live: %d, evicted since last clean: %d\n", dtaLive, dtaEvicted);
+    initializeDTAHashTable();
+    dtaEvicted = 0;
+}
+
+// Normalize a path to compare it with the directory snapshots: forward slashes,
+// no duplicated slashes and no trailing slash
+static bool __not_in_flash_func(dircache_normalize)(const char *path, char *normalized)
+{
+    if (strlen(path) >= MAX_FOLDER_LENGTH)
+    {
+        return false;
     }
-    if (new_current == NULL)
+    strcpy(normalized, path);
+    back_2_forwardslash(normalized);
+    remove_dup_slashes(normalized);
+    size_t len = strlen(normalized);
+    while (len > 1 && normalized[len - 1] == '/')
     {
-        DPRINTF("DTA key: %x not found\n", key);
+        normalized[--len] = '\0';
+    }
+    return true;
+}
+
+// Invalidate the snapshot of a directory, if any
+static void __not_in_flash_func(dircache_invalidate)(const char *dir_path)
+{
+    char normalized[MAX_FOLDER_LENGTH];
+    if (!dircache_normalize(dir_path, normalized))
+    {
+        return;
+    }
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+    {
+        if (dirCache[i].valid && (strcasecmp(dirCache[i].path, normalized) == 0))
+        {
+            DPRINTF("Directory snapshot %s invalidated\n", dirCache[i].path);
+            dirCache[i].valid = false;
+        }
+    }
+    for (int i = 0; i < DIR_CACHE_LARGE_SLOTS; i++)
+    {
+        if (dirCacheLarge[i].valid && (strcasecmp(dirCacheLarge[i].path, normalized) == 0))
+        {
+            dirCacheLarge[i].valid = false;
+        }
+    }
+}
+
+// Invalidate the snapshot of the directory containing a file or folder
+static void __not_in_flash_func(dircache_invalidate_parent)(const char *fullpath)
+{
+    char parent[MAX_FOLDER_LENGTH];
+    if (!dircache_normalize(fullpath, parent))
+    {
+        return;
+    }
+    char *slash = strrchr(parent, '/');
+    if (slash == NULL)
+    {
+        return;
+    }
+    if (slash == parent)
+    {
+        slash[1] = '\0'; // The parent is the root folder
     }
     else
     {
-        DPRINTF("Returning DTA key: %x\n", new_current->key);
+        slash[0] = '\0';
     }
-    return new_current;
+    dircache_invalidate(parent);
 }
 
-// Release function
-static void __not_in_flash_func(releaseDTA)(uint32_t key)
+// Invalidate all the directory snapshots
+static void __not_in_flash_func(dircache_invalidate_all)()
 {
-    unsigned int index = hash(key);
-    DTANode *current = dtaTbl[index];
-    DTANode *prev = NULL;
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+    {
+        dirCache[i].valid = false;
+    }
+    for (int i = 0; i < DIR_CACHE_LARGE_SLOTS; i++)
+    {
+        dirCacheLarge[i].valid = false;
+    }
+}
 
-    while (current != NULL)
+// Modified date and time of a directory. Zero for the root, it has no directory entry
+static void __not_in_flash_func(dircache_stamp)(const char *path, uint16_t *fdate, uint16_t *ftime)
+{
+    FILINFO fno;
+    if (f_stat(path, &fno) == FR_OK)
     {
-        if (current->key == key)
+        *fdate = fno.fdate;
+        *ftime = fno.ftime;
+    }
+    else
+    {
+        *fdate = 0;
+        *ftime = 0;
+    }
+}
+
+// Check if a directory was too big for a snapshot and has not changed since then
+static bool __not_in_flash_func(dircache_is_large)(const char *normalized, uint16_t fdate, uint16_t ftime)
+{
+    for (int i = 0; i < DIR_CACHE_LARGE_SLOTS; i++)
+    {
+        DirCacheLarge *large = &dirCacheLarge[i];
+        if (large->valid && (strcasecmp(large->path, normalized) == 0))
         {
-            if (prev == NULL)
-            {
-                // The node to be deleted is the first node in the list
-                dtaTbl[index] = current->next;
-            }
-            else
+            if ((large->fdate != fdate) || (large->ftime != ftime))
             {
-                // The node to be deleted is not the first node
-                prev->next = current->next;
+                large->valid = false;
+                return false;
             }
-            if (current->dj != NULL)
+            large->last_used = ++dirCacheTick;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Remember a directory too big for a snapshot, replacing the least recently used
+static void __not_in_flash_func(dircache_mark_large)(const char *normalized, uint16_t fdate, uint16_t ftime)
+{
+    DirCacheLarge *victim = &dirCacheLarge[0];
+    for (int i = 0; i < DIR_CACHE_LARGE_SLOTS; i++)
+    {
+        if (!dirCacheLarge[i].valid)
+        {
+            victim = &dirCacheLarge[i];
+            break;
+        }
+        if (dirCacheLarge[i].last_used < victim->last_used)
+        {
+            victim = &dirCacheLarge[i];
+        }
+    }
+    strcpy(victim->path, normalized);
+    victim->fdate = fdate;
+    victim->ftime = ftime;
+    victim->last_used = ++dirCacheTick;
+    victim->valid = true;
+}
+
+// Name of a directory entry as the Atari ST sees it. FatFs keeps the 8.3 name of the entries with
+// a long name in altname. The entries without it (exFAT) are shortened
+static void __not_in_flash_func(st_fname)(const FILINFO *fno, char fname[14])
+{
+    if (fno->altname[0] != '\0')
+    {
+        snprintf(fname, 14, "%s", fno->altname);
+        return;
+    }
+    char upper_filename[14];
+    char filtered_filename[14];
+    filter_fname(fno->fname, filtered_filename);
+    upper_fname(filtered_filename, upper_filename);
+    shorten_fname(upper_filename, fname);
+}
+
+// Return the snapshot of a directory, reading the directory if it is not cached yet.
+// Returns NULL if the directory can't be read or it's too big to be cached
+static DirCache *__not_in_flash_func(dircache_get)(const char *dir_path)
+{
+    char normalized[MAX_FOLDER_LENGTH];
+    if (!dircache_normalize(dir_path, normalized))
+    {
+        return NULL;
+    }
+
+    DirCache *victim = NULL;
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+    {
+        DirCache *snapshot = &dirCache[i];
+        if (snapshot->valid && (strcasecmp(snapshot->path, normalized) == 0))
+        {
+            snapshot->last_used = ++dirCacheTick;
+            return snapshot;
+        }
+        // Prefer the invalid slots, then the least recently used
+        if ((victim == NULL) ||
+            (victim->valid && !snapshot->valid) ||
+            ((victim->valid == snapshot->valid) && (snapshot->last_used < victim->last_used)))
+        {
+            victim = snapshot;
+        }
+    }
+
+    // Do not read again a big directory only to find it's still too big
+    uint16_t fdate;
+    uint16_t ftime;
+    dircache_stamp(normalized, &fdate, &ftime);
+    if (dircache_is_large(normalized, fdate, ftime))
+    {
+        return NULL;
+    }
+
+    DIR dj;
+    FILINFO fno;
+    FRESULT fr = f_opendir(&dj, normalized);
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not open directory %s to take a snapshot (%d)\n", normalized, fr);
+        return NULL;
+    }
+    victim->valid = false;
+    victim->generation = ++dirCacheGeneration;
+    victim->count = 0;
+    bool complete = true;
+    bool large = false;
+    while (true)
+    {
+        fr = f_readdir(&dj, &fno);
+        if (fr != FR_OK)
+        {
+            complete = false;
+            break;
+        }
+        if (fno.fname[0] == '\0')
+        {
+            break; // No more entries
+        }
+        if (fno.fname[0] == '.')
+        {
+            continue; // Ignore the dot entries and the hidden files of other systems
+        }
+        if (victim->count >= DIR_CACHE_MAX_ENTRIES)
+        {
+            complete = false;
+            large = true;
+            break;
+        }
+        DirCacheEntry *entry = &victim->entries[victim->count++];
+        st_fname(&fno, entry->fname);
+        entry->fattrib = fno.fattrib;
+        entry->st_attribs = attribs_fat2st(fno.fattrib);
+        entry->fdate = fno.fdate;
+        entry->ftime = fno.ftime;
+        entry->fsize = (uint32_t)fno.fsize;
+    }
+    f_closedir(&dj);
+    if (!complete)
+    {
+        DPRINTF("Directory %s not cached. Too many entries or read error (%d)\n", normalized, fr);
+        if (large)
+        {
+            dircache_mark_large(normalized, fdate, ftime);
+        }
+        return NULL;
+    }
+    strcpy(victim->path, normalized);
+    victim->valid = true;
+    victim->last_used = ++dirCacheTick;
+    DPRINTF("Directory snapshot %s taken with %d entries\n", victim->path, victim->count);
+    return victim;
+}
+
+// Expand a 8.3 name or pattern to the 11 characters of a directory entry.
+// A '*' fills the rest of the name or the extension with '?'
+static void __not_in_flash_func(expand_fname_83)(const char *name, char expanded[11])
+{
+    memset(expanded, ' ', 11);
+    int pos = 0;
+    int limit = 8;
+    for (const char *p = name; *p != '\0'; p++)
+    {
+        if (*p == '.')
+        {
+            if (limit == 11)
             {
-                f_closedir(current->dj); // Close the directory
-                free(current->dj);       // Free the memory of the DIR
+                break; // Only one extension is allowed
             }
-            if (current->fno != NULL)
+            pos = 8;
+            limit = 11;
+        }
+        else if (*p == '*')
+        {
+            while (pos < limit)
             {
-                free(current->fno); // Free the memory of the FILINFO
+                expanded[pos++] = '?';
             }
-            free(current->pat); // Free the memory of the pat
-            free(current);      // Free the memory of the node
-            return;
         }
+        else if (pos < limit)
+        {
+            expanded[pos++] = toupper((unsigned char)*p);
+        }
+    }
+}
 
-        prev = current;
-        current = current->next;
+// Match a filename with a pattern as TOS does: name and extension are compared
+// separately and a '?' matches any character, including the padding
+static bool __not_in_flash_func(match_fname_tos)(const char *pattern, const char *fname)
+{
+    char pattern_83[11];
+    char fname_83[11];
+    expand_fname_83(pattern, pattern_83);
+    expand_fname_83(fname, fname_83);
+    for (int i = 0; i < 11; i++)
+    {
+        if ((pattern_83[i] != '?') && (pattern_83[i] != fname_83[i]))
+        {
+            return false;
+        }
     }
+    return true;
 }
 
-// Count the number of elements in the hash table
-unsigned int __not_in_flash_func(countDTA)()
+// Look for the next entry of the directory snapshot matching the search of the DTA and
+// leave it in the FILINFO of the DTA, as populate_dta() expects
+static bool __not_in_flash_func(dircache_next)(DTANode *node)
 {
-    unsigned int totalCount = 0;
-    for (int i = 0; i < DTA_HASH_TABLE_SIZE; i++)
+    DirCache *snapshot = &dirCache[node->cache_slot];
+    if (snapshot->generation != node->cache_gen)
+    {
+        // The slot has been reused since the search started. Take a new snapshot
+        // and continue after the last entry returned
+        snapshot = dircache_get(node->cache_path);
+        if (snapshot == NULL)
+        {
+            return false;
+        }
+        uint16_t pos = node->cache_pos;
+        for (uint16_t i = 0; i < snapshot->count; i++)
+        {
+            if ((node->fno != NULL) && (strcmp(snapshot->entries[i].fname, node->fno->fname) == 0))
+            {
+                pos = i + 1;
+                break;
+            }
+        }
+        node->cache_slot = (uint8_t)(snapshot - dirCache);
+        node->cache_gen = snapshot->generation;
+        node->cache_pos = pos < snapshot->count ? pos : snapshot->count;
+    }
+    while (node->cache_pos < snapshot->count)
     {
-        DTANode *currentNode = dtaTbl[i];
-        while (currentNode != NULL)
+        DirCacheEntry *entry = &snapshot->entries[node->cache_pos++];
+        if ((entry->st_attribs & node->attribs) && match_fname_tos(node->pat, entry->fname))
         {
-            totalCount++;
-            currentNode = currentNode->next;
+            strcpy(node->fno_obj.fname, entry->fname);
+            node->fno_obj.fattrib = entry->fattrib;
+            node->fno_obj.fdate = entry->fdate;
+            node->fno_obj.ftime = entry->ftime;
+            node->fno_obj.fsize = entry->fsize;
+            node->fno = &node->fno_obj;
+            return true;
         }
     }
-    return totalCount;
+    return false;
 }
-// Initialize the hash table
-static void __not_in_flash_func(initializeDTAHashTable)()
+
+// Forget all the converted paths
+static void __not_in_flash_func(pathcache_clear)()
 {
-    for (int i = 0; i < DTA_HASH_TABLE_SIZE; ++i)
+    for (int i = 0; i < PATH_CACHE_SLOTS; i++)
     {
-        dtaTbl[i] = NULL;
+        pathCache[i].valid = false;
     }
 }
 
-// Clean the hash table
-static void __not_in_flash_func(cleanDTAHashTable)()
+// Return the internal path of a path sent by the Atari ST, if it was converted recently
+static PathCacheEntry *__not_in_flash_func(pathcache_lookup)(const char *st_path)
 {
-    for (int i = 0; i < DTA_HASH_TABLE_SIZE; ++i)
+    for (int i = 0; i < PATH_CACHE_SLOTS; i++)
     {
-        DTANode *currentNode = dtaTbl[i];
-        while (currentNode != NULL)
+        if (pathCache[i].valid && (strcmp(pathCache[i].st_path, st_path) == 0))
         {
-            DTANode *nextNode = currentNode->next;
-            if (currentNode->dj != NULL)
-            {
-                f_closedir(currentNode->dj); // Close the directory
-                free(currentNode->dj);       // Free the memory of the DIR
-            }
-            if (currentNode->fno != NULL)
-            {
-                free(currentNode->fno); // Free the memory of the FILINFO
-            }
-            free(currentNode); // Free the memory of the node
-            currentNode = nextNode;
+            pathCache[i].last_used = ++pathCacheTick;
+            return &pathCache[i];
+        }
+    }
+    return NULL;
+}
+
+// Keep the internal path of a path sent by the Atari ST, replacing the least recently used
+static void __not_in_flash_func(pathcache_store)(const char *st_path, const char *real_path)
+{
+    PathCacheEntry *victim = &pathCache[0];
+    for (int i = 0; i < PATH_CACHE_SLOTS; i++)
+    {
+        if (!pathCache[i].valid)
+        {
+            victim = &pathCache[i];
+            break;
+        }
+        if (pathCache[i].last_used < victim->last_used)
+        {
+            victim = &pathCache[i];
         }
-        dtaTbl[i] = NULL;
     }
+    snprintf(victim->st_path, sizeof(victim->st_path), "%s", st_path);
+    snprintf(victim->real_path, sizeof(victim->real_path), "%s", real_path);
+    victim->last_used = ++pathCacheTick;
+    victim->valid = true;
 }
 
 static void __not_in_flash_func(seach_path_2_st)(const char *fspec_str, char *internal_path, char *path_forwardslash, char *name_pattern)
@@ -379,47 +819,1288 @@ static void __not_in_flash_func(add_file)(FileDescriptors **head, FileDescriptor
     newFDescriptor->fobject = fobject;
     newFDescriptor->fd = new_fd;
     newFDescriptor->offset = 0;
+    newFDescriptor->last_read_end = 0;
+    newFDescriptor->sequential_reads = 0;
+    newFDescriptor->write_error = FR_OK;
     newFDescriptor->next = *head;
     *head = newFDescriptor;
     DPRINTF("File %s added with fd %i\n", fpath, new_fd);
 }
 
-static void __not_in_flash_func(print_file_descriptors)(FileDescriptors *head)
+static void __not_in_flash_func(print_file_descriptors)(FileDescriptors *head)
+{
+    FileDescriptors *current = head;
+    while (current != NULL)
+    {
+        DPRINTF("File descriptor: %i - File path: %s\n", current->fd, current->fpath);
+        current = current->next;
+    }
+}
+
+static FileDescriptors *__not_in_flash_func(get_file_by_fpath)(FileDescriptors *head, const char *fpath)
+{
+    while (head != NULL)
+    {
+        if (strcmp(head->fpath, fpath) == 0)
+        {
+            return head;
+        }
+        head = head->next;
+    }
+    return NULL;
+}
+
+static FileDescriptors *__not_in_flash_func(get_file_by_fdesc)(FileDescriptors *head, uint16_t fd)
+{
+    while (head != NULL)
+    {
+        DPRINTF("Comparing %i with %i\n", head->fd, fd);
+        if (head->fd == fd)
+        {
+            DPRINTF("File descriptor found. Returning %i\n", head->fd);
+            return head;
+        }
+        head = head->next;
+    }
+    return NULL;
+}
+
+// Check if the read-ahead window holds the requested bytes of the file
+static bool __not_in_flash_func(read_ahead_covers)(int fd, uint32_t offset, uint32_t size)
+{
+    if ((read_ahead_fd < 0) || (read_ahead_fd != fd) || (offset < read_ahead_offset))
+    {
+        return false;
+    }
+    uint32_t window_end = read_ahead_offset + read_ahead_bytes;
+    if (offset + size <= window_end)
+    {
+        return true;
+    }
+    // A window shorter than the buffer means the end of the file was reached when prefetching
+    return (read_ahead_bytes < DEFAULT_FOPEN_READ_BUFFER_SIZE) && (offset <= window_end);
+}
+
+// Discard the read-ahead data of a file descriptor. -1 discards everything
+static void __not_in_flash_func(read_ahead_invalidate)(int fd)
+{
+    if ((fd < 0) || (read_ahead_fd == fd))
+    {
+        read_ahead_fd = -1;
+        read_ahead_bytes = 0;
+    }
+    if ((fd < 0) || (read_ahead_pending_fd == fd))
+    {
+        read_ahead_pending_fd = -1;
+    }
+}
+
+// Read the next chunk of the file in the read-ahead window. Called when no command is pending
+static void __not_in_flash_func(read_ahead_prefetch)(uint32_t memory_shared_address)
+{
+    int fd = read_ahead_pending_fd;
+    uint32_t offset = read_ahead_pending_offset;
+    read_ahead_pending_fd = -1;
+    read_ahead_fd = -1;
+    read_ahead_bytes = 0;
+    FileDescriptors *file = get_file_by_fdesc(fdescriptors, fd);
+    if (file == NULL)
+    {
+        return;
+    }
+    UINT bytes_read = 0;
+    FRESULT fr = f_lseek(&file->fobject, offset);
+    if (fr == FR_OK)
+    {
+        fr = f_read(&file->fobject, (void *)(memory_shared_address + GEMDRVEMUL_READ_AHEAD_BUFF), DEFAULT_FOPEN_READ_BUFFER_SIZE, &bytes_read);
+    }
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not prefetch file with fd %i (%d)\n", fd, fr);
+        return;
+    }
+    read_ahead_fd = fd;
+    read_ahead_offset = offset;
+    read_ahead_bytes = bytes_read;
+    DPRINTF("Prefetched x%x bytes of fd %i at offset x%x\n", bytes_read, fd, offset);
+}
+
+// Start the count of the free clusters again. The clusters counted so far could have changed
+static void dfree_scan_restart(void)
+{
+    dfree_scan_sector = 0;
+    dfree_scan_free = 0;
+}
+
+// True if the command can allocate or free clusters of the volume
+static bool dfree_command_changes_fat(uint16_t command_id)
+{
+    return (command_id == GEMDRVEMUL_WRITE_BUFF_CALL) || (command_id == GEMDRVEMUL_FCLOSE_CALL) ||
+           (command_id == GEMDRVEMUL_FCREATE_CALL) || (command_id == GEMDRVEMUL_FDELETE_CALL) ||
+           (command_id == GEMDRVEMUL_DCREATE_CALL) || (command_id == GEMDRVEMUL_DDELETE_CALL) ||
+           (command_id == GEMDRVEMUL_FRENAME_CALL);
+}
+
+// End the count of the free clusters. Do not count again until the next interval, even if it failed.
+// Dfree would count them anyway
+static void dfree_scan_end(void)
+{
+    dfree_scanning = false;
+    dfree_seeded = true;
+    dfree_last_scan_ms = to_ms_since_boot(get_absolute_time());
+}
+
+// Count the free clusters of the volume, DFREE_SCAN_SECTORS sectors of the FAT in each call, so the
+// commands of the ST are not stalled. When the count ends FatFs takes it and keeps it updated as
+// clusters are allocated and freed
+static void __not_in_flash_func(dfree_scan)(FATFS *fs)
+{
+    if (!dfree_scanning)
+    {
+        dfree_scan_restart();
+        dfree_scanning = true;
+    }
+    if (fs->fs_type == FS_FAT12)
+    {
+        // The entries cross the sector boundaries, but the FAT is only a few sectors long
+        DWORD fre_clust = 0;
+        FRESULT fr = f_getfree(hd_folder, &fre_clust, &fs);
+        DPRINTF("Free clusters: %d (%d)\n", fre_clust, fr);
+        dfree_scan_end();
+        return;
+    }
+    // Entries of the FAT, or bits of the exFAT bitmap, in each sector
+    uint32_t per_sector = (fs->fs_type == FS_FAT16) ? FF_MAX_SS / 2 : ((fs->fs_type == FS_FAT32) ? FF_MAX_SS / 4 : FF_MAX_SS * 8);
+    // The FAT has an entry for every cluster plus the two reserved ones. The bitmap only the clusters
+    uint32_t entries = (fs->fs_type == FS_EXFAT) ? fs->n_fatent - 2 : fs->n_fatent;
+    uint32_t total_sectors = (entries + per_sector - 1) / per_sector;
+#if FF_FS_EXFAT
+    LBA_t base = (fs->fs_type == FS_EXFAT) ? fs->bitbase : fs->fatbase;
+#else
+    LBA_t base = fs->fatbase;
+#endif
+    for (int n = 0; (n < DFREE_SCAN_SECTORS) && (dfree_scan_sector < total_sectors); n++, dfree_scan_sector++)
+    {
+        LBA_t sector = base + dfree_scan_sector;
+        const BYTE *data = dfree_scan_buffer;
+        if (fs->winsect == sector)
+        {
+            // FatFs could have changes of this sector not written yet
+            data = fs->win;
+        }
+        else if (disk_read(fs->pdrv, dfree_scan_buffer, sector, 1) != RES_OK)
+        {
+            DPRINTF("ERROR: Could not read the sector %d counting the free clusters\n", (uint32_t)sector);
+            dfree_scan_end();
+            return;
+        }
+        uint32_t first = dfree_scan_sector * per_sector;
+        for (uint32_t i = 0; (i < per_sector) && (first + i < entries); i++)
+        {
+            bool free_cluster;
+            if (fs->fs_type == FS_FAT16)
+            {
+                free_cluster = (first + i >= 2) && (data[i * 2] == 0) && (data[i * 2 + 1] == 0);
+            }
+            else if (fs->fs_type == FS_FAT32)
+            {
+                free_cluster = (first + i >= 2) && (data[i * 4] == 0) && (data[i * 4 + 1] == 0) && (data[i * 4 + 2] == 0) && ((data[i * 4 + 3] & 0x0F) == 0);
+            }
+            else
+            {
+                free_cluster = (data[i / 8] & (1 << (i % 8))) == 0;
+            }
+            if (free_cluster)
+            {
+                dfree_scan_free++;
+            }
+        }
+    }
+    if (dfree_scan_sector >= total_sectors)
+    {
+        fs->free_clst = dfree_scan_free;
+        fs->fsi_flag |= 1;
+        DPRINTF("Free clusters: %d\n", dfree_scan_free);
+        dfree_scan_end();
+    }
+}
+
+// Drop the pending bytes of the write-behind buffer
+static void __not_in_flash_func(write_behind_discard)(void)
+{
+    write_behind_fd = -1;
+    write_behind_bytes = 0;
+}
+
+// Write the pending bytes of the write-behind buffer to the file. If the write fails the bytes
+// stay in the buffer and the error is latched in the file, to report it in its next Fwrite,
+// Fseek or Fclose
+static FRESULT __not_in_flash_func(write_behind_flush)(uint32_t memory_shared_address, bool sync)
+{
+    if (write_behind_fd < 0)
+    {
+        return FR_OK;
+    }
+    int fd = write_behind_fd;
+    FileDescriptors *file = get_file_by_fdesc(fdescriptors, fd);
+    if (file == NULL)
+    {
+        DPRINTF("ERROR: Discarding x%x pending bytes of unknown fd %i\n", write_behind_bytes, fd);
+        write_behind_discard();
+        return FR_INVALID_OBJECT;
+    }
+    UINT bytes_write = 0;
+    dfree_scan_restart();
+    FRESULT fr = f_lseek(&file->fobject, write_behind_offset);
+    if (fr == FR_OK)
+    {
+        fr = f_write(&file->fobject, (void *)(memory_shared_address + GEMDRVEMUL_WRITE_BEHIND_BUFF), write_behind_bytes, &bytes_write);
+    }
+    if ((fr == FR_OK) && (bytes_write < write_behind_bytes))
+    {
+        // The volume is full
+        fr = FR_DENIED;
+    }
+    if ((fr == FR_OK) && sync)
+    {
+        fr = f_sync(&file->fobject);
+    }
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not flush x%x bytes of fd %i at offset x%x (%d)\n", write_behind_bytes, fd, write_behind_offset, fr);
+        file->write_error = fr;
+        // Do not try again in every loop if the ST is idle
+        write_behind_last_ms = to_ms_since_boot(get_absolute_time());
+        return fr;
+    }
+    DPRINTF("Flushed x%x bytes of fd %i at offset x%x\n", bytes_write, fd, write_behind_offset);
+    write_behind_discard();
+    // The size and date of the file change
+    dircache_invalidate_parent(file->fpath);
+    return FR_OK;
+}
+
+// Keep the bytes written at the current offset of the file in the write-behind buffer
+static FRESULT __not_in_flash_func(write_behind_write)(uint32_t memory_shared_address, FileDescriptors *file, const void *data, uint32_t size)
+{
+    uint32_t offset = file->offset;
+    // The ST sends the same chunk again if the checksum fails, so overwriting buffered bytes is allowed
+    bool fits = (write_behind_fd == file->fd) && (offset >= write_behind_offset) &&
+                (offset <= write_behind_offset + write_behind_bytes) &&
+                (offset + size <= write_behind_offset + write_behind_limit);
+    if (file->write_error != FR_OK)
+    {
+        // A previous flush of this file failed
+        FRESULT fr = file->write_error;
+        file->write_error = FR_OK;
+        return fr;
+    }
+    if (!fits)
+    {
+        FRESULT fr = write_behind_flush(memory_shared_address, false);
+        if ((fr != FR_OK) && (write_behind_fd == file->fd))
+        {
+            file->write_error = FR_OK;
+            return fr;
+        }
+        if (fr != FR_OK)
+        {
+            // The buffer is needed for this file. The bytes of the other file are lost
+            // and the error stays latched in it
+            write_behind_discard();
+        }
+        // End the buffer in a cluster boundary, so FatFs writes full clusters without its sector window
+        uint32_t align = (uint32_t)file->fobject.obj.fs->csize * FF_MAX_SS;
+        if ((align == 0) || (align > WRITE_BEHIND_BUFFER_SIZE))
+        {
+            align = WRITE_BEHIND_BUFFER_SIZE;
+        }
+        uint32_t limit_end = ((offset + WRITE_BEHIND_BUFFER_SIZE) / align) * align;
+        if (limit_end < offset + size)
+        {
+            limit_end = offset + WRITE_BEHIND_BUFFER_SIZE;
+        }
+        write_behind_fd = file->fd;
+        write_behind_offset = offset;
+        write_behind_bytes = 0;
+        write_behind_limit = limit_end - offset;
+    }
+    uint32_t buff_pos = offset - write_behind_offset;
+    memcpy((void *)(memory_shared_address + GEMDRVEMUL_WRITE_BEHIND_BUFF + buff_pos), data, size);
+    if (buff_pos + size > write_behind_bytes)
+    {
+        write_behind_bytes = buff_pos + size;
+    }
+    write_behind_last_ms = to_ms_since_boot(get_absolute_time());
+    if (write_behind_bytes >= write_behind_limit)
+    {
+        return write_behind_flush(memory_shared_address, false);
+    }
+    return FR_OK;
+}
+
+// Translate the FatFs errors of the file operations to GEMDOS errors
+static int32_t __not_in_flash_func(fileop_error)(FRESULT fr)
+{
+    switch (fr)
+    {
+    case FR_OK:
+        return GEMDOS_EOK;
+    case FR_NO_FILE:
+        return GEMDOS_EFILNF;
+    case FR_NO_PATH:
+    case FR_INVALID_NAME:
+        return GEMDOS_EPTHNF;
+    case FR_DENIED:
+    case FR_EXIST:
+    case FR_LOCKED:
+        return GEMDOS_EACCDN;
+    case FR_WRITE_PROTECTED:
+        return GEMDOS_EWRPRO;
+    case FR_NOT_ENOUGH_CORE:
+        return GEMDOS_ENSMEM;
+    case FR_TOO_MANY_OPEN_FILES:
+        return GEMDOS_ENHNDL;
+    default:
+        return GEMDOS_EINTRN;
+    }
+}
+
+// Show the progress of the file operation to the ST
+static void __not_in_flash_func(fileop_show)(uint32_t memory_shared_address, int32_t status)
+{
+    *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_FILEOP_FILES)) = SWAP_LONGWORD(fileop.files);
+    *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_FILEOP_BYTES)) = SWAP_LONGWORD(fileop.bytes);
+    *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_FILEOP_STATUS)) = SWAP_LONGWORD(status);
+    fileop.status = status;
+}
+
+// Add a name to a path of the file operation. False if it does not fit
+static bool __not_in_flash_func(fileop_append)(char *path, const char *name)
+{
+    size_t len = strlen(path);
+    return snprintf(path + len, FILEOP_PATH_LENGTH - len, "/%s", name) < (int)(FILEOP_PATH_LENGTH - len);
+}
+
+// Go back to the folder being walked after processing one of its entries
+static void __not_in_flash_func(fileop_truncate)()
+{
+    if (fileop.depth > 0)
+    {
+        fileop.src_path[fileop.src_len[fileop.depth - 1]] = '\0';
+        fileop.dst_path[fileop.dst_len[fileop.depth - 1]] = '\0';
+    }
+}
+
+// Open the folder in src_path and walk it next
+static FRESULT __not_in_flash_func(fileop_push)()
+{
+    FRESULT fr = f_opendir(&fileop.dirs[fileop.depth], fileop.src_path);
+    if (fr == FR_OK)
+    {
+        fileop.src_len[fileop.depth] = strlen(fileop.src_path);
+        fileop.dst_len[fileop.depth] = strlen(fileop.dst_path);
+        fileop.depth++;
+    }
+    return fr;
+}
+
+// Close the files and free the memory of the file operation. A copy not finished is deleted
+static void __not_in_flash_func(fileop_release)()
+{
+    if (fileop.file_open)
+    {
+        if (fileop.op != FILEOP_UNZIP)
+        {
+            f_close(&fileop.src);
+        }
+        f_close(&fileop.dst);
+        fileop.file_open = false;
+        f_unlink(fileop.dst_path);
+    }
+    while (fileop.depth > 0)
+    {
+        f_closedir(&fileop.dirs[--fileop.depth]);
+    }
+    if (fileop.buffer != NULL)
+    {
+        free(fileop.buffer);
+        fileop.buffer = NULL;
+    }
+    if (fileop.zstream != NULL)
+    {
+        zip_stream_close(fileop.zstream);
+        free(fileop.zstream);
+        fileop.zstream = NULL;
+    }
+    if (fileop.zip != NULL)
+    {
+        zip_close(fileop.zip);
+        free(fileop.zip);
+        fileop.zip = NULL;
+    }
+    fileop.op = FILEOP_NONE;
+}
+
+// Stop the file operation and show its result to the ST
+static void __not_in_flash_func(fileop_finish)(uint32_t memory_shared_address, int32_t status)
+{
+    fileop_release();
+    // Folders and files changed behind the back of the ST
+    dircache_invalidate_all();
+    read_ahead_invalidate(-1);
+    DPRINTF("File operation finished (%d). Files: %d, bytes: %d\n", status, fileop.files, fileop.bytes);
+    fileop_show(memory_shared_address, status);
+}
+
+// Open the file in src_path and its copy in dst_path
+static FRESULT __not_in_flash_func(fileop_open_copy)()
+{
+    FRESULT fr = f_open(&fileop.src, fileop.src_path, FA_READ);
+    if (fr != FR_OK)
+    {
+        return fr;
+    }
+    // Never replace an existing file: it would be deleted if the copy fails
+    fr = f_open(&fileop.dst, fileop.dst_path, FA_WRITE | FA_CREATE_NEW);
+    if (fr != FR_OK)
+    {
+        f_close(&fileop.src);
+        return fr;
+    }
+    fileop.file_open = true;
+    return FR_OK;
+}
+
+// Copy the next chunk of the file. The copy keeps the date, time and attributes of the original file
+static void __not_in_flash_func(fileop_copy_step)(uint32_t memory_shared_address)
+{
+    UINT bytes_read = 0;
+    UINT bytes_written = 0;
+    FRESULT fr = f_read(&fileop.src, fileop.buffer, FILEOP_BUFFER_SIZE, &bytes_read);
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not read %s (%d)\n", fileop.src_path, fr);
+        fileop_finish(memory_shared_address, GEMDOS_EREADF);
+        return;
+    }
+    if (bytes_read > 0)
+    {
+        fr = f_write(&fileop.dst, fileop.buffer, bytes_read, &bytes_written);
+        if ((fr != FR_OK) || (bytes_written < bytes_read))
+        {
+            // Writing less bytes than requested means the disk is full
+            DPRINTF("ERROR: Could not write %s (%d)\n", fileop.dst_path, fr);
+            fileop_finish(memory_shared_address, GEMDOS_EWRITF);
+            return;
+        }
+        fileop.bytes += bytes_written;
+    }
+    if (bytes_read == FILEOP_BUFFER_SIZE)
+    {
+        fileop_show(memory_shared_address, FILEOP_RUNNING);
+        return;
+    }
+    f_close(&fileop.src);
+    fr = f_close(&fileop.dst);
+    fileop.file_open = false;
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not close %s (%d)\n", fileop.dst_path, fr);
+        f_unlink(fileop.dst_path);
+        fileop_finish(memory_shared_address, GEMDOS_EWRITF);
+        return;
+    }
+    FILINFO fno;
+    if (f_stat(fileop.src_path, &fno) == FR_OK)
+    {
+        f_utime(fileop.dst_path, &fno);
+        f_chmod(fileop.dst_path, fno.fattrib, AM_RDO | AM_HID | AM_SYS | AM_ARC);
+    }
+    fileop.files++;
+    if (fileop.depth == 0)
+    {
+        // Copy of a single file
+        fileop_finish(memory_shared_address, GEMDOS_EOK);
+        return;
+    }
+    fileop_truncate();
+    fileop_show(memory_shared_address, FILEOP_RUNNING);
+}
+
+// Create the folders of a path extracted from a ZIP archive. The folders up to from already exist
+static FRESULT __not_in_flash_func(fileop_mkdirs)(char *path, size_t from, bool last)
+{
+    FRESULT fr = FR_OK;
+    for (char *p = path + from + 1; (fr == FR_OK) && (*p != '\0'); p++)
+    {
+        if (*p == '/')
+        {
+            *p = '\0';
+            fr = f_mkdir(path);
+            *p = '/';
+            fr = (fr == FR_EXIST) ? FR_OK : fr;
+        }
+    }
+    if ((fr == FR_OK) && last)
+    {
+        fr = f_mkdir(path);
+        fr = (fr == FR_EXIST) ? FR_OK : fr;
+    }
+    return fr;
+}
+
+// Extract the next chunk of the entry being extracted, or start extracting the next entry of the archive
+static void __not_in_flash_func(fileop_unzip_step)(uint32_t memory_shared_address)
+{
+    if (fileop.file_open)
+    {
+        int bytes_read = zip_stream_read(fileop.zstream, fileop.buffer, FILEOP_BUFFER_SIZE);
+        if (bytes_read < 0)
+        {
+            fileop_finish(memory_shared_address, GEMDOS_EREADF);
+            return;
+        }
+        UINT bytes_written = 0;
+        FRESULT fr = (bytes_read > 0) ? f_write(&fileop.dst, fileop.buffer, bytes_read, &bytes_written) : FR_OK;
+        if ((fr != FR_OK) || (bytes_written < (UINT)bytes_read))
+        {
+            DPRINTF("ERROR: Could not write %s (%d)\n", fileop.dst_path, fr);
+            fileop_finish(memory_shared_address, GEMDOS_EWRITF);
+            return;
+        }
+        fileop.bytes += bytes_written;
+        if (bytes_read == FILEOP_BUFFER_SIZE)
+        {
+            fileop_show(memory_shared_address, FILEOP_RUNNING);
+            return;
+        }
+        zip_stream_close(fileop.zstream);
+        fr = f_close(&fileop.dst);
+        fileop.file_open = false;
+        if (fr != FR_OK)
+        {
+            DPRINTF("ERROR: Could not close %s (%d)\n", fileop.dst_path, fr);
+            f_unlink(fileop.dst_path);
+            fileop_finish(memory_shared_address, GEMDOS_EWRITF);
+            return;
+        }
+        fileop.files++;
+        fileop.dst_path[fileop.dst_len[0]] = '\0';
+        fileop_show(memory_shared_address, FILEOP_RUNNING);
+        return;
+    }
+    if (fileop.zip_entry >= fileop.zip->count)
+    {
+        fileop_finish(memory_shared_address, GEMDOS_EOK);
+        return;
+    }
+    int index = fileop.zip_entry++;
+    const char *name = fileop.zip->entries[index].name;
+    size_t name_len = strlen(name);
+    // Never write outside the destination folder
+    if ((name_len == 0) || (name[0] == '/') || (strstr(name, "..") != NULL))
+    {
+        DPRINTF("Skipping entry %s\n", name);
+        return;
+    }
+    bool is_folder = (name[name_len - 1] == '/');
+    if (!fileop_append(fileop.dst_path, name))
+    {
+        DPRINTF("ERROR: Path too long for %s\n", name);
+        fileop_finish(memory_shared_address, GEMDOS_ERANGE);
+        return;
+    }
+    if (is_folder)
+    {
+        fileop.dst_path[strlen(fileop.dst_path) - 1] = '\0';
+    }
+    FRESULT fr = fileop_mkdirs(fileop.dst_path, fileop.dst_len[0], is_folder);
+    if ((fr == FR_OK) && !is_folder)
+    {
+        fr = f_open(&fileop.dst, fileop.dst_path, FA_WRITE | FA_CREATE_NEW);
+        if (fr == FR_OK)
+        {
+            fr = zip_stream_open(fileop.zstream, fileop.zip, index);
+            if (fr != FR_OK)
+            {
+                f_close(&fileop.dst);
+                f_unlink(fileop.dst_path);
+            }
+        }
+        fileop.file_open = (fr == FR_OK);
+    }
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not extract %s (%d)\n", fileop.dst_path, fr);
+        fileop_finish(memory_shared_address, fileop_error(fr));
+        return;
+    }
+    if (is_folder)
+    {
+        fileop.files++;
+        fileop.dst_path[fileop.dst_len[0]] = '\0';
+    }
+    fileop_show(memory_shared_address, FILEOP_RUNNING);
+}
+
+// Run a step of the file operation: copy a chunk of a file or process an entry of a folder.
+// Called when no command is pending, so the ST is never kept waiting for more than a step
+static void __not_in_flash_func(fileop_step)(uint32_t memory_shared_address)
+{
+    if (fileop.op == FILEOP_UNZIP)
+    {
+        fileop_unzip_step(memory_shared_address);
+        return;
+    }
+    if (fileop.file_open)
+    {
+        fileop_copy_step(memory_shared_address);
+        return;
+    }
+    if (fileop.depth == 0)
+    {
+        fileop_finish(memory_shared_address, GEMDOS_EOK);
+        return;
+    }
+    FILINFO fno;
+    FRESULT fr = f_readdir(&fileop.dirs[fileop.depth - 1], &fno);
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not read folder %s (%d)\n", fileop.src_path, fr);
+        fileop_finish(memory_shared_address, fileop_error(fr));
+        return;
+    }
+    if (fno.fname[0] == '\0')
+    {
+        // End of the folder. Go back to the parent folder
+        f_closedir(&fileop.dirs[--fileop.depth]);
+        if (fileop.op == FILEOP_DELTREE)
+        {
+            // Now the folder is empty
+            fr = f_unlink(fileop.src_path);
+            if (fr != FR_OK)
+            {
+                DPRINTF("ERROR: Could not delete folder %s (%d)\n", fileop.src_path, fr);
+                fileop_finish(memory_shared_address, fileop_error(fr));
+                return;
+            }
+            fileop.files++;
+        }
+        if (fileop.depth == 0)
+        {
+            fileop_finish(memory_shared_address, GEMDOS_EOK);
+            return;
+        }
+        fileop_truncate();
+        fileop_show(memory_shared_address, FILEOP_RUNNING);
+        return;
+    }
+    if (!fileop_append(fileop.src_path, fno.fname) ||
+        ((fileop.op == FILEOP_COPY) && !fileop_append(fileop.dst_path, fno.fname)))
+    {
+        DPRINTF("ERROR: Path too long in %s\n", fileop.src_path);
+        fileop_finish(memory_shared_address, GEMDOS_ERANGE);
+        return;
+    }
+    if (fno.fattrib & AM_DIR)
+    {
+        if (fileop.depth >= FILEOP_MAX_DEPTH)
+        {
+            DPRINTF("ERROR: Too many nested folders in %s\n", fileop.src_path);
+            fileop_finish(memory_shared_address, GEMDOS_ERANGE);
+            return;
+        }
+        if (fileop.op == FILEOP_COPY)
+        {
+            fr = f_mkdir(fileop.dst_path);
+            if ((fr != FR_OK) && (fr != FR_EXIST))
+            {
+                DPRINTF("ERROR: Could not create folder %s (%d)\n", fileop.dst_path, fr);
+                fileop_finish(memory_shared_address, fileop_error(fr));
+                return;
+            }
+            fileop.files++;
+        }
+        fr = fileop_push();
+    }
+    else if (fileop.op == FILEOP_COPY)
+    {
+        fr = fileop_open_copy();
+    }
+    else
+    {
+        fr = f_unlink(fileop.src_path);
+        if (fr == FR_OK)
+        {
+            fileop.files++;
+            fileop_truncate();
+        }
+    }
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not process %s (%d)\n", fileop.src_path, fr);
+        fileop_finish(memory_shared_address, fileop_error(fr));
+        return;
+    }
+    fileop_show(memory_shared_address, FILEOP_RUNNING);
+}
+
+// Start a copy or a recursive delete. The paths are FatFs paths. dst_path is ignored when deleting
+static int32_t __not_in_flash_func(fileop_start)(uint8_t op, const char *src_path, const char *dst_path)
+{
+    if (fileop.op != FILEOP_NONE)
+    {
+        DPRINTF("ERROR: A file operation is already running\n");
+        return GEMDOS_EACCDN;
+    }
+    fileop.files = 0;
+    fileop.bytes = 0;
+    FILINFO fno;
+    FRESULT fr = f_stat(src_path, &fno);
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not find %s (%d)\n", src_path, fr);
+        return fileop_error(fr);
+    }
+    if ((op == FILEOP_DELTREE) && !(fno.fattrib & AM_DIR))
+    {
+        return GEMDOS_EPTHNF;
+    }
+    if (op == FILEOP_COPY)
+    {
+        // Never copy a folder into itself
+        size_t src_len = strlen(src_path);
+        if ((strncasecmp(src_path, dst_path, src_len) == 0) && ((dst_path[src_len] == '\0') || (dst_path[src_len] == '/')))
+        {
+            DPRINTF("ERROR: Cannot copy %s into %s\n", src_path, dst_path);
+            return GEMDOS_EACCDN;
+        }
+        fileop.buffer = malloc(FILEOP_BUFFER_SIZE);
+        if (fileop.buffer == NULL)
+        {
+            DPRINTF("ERROR: Not enough memory to copy\n");
+            return GEMDOS_ENSMEM;
+        }
+    }
+    snprintf(fileop.src_path, FILEOP_PATH_LENGTH, "%s", src_path);
+    snprintf(fileop.dst_path, FILEOP_PATH_LENGTH, "%s", dst_path);
+    fileop.depth = 0;
+    fileop.file_open = false;
+    if (!(fno.fattrib & AM_DIR))
+    {
+        fr = fileop_open_copy();
+    }
+    else
+    {
+        if (op == FILEOP_COPY)
+        {
+            fr = f_mkdir(fileop.dst_path);
+            fr = (fr == FR_EXIST) ? FR_OK : fr;
+            fileop.files = (fr == FR_OK) ? 1 : 0;
+        }
+        if (fr == FR_OK)
+        {
+            fr = fileop_push();
+        }
+    }
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not start the file operation on %s (%d)\n", src_path, fr);
+        if (fileop.buffer != NULL)
+        {
+            free(fileop.buffer);
+            fileop.buffer = NULL;
+        }
+        return fileop_error(fr);
+    }
+    fileop.op = op;
+    DPRINTF("File operation %d started on %s\n", op, src_path);
+    return FILEOP_RUNNING;
+}
+
+// Start the extraction of a ZIP archive into a folder, created if needed. The paths are FatFs paths
+static int32_t __not_in_flash_func(fileop_start_unzip)(const char *zip_path, const char *dst_path)
+{
+    if (fileop.op != FILEOP_NONE)
+    {
+        DPRINTF("ERROR: A file operation is already running\n");
+        return GEMDOS_EACCDN;
+    }
+    fileop.files = 0;
+    fileop.bytes = 0;
+    fileop.depth = 0;
+    fileop.file_open = false;
+    fileop.zip_entry = 0;
+    fileop.buffer = malloc(FILEOP_BUFFER_SIZE);
+    fileop.zip = calloc(1, sizeof(ZipArchive));
+    fileop.zstream = calloc(1, sizeof(ZipStream));
+    FRESULT fr = ((fileop.buffer == NULL) || (fileop.zip == NULL) || (fileop.zstream == NULL)) ? FR_NOT_ENOUGH_CORE : FR_OK;
+    if (fr == FR_OK)
+    {
+        fr = zip_open(fileop.zip, zip_path);
+    }
+    if (fr == FR_OK)
+    {
+        fr = f_mkdir(dst_path);
+        fr = (fr == FR_EXIST) ? FR_OK : fr;
+    }
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not extract %s into %s (%d)\n", zip_path, dst_path, fr);
+        fileop_release();
+        return fileop_error(fr);
+    }
+    snprintf(fileop.src_path, FILEOP_PATH_LENGTH, "%s", zip_path);
+    snprintf(fileop.dst_path, FILEOP_PATH_LENGTH, "%s", dst_path);
+    fileop.dst_len[0] = strlen(fileop.dst_path);
+    fileop.op = FILEOP_UNZIP;
+    DPRINTF("Extraction of %s into %s started\n", zip_path, dst_path);
+    return FILEOP_RUNNING;
+}
+
+// Move a file or a folder. It stays in the same volume, so no data is copied and it's done at once
+static int32_t __not_in_flash_func(fileop_move)(const char *src_path, const char *dst_path)
+{
+    if (fileop.op != FILEOP_NONE)
+    {
+        DPRINTF("ERROR: A file operation is already running\n");
+        return GEMDOS_EACCDN;
+    }
+    FRESULT fr = f_rename(src_path, dst_path);
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not move %s to %s (%d)\n", src_path, dst_path, fr);
+    }
+    else
+    {
+        dircache_invalidate(src_path);
+        dircache_invalidate_parent(src_path);
+        dircache_invalidate_parent(dst_path);
+        read_ahead_invalidate(-1);
+    }
+    fileop.files = (fr == FR_OK) ? 1 : 0;
+    fileop.bytes = 0;
+    return fileop_error(fr);
+}
+
+// Start the file operation requested from the web interface, or cancel the one running
+static void __not_in_flash_func(fileop_request_run)(uint32_t memory_shared_address)
+{
+    if (fileop_request.cancel)
+    {
+        fileop_request.cancel = false;
+        if (fileop.op != FILEOP_NONE)
+        {
+            DPRINTF("Cancelling the file operation\n");
+            fileop_finish(memory_shared_address, GEMDOS_ERROR);
+        }
+    }
+    uint8_t op = fileop_request.op;
+    fileop_request.op = FILEOP_NONE;
+    if (op == FILEOP_MOVE)
+    {
+        fileop_show(memory_shared_address, fileop_move(fileop_request.src_path, fileop_request.dst_path));
+    }
+    else if (op != FILEOP_NONE)
+    {
+        fileop_show(memory_shared_address, fileop_start(op, fileop_request.src_path, fileop_request.dst_path));
+    }
+}
+
+/**
+ * @brief Converts a path typed in the web interface to an internal path in the hard disk folder.
+ *
+ * The value of the parameter is URL decoded. The path is relative to the hard disk folder and
+ * can't go up with "..".
+ *
+ * @param value The value of the CGI parameter.
+ * @param path A pointer to a buffer of FILEOP_PATH_LENGTH characters where the path is stored.
+ * @return true if the path is valid, false otherwise.
+ */
+static bool fileop_web_path(const char *value, char *path)
+{
+    char decoded[FILEOP_PATH_LENGTH];
+    size_t len = 0;
+    for (const char *p = value; (*p != '\0') && (len < sizeof(decoded) - 1); p++)
+    {
+        if ((p[0] == '%') && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2]))
+        {
+            char hex[3] = {p[1], p[2], '\0'};
+            decoded[len++] = (char)strtol(hex, NULL, 16);
+            p += 2;
+        }
+        else
+        {
+            decoded[len++] = (*p == '+') ? ' ' : *p;
+        }
+    }
+    decoded[len] = '\0';
+    if ((hd_folder == NULL) || (decoded[0] == '\0') || (strstr(decoded, "..") != NULL))
+    {
+        return false;
+    }
+    if (snprintf(path, FILEOP_PATH_LENGTH, "%s/%s", hd_folder, decoded) >= FILEOP_PATH_LENGTH)
+    {
+        return false;
+    }
+    back_2_forwardslash(path);
+    remove_dup_slashes(path);
+    len = strlen(path);
+    while ((len > 1) && (path[len - 1] == '/'))
+    {
+        path[--len] = '\0';
+    }
+    return true;
+}
+
+/**
+ * @brief Queues a file operation requested from the web interface.
+ *
+ * The operation starts in the main loop, when no GEMDOS call is being served. Only one
+ * operation is queued at a time.
+ *
+ * @param op The file operation: FILEOP_COPY, FILEOP_MOVE or FILEOP_DELTREE.
+ * @param iNumParams The number of parameters passed to the CGI handler.
+ * @param pcParam An array of parameter names: "src" and, except to delete, "dst".
+ * @param pcValue An array of parameter values.
+ * @return The URL of the page that shows the progress of the operation.
+ */
+static const char *cgi_fileop(uint8_t op, int iNumParams, char *pcParam[], char *pcValue[])
+{
+    bool src_ok = false;
+    bool dst_ok = (op == FILEOP_DELTREE);
+    fileop_request.dst_path[0] = '\0';
+    for (int i = 0; i < iNumParams; i++)
+    {
+        if (strcmp(pcParam[i], "src") == 0)
+        {
+            src_ok = fileop_web_path(pcValue[i], fileop_request.src_path);
+        }
+        else if ((strcmp(pcParam[i], "dst") == 0) && (op != FILEOP_DELTREE))
+        {
+            dst_ok = fileop_web_path(pcValue[i], fileop_request.dst_path);
+        }
+    }
+    if (src_ok && dst_ok && (fileop.op == FILEOP_NONE))
+    {
+        DPRINTF("File operation %d requested on %s\n", op, fileop_request.src_path);
+        fileop_request.op = op;
+    }
+    else
+    {
+        DPRINTF("File operation %d not requested. Invalid paths or busy\n", op);
+    }
+    return "/gemdrive_status.shtml";
+}
+
+const char *cgi_fileop_copy(int iIndex, int iNumParams, char *pcParam[], char *pcValue[])
+{
+    return cgi_fileop(FILEOP_COPY, iNumParams, pcParam, pcValue);
+}
+
+const char *cgi_fileop_move(int iIndex, int iNumParams, char *pcParam[], char *pcValue[])
+{
+    return cgi_fileop(FILEOP_MOVE, iNumParams, pcParam, pcValue);
+}
+
+const char *cgi_fileop_deltree(int iIndex, int iNumParams, char *pcParam[], char *pcValue[])
+{
+    return cgi_fileop(FILEOP_DELTREE, iNumParams, pcParam, pcValue);
+}
+
+const char *cgi_fileop_cancel(int iIndex, int iNumParams, char *pcParam[], char *pcValue[])
+{
+    fileop_request.cancel = true;
+    return "/gemdrive_status.shtml";
+}
+
+/**
+ * @brief Array of CGI handlers for the file operations of the hard disk folder.
+ */
+static const tCGI cgi_handlers[] = {
+    {"/gemdrive_copy.cgi", cgi_fileop_copy},
+    {"/gemdrive_move.cgi", cgi_fileop_move},
+    {"/gemdrive_deltree.cgi", cgi_fileop_deltree},
+    {"/gemdrive_cancel.cgi", cgi_fileop_cancel}};
+
+/**
+ * @brief Array of SSI tags for the HTTP server.
+ */
+static const char *ssi_tags[] = {
+    "HDFOLDER", // 0
+    "FOPSTAT",  // 1
+    "FOPFILES", // 2
+    "FOPBYTES", // 3
+};
+
+/**
+ * @brief Server Side Include (SSI) handler for the HTTPD server.
+ *
+ * Shows the hard disk folder and the progress of the file operation.
+ *
+ * @param iIndex The index of the SSI tag.
+ * @param pcInsert A pointer to the buffer where the generated content should be inserted.
+ * @param iInsertLen The length of the buffer.
+ * @return The length of the generated content.
+ */
+static u16_t ssi_handler(int iIndex, char *pcInsert, int iInsertLen
+#if LWIP_HTTPD_SSI_MULTIPART
+                         ,
+                         u16_t current_tag_part, u16_t *next_tag_part
+#endif /* LWIP_HTTPD_SSI_MULTIPART */
+)
+{
+    int printed = 0;
+    if (iIndex == 0)
+    {
+        printed = snprintf(pcInsert, iInsertLen, "%s", hd_folder != NULL ? hd_folder : "Waiting for the ST");
+    }
+    else if (iIndex == 1)
+    {
+        if ((fileop.op != FILEOP_NONE) || (fileop_request.op != FILEOP_NONE))
+        {
+            printed = snprintf(pcInsert, iInsertLen, "Running");
+        }
+        else if (fileop.status != GEMDOS_EOK)
+        {
+            printed = snprintf(pcInsert, iInsertLen, "Error %ld", (long)fileop.status);
+        }
+        else
+        {
+            printed = snprintf(pcInsert, iInsertLen, (fileop.files > 0) ? "Done" : "Idle");
+        }
+    }
+    else if (iIndex == 2)
+    {
+        printed = snprintf(pcInsert, iInsertLen, "%lu", (unsigned long)fileop.files);
+    }
+    else if (iIndex == 3)
+    {
+        printed = snprintf(pcInsert, iInsertLen, "%lu", (unsigned long)fileop.bytes);
+    }
+    return (u16_t)((printed < iInsertLen) ? printed : iInsertLen - 1);
+}
+
+// Stop relocating the program being loaded, if any
+static void __not_in_flash_func(pexec_relocation_stop)()
+{
+    if (pexec_reloc.active)
+    {
+        f_close(&pexec_reloc.fobject);
+        pexec_reloc.active = false;
+        DPRINTF("Pexec relocation of fd %i finished\n", pexec_reloc.fd);
+    }
+}
+
+// Read the next byte of the fixup table
+static bool __not_in_flash_func(pexec_relocation_byte)(uint8_t *value)
+{
+    uint32_t pos = pexec_reloc.table_pos;
+    if ((pos < pexec_reloc.block_pos) || (pos >= pexec_reloc.block_pos + pexec_reloc.block_len))
+    {
+        UINT bytes_read = 0;
+        FRESULT fr = f_lseek(&pexec_reloc.fobject, pos);
+        if (fr == FR_OK)
+        {
+            fr = f_read(&pexec_reloc.fobject, pexec_reloc.block, PEXEC_RELOCATION_BLOCK_SIZE, &bytes_read);
+        }
+        if ((fr != FR_OK) || (bytes_read == 0))
+        {
+            return false;
+        }
+        pexec_reloc.block_pos = pos;
+        pexec_reloc.block_len = bytes_read;
+    }
+    *value = pexec_reloc.block[pos - pexec_reloc.block_pos];
+    pexec_reloc.table_pos++;
+    return true;
+}
+
+// Move to the next longword to relocate
+static void __not_in_flash_func(pexec_relocation_advance)()
+{
+    uint8_t value = 0;
+    while (!pexec_reloc.done)
+    {
+        if (!pexec_relocation_byte(&value) || (value == 0))
+        {
+            pexec_reloc.done = true;
+        }
+        else if (value == 1)
+        {
+            pexec_reloc.reloc += 254;
+        }
+        else
+        {
+            pexec_reloc.reloc += value;
+            return;
+        }
+    }
+}
+
+// Move to the first longword to relocate
+static void __not_in_flash_func(pexec_relocation_rewind)()
 {
-    FileDescriptors *current = head;
-    while (current != NULL)
+    uint8_t first[4];
+    pexec_reloc.table_pos = pexec_reloc.fixup_offset;
+    pexec_reloc.done = false;
+    pexec_reloc.bound = 0;
+    for (int i = 0; i < 4; i++)
     {
-        DPRINTF("File descriptor: %i - File path: %s\n", current->fd, current->fpath);
-        current = current->next;
+        if (!pexec_relocation_byte(&first[i]))
+        {
+            pexec_reloc.done = true;
+            return;
+        }
     }
+    pexec_reloc.reloc = ((uint32_t)first[0] << 24) | ((uint32_t)first[1] << 16) | ((uint32_t)first[2] << 8) | first[3];
+    pexec_reloc.done = (pexec_reloc.reloc == 0);
 }
 
-static FileDescriptors *__not_in_flash_func(get_file_by_fpath)(FileDescriptors *head, const char *fpath)
+// Relocate the longword at an offset from TEXT. Only the bytes inside the chunk read are changed
+static void __not_in_flash_func(pexec_relocate_longword)(uint8_t *data, uint32_t file_offset, uint32_t size, uint32_t reloc)
 {
-    while (head != NULL)
+    uint32_t long_offset = PRG_STRUCT_SIZE + reloc;
+    uint8_t original[4];
+    if ((long_offset >= file_offset) && (long_offset + 4 <= file_offset + size))
     {
-        if (strcmp(head->fpath, fpath) == 0)
+        memcpy(original, data + (long_offset - file_offset), 4);
+    }
+    else
+    {
+        // The longword crosses the limits of the chunk. Take the original bytes from the file
+        UINT bytes_read = 0;
+        FRESULT fr = f_lseek(&pexec_reloc.fobject, long_offset);
+        if (fr == FR_OK)
         {
-            return head;
+            fr = f_read(&pexec_reloc.fobject, original, 4, &bytes_read);
+        }
+        if ((fr != FR_OK) || (bytes_read != 4))
+        {
+            return;
+        }
+    }
+    uint32_t value = ((uint32_t)original[0] << 24) | ((uint32_t)original[1] << 16) | ((uint32_t)original[2] << 8) | original[3];
+    value += pexec_reloc.base;
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t pos = long_offset + i;
+        if ((pos >= file_offset) && (pos < file_offset + size))
+        {
+            data[pos - file_offset] = (uint8_t)(value >> (24 - (i * 8)));
         }
-        head = head->next;
     }
-    return NULL;
 }
 
-static FileDescriptors *__not_in_flash_func(get_file_by_fdesc)(FileDescriptors *head, uint16_t fd)
+// Apply the relocations to a chunk of the program read by the ST. The data is in the byte order of
+// the file. The first longword of the fixup table is shown as 0, so the ST does not relocate again
+static void __not_in_flash_func(pexec_relocate)(int fd, uint8_t *data, uint32_t file_offset, uint32_t size)
 {
-    while (head != NULL)
+    if (!pexec_reloc.active || (pexec_reloc.fd != fd) || (size == 0))
     {
-        DPRINTF("Comparing %i with %i\n", head->fd, fd);
-        if (head->fd == fd)
+        return;
+    }
+    for (uint32_t pos = pexec_reloc.fixup_offset; pos < pexec_reloc.fixup_offset + 4; pos++)
+    {
+        if ((pos >= file_offset) && (pos < file_offset + size))
         {
-            DPRINTF("File descriptor found. Returning %i\n", head->fd);
-            return head;
+            data[pos - file_offset] = 0;
         }
-        head = head->next;
     }
-    return NULL;
+    if ((file_offset + size <= PRG_STRUCT_SIZE) || (file_offset >= PRG_STRUCT_SIZE + pexec_reloc.image_size))
+    {
+        return;
+    }
+    // Limits of the chunk as offsets from TEXT
+    uint32_t start = file_offset > PRG_STRUCT_SIZE ? file_offset - PRG_STRUCT_SIZE : 0;
+    uint32_t end = file_offset + size - PRG_STRUCT_SIZE;
+    if (end > pexec_reloc.image_size)
+    {
+        end = pexec_reloc.image_size;
+    }
+    if (start < pexec_reloc.bound)
+    {
+        // Not read sequentially. Start again from the beginning of the table
+        pexec_relocation_rewind();
+    }
+    while (!pexec_reloc.done && (pexec_reloc.reloc + 4 <= start))
+    {
+        pexec_relocation_advance();
+    }
+    // The longwords crossing the end of the chunk are needed again in the next chunk
+    bool resume_saved = false;
+    uint32_t resume_table_pos = 0;
+    uint32_t resume_reloc = 0;
+    while (!pexec_reloc.done && (pexec_reloc.reloc < end))
+    {
+        if (!resume_saved && (pexec_reloc.reloc + 4 > end))
+        {
+            resume_saved = true;
+            resume_table_pos = pexec_reloc.table_pos;
+            resume_reloc = pexec_reloc.reloc;
+        }
+        pexec_relocate_longword(data, file_offset, size, pexec_reloc.reloc);
+        pexec_relocation_advance();
+    }
+    if (resume_saved)
+    {
+        pexec_reloc.table_pos = resume_table_pos;
+        pexec_reloc.reloc = resume_reloc;
+        pexec_reloc.done = false;
+    }
+    pexec_reloc.bound = end;
+}
+
+// Start relocating the program when the ST has sent both the header and the basepage, and the
+// program has not been read beyond the header yet
+static void __not_in_flash_func(pexec_relocation_start)()
+{
+    if (!pexec_header_saved || !pexec_basepage_saved)
+    {
+        return;
+    }
+    pexec_header_saved = false;
+    pexec_basepage_saved = false;
+    pexec_relocation_stop();
+    FileDescriptors *program = get_file_by_fdesc(fdescriptors, pexec_candidate_fd);
+    if ((program == NULL) || (program->offset != PRG_STRUCT_SIZE))
+    {
+        DPRINTF("Pexec relocation skipped. Program not found or already read\n");
+        return;
+    }
+    if (f_open(&pexec_reloc.fobject, program->fpath, FA_READ) != FR_OK)
+    {
+        DPRINTF("ERROR: Could not open %s to relocate it\n", program->fpath);
+        return;
+    }
+    uint8_t header[PRG_STRUCT_SIZE];
+    UINT bytes_read = 0;
+    FRESULT fr = f_read(&pexec_reloc.fobject, header, PRG_STRUCT_SIZE, &bytes_read);
+    uint32_t text_size = ((uint32_t)header[2] << 24) | ((uint32_t)header[3] << 16) | ((uint32_t)header[4] << 8) | header[5];
+    uint32_t data_size = ((uint32_t)header[6] << 24) | ((uint32_t)header[7] << 16) | ((uint32_t)header[8] << 8) | header[9];
+    uint32_t syms_size = ((uint32_t)header[14] << 24) | ((uint32_t)header[15] << 16) | ((uint32_t)header[16] << 8) | header[17];
+    uint16_t absflag = ((uint16_t)header[26] << 8) | header[27];
+    uint32_t saved_text_size = ((uint32_t)pexec_exec_header->text_h << 16) | pexec_exec_header->text_l;
+    uint32_t saved_data_size = ((uint32_t)pexec_exec_header->data_h << 16) | pexec_exec_header->data_l;
+    uint32_t fixup_offset = PRG_STRUCT_SIZE + text_size + data_size + syms_size;
+    if ((fr != FR_OK) || (bytes_read != PRG_STRUCT_SIZE) || (header[0] != 0x60) || (header[1] != 0x1A) ||
+        (absflag != 0) || (text_size != saved_text_size) || (data_size != saved_data_size) ||
+        (fixup_offset + 4 > f_size(&pexec_reloc.fobject)))
+    {
+        DPRINTF("Pexec relocation skipped. Not a relocatable program or not the one executed\n");
+        f_close(&pexec_reloc.fobject);
+        return;
+    }
+    pexec_reloc.fd = pexec_candidate_fd;
+    pexec_reloc.base = SWAP_LONGWORD(pexec_pd->p_lowtpa) + PDSIZE;
+    pexec_reloc.image_size = text_size + data_size;
+    pexec_reloc.fixup_offset = fixup_offset;
+    pexec_reloc.block_pos = 0;
+    pexec_reloc.block_len = 0;
+    pexec_reloc.active = true;
+    pexec_relocation_rewind();
+    DPRINTF("Pexec relocation of fd %i at x%x. TEXT+DATA: x%x bytes\n", pexec_reloc.fd, pexec_reloc.base, pexec_reloc.image_size);
 }
 
 static void __not_in_flash_func(delete_file_by_fpath)(FileDescriptors **head, const char *fpath)
@@ -465,6 +2146,11 @@ static void __not_in_flash_func(delete_file_by_fdesc)(FileDescriptors **head, ui
                 {
                     prev->next = current->next;
                 }
+                read_ahead_invalidate(fd);
+                if (pexec_reloc.fd == fd)
+                {
+                    pexec_relocation_stop();
+                }
                 free(current);
                 return;
             }
@@ -540,6 +2226,15 @@ static void __not_in_flash_func(get_local_full_pathname)(char *tmp_filepath)
     char tmp_path[MAX_FOLDER_LENGTH] = {0};
 
     COPY_AND_CHANGE_ENDIANESS_BLOCK16(payloadPtr, path_filename, MAX_FOLDER_LENGTH);
+    PathCacheEntry *cached = pathcache_lookup(path_filename);
+    if (cached != NULL)
+    {
+        strcpy(tmp_filepath, cached->real_path);
+        DPRINTF("tmp_filepath (cached): %s\n", tmp_filepath);
+        return;
+    }
+    char st_path[MAX_FOLDER_LENGTH];
+    strcpy(st_path, path_filename);
     DPRINTF("dpath_string: %s\n", dpath_string);
     DPRINTF("path_filename: %s\n", path_filename);
     if (path_filename[1] == ':')
@@ -575,6 +2270,7 @@ static void __not_in_flash_func(get_local_full_pathname)(char *tmp_filepath)
 
     // Remove duplicated forward slashes
     remove_dup_slashes(tmp_filepath);
+    pathcache_store(st_path, tmp_filepath);
     DPRINTF("tmp_filepath: %s\n", tmp_filepath);
 }
 
@@ -749,7 +2445,7 @@ void __not_in_flash_func(gemdrvemul_dma_irq_handler_lookup_callback)(void)
 
     // Avoid priting anything inside an IRQ handled function
     // DPRINTF("DMA LOOKUP: $%x\n", addr);
-    if (addr >= ROM3_START_ADDRESS)
+    if (addr >= protocol_rom3_start_address)
     {
         parse_protocol((uint16_t)(addr & 0xFFFF), handle_protocol_command);
     }
@@ -763,8 +2459,9 @@ void init_gemdrvemul(bool safe_config_reboot)
     FRESULT fr; /* FatFs function common result code */
     FATFS fs;
     bool hd_folder_ready = false;
+    bool web_ready = false;
 
-    char *ntp_server_host = NULL;
+    const char *ntp_server_host = NULL;
     int ntp_server_port = NTP_DEFAULT_PORT;
     u_int16_t network_poll_counter = 0;
 
@@ -785,18 +2482,14 @@ void init_gemdrvemul(bool safe_config_reboot)
     uint32_t memory_firmware_code = ROM4_START_ADDRESS;  // Start of the firmware code
 
     init_variables(memory_shared_address);
+    initializeDTAHashTable();
 
     *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_RTC_STATUS)) = 0x0;
     *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_NETWORK_STATUS)) = 0x0;
     *((volatile uint16_t *)(memory_shared_address + GEMDRVEMUL_RTC_XBIOS_REENTRY_TRAP)) = 0x0;
 
 
-    ConfigEntry *gemdrive_rtc = find_entry(PARAM_GEMDRIVE_RTC);
-    bool gemdrive_rtc_enabled = true;
-    if (gemdrive_rtc != NULL)
-    {
-        gemdrive_rtc_enabled = gemdrive_rtc->value[0] == 't' || gemdrive_rtc->value[0] == 'T';
-    }
+    bool gemdrive_rtc_enabled = config_bool(CONFIG_KEY_GEMDRIVE_RTC);
     // #if defined(_DEBUG) && (_DEBUG != 0)
     //     DPRINTF("RTC DISABLED FOR DEBUGGING\n");
     //     gemdrive_rtc_enabled = false;
@@ -804,48 +2497,18 @@ void init_gemdrvemul(bool safe_config_reboot)
     *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_RTC_ENABLED)) = gemdrive_rtc_enabled;
     DPRINTF("Network enabled? %s\n", gemdrive_rtc_enabled ? "Yes" : "No");
 
-    ConfigEntry *gemdrive_timeout = find_entry(PARAM_GEMDRIVE_TIMEOUT_SEC);
-    uint32_t gemdrive_timeout_sec = 0;
-    if (gemdrive_timeout != NULL)
-    {
-        gemdrive_timeout_sec = atoi(gemdrive_timeout->value);
-    }
+    uint32_t gemdrive_timeout_sec = config_int(CONFIG_KEY_GEMDRIVE_TIMEOUT_SEC);
     WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_TIMEOUT_SEC, gemdrive_timeout_sec);
     DPRINTF("Timeout in seconds: %d\n", gemdrive_timeout_sec);
 
-    ConfigEntry *drive_letter_conf = find_entry(PARAM_GEMDRIVE_DRIVE);
-    char drive_letter = 'C';
-    if (drive_letter_conf != NULL)
-    {
-        drive_letter = drive_letter_conf->value[0];
-    }
+    char drive_letter = config_string(CONFIG_KEY_GEMDRIVE_DRIVE)[0];
     uint32_t drive_letter_num = (uint8_t)toupper(drive_letter);
     uint32_t drive_number = drive_letter_num - 65; // Convert the drive letter to a number. Add 1 because 0 is the current drive
 
-    ConfigEntry *buffer_type_conf = find_entry(PARAM_GEMDRIVE_BUFF_TYPE);
-    uint16_t buffer_type = 0; // 0: Diskbuffer, 1: Stack
-    if (buffer_type_conf != NULL)
-    {
-        buffer_type = atoi(buffer_type_conf->value);
-    }
-
-    ConfigEntry *virtual_fake_floppy_conf = find_entry(PARAM_GEMDRIVE_FAKEFLOPPY);
-    uint16_t virtual_fake_floppy = 0; // 0: No, 1: Yes
-    if (virtual_fake_floppy_conf != NULL)
-    {
-        virtual_fake_floppy = virtual_fake_floppy_conf->value[0] == 't' || virtual_fake_floppy_conf->value[0] == 'T';
-    }
+    uint16_t buffer_type = config_int(CONFIG_KEY_GEMDRIVE_BUFF_TYPE);           // 0: Diskbuffer, 1: Stack
+    uint16_t virtual_fake_floppy = config_bool(CONFIG_KEY_GEMDRIVE_FAKEFLOPPY); // 0: No, 1: Yes
 
-    ConfigEntry *y2k_patch = find_entry(PARAM_RTC_Y2K_PATCH);
-    if (y2k_patch != NULL)
-    {
-        char *str = y2k_patch->value;
-        y2k_patch_enabled = ((y2k_patch!=NULL) && (strlen(y2k_patch->value)) && ((str[0] == 'T') || (str[0] == 't'))) ? true : false;
-    }
-    else {
-        y2k_patch_enabled = true;
-        DPRINTF("Y2K patch enabled by default\n");
-    }
+    y2k_patch_enabled = config_bool(CONFIG_KEY_RTC_Y2K_PATCH);
     DPRINTF("Y2K patch enabled: %s\n", y2k_patch_enabled ? "true" : "false");
     *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_RTC_Y2K_PATCH)) = y2k_patch_enabled ? 0xFFFFFFFF : 0;
 
@@ -862,7 +2525,7 @@ void init_gemdrvemul(bool safe_config_reboot)
     }
 
     // Only try to get the datetime from the network if the wifi is configured
-    if (gemdrive_rtc_enabled && strlen(find_entry(PARAM_WIFI_SSID)->value) > 0)
+    if (gemdrive_rtc_enabled && strlen(config_string(CONFIG_KEY_WIFI_SSID)) > 0)
     {
         // Initialize SD card
         if (!sd_init_driver())
@@ -893,7 +2556,7 @@ void init_gemdrvemul(bool safe_config_reboot)
         uint32_t wifi_timeout_sec = gemdrive_timeout_sec;
 
         // Wait until timeout
-        while ((!network_ready) && (wifi_timeout_sec > 0) && (strlen(find_entry(PARAM_WIFI_SSID)->value) > 0))
+        while ((!network_ready) && (wifi_timeout_sec > 0) && (strlen(config_string(CONFIG_KEY_WIFI_SSID)) > 0))
         {
             *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_RANDOM_TOKEN_SEED)) = rand() % 0xFFFFFFFF;
 #if PICO_CYW43_ARCH_POLL
@@ -976,13 +2639,13 @@ void init_gemdrvemul(bool safe_config_reboot)
             // Start the internal RTC
             rtc_init();
 
-            ntp_server_host = find_entry(PARAM_RTC_NTP_SERVER_HOST)->value;
-            ntp_server_port = atoi(find_entry(PARAM_RTC_NTP_SERVER_PORT)->value);
+            ntp_server_host = config_string(CONFIG_KEY_RTC_NTP_SERVER_HOST);
+            ntp_server_port = config_int(CONFIG_KEY_RTC_NTP_SERVER_PORT);
 
             DPRINTF("NTP server host: %s\n", ntp_server_host);
             DPRINTF("NTP server port: %d\n", ntp_server_port);
 
-            char *utc_offset_entry = find_entry(PARAM_RTC_UTC_OFFSET)->value;
+            const char *utc_offset_entry = config_string(CONFIG_KEY_RTC_UTC_OFFSET);
             if (strlen(utc_offset_entry) > 0)
             {
                 // The offset can be in decimal format
@@ -1065,6 +2728,17 @@ void init_gemdrvemul(bool safe_config_reboot)
                 // If set then set the RTC and network status to 1, otherwise set it to 0
                 *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_RTC_STATUS)) = 0xFFFFFFFF;
                 *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_NETWORK_STATUS)) = 0xFFFFFFFF;
+
+                // The web interface runs the file operations of the hard disk folder
+                cyw43_arch_lwip_begin();
+                httpd_server_init(ssi_tags, LWIP_ARRAYSIZE(ssi_tags), ssi_handler, cgi_handlers, LWIP_ARRAYSIZE(cgi_handlers));
+                cyw43_arch_lwip_end();
+                web_ready = true;
+#if defined(_DEBUG) && (_DEBUG != 0)
+                ConnectionData connection_data = {0};
+                get_connection_data(&connection_data);
+                DPRINTF("Web interface in http://%s/gemdrive.shtml\n", connection_data.ipv4_address);
+#endif
             }
             else
             {
@@ -1092,7 +2766,29 @@ void init_gemdrvemul(bool safe_config_reboot)
 #if defined(_DEBUG) && (_DEBUG != 0)
         uint16_t old_command = active_command_id != 0xFFFF ? active_command_id : 0xFFFF;
 #endif
-        switch (active_command_id)
+        // Take the command once, so the pending writes are flushed before the command that could need them
+        uint16_t command_id = active_command_id;
+        if (write_behind_fd >= 0)
+        {
+            if (command_id == 0xFFFF)
+            {
+                // Do not keep the bytes in RAM for too long if the ST stops writing
+                if ((to_ms_since_boot(get_absolute_time()) - write_behind_last_ms) > WRITE_BEHIND_IDLE_TIMEOUT_MS)
+                {
+                    write_behind_flush(memory_shared_address, true);
+                }
+            }
+            else if ((command_id != GEMDRVEMUL_WRITE_BUFF_CALL) && (command_id != GEMDRVEMUL_WRITE_BUFF_CHECK) && (command_id != GEMDRVEMUL_FCLOSE_CALL))
+            {
+                write_behind_flush(memory_shared_address, false);
+            }
+        }
+        // The free clusters counted so far are not valid if the command allocates or frees clusters
+        if (dfree_scanning && dfree_command_changes_fat(command_id))
+        {
+            dfree_scan_restart();
+        }
+        switch (command_id)
         {
         case GEMDRVEMUL_DEBUG:
         {
@@ -1200,16 +2896,22 @@ void init_gemdrvemul(bool safe_config_reboot)
                     }
                     else
                     {
-                        hd_folder = find_entry(PARAM_GEMDRIVE_FOLDERS)->value;
+                        hd_folder = config_string(CONFIG_KEY_GEMDRIVE_FOLDERS);
                         DPRINTF("Emulating GEMDRIVE in folder: %s\n", hd_folder);
                         // Iterate over fdescriptors and close all files
                         close_all_files(&fdescriptors);
                         cleanDTAHashTable();
+                        dircache_invalidate_all();
+                        read_ahead_invalidate(-1);
+                        pexec_relocation_stop();
                         delete_all_files(&fdescriptors);
                         DPRINTF("DTA table elements: %d\n", countDTA());
                         DPRINTF("File descriptors: %d\n", count_fdesc(fdescriptors));
                         dpath_string[0] = '\\'; // Set the root folder as default
                         dpath_string[1] = '\0';
+                        pathcache_clear();
+                        dfree_seeded = false;
+                        dfree_scanning = false;
                         hd_folder_ready = true;
                         *((volatile uint16_t *)(memory_shared_address + GEMDRVEMUL_PING_STATUS)) = 0x1;
                     }
@@ -1281,7 +2983,7 @@ void init_gemdrvemul(bool safe_config_reboot)
             DWORD fre_clust;
             FATFS *fs;
             FRESULT fr;
-            // Get free space
+            // Get free space. Only the first call after mounting scans the FAT, and it's usually done when idle
             fr = f_getfree(hd_folder, &fre_clust, &fs);
             if (fr != FR_OK)
             {
@@ -1297,9 +2999,15 @@ void init_gemdrvemul(bool safe_config_reboot)
                 WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_DFREE_STRUCT + 8, NUM_BYTES_PER_SECTOR);
                 WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_DFREE_STRUCT + 12, fs->csize);
                 *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_DFREE_STATUS)) = GEMDOS_EOK;
+                if (!dfree_seeded)
+                {
+                    // f_getfree() counted them
+                    dfree_scan_end();
+                }
             }
             write_random_token(memory_shared_address);
             active_command_id = 0xFFFF;
+            break;
         }
         case GEMDRVEMUL_DGETPATH_CALL:
         {
@@ -1380,6 +3088,8 @@ void init_gemdrvemul(bool safe_config_reboot)
             }
             // Copy dpath_tmp to dpath_string
             strcpy(dpath_string, dpath_tmp);
+            // The relative paths converted before are not valid anymore
+            pathcache_clear();
             DPRINTF("The new default path is: %s\n", dpath_string);
             write_random_token(memory_shared_address);
             active_command_id = 0xFFFF;
@@ -1412,6 +3122,7 @@ void init_gemdrvemul(bool safe_config_reboot)
                 else
                 {
                     DPRINTF("Folder created\n");
+                    dircache_invalidate_parent(tmp_pathname);
                     *((volatile uint16_t *)(memory_shared_address + GEMDRVEMUL_DCREATE_STATUS)) = GEMDOS_EOK;
                 }
             }
@@ -1460,6 +3171,8 @@ void init_gemdrvemul(bool safe_config_reboot)
                 else
                 {
                     DPRINTF("Folder deleted\n");
+                    dircache_invalidate(tmp_pathname);
+                    dircache_invalidate_parent(tmp_pathname);
                     *((volatile uint16_t *)(memory_shared_address + GEMDRVEMUL_DDELETE_STATUS)) = GEMDOS_EOK;
                 }
             }
@@ -1479,7 +3192,7 @@ void init_gemdrvemul(bool safe_config_reboot)
             else
             {
                 DTA data = {"filename", 0, 0, 0, 0, 0, 0, 0, 0, "filename"};
-                insertDTA(ndta, data, NULL, NULL, 0);
+                insertDTA(ndta, data, 0);
                 DPRINTF("Added ndta: %x.\n", ndta);
             }
             write_random_token(memory_shared_address);
@@ -1569,119 +3282,112 @@ void init_gemdrvemul(bool safe_config_reboot)
             DPRINTF("Fsfirst ndta: %x, attribs: %s, fspec: %x, fspec string: %s\n", ndta, attribs_str, fspec, fspec_string);
             DPRINTF("Fsfirst Full internal path: %s, filename pattern: %s[%d]\n", internal_path, pattern, strlen(pattern));
 
-            bool ndta_exists = lookupDTA(ndta) ? true : false;
-
             if (!(attribs & FS_ST_LABEL))
             {
                 attribs |= FS_ST_ARCH;
             }
 
-            FRESULT fr;   /* Return value */
-            DIR *dj;      /* Directory object */
-            FILINFO *fno; /* File information */
-            dj = (DIR *)malloc(sizeof(DIR));
-            fno = (FILINFO *)malloc(sizeof(FILINFO));
+            // Take the slot of the DTA (reusing it if it already exists)
+            DTA data = {"filename.typ", 0, 0, 0, 0, 0, 0, 0, 0, "filename.typ"};
+            DTANode *dtaNode = insertDTA(ndta, data, attribs);
+            bool found = false;
 
-            char raw_filename[2] = "._";
-            fr = FR_OK;
-            bool first_time = true;
-            while (fr == FR_OK && ((raw_filename[0] == '.') || (raw_filename[0] == '.' && raw_filename[1] == '_')))
+            DirCache *snapshot = dircache_get(internal_path);
+            if (snapshot != NULL)
             {
-                if (first_time)
-                {
-                    first_time = false;
-                    fr = f_findfirst(dj, fno, internal_path, pattern);
-                }
-                else
-                {
-                    fr = f_findnext(dj, fno);
-                }
-                if (fno->fname[0])
+                // Search in the snapshot of the directory. The pattern is matched as TOS does,
+                // so use the original one and not the one adjusted for FatFs
+                const char *tos_pattern = strrchr(fspec_string, '/');
+                tos_pattern = (tos_pattern != NULL) ? tos_pattern + 1 : fspec_string;
+                snprintf(dtaNode->pat_buf, sizeof(dtaNode->pat_buf), "%s", tos_pattern);
+                remove_trailing_spaces(dtaNode->pat_buf);
+                dtaNode->pat = dtaNode->pat_buf;
+                dtaNode->cached = true;
+                dtaNode->cache_slot = (uint8_t)(snapshot - dirCache);
+                dtaNode->cache_gen = snapshot->generation;
+                dtaNode->cache_pos = 0;
+                snprintf(dtaNode->cache_path, sizeof(dtaNode->cache_path), "%s", snapshot->path);
+                found = dircache_next(dtaNode);
+                DPRINTF("Fsfirst in directory snapshot %s with pattern %s: %s\n", snapshot->path, dtaNode->pat, found ? dtaNode->fno->fname : "NOT FOUND");
+            }
+            else
+            {
+                // Search with the DIR, FILINFO and pattern embedded in the slot
+                snprintf(dtaNode->pat_buf, sizeof(dtaNode->pat_buf), "%s", pattern);
+                dtaNode->pat = dtaNode->pat_buf;
+                dtaNode->dj = &dtaNode->dir_obj;
+                dtaNode->fno = &dtaNode->fno_obj;
+
+                FRESULT fr;                  /* Return value */
+                DIR *dj = dtaNode->dj;       /* Directory object */
+                FILINFO *fno = dtaNode->fno; /* File information */
+
+                char raw_filename[2] = "._";
+                fr = FR_OK;
+                bool first_time = true;
+                while (fr == FR_OK && ((raw_filename[0] == '.') || (raw_filename[0] == '.' && raw_filename[1] == '_')))
                 {
-                    if (attribs & attribs_fat2st(fno->fattrib))
+                    if (first_time)
+                    {
+                        first_time = false;
+                        fr = f_findfirst(dj, fno, internal_path, dtaNode->pat);
+                    }
+                    else
                     {
-                        if (fr == FR_OK)
+                        fr = f_findnext(dj, fno);
+                    }
+                    if (fno->fname[0])
+                    {
+                        if (attribs & attribs_fat2st(fno->fattrib))
                         {
-                            raw_filename[0] = fno->fname[0];
-                            raw_filename[1] = fno->fname[1];
+                            if (fr == FR_OK)
+                            {
+                                raw_filename[0] = fno->fname[0];
+                                raw_filename[1] = fno->fname[1];
+                            }
                         }
                     }
+                    else
+                    {
+                        raw_filename[0] = 'x'; // Force exit, no more elements
+                        raw_filename[1] = 'x'; // Force exit, no more elements
+                    }
                 }
-                else
-                {
-                    raw_filename[0] = 'x'; // Force exit, no more elements
-                    raw_filename[1] = 'x'; // Force exit, no more elements
-                }
-            }
 
-            if (fr == FR_OK && fno->fname[0])
-            {
-                uint8_t attribs_conv_st = attribs_fat2st(fno->fattrib);
-                char attribs_str[7] = "";
-                get_attribs_st_str(attribs_str, attribs_conv_st);
-                char shorten_filename[14];
-                char upper_filename[14];
-                char filtered_filename[14];
-                filter_fname(fno->fname, filtered_filename);
-                upper_fname(filtered_filename, upper_filename);
-                shorten_fname(upper_filename, shorten_filename);
-
-                strcpy(fno->fname, shorten_filename);
-
-                // Filter out elements that do not match the attributes
-                if (attribs_conv_st & attribs)
+                if (fr == FR_OK && fno->fname[0])
                 {
-                    DPRINTF("Found: %s, attr: %s\n", fno->fname, attribs_str);
-                    if (ndta_exists)
-                    {
-                        releaseDTA(ndta);
-                        DPRINTF("Existing DTA at %x released. DTA table elements: %d\n", ndta, countDTA());
-                        nullify_dta(memory_shared_address);
-                    }
-                    DTA data = {"filename.typ", 0, 0, 0, 0, 0, 0, 0, 0, "filename.typ"};
-                    insertDTA(ndta, data, dj, fno, attribs);
-                    // Populate the DTA with the first file found
-                    populate_dta(memory_shared_address, ndta, GEMDOS_EFILNF);
-                    // Null dj and fno to avoid freeing them
-                    dj = NULL;
-                    fno = NULL;
+                    uint8_t attribs_conv_st = attribs_fat2st(fno->fattrib);
+                    char attribs_str[7] = "";
+                    get_attribs_st_str(attribs_str, attribs_conv_st);
+                    char shorten_filename[14];
+                    st_fname(fno, shorten_filename);
+                    strcpy(fno->fname, shorten_filename);
+
+                    // Filter out elements that do not match the attributes
+                    found = (attribs_conv_st & attribs) != 0;
+                    DPRINTF("%s: %s, attr: %s\n", found ? "Found" : "Skipped", fno->fname, attribs_str);
                 }
                 else
                 {
-                    DPRINTF("Skipped: %s, attr: %s\n", fno->fname, attribs_str);
-                    int16_t error_code = GEMDOS_EFILNF;
-                    DPRINTF("DTA at %x showing error code: %x\n", ndta, error_code);
-                    *((volatile uint16_t *)(memory_shared_address + GEMDRVEMUL_DTA_F_FOUND)) = error_code;
-                    if (ndta_exists)
-                    {
-                        releaseDTA(ndta);
-                        DPRINTF("Existing DTA at %x released. DTA table elements: %d\n", ndta, countDTA());
-                        nullify_dta(memory_shared_address);
-                    }
+                    DPRINTF("Nothing returned from Fsfirst\n");
                 }
             }
+
+            if (found)
+            {
+                // Populate the DTA with the first file found
+                populate_dta(memory_shared_address, ndta, GEMDOS_EFILNF);
+            }
             else
             {
-                DPRINTF("Nothing returned from Fsfirst\n");
                 int16_t error_code = GEMDOS_EFILNF;
                 DPRINTF("DTA at %x showing error code: %x\n", ndta, error_code);
-                if (ndta_exists)
-                {
-                    releaseDTA(ndta);
-                    DPRINTF("Existing DTA at %x released. DTA table elements: %d\n", ndta, countDTA());
-                }
+                releaseDTA(ndta);
+                DPRINTF("Existing DTA at %x released. DTA table elements: %d\n", ndta, countDTA());
                 *((volatile uint16_t *)(memory_shared_address + GEMDRVEMUL_DTA_F_FOUND)) = error_code;
                 nullify_dta(memory_shared_address);
             }
-            // Guarantee that the dynamic memory is released
-            if (dj != NULL)
-            {
-                free(dj);
-            }
-            if (fno != NULL)
-            {
-                free(fno);
-            }
+            DPRINTF("DTA pool. Live: %d, evicted: %d\n", dtaLive, dtaEvicted);
             write_random_token(memory_shared_address);
             active_command_id = 0xFFFF;
             break;
@@ -1695,7 +3401,27 @@ void init_gemdrvemul(bool safe_config_reboot)
             DTANode *dtaNode = lookupDTA(ndta);
 
             bool ndta_exists = dtaNode ? true : false;
-            if (dtaNode != NULL && dtaNode->dj != NULL && dtaNode->fno != NULL && ndta_exists)
+            if (dtaNode != NULL && dtaNode->cached)
+            {
+                // The search runs over a directory snapshot
+                if (dircache_next(dtaNode))
+                {
+                    DPRINTF("Found: %s in directory snapshot\n", dtaNode->fno->fname);
+                    // Populate the DTA with the next file found
+                    populate_dta(memory_shared_address, ndta, GEMDOS_ENMFIL);
+                }
+                else
+                {
+                    DPRINTF("Nothing found\n");
+                    int16_t error_code = GEMDOS_ENMFIL;
+                    DPRINTF("DTA at %x showing error code: %x\n", ndta, error_code);
+                    *((volatile uint16_t *)(memory_shared_address + GEMDRVEMUL_DTA_F_FOUND)) = error_code;
+                    releaseDTA(ndta);
+                    DPRINTF("Existing DTA at %x released. DTA table elements: %d\n", ndta, countDTA());
+                    nullify_dta(memory_shared_address);
+                }
+            }
+            else if (dtaNode != NULL && dtaNode->dj != NULL && dtaNode->fno != NULL && ndta_exists)
             {
                 uint32_t attribs = dtaNode->attribs;
                 // We need to filter out the elements that does not make sense in the FsFat environment
@@ -1726,11 +3452,7 @@ void init_gemdrvemul(bool safe_config_reboot)
                 if (fr == FR_OK && dtaNode->fno->fname[0])
                 {
                     char shorten_filename[14];
-                    char upper_filename[14];
-                    char filtered_filename[14];
-                    filter_fname(dtaNode->fno->fname, filtered_filename);
-                    upper_fname(filtered_filename, upper_filename);
-                    shorten_fname(upper_filename, shorten_filename);
+                    st_fname(dtaNode->fno, shorten_filename);
                     strcpy(dtaNode->fno->fname, shorten_filename);
 
                     uint8_t attribs = dtaNode->fno->fattrib;
@@ -1853,9 +3575,22 @@ void init_gemdrvemul(bool safe_config_reboot)
             }
             else
             {
+                // Write the pending bytes of the file before closing it. They are lost if it fails
+                FRESULT flush_fr = (write_behind_fd == fclose_fd) ? write_behind_flush(memory_shared_address, false) : FR_OK;
+                if (flush_fr != FR_OK)
+                {
+                    write_behind_discard();
+                }
+                flush_fr = file->write_error;
                 // Close the file with FatFs
                 fr = f_close(&file->fobject);
-                if (fr == FR_INVALID_OBJECT)
+                if ((fr == FR_OK) && (flush_fr != FR_OK))
+                {
+                    DPRINTF("ERROR: Could not write the pending bytes of the file (%d)\r\n", flush_fr);
+                    delete_file_by_fdesc(&fdescriptors, fclose_fd);
+                    *((volatile uint16_t *)(memory_shared_address + GEMDRVEMUL_FCLOSE_STATUS)) = GEMDOS_EWRITF;
+                }
+                else if (fr == FR_INVALID_OBJECT)
                 {
                     DPRINTF("ERROR: File descriptor is not valid\n");
                     *((volatile uint16_t *)(memory_shared_address + GEMDRVEMUL_FCLOSE_STATUS)) = GEMDOS_EIHNDL;
@@ -1904,6 +3639,8 @@ void init_gemdrvemul(bool safe_config_reboot)
             }
             else
             {
+                // The file is truncated, so the prefetched data could be stale
+                read_ahead_invalidate(-1);
                 // Add the file to the list of open files
                 int fd_counter = get_first_available_fd(fdescriptors);
                 DPRINTF("File created with file descriptor: %d\n", fd_counter);
@@ -1917,6 +3654,7 @@ void init_gemdrvemul(bool safe_config_reboot)
                 else
                 {
                     add_file(&fdescriptors, newFDescriptor, tmp_filepath, file_object, fd_counter);
+                    dircache_invalidate_parent(tmp_filepath);
 
                     // MISSING ATTRIBUTE MODIFICATION
 
@@ -1985,6 +3723,7 @@ void init_gemdrvemul(bool safe_config_reboot)
                 else
                 {
                     DPRINTF("File deleted\n");
+                    dircache_invalidate_parent(tmp_filepath);
                     status = GEMDOS_EOK;
                 }
             }
@@ -2008,6 +3747,14 @@ void init_gemdrvemul(bool safe_config_reboot)
                 DPRINTF("ERROR: File descriptor not found\n");
                 WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_FSEEK_STATUS, GEMDOS_EIHNDL);
             }
+            else if (file->write_error != FR_OK)
+            {
+                // The pending bytes could not be written in the flush before this command
+                fr = file->write_error;
+                file->write_error = FR_OK;
+                DPRINTF("ERROR: Could not write the pending bytes of the file (%d)\r\n", fr);
+                WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_FSEEK_STATUS, GEMDOS_EWRITF);
+            }
             else
             {
                 switch (fseek_mode)
@@ -2093,6 +3840,10 @@ void init_gemdrvemul(bool safe_config_reboot)
                         DPRINTF("ERROR: Could not set file attributes (%d)\r\n", fr);
                         WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_FATTRIB_STATUS, GEMDOS_EACCDN);
                     }
+                    else
+                    {
+                        dircache_invalidate_parent(tmp_filepath);
+                    }
                 }
             }
             write_random_token(memory_shared_address);
@@ -2165,6 +3916,9 @@ void init_gemdrvemul(bool safe_config_reboot)
                 else
                 {
                     DPRINTF("File renamed\n");
+                    dircache_invalidate(frename_fname_src);
+                    dircache_invalidate_parent(frename_fname_src);
+                    dircache_invalidate_parent(frename_fname_dst);
                     *((volatile uint32_t *)(memory_shared_address + GEMDRVEMUL_FRENAME_STATUS)) = GEMDOS_EOK;
                 }
             }
@@ -2173,6 +3927,21 @@ void init_gemdrvemul(bool safe_config_reboot)
             active_command_id = 0xFFFF;
             break;
         }
+        case GEMDRVEMUL_FUNZIP_CALL:
+        {
+            payloadPtr += 6; // Skip six words
+            // The archive and the destination folder follow, as in Frename
+            char funzip_fname_src[MAX_FOLDER_LENGTH] = {0};
+            char funzip_fname_dst[MAX_FOLDER_LENGTH] = {0};
+            get_local_full_pathname(funzip_fname_src);
+            payloadPtr += MAX_FOLDER_LENGTH / 2; // MAX_FOLDER_LENGTH * 2 bytes per uint16_t
+            get_local_full_pathname(funzip_fname_dst);
+            DPRINTF("Extracting: %s into %s\n", funzip_fname_src, funzip_fname_dst);
+            fileop_show(memory_shared_address, fileop_start_unzip(funzip_fname_src, funzip_fname_dst));
+            write_random_token(memory_shared_address);
+            active_command_id = 0xFFFF;
+            break;
+        }
         case GEMDRVEMUL_FDATETIME_CALL:
         {
             uint16_t fdatetime_flag = payloadPtr[0]; // d3.w register
@@ -2252,6 +4021,7 @@ void init_gemdrvemul(bool safe_config_reboot)
                     fr = f_utime(fd->fpath, &fno);
                     if (fr == FR_OK)
                     {
+                        dircache_invalidate_parent(fd->fpath);
                         // File exists and date and time set
                         // So now we can return the status
                         DPRINTF("Set the file date and time: %02d:%02d:%02d %02d/%02d/%02d\n", hour, minute, second * 2, day, month, year + 1980);
@@ -2296,37 +4066,76 @@ void init_gemdrvemul(bool safe_config_reboot)
             {
                 uint32_t readbuff_offset = file->offset;
                 UINT bytes_read = 0;
-                // Read the file with FatFs
-                fr = f_lseek(&file->fobject, readbuff_offset);
-                if (fr != FR_OK)
+                // Only read DEFAULT_FOPEN_READ_BUFFER_SIZE bytes at a time
+                uint16_t buff_size = readbuff_pending_bytes_to_read > DEFAULT_FOPEN_READ_BUFFER_SIZE ? DEFAULT_FOPEN_READ_BUFFER_SIZE : readbuff_pending_bytes_to_read;
+                // Detect if the file is read sequentially
+                if (readbuff_offset == file->last_read_end)
                 {
-                    DPRINTF("ERROR: Could not change read offset of the file (%d)\r\n", fr);
-                    WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_READ_BYTES, GEMDOS_EINTRN);
+                    if (file->sequential_reads < 0xFFFF)
+                    {
+                        file->sequential_reads++;
+                    }
                 }
                 else
                 {
-                    // Only read DEFAULT_FOPEN_READ_BUFFER_SIZE bytes at a time
-                    uint16_t buff_size = readbuff_pending_bytes_to_read > DEFAULT_FOPEN_READ_BUFFER_SIZE ? DEFAULT_FOPEN_READ_BUFFER_SIZE : readbuff_pending_bytes_to_read;
-                    DPRINTF("Reading x%x bytes from the file at offset x%x\n", buff_size, readbuff_offset);
-                    if (buff_size < DEFAULT_FOPEN_READ_BUFFER_SIZE) {
-                        memset((void *)(memory_shared_address + GEMDRVEMUL_READ_BUFF), 0, DEFAULT_FOPEN_READ_BUFFER_SIZE);
-                    }
-                    fr = f_read(&file->fobject, (void *)(memory_shared_address + GEMDRVEMUL_READ_BUFF), buff_size, &bytes_read);
+                    file->sequential_reads = 0;
+                }
+                if (buff_size < DEFAULT_FOPEN_READ_BUFFER_SIZE)
+                {
+                    memset((void *)(memory_shared_address + GEMDRVEMUL_READ_BUFF), 0, DEFAULT_FOPEN_READ_BUFFER_SIZE);
+                }
+                if (read_ahead_covers(readbuff_fd, readbuff_offset, buff_size))
+                {
+                    // The data was prefetched while the ST was copying the previous chunk
+                    uint32_t window_pos = readbuff_offset - read_ahead_offset;
+                    bytes_read = (read_ahead_bytes - window_pos) < buff_size ? (read_ahead_bytes - window_pos) : buff_size;
+                    DPRINTF("Reading x%x bytes from the read-ahead window at offset x%x\n", bytes_read, readbuff_offset);
+                    memcpy((void *)(memory_shared_address + GEMDRVEMUL_READ_BUFF), (void *)(memory_shared_address + GEMDRVEMUL_READ_AHEAD_BUFF + window_pos), bytes_read);
+                    fr = FR_OK;
+                }
+                else
+                {
+                    // Read the file with FatFs
+                    fr = f_lseek(&file->fobject, readbuff_offset);
                     if (fr != FR_OK)
                     {
-                        DPRINTF("ERROR: Could not read file (%d)\r\n", fr);
-                        WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_READ_BYTES, GEMDOS_EINTRN);
+                        DPRINTF("ERROR: Could not change read offset of the file (%d)\r\n", fr);
                     }
                     else
                     {
-                        // Update the offset of the file
-                        file->offset += bytes_read;
-                        uint32_t current_offset = file->offset;
-                        DPRINTF("New offset: x%x after reading x%x bytes\n", current_offset, bytes_read);
-                        // Change the endianness of the bytes read
-                        CHANGE_ENDIANESS_BLOCK16(memory_shared_address + GEMDRVEMUL_READ_BUFF, buff_size + (buff_size % 2));
-                        // Return the number of bytes read
-                        WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_READ_BYTES, (uint32_t)bytes_read);
+                        DPRINTF("Reading x%x bytes from the file at offset x%x\n", buff_size, readbuff_offset);
+                        fr = f_read(&file->fobject, (void *)(memory_shared_address + GEMDRVEMUL_READ_BUFF), buff_size, &bytes_read);
+                    }
+                }
+                if (fr != FR_OK)
+                {
+                    DPRINTF("ERROR: Could not read file (%d)\r\n", fr);
+                    WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_READ_BYTES, GEMDOS_EINTRN);
+                }
+                else
+                {
+                    uint8_t *readbuff_data = (uint8_t *)(memory_shared_address + GEMDRVEMUL_READ_BUFF);
+                    if ((readbuff_offset == 0) && (bytes_read >= 2) && (readbuff_data[0] == 0x60) && (readbuff_data[1] == 0x1A))
+                    {
+                        // The header of a program. It could be launched with Pexec
+                        pexec_candidate_fd = readbuff_fd;
+                    }
+                    pexec_relocate(readbuff_fd, readbuff_data, readbuff_offset, bytes_read);
+                    // Update the offset of the file
+                    file->offset += bytes_read;
+                    file->last_read_end = file->offset;
+                    uint32_t current_offset = file->offset;
+                    DPRINTF("New offset: x%x after reading x%x bytes\n", current_offset, bytes_read);
+                    // Change the endianness of the bytes read
+                    CHANGE_ENDIANESS_BLOCK16(memory_shared_address + GEMDRVEMUL_READ_BUFF, buff_size + (buff_size % 2));
+                    // Return the number of bytes read
+                    WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_READ_BYTES, (uint32_t)bytes_read);
+                    // Prefetch the next chunk when idle if the file is read sequentially and not at the end
+                    if ((file->sequential_reads >= READ_AHEAD_SEQUENTIAL_READS) && (bytes_read == buff_size) &&
+                        !read_ahead_covers(readbuff_fd, current_offset, DEFAULT_FOPEN_READ_BUFFER_SIZE))
+                    {
+                        read_ahead_pending_fd = readbuff_fd;
+                        read_ahead_pending_offset = current_offset;
                     }
                 }
             }
@@ -2353,52 +4162,43 @@ void init_gemdrvemul(bool safe_config_reboot)
             else
             {
                 uint32_t writebuff_offset = file->offset;
-                UINT bytes_write = 0;
-                // Reposition the file pointer with FatFs
-                fr = f_lseek(&file->fobject, writebuff_offset);
+                // Only write DEFAULT_FWRITE_BUFFER_SIZE bytes at a time
+                uint16_t buff_size = writebuff_pending_bytes_to_write > DEFAULT_FWRITE_BUFFER_SIZE ? DEFAULT_FWRITE_BUFFER_SIZE : writebuff_pending_bytes_to_write;
+                // Transform buffer's words from little endian to big endian inline
+                uint16_t *target = payloadPtr;
+                // Calculate the checksum of the buffer
+                // Use a 16 bit checksum to minimize the number of loops
+                uint16_t chk = 0;
+                UINT words_to_write = (DEFAULT_FWRITE_BUFFER_SIZE) / 2;
+                UINT pending_bytes = (DEFAULT_FWRITE_BUFFER_SIZE) % 2;
+                uint16_t *target16 = (uint16_t *)target;
+                for (int i = 0; i < words_to_write; i++)
+                {
+                    // Swap the order of the bytes in target16
+                    chk += target16[i];
+                }
+                DPRINTF("Checksum: x%x\n", chk);
+                if (pending_bytes > 0)
+                {
+                    uint16_t pending_long_word = target16[words_to_write];
+                    chk += pending_long_word & (0x00FF << (pending_bytes * 8));
+                }
+                // Change the endianness of the bytes read
+                CHANGE_ENDIANESS_BLOCK16(target, buff_size + (buff_size % 2));
+                // Write the bytes. They reach the card when the write-behind buffer is flushed
+                DPRINTF("Write x%x bytes from the file at offset x%x\n", buff_size, writebuff_offset);
+                // The prefetched data could be stale after writing
+                read_ahead_invalidate(-1);
+                fr = write_behind_write(memory_shared_address, file, (void *)target, buff_size);
                 if (fr != FR_OK)
                 {
-                    DPRINTF("ERROR: Could not change write offset of the file (%d)\r\n", fr);
+                    DPRINTF("ERROR: Could not write file (%d)\r\n", fr);
                     WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_WRITE_BYTES, GEMDOS_EINTRN);
                 }
                 else
                 {
-                    // Only write DEFAULT_FWRITE_BUFFER_SIZE bytes at a time
-                    uint16_t buff_size = writebuff_pending_bytes_to_write > DEFAULT_FWRITE_BUFFER_SIZE ? DEFAULT_FWRITE_BUFFER_SIZE : writebuff_pending_bytes_to_write;
-                    // Transform buffer's words from little endian to big endian inline
-                    uint16_t *target = payloadPtr;
-                    // Calculate the checksum of the buffer
-                    // Use a 16 bit checksum to minimize the number of loops
-                    uint16_t chk = 0;
-                    UINT words_to_write = (DEFAULT_FWRITE_BUFFER_SIZE) / 2;
-                    UINT pending_bytes = (DEFAULT_FWRITE_BUFFER_SIZE) % 2;
-                    uint16_t *target16 = (uint16_t *)target;
-                    for (int i = 0; i < words_to_write; i++)
-                    {
-                        // Swap the order of the bytes in target16
-                        chk += target16[i];
-                    }
-                    DPRINTF("Checksum: x%x\n", chk);
-                    if (pending_bytes > 0)
-                    {
-                        uint16_t pending_long_word = target16[words_to_write];
-                        chk += pending_long_word & (0x00FF << (pending_bytes * 8));
-                    }
-                    // Change the endianness of the bytes read
-                    CHANGE_ENDIANESS_BLOCK16(target, buff_size + (buff_size % 2));
-                    // Write the bytes
-                    DPRINTF("Write x%x bytes from the file at offset x%x\n", buff_size, writebuff_offset);
-                    fr = f_write(&file->fobject, (void *)target, buff_size, &bytes_write);
-                    if (fr != FR_OK)
-                    {
-                        DPRINTF("ERROR: Could not write file (%d)\r\n", fr);
-                        WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_WRITE_BYTES, GEMDOS_EINTRN);
-                    }
-                    else
-                    {
-                        WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_WRITE_CHK, (uint32_t)chk);
-                        WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_WRITE_BYTES, bytes_write);
-                    }
+                    WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_WRITE_CHK, (uint32_t)chk);
+                    WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_WRITE_BYTES, (uint32_t)buff_size);
                 }
             }
             write_random_token(memory_shared_address);
@@ -2451,6 +4251,10 @@ void init_gemdrvemul(bool safe_config_reboot)
             WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_PEXEC_FNAME, pexec_fname);
             WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_PEXEC_CMDLINE, pexec_cmdline);
             WRITE_AND_SWAP_LONGWORD(memory_shared_address, GEMDRVEMUL_PEXEC_ENVSTR, pexec_envstr);
+            // A new program is going to be loaded
+            pexec_relocation_stop();
+            pexec_header_saved = false;
+            pexec_basepage_saved = false;
             write_random_token(memory_shared_address);
             active_command_id = 0xFFFF;
             break;
@@ -2484,6 +4288,8 @@ void init_gemdrvemul(bool safe_config_reboot)
             DPRINTF("pexec_pd->p_uftsize: %x\n", SWAP_LONGWORD(pexec_pd->p_uftsize));
             DPRINTF("pexec_pd->p_uft: %x\n", SWAP_LONGWORD(pexec_pd->p_uft));
             DPRINTF("pexec_pd->p_cmdlin: %x\n", SWAP_LONGWORD(pexec_pd->p_cmdlin));
+            pexec_basepage_saved = true;
+            pexec_relocation_start();
             write_random_token(memory_shared_address);
             active_command_id = 0xFFFF;
             break;
@@ -2508,15 +4314,17 @@ void init_gemdrvemul(bool safe_config_reboot)
             DPRINTF("pexec_exec->reserved1: %x\n", (uint32_t)(pexec_exec_header->reserved1_h << 16 | pexec_exec_header->reserved1_l));
             DPRINTF("pexec_exec->prgflags: %x\n", (uint32_t)(pexec_exec_header->prgflags_h << 16 | pexec_exec_header->prgflags_l));
             DPRINTF("pexec_exec->absflag: %x\n", pexec_exec_header->absflag);
+            pexec_header_saved = true;
+            pexec_relocation_start();
             write_random_token(memory_shared_address);
             active_command_id = 0xFFFF;
             break;
         }
         default:
         {
-            if (active_command_id != 0xFFFF)
+            if (command_id != 0xFFFF)
             {
-                DPRINTF("ERROR: Unknown command: %x\n", active_command_id);
+                DPRINTF("ERROR: Unknown command: %x\n", command_id);
                 uint32_t d3 = ((uint32_t)payloadPtr[1] << 16) | payloadPtr[0];
                 DPRINTF("DEBUG: %x\n", d3);
                 payloadPtr += 2;
@@ -2534,6 +4342,35 @@ void init_gemdrvemul(bool safe_config_reboot)
             }
         }
         }
+        // Prefetch the next chunk of the file read sequentially while the ST copies the current one
+        if ((active_command_id == 0xFFFF) && (read_ahead_pending_fd >= 0))
+        {
+            read_ahead_prefetch(memory_shared_address);
+        }
+        // Count the free clusters when idle, so Dfree does not stall the ST scanning the FAT. Count them
+        // again from time to time, to fix any drift of the FSINFO sector
+        if ((active_command_id == 0xFFFF) && hd_folder_ready &&
+            (dfree_scanning || !dfree_seeded ||
+             ((DFREE_REVALIDATE_INTERVAL_SEC > 0) && ((to_ms_since_boot(get_absolute_time()) - dfree_last_scan_ms) > (DFREE_REVALIDATE_INTERVAL_SEC * 1000)))))
+        {
+            dfree_scan(&fs);
+        }
+        if ((active_command_id == 0xFFFF) && web_ready)
+        {
+#if PICO_CYW43_ARCH_POLL
+            cyw43_arch_poll();
+#endif
+            if (hd_folder_ready && (fileop_request.cancel || (fileop_request.op != FILEOP_NONE)))
+            {
+                fileop_request_run(memory_shared_address);
+            }
+        }
+        // Run the next step of the file operation, if any
+        if ((active_command_id == 0xFFFF) && (fileop.op != FILEOP_NONE))
+        {
+            dfree_scan_restart();
+            fileop_step(memory_shared_address);
+        }
 // Fully bypass the print variables
 #if defined(_DEBUG) && (_DEBUG != 0)
         // if (old_command != 0xFFFF)
@@ -0,0 +1,574 @@
+/**
+ * File: httpclient.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: HTTP/1.1 GET client over the raw lwIP TCP API. The lwIP httpc
+ * does not allow custom request headers, needed for conditional and range requests.
+ * The connection is kept open after a response and reused by the next request to the same
+ * server, saving the DNS lookup, the TCP handshake and the slow start.
+ */
+
+#include "include/httpclient.h"
+
+// One request at a time. The callers wait for the result polling the network
+static HttpClient client;
+static bool client_aborted = false; // The connection was aborted inside a lwIP callback
+static HttpClientStats stats;
+
+static void http_client_connect(void);
+
+// Open the receive window for the bytes of the body the caller did not acknowledge. A connection
+// kept open would lose that window for the next request
+static void http_client_ack_unacked(void)
+{
+    while ((client.pcb != NULL) && (client.rx_unacked > 0))
+    {
+        u16_t n = client.rx_unacked > 0xFFFF ? 0xFFFF : client.rx_unacked;
+        tcp_recved(client.pcb, n);
+        client.rx_unacked -= n;
+    }
+    client.rx_unacked = 0;
+}
+
+static void http_client_close_pcb(void)
+{
+    if (client.pcb != NULL)
+    {
+        tcp_arg(client.pcb, NULL);
+        tcp_recv(client.pcb, NULL);
+        tcp_err(client.pcb, NULL);
+        if (tcp_close(client.pcb) != ERR_OK)
+        {
+            tcp_abort(client.pcb);
+            client_aborted = true;
+        }
+        client.pcb = NULL;
+    }
+    client.rx_unacked = 0;
+}
+
+static void http_client_close(void)
+{
+    http_client_close_pcb();
+    if (client.req != NULL)
+    {
+        free(client.req);
+        client.req = NULL;
+    }
+}
+
+static void http_client_finish(httpc_result_t result, err_t err)
+{
+    if (client.state == HTTP_CLIENT_IDLE)
+    {
+        return;
+    }
+    if ((result == HTTPC_RESULT_OK) && client.keep_alive && (client.pcb != NULL))
+    {
+        // The connection stays open for the next request to the same server
+        free(client.req);
+        client.req = NULL;
+        client.idle_us = time_us_64();
+    }
+    else
+    {
+        http_client_close();
+    }
+    client.state = HTTP_CLIENT_IDLE;
+    stats.last_total_us = (uint32_t)(time_us_64() - client.start_us);
+    if ((result == HTTPC_RESULT_OK) && client.reused)
+    {
+        stats.reused_done++;
+        stats.reused_first_us += stats.last_first_us;
+    }
+    else if (result == HTTPC_RESULT_OK)
+    {
+        stats.new_done++;
+        stats.new_first_us += stats.last_first_us;
+    }
+    DPRINTF("HTTP request finished. Result: %d. Status: %d. Body: %d bytes\n", result, client.status, client.rx_body);
+    DPRINTF("%s. Sent in %d ms. First byte in %d ms. Total %d ms\n", client.reused ? "Connection reused" : "New connection",
+            stats.last_connect_us / 1000, stats.last_first_us / 1000, stats.last_total_us / 1000);
+    // The callbacks can point to the stack of the caller. Not kept after the request
+    httpc_result_fn result_fn = client.request.result_fn;
+    memset(&client.request, 0, sizeof(client.request));
+    if (result_fn)
+    {
+        result_fn(NULL, result, client.rx_body, client.status, err);
+    }
+}
+
+// Parse a line of the status or the headers. Returns false if the response is not valid
+static bool http_client_line(void)
+{
+    client.line[client.line_len] = '\0';
+    if (client.state == HTTP_CLIENT_STATUS)
+    {
+        // HTTP/1.x nnn Reason
+        char *code = strchr(client.line, ' ');
+        if ((strncmp(client.line, "HTTP/", 5) != 0) || (code == NULL))
+        {
+            return false;
+        }
+        client.status = strtoul(code + 1, NULL, 10);
+        client.keep_alive &= (strncmp(client.line, "HTTP/1.0", 8) != 0);
+        client.state = HTTP_CLIENT_HEADERS;
+        stats.last_first_us = (uint32_t)(time_us_64() - client.start_us);
+        return true;
+    }
+    if (client.state == HTTP_CLIENT_CHUNK_SIZE)
+    {
+        client.chunk_left = strtoul(client.line, NULL, 16); // Extensions after ';' are ignored
+        client.state = client.chunk_left > 0 ? HTTP_CLIENT_CHUNK_DATA : HTTP_CLIENT_TRAILER;
+        return true;
+    }
+    if (client.line_len == 0)
+    {
+        // Empty line: end of the headers, or of the trailer
+        if (client.state == HTTP_CLIENT_TRAILER)
+        {
+            client.state = HTTP_CLIENT_DONE;
+            return true;
+        }
+        if (client.request.headers_done_fn)
+        {
+            client.request.headers_done_fn(client.status, client.content_length);
+        }
+        if ((client.status == 204) || (client.status == 304) || (client.content_length == 0))
+        {
+            client.state = HTTP_CLIENT_DONE; // No body
+        }
+        else
+        {
+            client.state = client.chunked ? HTTP_CLIENT_CHUNK_SIZE : HTTP_CLIENT_BODY;
+            // A body without length ends when the server closes the connection
+            client.keep_alive &= client.chunked || (client.content_length >= 0);
+        }
+        return true;
+    }
+    if (client.state == HTTP_CLIENT_TRAILER)
+    {
+        return true;
+    }
+    char *value = strchr(client.line, ':');
+    if (value == NULL)
+    {
+        return true; // Not a header. Ignored
+    }
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t')
+    {
+        value++;
+    }
+    if (strcasecmp(client.line, "Content-Length") == 0)
+    {
+        client.content_length = strtol(value, NULL, 10);
+    }
+    else if ((strcasecmp(client.line, "Transfer-Encoding") == 0) && (strstr(value, "chunked") != NULL))
+    {
+        client.chunked = true;
+        client.content_length = -1;
+    }
+    else if ((strcasecmp(client.line, "Connection") == 0) && (strcasecmp(value, "close") == 0))
+    {
+        client.keep_alive = false;
+    }
+    if (client.request.header_fn)
+    {
+        client.request.header_fn(client.line, value);
+    }
+    return true;
+}
+
+// Pass n bytes of the pbuf, from offset, to the body callback. The tail of a pbuf is passed
+// as it is. Data in the middle of a pbuf (chunked bodies) is copied to a new one
+static bool http_client_deliver(struct pbuf **p, u16_t *offset, u16_t n)
+{
+    struct pbuf *q;
+    if (*offset + n == (*p)->tot_len)
+    {
+        q = pbuf_free_header(*p, *offset);
+        *p = NULL;
+        *offset = 0;
+    }
+    else
+    {
+        q = pbuf_alloc(PBUF_RAW, n, PBUF_RAM);
+        if (q == NULL)
+        {
+            return false;
+        }
+        pbuf_copy_partial(*p, q->payload, n, *offset);
+        *offset += n;
+    }
+    client.rx_body += n;
+    if (client.request.body_fn)
+    {
+        client.rx_unacked += n;
+        client.request.body_fn(NULL, client.pcb, q, ERR_OK);
+    }
+    else
+    {
+        tcp_recved(client.pcb, n);
+        pbuf_free(q);
+    }
+    return true;
+}
+
+// true if a request sent over a connection kept open failed before any byte of the response.
+// The server closed the connection while it was idle, so the request is sent again
+static bool http_client_retry(void)
+{
+    if (!client.reused || (client.state != HTTP_CLIENT_STATUS) || (client.line_len > 0))
+    {
+        return false;
+    }
+    DPRINTF("Connection closed by the server while idle. Connecting again\n");
+    client.reused = false;
+    http_client_close_pcb();
+    http_client_connect();
+    return true;
+}
+
+static err_t http_client_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    client_aborted = false;
+    if (client.state == HTTP_CLIENT_IDLE)
+    {
+        // Connection kept open. The server closed it, or sent something unexpected
+        if (p != NULL)
+        {
+            tcp_recved(pcb, p->tot_len);
+            pbuf_free(p);
+        }
+        http_client_close();
+        return client_aborted ? ERR_ABRT : ERR_OK;
+    }
+    if (p == NULL)
+    {
+        if (http_client_retry())
+        {
+            return client_aborted ? ERR_ABRT : ERR_OK;
+        }
+        // Closed by the server. It is the end of the body if there is no length
+        bool complete = (client.state == HTTP_CLIENT_DONE) ||
+                        ((client.state == HTTP_CLIENT_BODY) && (client.content_length < 0));
+        client.keep_alive = false;
+        http_client_finish(complete ? HTTPC_RESULT_OK : HTTPC_RESULT_ERR_CLOSED, ERR_OK);
+        return client_aborted ? ERR_ABRT : ERR_OK;
+    }
+    httpc_result_t result = HTTPC_RESULT_OK;
+    u16_t offset = 0;
+    u16_t consumed = 0; // Bytes of the headers and the chunk framing. The body callback acknowledges the rest
+    while ((p != NULL) && (offset < p->tot_len) && (client.state != HTTP_CLIENT_DONE))
+    {
+        u16_t available = p->tot_len - offset;
+        if (client.state == HTTP_CLIENT_BODY)
+        {
+            u16_t n = available;
+            if ((client.content_length >= 0) && (client.rx_body + n > (u32_t)client.content_length))
+            {
+                n = client.content_length - client.rx_body;
+            }
+            if (!http_client_deliver(&p, &offset, n))
+            {
+                result = HTTPC_RESULT_ERR_MEM;
+                client.state = HTTP_CLIENT_DONE;
+                break;
+            }
+            if ((client.content_length >= 0) && (client.rx_body >= (u32_t)client.content_length))
+            {
+                client.state = HTTP_CLIENT_DONE;
+            }
+        }
+        else if (client.state == HTTP_CLIENT_CHUNK_DATA)
+        {
+            u16_t n = available < client.chunk_left ? available : client.chunk_left;
+            if (!http_client_deliver(&p, &offset, n))
+            {
+                result = HTTPC_RESULT_ERR_MEM;
+                client.state = HTTP_CLIENT_DONE;
+                break;
+            }
+            client.chunk_left -= n;
+            if (client.chunk_left == 0)
+            {
+                client.state = HTTP_CLIENT_CHUNK_END;
+            }
+        }
+        else
+        {
+            // Lines: status, headers, chunk sizes and trailer
+            char c = pbuf_get_at(p, offset++);
+            consumed++;
+            if (c == '\n')
+            {
+                if (client.state == HTTP_CLIENT_CHUNK_END)
+                {
+                    client.state = HTTP_CLIENT_CHUNK_SIZE;
+                }
+                else if (!http_client_line())
+                {
+                    DPRINTF("Invalid HTTP response\n");
+                    tcp_recved(pcb, consumed);
+                    pbuf_free(p);
+                    http_client_finish(HTTPC_RESULT_ERR_SVR_RESP, ERR_VAL);
+                    return client_aborted ? ERR_ABRT : ERR_OK;
+                }
+                client.line_len = 0;
+            }
+            else if ((c != '\r') && (client.line_len < HTTP_CLIENT_LINE_SIZE - 1))
+            {
+                client.line[client.line_len++] = c;
+            }
+        }
+    }
+    if (p != NULL)
+    {
+        // What is left of the pbuf was not delivered to the body callback
+        consumed += p->tot_len - offset;
+        pbuf_free(p);
+    }
+    if ((consumed > 0) && (client.pcb != NULL))
+    {
+        tcp_recved(pcb, consumed);
+    }
+    if (client.state == HTTP_CLIENT_DONE)
+    {
+        http_client_finish(result, result == HTTPC_RESULT_OK ? ERR_OK : ERR_MEM);
+    }
+    return client_aborted ? ERR_ABRT : ERR_OK;
+}
+
+static void http_client_error(void *arg, err_t err)
+{
+    DPRINTF("HTTP connection error: %d\n", err);
+    client.pcb = NULL; // Already freed by lwIP
+    if ((client.state == HTTP_CLIENT_IDLE) || http_client_retry())
+    {
+        return;
+    }
+    http_client_finish(client.state == HTTP_CLIENT_CONNECTING ? HTTPC_RESULT_ERR_CONNECT : HTTPC_RESULT_ERR_CLOSED, err);
+}
+
+// Send the request. It is kept until the response starts, in case it must be sent again
+static void http_client_send(void)
+{
+    client.state = HTTP_CLIENT_STATUS;
+    stats.last_connect_us = (uint32_t)(time_us_64() - client.start_us);
+    err_t err = tcp_write(client.pcb, client.req, client.req_len, TCP_WRITE_FLAG_COPY);
+    if (err == ERR_OK)
+    {
+        err = tcp_output(client.pcb);
+    }
+    if (err != ERR_OK)
+    {
+        http_client_finish(HTTPC_RESULT_ERR_MEM, err);
+    }
+}
+
+static err_t http_client_connected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    if (err != ERR_OK)
+    {
+        http_client_finish(HTTPC_RESULT_ERR_CONNECT, err);
+        return ERR_OK;
+    }
+    client_aborted = false;
+    http_client_send();
+    return client_aborted ? ERR_ABRT : ERR_OK;
+}
+
+static void http_client_connect(void)
+{
+    client.pcb = tcp_new_ip_type(IP_GET_TYPE(&client.addr));
+    if (client.pcb == NULL)
+    {
+        http_client_finish(HTTPC_RESULT_ERR_MEM, ERR_MEM);
+        return;
+    }
+    client.state = HTTP_CLIENT_CONNECTING;
+    tcp_arg(client.pcb, &client);
+    tcp_recv(client.pcb, http_client_recv);
+    tcp_err(client.pcb, http_client_error);
+    err_t err = tcp_connect(client.pcb, &client.addr, client.port, http_client_connected);
+    if (err != ERR_OK)
+    {
+        http_client_finish(HTTPC_RESULT_ERR_CONNECT, err);
+    }
+}
+
+static void http_client_dns_found(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    if ((client.state != HTTP_CLIENT_RESOLVING) || (strcmp(name, client.host) != 0))
+    {
+        return; // Aborted while resolving
+    }
+    if (ipaddr == NULL)
+    {
+        DPRINTF("DNS lookup of %s failed\n", name);
+        http_client_finish(HTTPC_RESULT_ERR_HOSTNAME, ERR_ARG);
+        return;
+    }
+    client.addr = *ipaddr;
+    http_client_connect();
+}
+
+/**
+ * @brief Starts a GET request.
+ *
+ * The callbacks are called from the network polling, as with httpc_get_file_dns().
+ * The result callback is always called once if the request starts.
+ *
+ * @param host The server.
+ * @param port The port of the server.
+ * @param uri The path of the resource.
+ * @param request The extra headers and the callbacks of the request.
+ *
+ * @return ERR_OK if the request started.
+ */
+err_t http_get(const char *host, u16_t port, const char *uri, const HttpRequest *request)
+{
+    if (client.state != HTTP_CLIENT_IDLE)
+    {
+        DPRINTF("HTTP client busy. Aborting the previous request\n");
+        http_abort();
+    }
+    if (strlen(host) >= HTTP_CLIENT_HOST_SIZE)
+    {
+        return ERR_ARG;
+    }
+    client.req = malloc(HTTP_CLIENT_REQUEST_SIZE);
+    if (client.req == NULL)
+    {
+        return ERR_MEM;
+    }
+    // The Host header has the port when it's not the default one
+    char host_header[HTTP_CLIENT_HOST_SIZE + 6];
+    snprintf(host_header, sizeof(host_header), (port != HTTP_CLIENT_PORT) ? "%s:%u" : "%s", host, port);
+    int len = snprintf(client.req, HTTP_CLIENT_REQUEST_SIZE,
+                       "GET %s HTTP/1.1\r\n"
+                       "Host: %s\r\n"
+                       "User-Agent: " HTTP_CLIENT_USER_AGENT "\r\n"
+                       "Accept: */*\r\n"
+                       "%s"
+                       "\r\n",
+                       uri, host_header, request->headers ? request->headers : "");
+    if ((len < 0) || (len >= HTTP_CLIENT_REQUEST_SIZE))
+    {
+        free(client.req);
+        client.req = NULL;
+        return ERR_ARG;
+    }
+    client.req_len = len;
+    client.request = *request;
+    client.start_us = time_us_64();
+    stats.requests++;
+
+    // A connection kept open is used if it is to the same server and it has not been idle for too long
+    bool same_server = (client.pcb != NULL) && (strcmp(client.host, host) == 0) && (client.port == port);
+    if ((client.pcb != NULL) && (!same_server || (client.start_us - client.idle_us > HTTP_CLIENT_KEEP_ALIVE_MS * 1000)))
+    {
+        http_client_close_pcb();
+    }
+    strcpy(client.host, host);
+    client.port = port;
+    // The previous caller could have left part of its body unread
+    http_client_ack_unacked();
+    client.reused = (client.pcb != NULL);
+    client.keep_alive = true;
+    client.status = 0;
+    client.content_length = -1;
+    client.chunked = false;
+    client.chunk_left = 0;
+    client.rx_body = 0;
+    client.line_len = 0;
+
+    if (client.reused)
+    {
+        stats.reused++;
+        http_client_send();
+        return ERR_OK;
+    }
+
+    client.state = HTTP_CLIENT_RESOLVING;
+    err_t err = dns_gethostbyname(client.host, &client.addr, http_client_dns_found, NULL);
+    if (err == ERR_OK)
+    {
+        // In the DNS table of lwIP, until its TTL expires
+        stats.dns_cached++;
+        http_client_connect();
+    }
+    else if (err == ERR_INPROGRESS)
+    {
+        stats.dns_lookups++;
+    }
+    else
+    {
+        DPRINTF("DNS lookup of %s failed: %d\n", host, err);
+        free(client.req);
+        client.req = NULL;
+        client.state = HTTP_CLIENT_IDLE;
+        return err;
+    }
+    return ERR_OK;
+}
+
+/**
+ * @brief Cancels the request in progress, without calling its callbacks.
+ *
+ * Must be called before returning when a caller gives up waiting, because the callbacks
+ * can point to its stack.
+ */
+void http_abort(void)
+{
+    if (client.pcb != NULL)
+    {
+        tcp_arg(client.pcb, NULL);
+        tcp_recv(client.pcb, NULL);
+        tcp_err(client.pcb, NULL);
+        tcp_abort(client.pcb);
+        client.pcb = NULL;
+    }
+    client.rx_unacked = 0;
+    if (client.req != NULL)
+    {
+        free(client.req);
+        client.req = NULL;
+    }
+    memset(&client.request, 0, sizeof(client.request));
+    client.state = HTTP_CLIENT_IDLE;
+}
+
+/**
+ * @brief Acknowledges bytes of the body read by the caller, opening the receive window.
+ *
+ * Replaces tcp_recved() in the body callbacks. It can be called after the result callback:
+ * the connection can be kept open for the next request, and it must get its window back.
+ * Nothing is sent if the connection is already closed.
+ *
+ * @param len The bytes read.
+ */
+void http_recved(u16_t len)
+{
+    if (len > client.rx_unacked)
+    {
+        len = client.rx_unacked;
+    }
+    client.rx_unacked -= len;
+    if ((client.pcb != NULL) && (len > 0))
+    {
+        tcp_recved(client.pcb, len);
+    }
+}
+
+/**
+ * @brief Gets the counters and the times of the requests.
+ *
+ * @param out Where the statistics are copied.
+ */
+void http_client_stats(HttpClientStats *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,107 @@
+/**
+ * File: catalog.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Header file for the push parser of the ROM and floppy catalogs downloaded
+ */
+
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "pico/stdlib.h"
+
+#include "sd_card.h"
+#include "f_util.h"
+
+#include "zipfs.h"
+
+#define CATALOG_ARENA_SIZE 32768 // Bytes of the records and strings of a catalog. Fixed, whatever the size of the catalog
+#define CATALOG_FIELD_SIZE 256   // Max length of a field. Longer fields are truncated
+
+// The catalogs downloaded are kept as indexes in the microSD card. An index is used without asking
+// the server for CATALOG_REVALIDATE_MINUTES. Then it is revalidated with If-None-Match and
+// If-Modified-Since. It is also used when the server can not be reached
+#define CATALOG_INDEX_FOLDER "/.catalog"
+#define CATALOG_INDEX_EXTENSION ".idx"
+#define CATALOG_INDEX_MAGIC 0x58444943 // "CIDX"
+#define CATALOG_INDEX_SEPARATOR ';'
+#define CATALOG_INDEX_PATH_SIZE 64
+#define CATALOG_INDEX_BUFFER_SIZE 512
+#define CATALOG_VALIDATOR_SIZE 64      // Longest ETag or Last-Modified kept
+#define CATALOG_REVALIDATE_MINUTES 60
+#define CATALOG_INDEX_RECENT 8         // Indexes with the time of their last validation
+
+typedef void (*CatalogFieldCallback)(uint8_t field, const char *value, uint16_t len);
+typedef void (*CatalogRecordCallback)(uint8_t fields);
+
+typedef struct
+{
+    uint8_t *base; /* Memory of the arena. The first record is at the start */
+    uint32_t size; /* Bytes of the arena */
+    uint32_t used; /* Bytes allocated */
+} CatalogArena;
+
+typedef struct
+{
+    char separator;                  /* Separator of the fields */
+    uint8_t max_fields;              /* A record ends after this many fields, even without a new line. 0: only at the new line */
+    bool skip_header;                /* The first record is the header and it is ignored */
+    bool quoted;                     /* Inside a quoted field */
+    bool quote_pending;              /* Quote found in a quoted field: the closing one or the first of an escaped one */
+    bool in_record;                  /* Something read in the current record */
+    uint8_t field;                   /* Index of the field being read */
+    uint16_t len;                    /* Bytes of the field being read */
+    char value[CATALOG_FIELD_SIZE];  /* Field being read */
+    CatalogFieldCallback field_fn;   /* Called at the end of each field */
+    CatalogRecordCallback record_fn; /* Called at the end of each record */
+} CatalogParser;
+
+typedef struct
+{
+    uint32_t magic;                             /* CATALOG_INDEX_MAGIC. 0 while the index is written */
+    uint32_t url_hash;                          /* CRC32 of the URL of the catalog */
+    uint32_t count;                             /* Records of the index */
+    char etag[CATALOG_VALIDATOR_SIZE];          /* ETag of the catalog. Empty if none */
+    char last_modified[CATALOG_VALIDATOR_SIZE]; /* Last-Modified of the catalog. Empty if none */
+} CatalogIndexHeader;
+
+typedef struct
+{
+    FIL file;                               /* The index */
+    CatalogIndexHeader header;              /* Written again when the index is closed */
+    uint8_t fields;                         /* Fields written in the current record */
+    uint16_t len;                           /* Bytes in the buffer */
+    char buffer[CATALOG_INDEX_BUFFER_SIZE]; /* Records not written yet */
+    bool error;                             /* A write failed. The index is discarded */
+} CatalogIndexWriter;
+
+bool catalog_arena_init(CatalogArena *arena, uint32_t size);
+void *catalog_arena_alloc(CatalogArena *arena, uint32_t size);
+char *catalog_arena_strndup(CatalogArena *arena, const char *value, uint16_t len);
+
+void catalog_parser_init(CatalogParser *parser, char separator, uint8_t max_fields, bool skip_header,
+                         CatalogFieldCallback field_fn, CatalogRecordCallback record_fn);
+void catalog_parser_feed(CatalogParser *parser, const char *data, uint16_t len);
+void catalog_parser_finish(CatalogParser *parser);
+
+void catalog_index_path(char *path, const char *name);
+bool catalog_index_header(const char *path, const char *url, CatalogIndexHeader *header);
+bool catalog_index_load(const char *path, CatalogParser *parser);
+bool catalog_index_create(CatalogIndexWriter *writer, const char *path, const char *url, const char *etag, const char *last_modified);
+void catalog_index_field(CatalogIndexWriter *writer, const char *value);
+void catalog_index_end_record(CatalogIndexWriter *writer);
+bool catalog_index_close(CatalogIndexWriter *writer);
+bool catalog_index_fresh(const char *path);
+void catalog_index_validated(const char *path);
+
+#endif // CATALOG_H
@@ -111,6 +111,7 @@
 #define GEMDRVEMUL_WRITE_BUFF_CHECK (APP_GEMDRVEMUL << 8 | 0x89) // Write to sdCard the write buffer check call
 #define GEMDRVEMUL_DTA_EXIST_CALL (APP_GEMDRVEMUL << 8 | 0x8A)   // Check if the DTA exists in the rp2040 memory
 #define GEMDRVEMUL_DTA_RELEASE_CALL (APP_GEMDRVEMUL << 8 | 0x8B) // Release the DTA from the rp2040 memory
+#define GEMDRVEMUL_FUNZIP_CALL (APP_GEMDRVEMUL << 8 | 0x90)      // Extract a ZIP archive into a folder in the rp2040
 
 typedef struct
 {
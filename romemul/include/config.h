@@ -24,6 +24,7 @@
 #include "pico/cyw43_arch.h"
 
 #include "include/network.h"
+#include "flashwrite.h"
 #include "hardware/resets.h"
 
 // sync values here as well : atarist-sidecart-firmware/configurator/src/include/config.h
@@ -87,6 +88,68 @@
 #define TYPE_STRING ((uint16_t)1)
 #define TYPE_BOOL ((uint16_t)2)
 
+// Key, type and default value of the entries, in the order they have in configData.
+// The PARAM_ name of each key is used by the configurator and stored in the flash
+#define CONFIG_ENTRIES(X) \
+    X(BOOT_FEATURE, TYPE_STRING, "CONFIGURATOR")                             \
+    X(CONFIGURATOR_DARK, TYPE_BOOL, "false")                                 \
+    X(DELAY_ROM_EMULATION, TYPE_BOOL, "false")                               \
+    X(DOWNLOAD_TIMEOUT_SEC, TYPE_INT, "60")                                  \
+    X(FILE_COUNT_ENABLED, TYPE_BOOL, "false")                                \
+    X(FLOPPIES_FOLDER, TYPE_STRING, "/floppies")                             \
+    X(FLOPPY_BOOT_ENABLED, TYPE_BOOL, "true")                                \
+    X(FLOPPY_BUFFER_TYPE, TYPE_INT, "0")                                     \
+    X(FLOPPY_DB_URL, TYPE_STRING, "http://ataristdb.sidecartridge.com")      \
+    X(FLOPPY_IMAGE_A, TYPE_STRING, "")                                       \
+    X(FLOPPY_IMAGE_B, TYPE_STRING, "")                                       \
+    X(FLOPPY_NET_ENABLED, TYPE_BOOL, "false")                                \
+    X(FLOPPY_NET_TOUT_SEC, TYPE_INT, "45")                                   \
+    X(FLOPPY_XBIOS_ENABLED, TYPE_BOOL, "true")                               \
+    X(GEMDRIVE_BUFF_TYPE, TYPE_INT, "0")                                     \
+    X(GEMDRIVE_DRIVE, TYPE_STRING, "C")                                      \
+    X(GEMDRIVE_FOLDERS, TYPE_STRING, "/hd")                                  \
+    X(GEMDRIVE_RTC, TYPE_BOOL, "true")                                       \
+    X(GEMDRIVE_TIMEOUT_SEC, TYPE_INT, "45")                                  \
+    X(GEMDRIVE_FAKEFLOPPY, TYPE_BOOL, "true")                                \
+    X(HOSTNAME, TYPE_STRING, "sidecart")                                     \
+    X(LASTEST_RELEASE_URL, TYPE_STRING, LATEST_RELEASE_URL)                  \
+    X(MENU_REFRESH_SEC, TYPE_INT, "3")                                       \
+    X(NETWORK_STATUS_SEC, TYPE_INT, NETWORK_POLL_INTERVAL_STR)               \
+    X(ROMS_CSV_URL, TYPE_STRING, "http://roms.sidecartridge.com/roms.csv")   \
+    X(ROMS_FOLDER, TYPE_STRING, "/roms")                                     \
+    X(ROMS_YAML_URL, TYPE_STRING, "http://roms.sidecartridge.com/roms.json") \
+    X(RTC_NTP_SERVER_HOST, TYPE_STRING, "pool.ntp.org")                      \
+    X(RTC_NTP_SERVER_PORT, TYPE_INT, "123")                                  \
+    X(RTC_TYPE, TYPE_STRING, "SIDECART")                                     \
+    X(RTC_UTC_OFFSET, TYPE_STRING, "+1")                                     \
+    X(RTC_Y2K_PATCH, TYPE_BOOL, "true")                                      \
+    X(SAFE_CONFIG_REBOOT, TYPE_BOOL, "true")                                 \
+    X(SD_MASS_STORAGE, TYPE_BOOL, "true")                                    \
+    X(SD_BAUD_RATE_KB, TYPE_INT, "12500")                                    \
+    X(WIFI_AUTH, TYPE_INT, "")                                               \
+    X(WIFI_CONNECT_TIMEOUT, TYPE_INT, "30")                                  \
+    X(WIFI_COUNTRY, TYPE_STRING, "")                                         \
+    X(WIFI_DHCP, TYPE_BOOL, "true")                                          \
+    X(WIFI_DNS, TYPE_STRING, "8.8.8.8")                                      \
+    X(WIFI_GATEWAY, TYPE_STRING, "")                                         \
+    X(WIFI_IP, TYPE_STRING, "")                                              \
+    X(WIFI_NETMASK, TYPE_STRING, "")                                         \
+    X(WIFI_PASSWORD, TYPE_STRING, "")                                        \
+    X(WIFI_POWER, TYPE_INT, "0")                                             \
+    X(WIFI_RSSI, TYPE_BOOL, "false")                                         \
+    X(WIFI_SCAN_SECONDS, TYPE_INT, WIFI_SCAN_POLL_COUNTER_STR)               \
+    X(WIFI_SSID, TYPE_STRING, "")
+
+#define CONFIG_MAX_LISTENERS 8 // Functions notified of changes in the entries
+
+// The config flash region is a journal of two sectors. Each write appends the entries changed,
+// and when the active sector is full the entries different from the defaults are compacted
+// into the other one
+#define CONFIG_JOURNAL_SECTORS 2
+#define CONFIG_JOURNAL_TAG 0xA5 // First byte of a record. Free space is 0xFF
+// Offset in the second sector of the copy written while migrating an old config of 8KB, after its end
+#define CONFIG_JOURNAL_STAGING_OFFSET (sizeof(ConfigData) - FLASH_SECTOR_SIZE)
+
 #define STRINGIFY_HELPER(x) #x
 #define STRINGIFY(x) STRINGIFY_HELPER(x)
 
@@ -106,6 +169,31 @@ typedef struct
     size_t count;
 } ConfigData;
 
+// Index of each entry in configData, for the typed access functions
+typedef enum
+{
+#define CONFIG_KEY_ENUM(name, type, value) CONFIG_KEY_##name,
+    CONFIG_ENTRIES(CONFIG_KEY_ENUM)
+#undef CONFIG_KEY_ENUM
+    CONFIG_KEY_COUNT
+} ConfigKey;
+
+typedef void (*ConfigChangeCallback)(ConfigKey key);
+
+typedef struct
+{
+    uint32_t magic;    /* CONFIG_MAGIC | CONFIG_VERSION_JOURNAL */
+    uint32_t sequence; /* Incremented on each compaction. The sector with the highest one is active */
+} ConfigJournalHeader;
+
+typedef struct
+{
+    uint8_t tag;       /* CONFIG_JOURNAL_TAG */
+    uint8_t type;      /* DataType of the entry */
+    uint8_t key_len;   /* Bytes of the key that follows */
+    uint8_t value_len; /* Bytes of the value after the key. Then a checksum byte */
+} ConfigJournalRecord;
+
 extern ConfigData configData;
 
 // Load functions. Should be used only at startup
@@ -123,8 +211,15 @@ void print_config_table();
 // Swap the text fields of the structure to be readable by the host
 void swap_data(uint16_t *dest_ptr_word);
 
+// Lookup by name. Use it only for the keys coming from the configurator
 ConfigEntry *find_entry(const char *key);
 
+// Typed access. The integer and boolean values are parsed when they change
+const char *config_string(ConfigKey key);
+int config_int(ConfigKey key);
+bool config_bool(ConfigKey key);
+int config_subscribe(ConfigKey key, ConfigChangeCallback callback);
+
 int put_bool(const char key[MAX_KEY_LENGTH], bool value);
 int put_string(const char key[MAX_KEY_LENGTH], const char *value);
 int put_integer(const char key[MAX_KEY_LENGTH], int value);
@@ -0,0 +1,35 @@
+/**
+ * File: ffpool.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Header file for the pool of FatFs long file name working buffers
+ */
+
+#ifndef FFPOOL_H
+#define FFPOOL_H
+
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hardware/sync.h>
+#include "ff.h"
+
+// Working buffer of FatFs for a long file name, plus the exFAT directory entries
+#define FF_POOL_BUFFER_SIZE ((FF_MAX_LFN + 1) * 2 + (FF_MAX_LFN + 44) / 15 * 32)
+#define FF_POOL_BUFFERS_PER_CORE 1 // One FatFs call in progress per core. Nested calls use the heap
+
+typedef struct
+{
+    uint32_t pooled;    /* Buffers taken from the pool */
+    uint32_t contended; /* Buffers taken from the heap because the pool of the core was in use */
+    uint32_t oversized; /* Buffers taken from the heap because they did not fit in the pool */
+} FfPoolStats;
+
+void ff_pool_stats(uint core, FfPoolStats *stats);
+
+#endif // FFPOOL_H
@@ -12,9 +12,11 @@
 #include "sd_card.h"
 #include "f_util.h"
 #include "hw_config.h"
+#include "diskio.h"
 
 #include "config.h"
 #include "memfunc.h"
+#include "zipfs.h"
 
 #define GEMDOS_FILE_ATTRIB_VOLUME_LABEL 8
 
@@ -28,6 +30,17 @@
 
 #define STORAGE_POLL_INTERVAL 30000
 
+#define SD_SPEED_FILE_NAME "/.sdspeed" // Fastest stable SPI rate of each card. One "serial sectors kHz" line per card
+#define SD_PROBE_SECTORS 32            // Sectors read at each SPI rate probed. Enough for multi-block transfers
+#define SD_SPEED_MAX_CARDS 8           // Cards remembered in the speed file
+#define SD_SPI_MAX_RETRIES 3           // Retries of a failed transfer, one SPI rate step slower each time
+
+#define FOLDER_COUNT_FILE_NAME "/.fcount" // File counts of the ROMs, floppies and hard disks folders
+#define FOLDER_COUNT_MAGIC 0x464E4354     // "FCNT"
+#define FOLDER_COUNT_FOLDERS 3            // ROMs, floppies and hard disks folders
+#define FOLDER_COUNT_MAX_DEPTH 8          // Levels of subfolders counted
+#define FOLDER_COUNT_BUDGET_MS 5          // Time counting files in each iteration of the main loop
+
 #define FS_ST_READONLY 0x1 // Read only
 #define FS_ST_HIDDEN 0x2   // Hidden
 #define FS_ST_SYSTEM 0x4   // System
@@ -65,6 +78,32 @@ typedef struct sd_data
     uint16_t harddisks_folder_status;         // Hard disks folder status
 } SdCardData;
 
+typedef enum
+{
+    FOLDER_COUNT_ROMS = 0,
+    FOLDER_COUNT_FLOPPIES,
+    FOLDER_COUNT_HARDDISKS,
+} FolderCountIndex;
+
+typedef struct
+{
+    char path[MAX_FOLDER_LENGTH]; /* Folder counted */
+    uint16_t fdate;               /* Date of the folder when counted. A different date means a new folder */
+    uint16_t ftime;               /* Time of the folder when counted */
+    uint32_t count;               /* Files in the folder and its subfolders */
+    uint8_t valid;                /* The count belongs to the folder */
+    uint8_t pending;              /* The folder must be counted again */
+} FolderCount;
+
+typedef struct
+{
+    int8_t index;                       /* Folder being counted. -1 if none */
+    uint8_t depth;                      /* Directories open */
+    uint32_t count;                     /* Files found so far */
+    DIR dirs[FOLDER_COUNT_MAX_DEPTH];   /* Directories open, from the folder down */
+    char path[256];                     /* Path of the deepest directory open */
+} FolderCountWalk;
+
 typedef struct
 {
     uint16_t ID;              /* Word : ID marker, should be $0E0F */
@@ -93,11 +132,14 @@ FRESULT copy_file(const char *folder, const char *src_filename, const char *dest
 int directory_exists(const char *dir);
 void get_card_info(FATFS *fs_ptr, uint32_t *totalSize_MB, uint32_t *freeSpace_MB);
 uint32_t calculate_folder_count(const char *path);
+uint32_t folder_count_get(FolderCountIndex index, const char *path);
+void folder_count_adjust(const char *file_path, int32_t delta);
+bool folder_count_task(uint32_t budget_ms);
 void get_sdcard_data(FATFS *fs, SdCardData *sd_data, const SdCardData *sd_data_src, bool is_fcount_enabled);
 bool is_sdcard_mounted(FATFS *fs_ptr);
 char **show_dir_files(const char *dir, int *num_files);
 void release_memory_files(char **files, int num_files);
-int load_rom_from_fs(char *path, char *filename, uint32_t rom_load_offset);
+int load_rom_from_fs(const char *path, char *filename, uint32_t rom_load_offset);
 char **filter(char **file_list, int file_count, int *num_files, const char **allowed_extensions, size_t num_extensions);
 void store_file_list(char **file_list, int num_files, uint8_t *memory_location);
 FRESULT read_and_trim_file(const char *path, char **content, size_t max_length);
@@ -115,5 +157,6 @@ void extract_filename(const char *url, char filename[256]);
 bool get_dir_files(const char *dir, const char *allowed_extensions[], char ***files, int *num_files, FATFS *fs_ptr);
 bool is_floppy_rw(const char *filename);
 void change_spi_speed();
+uint32_t sd_spi_retries();
 
 #endif // FILESYS_H
\ No newline at end of file
@@ -0,0 +1,48 @@
+/**
+ * File: flashwrite.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Header for flashwrite.c which erases and programs the flash keeping the ROM3 protocol alive
+ */
+
+#ifndef FLASHWRITE_H
+#define FLASHWRITE_H
+
+#include "debug.h"
+#include "constants.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+#include <hardware/irq.h>
+#include <hardware/timer.h>
+#include "hardware/regs/m0plus.h"
+
+#include "tprotocol.h"
+
+#define FLASH_WRITE_PROTOCOL_IRQ DMA_IRQ_1              // IRQ of the ROM3 protocol. Not masked while writing the flash if RAM safe
+#define FLASH_WRITE_PROGRAM_SLICE (FLASH_PAGE_SIZE * 4) // Bytes programmed in each masked window. Multiple of FLASH_PAGE_SIZE
+
+typedef struct
+{
+    uint32_t erases;            /* Sectors erased */
+    uint32_t programs;          /* Slices programmed */
+    uint32_t max_masked_us;     /* Longest window with the other IRQs masked */
+    uint32_t last_masked_us;    /* Window of the last operation */
+    uint32_t max_blackout_us;   /* Longest time the ROM3 protocol IRQ could not run */
+    uint32_t max_range_us;      /* Longest erase or program of a whole range. Masked before the slicing */
+    uint32_t deferred_commands; /* ROM3 commands queued until the flash operation ended */
+    uint32_t dropped_commands;  /* ROM3 commands lost because the queue was full */
+} FlashWriteStats;
+
+void flash_write_erase(uint32_t flash_offs, size_t count);
+void flash_write_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+void flash_write_stats(FlashWriteStats *stats);
+void flash_write_report(const char *context);
+void flash_write_keep_protocol_irq(bool keep);
+
+#endif // FLASHWRITE_H
@@ -27,6 +27,8 @@
 #include "pico/cyw43_arch.h"
 #include "hardware/rtc.h"
 
+#include "lwip/apps/httpd.h"
+
 #include "sd_card.h"
 #include "f_util.h"
 
@@ -38,9 +40,17 @@
 #include "memfunc.h"
 #include "filesys.h"
 #include "rtcemul.h"
+#include "httpd.h"
 
 #define DEFAULT_FOPEN_READ_BUFFER_SIZE 16384
 #define DEFAULT_FWRITE_BUFFER_SIZE 2048
+#define WRITE_BEHIND_BUFFER_SIZE 16384      // Bytes written accumulated before writing them to the card
+#define WRITE_BEHIND_IDLE_TIMEOUT_MS 500    // Pending writes are flushed after this time without commands
+#define DFREE_SCAN_SECTORS 4                // Sectors of the FAT counted in each idle pass looking for free clusters
+#define DFREE_REVALIDATE_INTERVAL_SEC 600   // Seconds between recounts of the free clusters when idle. 0 disables it
+#define FILEOP_BUFFER_SIZE 8192             // Bytes copied in each step of a file operation running in the RP2040
+#define FILEOP_MAX_DEPTH 6                  // Nested folders walked by a file operation. Each one keeps a FatFs lock while open
+#define FILEOP_PATH_LENGTH 256              // Max length of the paths walked by a file operation
 #define FIRST_FILE_DESCRIPTOR 16384
 #define PRG_STRUCT_SIZE 28 // Size of the GEMDOS structure in the executable header file (PRG)
 #define SHARED_VARIABLES_MAXSIZE 32
@@ -107,6 +117,16 @@
 
 #define GEMDRVEMUL_EXEC_PD (GEMDRVEMUL_SHARED_VARIABLES + 256) // shared variables + 256 bytes
 
+// Progress of the file operations running in the RP2040. The ST polls them
+#define GEMDRVEMUL_FILEOP_STATUS (GEMDRVEMUL_EXEC_PD + PDSIZE)   // exec pd + PDSIZE bytes. FILEOP_RUNNING or GEMDOS error code
+#define GEMDRVEMUL_FILEOP_FILES (GEMDRVEMUL_FILEOP_STATUS + 4)   // fileop status + 4 bytes. Files and folders processed
+#define GEMDRVEMUL_FILEOP_BYTES (GEMDRVEMUL_FILEOP_FILES + 4)    // fileop files + 4 bytes. Bytes copied
+
+// From here the shared memory is not used by the ST driver. Only the RP2040 uses it
+#define GEMDRVEMUL_PRIVATE_AREA 0x8000                           // Must be above GEMDRVEMUL_FILEOP_BYTES + 4 bytes
+#define GEMDRVEMUL_READ_AHEAD_BUFF (GEMDRVEMUL_PRIVATE_AREA)     // read-ahead window of DEFAULT_FOPEN_READ_BUFFER_SIZE bytes
+#define GEMDRVEMUL_WRITE_BEHIND_BUFF (GEMDRVEMUL_READ_AHEAD_BUFF + DEFAULT_FOPEN_READ_BUFFER_SIZE) // read-ahead window + DEFAULT_FOPEN_READ_BUFFER_SIZE bytes
+
 // Atari ST FATTRIB flag
 #define FATTRIB_INQUIRE 0x00
 #define FATTRIB_SET 0x01
@@ -115,6 +135,14 @@
 #define FDATETIME_INQUIRE 0x00
 #define FDATETIME_SET 0x01
 
+// File operations running in the RP2040
+#define FILEOP_NONE 0
+#define FILEOP_COPY 1    // Copy a file or a folder and its content
+#define FILEOP_DELTREE 2 // Delete a folder and its content
+#define FILEOP_UNZIP 3   // Extract a ZIP archive into a folder
+#define FILEOP_MOVE 4    // Move a file or a folder. Done at once with f_rename
+#define FILEOP_RUNNING 1 // Value of GEMDRVEMUL_FILEOP_STATUS while the operation is running
+
 // Atari ST GEMDOS error codes
 #define GEMDOS_EOK 0       // OK
 #define GEMDOS_ERROR -1    // Generic error
@@ -152,8 +180,17 @@
 #define GEMDOS_EMOUNT -200 // Mount point crossed (indicator)
 
 #define DTA_HASH_TABLE_SIZE 512
+#define DTA_POOL_SIZE 16         // Max number of DTAs tracked at the same time. Older ones are evicted (LRU)
+#define DTA_POOL_PATTERN_SIZE 64 // Max length of the search pattern of a Fsfirst/Fsnext search
+#define DIR_CACHE_SLOTS 2          // Number of directory snapshots kept in RAM
+#define DIR_CACHE_MAX_ENTRIES 128  // Max entries of a snapshot. Bigger directories are read with FatFs every time
+#define DIR_CACHE_LARGE_SLOTS 4    // Number of directories remembered as too big for a snapshot
+#define PATH_CACHE_SLOTS 4          // Number of Atari ST paths converted to FatFs paths kept in RAM
+#define PEXEC_RELOCATION_BLOCK_SIZE 256 // Bytes of the fixup table of a program read at a time
+#define READ_AHEAD_SEQUENTIAL_READS 1 // Consecutive sequential reads of a file needed to start prefetching
 
 #define PDCLSIZE 0x80 /*  size of command line in bytes  */
+#define PDSIZE 0x100  /*  size of the basepage. TEXT starts after it */
 #define MAXDEVS 16    /* max number of block devices */
 
 typedef struct
@@ -187,12 +224,59 @@ typedef struct DTANode
     uint32_t key;
     uint32_t attribs;
     DTA data;
-    DIR *dj;
-    FILINFO *fno;
-    TCHAR *pat; /* Pointer to the name matching pattern. Hack for dir_findfirst().  */
-    struct DTANode *next;
+    DIR *dj;                              /* Points to dir_obj while a search is active, NULL otherwise */
+    FILINFO *fno;                         /* Points to fno_obj while a search is active, NULL otherwise */
+    TCHAR *pat;                           /* Pointer to the name matching pattern. Hack for dir_findfirst().  */
+    bool in_use;                          /* The slot is assigned to a DTA address */
+    uint8_t next;                         /* Next slot in the same hash bucket (slot index + 1, 0 = end) */
+    uint32_t last_used;                   /* LRU tick of the last access */
+    DIR dir_obj;                          /* Embedded directory object */
+    FILINFO fno_obj;                      /* Embedded file information */
+    TCHAR pat_buf[DTA_POOL_PATTERN_SIZE]; /* Embedded copy of the search pattern */
+    bool cached;                          /* The search runs over a directory snapshot instead of FatFs */
+    uint8_t cache_slot;                   /* Directory snapshot slot of the search */
+    uint16_t cache_pos;                   /* Next entry to check in the directory snapshot */
+    uint32_t cache_gen;                   /* Generation of the directory snapshot when the search started */
+    char cache_path[MAX_FOLDER_LENGTH];   /* Internal path of the directory searched */
 } DTANode;
 
+typedef struct
+{
+    char fname[14];     /* 8.3 name as seen by the Atari ST */
+    uint8_t fattrib;    /* FatFs attributes */
+    uint8_t st_attribs; /* Atari ST attributes */
+    uint16_t fdate;     /* Modified date */
+    uint16_t ftime;     /* Modified time */
+    uint32_t fsize;     /* File size */
+} DirCacheEntry;
+
+typedef struct
+{
+    bool valid;                                   /* The snapshot matches the content of the directory */
+    uint32_t generation;                          /* Changes every time the slot is rebuilt */
+    uint32_t last_used;                           /* LRU tick of the last access */
+    uint16_t count;                               /* Number of entries in the snapshot */
+    char path[MAX_FOLDER_LENGTH];                 /* Internal path of the directory */
+    DirCacheEntry entries[DIR_CACHE_MAX_ENTRIES]; /* Converted entries in directory order */
+} DirCache;
+
+typedef struct
+{
+    bool valid;                   /* The directory was too big the last time it was read */
+    uint32_t last_used;           /* LRU tick of the last access */
+    uint16_t fdate;               /* Modified date of the directory when it was read */
+    uint16_t ftime;               /* Modified time of the directory when it was read */
+    char path[MAX_FOLDER_LENGTH]; /* Internal path of the directory */
+} DirCacheLarge;
+
+typedef struct
+{
+    bool valid;                        /* The entry can be used */
+    uint32_t last_used;                /* LRU tick of the last access */
+    char st_path[MAX_FOLDER_LENGTH];   /* Path as sent by the Atari ST */
+    char real_path[MAX_FOLDER_LENGTH]; /* Internal path in the microSD card */
+} PathCacheEntry;
+
 typedef struct FileDescriptors
 {
     char fpath[128];
@@ -200,6 +284,9 @@ typedef struct FileDescriptors
     FIL fobject;
     struct FileDescriptors *next;
     uint32_t offset;
+    uint32_t last_read_end;    /* Offset after the last read. Used to detect sequential access */
+    uint16_t sequential_reads; /* Number of consecutive sequential reads */
+    FRESULT write_error;       /* Error of a write-behind flush not reported yet to the ST */
 } FileDescriptors;
 
 typedef struct _pd PD;
@@ -259,6 +346,52 @@ typedef struct ExecHeader
     uint16_t absflag;
 } ExecHeader;
 
+typedef struct
+{
+    bool active;           /* The program is relocated when the ST reads it */
+    int fd;                /* File descriptor of the program opened by the ST */
+    FIL fobject;           /* Own handle of the program to read the fixup table */
+    uint32_t base;         /* Address of the TEXT segment in the ST */
+    uint32_t image_size;   /* Size of TEXT + DATA. Only these bytes are relocated */
+    uint32_t fixup_offset; /* Offset in the file of the fixup table */
+    uint32_t table_pos;    /* Offset in the file of the next byte of the fixup table */
+    uint32_t reloc;        /* Offset from TEXT of the next longword to relocate */
+    bool done;             /* No more longwords to relocate */
+    uint32_t bound;        /* The cursor is valid for reads starting at this offset from TEXT or later */
+    uint32_t block_pos;    /* Offset in the file of the block of the fixup table in RAM */
+    uint16_t block_len;    /* Bytes of the block of the fixup table in RAM */
+    uint8_t block[PEXEC_RELOCATION_BLOCK_SIZE];
+} PexecRelocation;
+
+typedef struct
+{
+    uint8_t op;                                 /* FILEOP_NONE if nothing is running */
+    bool file_open;                             /* A file is being copied from src to dst */
+    FIL src;                                    /* File copied */
+    FIL dst;                                    /* Copy of the file */
+    uint8_t depth;                              /* Folders open in dirs */
+    DIR dirs[FILEOP_MAX_DEPTH];                 /* Folders walked. The last one is the current one */
+    uint16_t src_len[FILEOP_MAX_DEPTH];         /* Length of src_path when each folder was opened */
+    uint16_t dst_len[FILEOP_MAX_DEPTH];         /* Length of dst_path when each folder was opened */
+    char src_path[FILEOP_PATH_LENGTH];          /* Folder or file processed */
+    char dst_path[FILEOP_PATH_LENGTH];          /* Destination of the copy */
+    uint32_t files;                             /* Files and folders processed */
+    uint32_t bytes;                             /* Bytes copied */
+    uint8_t *buffer;                            /* FILEOP_BUFFER_SIZE bytes used to copy */
+    ZipArchive *zip;                            /* Archive extracted */
+    ZipStream *zstream;                         /* Entry of the archive being extracted to dst */
+    uint16_t zip_entry;                         /* Next entry of the archive to extract */
+    int32_t status;                             /* FILEOP_RUNNING, or the result of the last operation */
+} FileOperation;
+
+typedef struct
+{
+    uint8_t op;                        /* FILEOP_COPY, FILEOP_MOVE, FILEOP_DELTREE or FILEOP_NONE */
+    bool cancel;                       /* Stop the file operation running */
+    char src_path[FILEOP_PATH_LENGTH]; /* Internal path of the source */
+    char dst_path[FILEOP_PATH_LENGTH]; /* Internal path of the destination */
+} FileOperationRequest;
+
 typedef void (*IRQInterceptionCallback)();
 
 extern int read_addr_rom_dma_channel;
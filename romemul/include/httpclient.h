@@ -0,0 +1,105 @@
+/**
+ * File: httpclient.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Header for httpclient.c, a HTTP/1.1 GET client with custom request headers
+ */
+
+#ifndef HTTPCLIENT_H
+#define HTTPCLIENT_H
+
+#include "debug.h"
+#include "constants.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/apps/http_client.h"
+#include "lwip/tcp.h"
+#include "lwip/dns.h"
+
+#define HTTP_CLIENT_PORT 80
+#define HTTP_CLIENT_USER_AGENT "SidecartRP2040/" RELEASE_VERSION
+#define HTTP_CLIENT_HOST_SIZE 128    // Longest host name
+#define HTTP_CLIENT_LINE_SIZE 256    // Longest line of the response headers kept. Longer lines are truncated
+#define HTTP_CLIENT_REQUEST_SIZE 768 // Longest request, with the extra headers
+#define HTTP_CLIENT_KEEP_ALIVE_MS 15000 // Time a connection is kept open for the next request to the same server
+
+// Parsing states of the response
+#define HTTP_CLIENT_IDLE 0
+#define HTTP_CLIENT_RESOLVING 1
+#define HTTP_CLIENT_CONNECTING 2
+#define HTTP_CLIENT_STATUS 3     // Reading the status line
+#define HTTP_CLIENT_HEADERS 4    // Reading the headers
+#define HTTP_CLIENT_BODY 5       // Body with Content-Length, or until the server closes
+#define HTTP_CLIENT_CHUNK_SIZE 6 // Size line of a chunk
+#define HTTP_CLIENT_CHUNK_DATA 7 // Data of a chunk
+#define HTTP_CLIENT_CHUNK_END 8  // CRLF after the data of a chunk
+#define HTTP_CLIENT_TRAILER 9    // Headers after the last chunk
+#define HTTP_CLIENT_DONE 10
+
+typedef void (*HttpHeaderCallback)(const char *name, const char *value);
+typedef void (*HttpHeadersDoneCallback)(u32_t status, s32_t content_length);
+
+typedef struct
+{
+    const char *headers;                     /* Extra request headers, each one ending with "\r\n". NULL if none */
+    HttpHeaderCallback header_fn;            /* Called for each header of the response. Can be NULL */
+    HttpHeadersDoneCallback headers_done_fn; /* Called before the body. Can be NULL */
+    altcp_recv_fn body_fn;                   /* Body as it arrives. Must call http_recved() and pbuf_free() */
+    httpc_result_fn result_fn;               /* Called once at the end of the request */
+} HttpRequest;
+
+typedef struct
+{
+    uint32_t requests;        /* Requests started */
+    uint32_t reused;          /* Requests sent over a connection kept open */
+    uint32_t dns_cached;      /* Host names found in the DNS table of lwIP */
+    uint32_t dns_lookups;     /* Host names asked to the DNS server */
+    uint32_t last_connect_us; /* Time of the last request until it was sent: DNS and TCP handshake */
+    uint32_t last_first_us;   /* Time of the last request until the status line was received */
+    uint32_t last_total_us;   /* Time of the last request until it finished */
+    uint32_t new_done;        /* Requests finished over a new connection */
+    uint64_t new_first_us;    /* Sum of the times until the status line over a new connection */
+    uint32_t reused_done;     /* Requests finished over a connection kept open */
+    uint64_t reused_first_us; /* Sum of the times until the status line over a connection kept open */
+} HttpClientStats;
+
+typedef struct
+{
+    HttpRequest request;              /* Callbacks of the request in progress */
+    char host[HTTP_CLIENT_HOST_SIZE]; /* Server */
+    u16_t port;                       /* Port of the server */
+    char *req;                        /* Request to send */
+    u16_t req_len;                    /* Bytes of the request */
+    struct tcp_pcb *pcb;              /* Connection */
+    ip_addr_t addr;                   /* Address of the server */
+    uint8_t state;                    /* HTTP_CLIENT_* */
+    u32_t status;                     /* Status code of the response */
+    s32_t content_length;             /* -1 if not known */
+    bool chunked;                     /* Transfer-Encoding: chunked */
+    u32_t chunk_left;                 /* Bytes left of the current chunk */
+    u32_t rx_body;                    /* Bytes of the body received */
+    u32_t rx_unacked;                 /* Bytes of the body passed to the caller and not acknowledged yet */
+    char line[HTTP_CLIENT_LINE_SIZE]; /* Line of the headers being read */
+    u16_t line_len;                   /* Bytes of the line */
+    bool keep_alive;                  /* The connection can be used again when the response ends */
+    bool reused;                      /* The request was sent over a connection kept open */
+    uint64_t start_us;                /* Time the request started */
+    uint64_t idle_us;                 /* Time the last response ended on the connection kept open */
+} HttpClient;
+
+err_t http_get(const char *host, u16_t port, const char *uri, const HttpRequest *request);
+void http_abort(void);
+void http_recved(u16_t len);
+void http_client_stats(HttpClientStats *stats);
+
+#endif // HTTPCLIENT_H
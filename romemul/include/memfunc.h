@@ -55,6 +55,18 @@
         }                                                          \
     } while (0)
 
+// Same as CHANGE_ENDIANESS_BLOCK16, two words per iteration. The buffer must be 32 bit aligned
+// and the size a multiple of 4
+#define CHANGE_ENDIANESS_BLOCK32(dest_ptr_long, size_in_bytes)                                   \
+    do                                                                                           \
+    {                                                                                            \
+        uint32_t *long_ptr = (uint32_t *)(dest_ptr_long);                                        \
+        for (uint32_t j = 0; j < (size_in_bytes) / 4; ++j)                                       \
+        {                                                                                        \
+            long_ptr[j] = ((long_ptr[j] << 8) & 0xFF00FF00) | ((long_ptr[j] >> 8) & 0x00FF00FF); \
+        }                                                                                        \
+    } while (0)
+
 #define COPY_AND_CHANGE_ENDIANESS_BLOCK16(src_ptr_word, dest_ptr_word, size_in_bytes) \
     do                                                                                \
     {                                                                                 \
@@ -33,6 +33,8 @@
 #include "f_util.h"
 
 #include "memfunc.h"
+#include "catalog.h"
+#include "httpclient.h"
 
 #define MAX_NETWORKS 100
 #define MAX_SSID_LENGTH 36 // SSID can have up to 32 characters + null terminator + padding
@@ -52,7 +54,15 @@
 #define FIRMWARE_RELEASE_VERSION_URL "https://api.github.com/repos/diegoparrilla/atarist-sidecart-raspberry-pico/releases/latest"
 
 #define DOWNLOAD_LISTS_TIMEOUT 20 // seconds
-#define DOWNLOAD_FILES_TIMEOUT 99 // seconds
+#define DOWNLOAD_FILES_TIMEOUT 99 // seconds without data
+#define DOWNLOAD_CHUNK_SIZE 8192  // Max bytes of a write to the microSD card. Power of two
+#define DOWNLOAD_SYNC_CHUNKS 16   // Chunks written between syncs of the .part file
+#define DOWNLOAD_FLOPPY_ATTEMPTS 3 // Requests of a floppy image. Each one resumes the previous one
+#define DOWNLOAD_PART_EXTENSION ".part"
+#define DOWNLOAD_VALIDATOR_EXTENSION ".val" // Next to the .part file: URL and validator of the image being downloaded
+#define DOWNLOAD_VALIDATOR_SIZE 128        // Longest ETag or Last-Modified kept to resume a download
+#define DOWNLOAD_VALIDATOR_URL_SIZE 512    // Longest URL of a download that can be resumed
+#define DOWNLOAD_ACCEPT_ENCODING "gzip, deflate" // Inflated while the image is written
 
 typedef enum
 {
@@ -144,8 +154,16 @@ typedef struct
     char *protocol;
     char *domain;
     char *uri;
+    uint16_t port; // Explicit port of the URL, or HTTP_CLIENT_PORT
 } UrlParts;
 
+typedef struct
+{
+    char etag[CATALOG_VALIDATOR_SIZE];          /* ETag of the catalog downloaded */
+    char last_modified[CATALOG_VALIDATOR_SIZE]; /* Last-Modified of the catalog downloaded */
+    bool downloaded;                            /* Read from the server. The index must be written again */
+} CatalogFetch;
+
 extern WifiScanData wifiScanData;
 
 ConnectionStatus get_network_connection_status();
@@ -175,6 +193,7 @@ void wait_cyw43_with_polling(uint32_t milliseconds);
 
 int split_url(const char *url, UrlParts *parts);
 err_t get_rom_catalog_file(RomInfo **items, int *itemCount, const char *url);
+void free_rom_catalog(RomInfo *items);
 int compare_versions(const char *newer_version, const char *current_version);
 int get_latest_release(void);
 char *get_latest_release_str(void);
@@ -182,6 +201,7 @@ char *get_latest_release_str(void);
 int download_rom(const char *url, uint32_t rom_load_offset);
 int download_floppy(const char *url, const char *folder, const char *dest_filename, bool overwrite_flag);
 err_t get_floppy_db_files(FloppyImageInfo **items, int *itemCount, const char *url);
+void free_floppy_db_files(FloppyImageInfo *items);
 
 int time_passed(absolute_time_t *t, uint32_t ms);
 
@@ -48,6 +48,7 @@
 
 // Size of the random seed to use in the sync commands
 #define RANDOM_SEED_SIZE 4 // 4 bytes
+#define MSA_EXTRACT_EXTENSION ".tmp" // Added to an MSA image extracted from a ZIP archive while it's converted to ST
 
 // Delete flash
 int delete_FLASH(void);
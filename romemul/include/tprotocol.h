@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 
 #define PROTOCOL_HEADER 0xABCD
 #define PROTOCOL_READ_RESTART_MICROSECONDS 10000
@@ -22,6 +23,9 @@
 
 #define SHOW_COMMANDS 0 // Set to 1 to show commands received
 
+#define PROTOCOL_DEFERRED_COMMANDS 4        // Commands queued while the flash is written
+#define PROTOCOL_DEFERRED_PAYLOAD_SIZE 1024 // Bytes of payload of all the commands queued
+
 typedef enum
 {
     HEADER_DETECTION,
@@ -42,9 +46,17 @@ typedef struct
 
 typedef void (*ProtocolCallback)(const TransmissionProtocol *);
 
+// RAM copy of ROM3_START_ADDRESS for the IRQ handlers. The constants are in flash
+extern uint32_t protocol_rom3_start_address;
+
 // Function to parse the protocol
 void parse_protocol(uint16_t data, ProtocolCallback callback);
 void init_protocol_parser();
 void terminate_protocol_parser();
 
+// Queue the commands while the XIP is not available, and run them later
+void defer_protocol_commands(bool defer);
+void dispatch_deferred_protocol_commands();
+void deferred_protocol_stats(uint32_t *deferred, uint32_t *dropped);
+
 #endif // TPROTOCOL_H
@@ -29,11 +29,18 @@
 #include "hardware/resets.h"
 
 #include "include/config.h"
+#include "include/usb_transfer.h"
 
 #define USBDRIVE_READ_ONLY false
 
 #define TUD_OPT_HIGH_SPEED true
 
+#define USB_MASS_READ_AHEAD_SECTORS 16  // Sectors read at once when the host reads sequentially
+#define USB_MASS_WRITE_BACK_SECTORS 16  // Consecutive sectors gathered before writing them at once
+#define USB_MASS_WRITE_BACK_IDLE_MS 250 // Sectors gathered are written after this time without new writes
+
+#define SCSI_CMD_SYNCHRONIZE_CACHE_10 0x35 // Not in the list of commands of TinyUSB
+
 // Init USB Mass storage device
 void usb_mass_init(void);
 void usb_mass_start(void);
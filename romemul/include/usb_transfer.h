@@ -0,0 +1,105 @@
+/**
+ * File: usb_transfer.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Header for usb_transfer.c which receives ROMs and images through the USB CDC interface
+ */
+
+#ifndef USB_TRANSFER_H
+#define USB_TRANSFER_H
+
+#include "debug.h"
+#include "constants.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tusb.h"
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+
+#include "sd_card.h"
+#include "f_util.h"
+#include "ff.h"
+
+#include "include/config.h"
+#include "include/filesys.h"
+#include "include/memfunc.h"
+#include "include/zipfs.h"
+
+/*
+ * Every frame, in both directions, starts with a 16 bytes little endian header:
+ *
+ *   uint16_t magic    USB_TRANSFER_MAGIC
+ *   uint8_t  command  USB_TRANSFER_* command, or ACK/NAK in the replies
+ *   uint8_t  flags    Options of the command, or the error code of a NAK
+ *   uint32_t offset   Byte offset of the data. Size of the image in OPEN. Bytes done in the replies
+ *   uint32_t length   Bytes of payload after the header
+ *   uint32_t crc32    CRC32 of the payload. CRC32 of the bytes done in the replies
+ *
+ * OPEN_ROM and OPEN_FILE (payload: the path on the microSD card) start a transfer. If the
+ * same transfer was interrupted, the reply has the bytes already done and their CRC32:
+ * the host continues from there if it matches its own data, or opens again with the
+ * RESTART flag. DATA frames must come in order. A NAK has the offset where the host
+ * must continue. END (payload: CRC32 of the whole image) checks the image and commits it.
+ */
+#define USB_TRANSFER_MAGIC 0x5354          // "ST"
+#define USB_TRANSFER_HEADER_SIZE 16        // Bytes of the header of the frames
+#define USB_TRANSFER_CHUNK_SIZE 4096       // Max payload of a frame. A flash sector, so each ROM chunk is a sector
+#define USB_TRANSFER_PATH_LENGTH 256       // Max length of the target path on the microSD card
+#define USB_TRANSFER_PART_EXTENSION ".part" // Images being received. Renamed when complete
+#define USB_TRANSFER_BACKUP_EXTENSION ".bak" // Image replaced, kept until the new one is in place
+
+// Commands
+#define USB_TRANSFER_OPEN_ROM 0x01  // Flash a ROM image of up to two banks
+#define USB_TRANSFER_OPEN_FILE 0x02 // Write a file on the microSD card
+#define USB_TRANSFER_DATA 0x03      // Chunk of the image
+#define USB_TRANSFER_END 0x04       // Check and commit the image
+#define USB_TRANSFER_ABORT 0x05     // Stop the transfer. A file can be resumed later
+#define USB_TRANSFER_ACK 0x80
+#define USB_TRANSFER_NAK 0x81
+
+// Flags
+#define USB_TRANSFER_FLAG_RESTART 0x01 // OPEN: ignore the data of an interrupted transfer
+#define USB_TRANSFER_FLAG_BOOT 0x01    // END: boot the ROM emulator with the new ROM
+
+// Error codes of the NAK replies
+#define USB_TRANSFER_E_CRC 1    // Payload corrupted
+#define USB_TRANSFER_E_OFFSET 2 // Data out of order
+#define USB_TRANSFER_E_STATE 3  // No transfer open, or command not expected
+#define USB_TRANSFER_E_SIZE 4   // Image or chunk too big
+#define USB_TRANSFER_E_IO 5     // Error writing the flash or the microSD card
+#define USB_TRANSFER_E_BUSY 6   // The microSD card is mounted by the host. Eject it first
+
+#define USB_TRANSFER_TARGET_NONE 0
+#define USB_TRANSFER_TARGET_ROM 1
+#define USB_TRANSFER_TARGET_FILE 2
+
+typedef struct
+{
+    uint16_t magic;
+    uint8_t command;
+    uint8_t flags;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t crc32;
+} UsbTransferHeader;
+
+typedef struct
+{
+    uint8_t target;                          /* USB_TRANSFER_TARGET_* */
+    uint32_t size;                           /* Bytes of the image */
+    uint32_t done;                           /* Bytes received and written */
+    uint32_t crc;                            /* CRC32 of the bytes done */
+    FATFS *fs;                               /* microSD card mounted while a file is received */
+    FIL file;                                /* File being received */
+    char path[USB_TRANSFER_PATH_LENGTH];     /* Path of the file being received */
+    uint32_t frame_len;                      /* Bytes of the frame received so far */
+    uint8_t frame[USB_TRANSFER_HEADER_SIZE + USB_TRANSFER_CHUNK_SIZE]; /* Frame being received */
+} UsbTransfer;
+
+void usb_transfer_task(bool card_ejected);
+
+#endif // USB_TRANSFER_H
@@ -0,0 +1,133 @@
+/**
+ * File: zipfs.h
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Header file for the ZIP archives read from the microSD card
+ */
+
+#ifndef ZIPFS_H
+#define ZIPFS_H
+
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sd_card.h"
+#include "f_util.h"
+
+#define ZIP_EXTENSION ".zip"
+#define ZIP_CACHE_EXTENSION ".zcache" // Images decompressed from a ZIP archive. Named after their CRC32 and size
+#define ZIP_CACHE_MAX_SIZE (8 * 1024 * 1024) // Bytes of the cache files kept in a folder. The least recently used go first
+#define ZIP_MAX_ENTRIES 1024          // Entries of the central directory kept in the index
+#define ZIP_INPUT_BUFFER_SIZE 512     // Compressed bytes read from the card at once
+#define ZIP_WINDOW_SIZE 32768         // History of the deflate stream. Fixed by the format
+#define ZIP_EOCD_SEARCH_SIZE (22 + 65535) // End of central directory record plus the longest comment
+#define ZIP_MAX_PATH_LENGTH 256           // Max length of the paths to the archives and cache files
+#define ZIP_LIST_CACHE_ARCHIVES 8         // Archives whose list of entries is kept between listings
+#define ZIP_LIST_CACHE_MAX_SIZE 4096      // Bytes of the names of an archive kept. Bigger lists are read every time
+
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+
+// Formats of the streams read from a source instead of an archive
+#define ZIP_FORMAT_DEFLATE 0 // Raw deflate data
+#define ZIP_FORMAT_ZLIB 1    // zlib wrapper. HTTP Content-Encoding: deflate
+#define ZIP_FORMAT_GZIP 2    // gzip wrapper. HTTP Content-Encoding: gzip and .gz files
+#define ZIP_GZIP_EXTENSION ".gz"
+
+// Reads up to len compressed bytes. Returns the bytes read, 0 at the end of the data or -1 on error
+typedef int (*ZipSourceCallback)(uint8_t *buf, uint16_t len);
+
+typedef struct
+{
+    char *name;                   /* Name of the entry. Folders end with '/' */
+    uint16_t method;              /* ZIP_METHOD_STORED or ZIP_METHOD_DEFLATED */
+    uint32_t crc32;               /* CRC32 of the uncompressed data */
+    uint32_t compressed_size;     /* Bytes of the entry in the archive */
+    uint32_t uncompressed_size;   /* Bytes of the entry once decompressed */
+    uint32_t local_header_offset; /* Offset in the archive of the local header */
+} ZipEntry;
+
+typedef struct
+{
+    FIL file;          /* The archive */
+    uint16_t count;    /* Entries in the index */
+    ZipEntry *entries; /* Index of the central directory */
+} ZipArchive;
+
+typedef struct
+{
+    uint16_t count[16];  /* Codes of each length */
+    uint16_t symbol[288]; /* Symbols sorted by code */
+} ZipHuffman;
+
+typedef struct
+{
+    ZipArchive *zip;                       /* Archive of the entry */
+    const ZipEntry *entry;                 /* Entry decompressed */
+    uint32_t in_pos;                       /* Offset in the archive of the next compressed bytes to read */
+    uint32_t in_left;                      /* Compressed bytes not read yet */
+    uint16_t in_len;                       /* Bytes in in_buf */
+    uint16_t in_idx;                       /* Next byte of in_buf */
+    uint8_t in_buf[ZIP_INPUT_BUFFER_SIZE]; /* Compressed bytes read from the card */
+    uint32_t bit_buf;                      /* Bits read and not used yet */
+    uint8_t bit_count;                     /* Bits in bit_buf */
+    uint8_t state;                         /* State of the deflate stream */
+    bool final;                            /* The block being decompressed is the last one */
+    uint16_t stored_left;                  /* Bytes left of the stored block */
+    uint16_t copy_len;                     /* Bytes left of the back reference being copied */
+    uint16_t copy_dist;                    /* Distance of the back reference being copied */
+    ZipHuffman lencode;                    /* Literal/length codes of the block */
+    ZipHuffman distcode;                   /* Distance codes of the block */
+    uint8_t *window;                       /* Last ZIP_WINDOW_SIZE bytes decompressed. Only for deflate */
+    uint16_t window_pos;                   /* Next position in the window */
+    uint32_t out_total;                    /* Bytes decompressed */
+    uint32_t crc;                          /* CRC32 of the bytes decompressed */
+    ZipSourceCallback source;              /* Source of the compressed bytes. NULL if they come from the archive */
+    uint8_t format;                        /* ZIP_FORMAT_* of a stream read from a source */
+    ZipEntry source_entry;                 /* Entry of a stream read from a source. Size unknown until the end */
+} ZipStream;
+
+typedef struct
+{
+    bool active;        /* The image is inside a ZIP archive */
+    ZipArchive zip;     /* Archive of the image */
+    ZipStream stream;   /* Decompression of the image. Closed when the whole image is in the cache */
+    FIL *cache;         /* Cache file with the sectors already decompressed */
+    uint32_t cached;    /* Bytes of the image in the cache file */
+    uint32_t size;      /* Bytes of the image */
+} ZipImage;
+
+typedef struct
+{
+    char path[ZIP_MAX_PATH_LENGTH]; /* The archive */
+    FSIZE_t size;                   /* Size of the archive when it was listed */
+    WORD date;                      /* Modification date of the archive when it was listed */
+    WORD time;                      /* Modification time of the archive when it was listed */
+    uint32_t extensions;            /* Hash of the extensions allowed in the list */
+    uint16_t count;                 /* Names in the list */
+    char *names;                    /* Names of the entries allowed, each one ending with '\0'. NULL if free */
+} ZipListCache;
+
+uint32_t zip_crc32(uint32_t crc, const uint8_t *data, uint32_t len);
+bool zip_split_path(const char *fullpath, char *zip_path, size_t zip_path_len, const char **entry_name);
+FRESULT zip_open(ZipArchive *zip, const char *path);
+void zip_close(ZipArchive *zip);
+int zip_find(const ZipArchive *zip, const char *name);
+FRESULT zip_stream_open(ZipStream *stream, ZipArchive *zip, int index);
+FRESULT zip_stream_open_source(ZipStream *stream, ZipSourceCallback source, uint8_t format);
+int zip_stream_read(ZipStream *stream, uint8_t *out, uint32_t len);
+void zip_stream_close(ZipStream *stream);
+FRESULT zip_extract(const char *zip_path, const char *entry_name, const char *dest_path, bool overwrite);
+FRESULT zip_image_open(ZipImage *image, const char *fullpath, FIL *cache);
+FRESULT zip_image_fill(ZipImage *image, uint32_t end);
+void zip_image_close(ZipImage *image);
+void zip_expand_file_list(const char *dir, char ***file_list, int *num_files, const char **allowed_extensions, size_t num_extensions);
+
+#endif // ZIPFS_H
@@ -52,6 +52,7 @@
 #define LWIP_TCP 1
 #define LWIP_UDP 1
 #define LWIP_DNS 1
+#define DNS_TABLE_SIZE 8 // Host names resolved, kept until their TTL expires
 #define LWIP_TCP_KEEPALIVE 0
 #define LWIP_NETIF_TX_SINGLE_PBUF 0
 #define DHCP_DOES_ARP_CHECK 0
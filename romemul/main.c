@@ -54,24 +54,21 @@ int main()
     // Load the config from FLASH
     load_all_entries();
 
-    ConfigEntry *default_config_entry = find_entry(PARAM_BOOT_FEATURE);
-    DPRINTF("BOOT_FEATURE: %s\n", default_config_entry->value);
+    const char *boot_feature = config_string(CONFIG_KEY_BOOT_FEATURE);
+    DPRINTF("BOOT_FEATURE: %s\n", boot_feature);
 
-    ConfigEntry *default_config_reboot_mode = find_entry(PARAM_SAFE_CONFIG_REBOOT);
-    DPRINTF("SAFE_CONFIG_REBOOT: %s\n", default_config_reboot_mode->value);
-
-    bool safe_config_reboot = default_config_reboot_mode->value[0] == 't' || default_config_reboot_mode->value[0] == 'T';
+    bool safe_config_reboot = config_bool(CONFIG_KEY_SAFE_CONFIG_REBOOT);
+    DPRINTF("SAFE_CONFIG_REBOOT: %s\n", safe_config_reboot ? "true" : "false");
 
 // Check the different modes
     DPRINTF("Testing the different modes\n");
-    if ((!force_configurator) && (strcmp(default_config_entry->value, "ROM_EMULATOR") == 0))
+    if ((!force_configurator) && (strcmp(boot_feature, "ROM_EMULATOR") == 0))
     {
         DPRINTF("No SELECT button pressed. ROM_EMULATOR entry found in config. Launching.\n");
 
         // Check if Delay ROM emulation (ripper style boot) is true
-        ConfigEntry *rom_delay_config_entry = find_entry(PARAM_DELAY_ROM_EMULATION);
-        DPRINTF("DELAY_ROM_EMULATION: %s\n", rom_delay_config_entry->value);
-        if ((strcmp(rom_delay_config_entry->value, "true") == 0) || (strcmp(rom_delay_config_entry->value, "TRUE") == 0) || (strcmp(rom_delay_config_entry->value, "T") == 0))
+        DPRINTF("DELAY_ROM_EMULATION: %s\n", config_string(CONFIG_KEY_DELAY_ROM_EMULATION));
+        if (config_bool(CONFIG_KEY_DELAY_ROM_EMULATION))
         {
             DPRINTF("Delaying ROM emulation.\n"); // Always print this line
             // The "D" character stands for "Delay"
@@ -121,7 +118,7 @@ int main()
         }
     }
 
-    if ((!force_configurator) && (strcmp(default_config_entry->value, "FLOPPY_EMULATOR") == 0))
+    if ((!force_configurator) && (strcmp(boot_feature, "FLOPPY_EMULATOR") == 0))
     {
         DPRINTF("FLOPPY_EMULATOR entry found in config. Launching.\n");
 
@@ -133,12 +130,15 @@ int main()
         init_protocol_parser();
         DPRINTF("Floppy emulation started.\n"); // Print always
 
+        // Tune the SD card before the emulation starts. The probe is slow the first time
+        change_spi_speed();
+
         // Hybrid way to initialize the ROM emulator:
         // IRQ handler callback to read the commands in ROM3, and NOT copy the FLASH ROMs to RAM
         // and start the state machine
         init_romemul(NULL, floppyemul_dma_irq_handler_lookup_callback, false);
-
-        change_spi_speed();
+        // The DMA IRQ handler is RAM resident, so it keeps running while the flash is written
+        flash_write_keep_protocol_irq(true);
 
         DPRINTF("Ready to accept commands.\n");
 
@@ -147,11 +147,11 @@ int main()
         // You should never reach this line...
     }
 
-    if ((!force_configurator) && (strcmp(default_config_entry->value, "RTC_EMULATOR") == 0))
+    if ((!force_configurator) && (strcmp(boot_feature, "RTC_EMULATOR") == 0))
     {
         DPRINTF("RTC_EMULATOR entry found in config. Launching.\n");
 
-        char *rtc_type_str = find_entry(PARAM_RTC_TYPE)->value;
+        const char *rtc_type_str = config_string(CONFIG_KEY_RTC_TYPE);
         if (strcmp(rtc_type_str, "SIDECART") == 0)
         {
             // Copy the ST RTC firmware emulator to RAM
@@ -181,7 +181,7 @@ int main()
         // You should never reach this line...
     }
 
-    if ((!force_configurator) && (strcmp(default_config_entry->value, "GEMDRIVE_EMULATOR") == 0))
+    if ((!force_configurator) && (strcmp(boot_feature, "GEMDRIVE_EMULATOR") == 0))
     {
         DPRINTF("GEMDRIVE_EMULATOR entry found in config. Launching.\n");
 
@@ -191,10 +191,15 @@ int main()
         // Reserve memory for the protocol parser
         init_protocol_parser();
 
+        // Tune the SD card before the emulation starts. The probe is slow the first time
+        change_spi_speed();
+
         // Hybrid way to initialize the ROM emulator:
         // IRQ handler callback to read the commands in ROM3, and NOT copy the FLASH ROMs to RAM
         // and start the state machine
         init_romemul(NULL, gemdrvemul_dma_irq_handler_lookup_callback, false);
+        // The DMA IRQ handler is RAM resident, so it keeps running while the flash is written
+        flash_write_keep_protocol_irq(true);
 
 #if _DEBUG
         //  Check if the USB is connected. If so, check if the SD card is inserted and initialize the USB Mass storage device
@@ -204,7 +209,6 @@ int main()
             usb_mass_init();
         }
 #endif
-        change_spi_speed();
 
         DPRINTF("Ready to accept commands.\n");
 
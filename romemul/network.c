@@ -120,7 +120,7 @@ void network_swap_connection_data(uint16_t *dest_ptr_word)
     CHANGE_ENDIANESS_BLOCK16(dest_ptr_word, sizeof(ConnectionData) - sizeof(uint16_t) * 6);
 }
 
-uint32_t get_country_code(char *c, char **valid_country_str)
+uint32_t get_country_code(const char *c, char **valid_country_str)
 {
     *valid_country_str = "XX";
     // empty configuration select worldwide
@@ -221,13 +221,9 @@ int network_wifi_init()
     cyw43_initialized = true;
     DPRINTF("CYW43 Logging level: %d\n", CYW43_VERBOSE_DEBUG);
     uint32_t country = CYW43_COUNTRY_WORLDWIDE;
-    ConfigEntry *country_entry = find_entry(PARAM_WIFI_COUNTRY);
-    if (country_entry != NULL)
-    {
-        char *valid;
-        country = get_country_code(country_entry->value, &valid);
-        put_string(PARAM_WIFI_COUNTRY, valid);
-    }
+    char *valid;
+    country = get_country_code(config_string(CONFIG_KEY_WIFI_COUNTRY), &valid);
+    put_string(PARAM_WIFI_COUNTRY, valid);
 
     int res;
     DPRINTF("Initialization WiFi...\n");
@@ -237,18 +233,13 @@ int network_wifi_init()
         DPRINTF("Failed to initialize WiFi: %d\n", res);
         return -1;
     }
-    DPRINTF("Country: %s\n", country_entry->value);
+    DPRINTF("Country: %s\n", config_string(CONFIG_KEY_WIFI_COUNTRY));
 
     DPRINTF("Enabling STA mode...\n");
     cyw43_arch_enable_sta_mode();
 
     // Setting the power management
-    uint32_t pm_value = 0xa11140; // 0: Disable PM
-    ConfigEntry *pm_entry = find_entry(PARAM_WIFI_POWER);
-    if (pm_entry != NULL)
-    {
-        pm_value = strtoul(pm_entry->value, NULL, 16);
-    }
+    uint32_t pm_value = strtoul(config_string(CONFIG_KEY_WIFI_POWER), NULL, 16); // 0: Disable PM
     if (pm_value < 5)
     {
         switch (pm_value)
@@ -285,7 +276,7 @@ int network_init(bool force, bool async, char **pass)
     int res;
 
     // Set hostname
-    char *hostname = find_entry(PARAM_HOSTNAME)->value;
+    const char *hostname = config_string(CONFIG_KEY_HOSTNAME);
 
     struct netif *n = &cyw43_state.netif[CYW43_ITF_STA];
 
@@ -307,7 +298,7 @@ int network_init(bool force, bool async, char **pass)
     netif_set_status_callback(n, network_status_callback);
 
     // DHCP or static IP
-    if ((find_entry(PARAM_WIFI_DHCP) != NULL) && (find_entry(PARAM_WIFI_DHCP)->value[0] == 't' || find_entry(PARAM_WIFI_DHCP)->value[0] == 'T'))
+    if (config_bool(CONFIG_KEY_WIFI_DHCP))
     {
         DPRINTF("DHCP enabled\n");
     }
@@ -316,9 +307,9 @@ int network_init(bool force, bool async, char **pass)
         DPRINTF("Static IP enabled\n");
         dhcp_stop(n);
         ip_addr_t ipaddr, netmask, gw;
-        ipaddr.addr = ipaddr_addr(find_entry(PARAM_WIFI_IP)->value);
-        netmask.addr = ipaddr_addr(find_entry(PARAM_WIFI_NETMASK)->value);
-        gw.addr = ipaddr_addr(find_entry(PARAM_WIFI_GATEWAY)->value);
+        ipaddr.addr = ipaddr_addr(config_string(CONFIG_KEY_WIFI_IP));
+        netmask.addr = ipaddr_addr(config_string(CONFIG_KEY_WIFI_NETMASK));
+        gw.addr = ipaddr_addr(config_string(CONFIG_KEY_WIFI_GATEWAY));
         netif_set_addr(n, &ipaddr, &netmask, &gw);
         DPRINTF("IP: %s\n", ipaddr_ntoa(&ipaddr));
         DPRINTF("Netmask: %s\n", ipaddr_ntoa(&netmask));
@@ -326,12 +317,11 @@ int network_init(bool force, bool async, char **pass)
 
         // Now set the DNS
         // The values in PARAM_WIFI_DNS are separated by commas. Only one or two values are allowed
-        ConfigEntry *entry = find_entry(PARAM_WIFI_DNS);
-        if (entry == NULL || entry->value == NULL) {
+        const char *dns = config_string(CONFIG_KEY_WIFI_DNS);
+        if (strlen(dns) == 0) {
             DPRINTF("Error: DNS configuration is missing.\n");
         }
         else {
-            char *dns = entry->value;
             char *dns_copy = strdup(dns); // Make a copy of the string to avoid modifying the original
             if (dns_copy == NULL) {
                 DPRINTF("Error: Memory allocation failed.\n");
@@ -374,14 +364,14 @@ int network_init(bool force, bool async, char **pass)
         return -2;
     }
 
-    ConfigEntry *ssid = find_entry(PARAM_WIFI_SSID);
-    if (strlen(ssid->value) == 0)
+    const char *ssid = config_string(CONFIG_KEY_WIFI_SSID);
+    if (strlen(ssid) == 0)
     {
         DPRINTF("No SSID found in config. Can't connect\n");
         return -3;
     }
-    ConfigEntry *auth_mode = find_entry(PARAM_WIFI_AUTH);
-    if (strlen(auth_mode->value) == 0)
+    const char *auth_mode = config_string(CONFIG_KEY_WIFI_AUTH);
+    if (strlen(auth_mode) == 0)
     {
         DPRINTF("No auth mode found in config. Can't connect\n");
         return -4;
@@ -389,10 +379,10 @@ int network_init(bool force, bool async, char **pass)
     char *password_value = NULL;
     if (*pass == NULL)
     {
-        ConfigEntry *password = find_entry(PARAM_WIFI_PASSWORD);
-        if (strlen(password->value) > 0)
+        const char *password = config_string(CONFIG_KEY_WIFI_PASSWORD);
+        if (strlen(password) > 0)
         {
-            password_value = strdup(password->value);
+            password_value = strdup(password);
         }
         else
         {
@@ -405,26 +395,22 @@ int network_init(bool force, bool async, char **pass)
     }
     DPRINTF("The password is: %s\n", password_value);
 
-    uint32_t auth_value = get_auth_pico_code(atoi(auth_mode->value));
+    uint32_t auth_value = get_auth_pico_code(config_int(CONFIG_KEY_WIFI_AUTH));
     int error_code = 0;
     if (!async)
     {
-        uint32_t network_timeout = NETWORK_CONNECTION_TIMEOUT;
-        if (find_entry(PARAM_WIFI_CONNECT_TIMEOUT) != NULL)
-        {
-            network_timeout = atoi(find_entry(PARAM_WIFI_CONNECT_TIMEOUT)->value) * 1000;
-        }
+        uint32_t network_timeout = config_int(CONFIG_KEY_WIFI_CONNECT_TIMEOUT) * 1000;
         uint16_t retries = 3;
         do
         {
-            DPRINTF("Connecting to SSID=%s, password=%s, auth=%08x. SYNC. Retry: %d\n", ssid->value, password_value, auth_value, retries);
-            error_code = cyw43_arch_wifi_connect_timeout_ms(ssid->value, password_value, auth_value, network_timeout);
+            DPRINTF("Connecting to SSID=%s, password=%s, auth=%08x. SYNC. Retry: %d\n", ssid, password_value, auth_value, retries);
+            error_code = cyw43_arch_wifi_connect_timeout_ms(ssid, password_value, auth_value, network_timeout);
         } while (error_code != 0 && retries--);
     }
     else
     {
-        DPRINTF("Connecting to SSID=%s, password=%s, auth=%08x. ASYNC\n", ssid->value, password_value, auth_value);
-        error_code = cyw43_arch_wifi_connect_async(ssid->value, password_value, auth_value);
+        DPRINTF("Connecting to SSID=%s, password=%s, auth=%08x. ASYNC\n", ssid, password_value, auth_value);
+        error_code = cyw43_arch_wifi_connect_async(ssid, password_value, auth_value);
     }
     free(password_value);
     if (error_code != 0)
@@ -627,37 +613,19 @@ void network_safe_poll()
 
 uint32_t get_network_status_polling_ms()
 {
-    uint32_t network_status_polling_ms = NETWORK_POLL_INTERVAL * 1000;
-    ConfigEntry *default_network_status_polling_sec = find_entry(PARAM_NETWORK_STATUS_SEC);
-    if (default_network_status_polling_sec != NULL)
-    {
-        network_status_polling_ms = atoi(default_network_status_polling_sec->value) * 1000;
-        // If the value is too small, set the minimum value
-        if (network_status_polling_ms < NETWORK_POLL_INTERVAL_MIN * 1000)
-        {
-            network_status_polling_ms = NETWORK_POLL_INTERVAL_MIN * 1000;
-            DPRINTF("NETWORK_STATUS_SEC value too small. Changing to minimum value: %d\n", network_status_polling_ms);
-        }
-    }
-    else
+    uint32_t network_status_polling_ms = config_int(CONFIG_KEY_NETWORK_STATUS_SEC) * 1000;
+    // If the value is too small, set the minimum value
+    if (network_status_polling_ms < NETWORK_POLL_INTERVAL_MIN * 1000)
     {
-        DPRINTF("%s not found in the config file. Using default value: %d\n", PARAM_NETWORK_STATUS_SEC, network_status_polling_ms);
+        network_status_polling_ms = NETWORK_POLL_INTERVAL_MIN * 1000;
+        DPRINTF("NETWORK_STATUS_SEC value too small. Changing to minimum value: %d\n", network_status_polling_ms);
     }
     return network_status_polling_ms;
 }
 
 uint16_t get_wifi_scan_poll_secs()
 {
-    uint16_t value = WIFI_SCAN_POLL_COUNTER;
-    ConfigEntry *default_config_entry = find_entry(PARAM_WIFI_SCAN_SECONDS);
-    if (default_config_entry != NULL)
-    {
-        value = atoi(default_config_entry->value);
-    }
-    else
-    {
-        DPRINTF("WIFI_SCAN_SECONDS not found in the config file. Disabling polling.\n");
-    }
+    uint16_t value = config_int(CONFIG_KEY_WIFI_SCAN_SECONDS);
     if (value < WIFI_SCAN_POLL_COUNTER_MIN)
     {
         value = WIFI_SCAN_POLL_COUNTER_MIN;
@@ -719,13 +687,9 @@ char *print_mac(uint8_t *mac_address)
 
 void get_connection_data(ConnectionData *connection_data)
 {
-    ConfigEntry *ssid = find_entry(PARAM_WIFI_SSID);
-    ConfigEntry *wifi_auth = find_entry(PARAM_WIFI_AUTH);
-    ConfigEntry *wifi_scan_interval = find_entry(PARAM_WIFI_SCAN_SECONDS);
-    ConfigEntry *network_status_scan_interval = find_entry(PARAM_NETWORK_STATUS_SEC);
-    ConfigEntry *file_downloading_timeout = find_entry(PARAM_DOWNLOAD_TIMEOUT_SEC);
-    ConfigEntry *wifi_country = find_entry(PARAM_WIFI_COUNTRY);
-    ConfigEntry *wifi_rssi_visible = find_entry(PARAM_WIFI_RSSI);
+    const char *ssid = config_string(CONFIG_KEY_WIFI_SSID);
+    const char *wifi_country = config_string(CONFIG_KEY_WIFI_COUNTRY);
+    bool wifi_rssi_visible = config_bool(CONFIG_KEY_WIFI_RSSI);
     connection_data->network_status = (u_int16_t)connection_status;
     snprintf(connection_data->ipv4_address, sizeof(connection_data->ipv4_address), "%s", "Not connected" + '\0');
     snprintf(connection_data->ipv6_address, sizeof(connection_data->ipv6_address), "%s", "Not connected" + '\0');
@@ -733,27 +697,27 @@ void get_connection_data(ConnectionData *connection_data)
     snprintf(connection_data->gw_ipv4_address, sizeof(connection_data->gw_ipv4_address), "%s", "Not connected" + '\0');
     snprintf(connection_data->netmask_ipv4_address, sizeof(connection_data->netmask_ipv4_address), "Not connected" + '\0');
     snprintf(connection_data->dns_ipv4_address, sizeof(connection_data->dns_ipv4_address), "%s", "Not connected" + '\0');
-    connection_data->wifi_auth_mode = (uint16_t)atoi(wifi_auth->value);
+    connection_data->wifi_auth_mode = (uint16_t)config_int(CONFIG_KEY_WIFI_AUTH);
     connection_data->wifi_scan_interval = get_wifi_scan_poll_secs();
     connection_data->network_status_poll_interval = (uint16_t)(get_network_status_polling_ms() / 1000);
-    connection_data->file_downloading_timeout = (uint16_t)atoi(file_downloading_timeout->value);
+    connection_data->file_downloading_timeout = (uint16_t)config_int(CONFIG_KEY_DOWNLOAD_TIMEOUT_SEC);
     connection_data->rssi = 0;
 
     // If the country is empty, set it to XX. Otherwise, copy the first two characters
-    if (wifi_country->value[0] == '\0')
+    if (wifi_country[0] == '\0')
     { // Check if the country value is empty
         snprintf(connection_data->wifi_country, 4, "XX\0\0");
     }
     else
     {
-        snprintf(connection_data->wifi_country, 4, "%.2s\0\0", wifi_country->value);
+        snprintf(connection_data->wifi_country, 4, "%.2s\0\0", wifi_country);
     }
 
     switch (connection_status)
     {
     case CONNECTED_WIFI_IP:
     {
-        snprintf(connection_data->ssid, sizeof(connection_data->ssid), "%s", ssid->value);
+        snprintf(connection_data->ssid, sizeof(connection_data->ssid), "%s", ssid);
         snprintf(connection_data->ipv4_address, sizeof(connection_data->ipv4_address), "%s", print_ipv4(get_ip_address()));
         snprintf(connection_data->ipv6_address, sizeof(connection_data->ipv6_address), "%s", "Not implemented" + '\0');
         snprintf(connection_data->mac_address, sizeof(connection_data->mac_address), "%s", print_mac(get_mac_address()));
@@ -763,7 +727,7 @@ void get_connection_data(ConnectionData *connection_data)
         snprintf(connection_data->netmask_ipv6_address, sizeof(connection_data->netmask_ipv6_address), "%s", "Not implemented" + '\0');
         snprintf(connection_data->dns_ipv4_address, sizeof(connection_data->dns_ipv4_address), "%s", print_ipv4(get_dns()));
         snprintf(connection_data->dns_ipv6_address, sizeof(connection_data->dns_ipv6_address), "%s", "Not implemented" + '\0');
-        if ((wifi_rssi_visible != NULL) && (wifi_rssi_visible->value[0] == 't' || wifi_rssi_visible->value[0] == 'T'))
+        if (wifi_rssi_visible)
         {
             connection_data->rssi = get_rssi();
         }
@@ -775,7 +739,7 @@ void get_connection_data(ConnectionData *connection_data)
     case CONNECTED_WIFI:
     case CONNECTED_WIFI_NO_IP:
     {
-        snprintf(connection_data->ssid, sizeof(connection_data->ssid), "%s", ssid->value);
+        snprintf(connection_data->ssid, sizeof(connection_data->ssid), "%s", ssid);
         snprintf(connection_data->ipv4_address, sizeof(connection_data->ipv4_address), "%s", "Waiting address" + '\0');
         snprintf(connection_data->ipv6_address, sizeof(connection_data->ipv6_address), "%s", "Waiting address" + '\0');
         snprintf(connection_data->mac_address, sizeof(connection_data->mac_address), "%s", "Waiting address" + '\0');
@@ -785,7 +749,7 @@ void get_connection_data(ConnectionData *connection_data)
         snprintf(connection_data->netmask_ipv6_address, sizeof(connection_data->netmask_ipv6_address), "%s", "Waiting address" + '\0');
         snprintf(connection_data->dns_ipv4_address, sizeof(connection_data->dns_ipv4_address), "%s", "Waiting address" + '\0');
         snprintf(connection_data->dns_ipv6_address, sizeof(connection_data->dns_ipv6_address), "%s", "Waiting address" + '\0');
-        if ((wifi_rssi_visible != NULL) && (wifi_rssi_visible->value[0] == 't' || wifi_rssi_visible->value[0] == 'T'))
+        if (wifi_rssi_visible)
         {
             connection_data->rssi = get_rssi();
         }
@@ -864,6 +828,7 @@ int split_url(const char *url, UrlParts *parts)
     parts->protocol = NULL;
     parts->domain = NULL;
     parts->uri = NULL;
+    parts->port = HTTP_CLIENT_PORT;
 
     char *p, *q;
 
@@ -902,6 +867,18 @@ int split_url(const char *url, UrlParts *parts)
             return -1; // Allocation failed
     }
 
+    // Get the port, if any, like in "host:8080"
+    q = strchr(parts->domain, ':');
+    if (q)
+    {
+        char *end = NULL;
+        unsigned long port = strtoul(q + 1, &end, 10);
+        if ((end == q + 1) || (*end != '\0') || (port == 0) || (port > 65535))
+            return -1; // Invalid port
+        parts->port = (uint16_t)port;
+        *q = '\0';
+    }
+
     return 0;
 }
 
@@ -915,18 +892,30 @@ static void free_url_parts(UrlParts *parts)
         free(parts->uri);
 }
 
+bool check_gzip_extension(UrlParts parts)
+{
+    int len = strlen(parts.uri);
+    int ext_len = strlen(ZIP_GZIP_EXTENSION);
+    return (len >= ext_len) && (strcasecmp(parts.uri + len - ext_len, ZIP_GZIP_EXTENSION) == 0);
+}
+
 bool check_STEEM_extension(UrlParts parts)
 {
     bool steem_extension = false;
 
     int len = strlen(parts.uri);
+    if (check_gzip_extension(parts))
+    {
+        // The extension of a compressed image is the one before .gz
+        len -= strlen(ZIP_GZIP_EXTENSION);
+    }
     if (len >= 4)
     {
         // Point to the last four characters of the uri
         char *extension = parts.uri + len - 4;
 
         // Check for .stc or .STC extension
-        if (strcasecmp(extension, ".stc") == 0)
+        if (strncasecmp(extension, ".stc", 4) == 0)
         {
             steem_extension = true;
         }
@@ -937,19 +926,17 @@ bool check_STEEM_extension(UrlParts parts)
 
 int download_latest_release(const char *url)
 {
-    // Very small buffer to force the library to call the minimal number of times the body function
-    char *buff = malloc(512);
+    // Very small buffer. The file only has the version
+    const int BUFFER_SIZE = 512;
+    char *buff = malloc(BUFFER_SIZE);
     uint32_t buff_pos = 0;
     volatile bool complete = false;
     volatile err_t callback_error = ERR_OK; // If any error found in the callback and cannot be returned, store it here
     UrlParts parts;
 
-    err_t headers(httpc_state_t * connection, void *arg,
-                  struct pbuf *hdr, u16_t hdr_len, u32_t content_len)
+    if (buff == NULL)
     {
-        DPRINTF("version.txt headers\n");
-        pbuf_copy_partial(hdr, buff, hdr->tot_len, 0);
-        return ERR_OK;
+        return ERR_MEM;
     }
 
     void result(void *arg, httpc_result_t httpc_result,
@@ -962,12 +949,12 @@ int download_latest_release(const char *url)
         {
             DPRINTF("version.txt something went wrong. HTTP error: %d\n", srv_res);
             snprintf(latest_release_version, sizeof(latest_release_version), "v0.0.0");
-            free(buff);
             callback_error = srv_res == 0 ? ERR_TIMEOUT : srv_res;
         }
         else
         {
             DPRINTF("version.txt Transfer complete. %d transfered.\n", rx_content_len);
+            buff[buff_pos] = '\0';
             // Find newline character in buff, if any
             char *newline_pos = strchr(buff, '\n');
 
@@ -982,8 +969,6 @@ int download_latest_release(const char *url)
             strncpy(latest_release_version, buff, copy_len);
             latest_release_version[copy_len] = '\0';  // Ensure null termination
 
-            free(buff);
-
             // Print an error message if download fails and set a default version
             if (strlen(latest_release_version) == 0) {
                 DPRINTF("Failed to download latest release. Returning fake release.\n");
@@ -996,15 +981,9 @@ int download_latest_release(const char *url)
                struct pbuf *p, err_t err)
     {
         DPRINTF("version.txt body\n");
-        pbuf_copy_partial(p, (buff + buff_pos), p->tot_len, 0);
-        buff_pos += p->tot_len;
-        tcp_recved(conn, p->tot_len);
-        if (p != NULL)
-        {
-            DPRINTF("pbuf ref count before free: %d\n", p->ref);
-            pbuf_free(p);
-        }
-
+        buff_pos += pbuf_copy_partial(p, (buff + buff_pos), MIN(p->tot_len, BUFFER_SIZE - 1 - buff_pos), 0);
+        http_recved(p->tot_len);
+        pbuf_free(p);
         return ERR_OK;
     }
 
@@ -1012,6 +991,7 @@ int download_latest_release(const char *url)
     if (split_url(url, &parts) != 0)
     {
         DPRINTF("Failed to split URL\n");
+        free(buff);
         return ERR_ARG;
     }
 
@@ -1019,25 +999,20 @@ int download_latest_release(const char *url)
     DPRINTF("Domain %s\n", parts.domain);
     DPRINTF("URI %s\n", parts.uri);
 
-    httpc_connection_t settings;
-    settings.result_fn = result;
-    settings.headers_done_fn = headers;
-    settings.use_proxy = false;
+    HttpRequest request = {
+        .body_fn = body,
+        .result_fn = result,
+    };
 
     cyw43_arch_lwip_begin();
-    err_t err = httpc_get_file_dns(
-        parts.domain,
-        LWIP_IANA_PORT_HTTP,
-        parts.uri,
-        &settings,
-        body,
-        NULL,
-        NULL);
+    err_t err = http_get(parts.domain, parts.port, parts.uri, &request);
     cyw43_arch_lwip_end();
+    free_url_parts(&parts);
 
     if (err != ERR_OK)
     {
         DPRINTF("HTTP GET failed: %d\n", err);
+        free(buff);
         return ERR_USE;
     }
 
@@ -1052,12 +1027,15 @@ int download_latest_release(const char *url)
         if (time_us_64() - start_time > timeout)
         {
             DPRINTF("Download timed out\n");
-            free_url_parts(&parts);
-            return ERR_TIMEOUT;
+            cyw43_arch_lwip_begin();
+            http_abort();
+            cyw43_arch_lwip_end();
+            callback_error = ERR_TIMEOUT;
+            break;
         }
     }
 
-    free_url_parts(&parts);
+    free(buff);
     return callback_error;
 }
 
@@ -1086,419 +1064,522 @@ int compare_versions(const char *newer_version, const char *current_version)
 
 int get_latest_release(void)
 {
-    ConfigEntry *entry = find_entry(PARAM_LASTEST_RELEASE_URL);
-
-    if (entry == NULL)
-    {
-        DPRINTF("%s not found in config\n", PARAM_LASTEST_RELEASE_URL);
-        return ERR_ARG;
-    }
-    if (strlen(entry->value) == 0)
+    const char *url = config_string(CONFIG_KEY_LASTEST_RELEASE_URL);
+    if (strlen(url) == 0)
     {
         DPRINTF("%s is empty\n", PARAM_LASTEST_RELEASE_URL);
         return ERR_ARG;
     }
 
-    int err = download_latest_release(entry->value);
+    int err = download_latest_release(url);
 
     return err;
 }
 
-static char *next_token(char **line_ptr)
+// Log how many requests saved the DNS lookup and the TCP handshake, and what they saved. A new
+// connection is what every request paid before the connections were kept open
+static void log_http_client_stats(void)
 {
-    char *line = *line_ptr;
-    if (!line || *line == '\0')
-        return NULL;
+    HttpClientStats http_stats;
+    http_client_stats(&http_stats);
+    DPRINTF("HTTP requests: %d. Connections reused: %d. DNS cached: %d. DNS lookups: %d\n",
+            http_stats.requests, http_stats.reused, http_stats.dns_cached, http_stats.dns_lookups);
+    uint32_t new_avg_ms = http_stats.new_done > 0 ? (uint32_t)(http_stats.new_first_us / http_stats.new_done / 1000) : 0;
+    uint32_t reused_avg_ms = http_stats.reused_done > 0 ? (uint32_t)(http_stats.reused_first_us / http_stats.reused_done / 1000) : 0;
+    DPRINTF("First byte. New connection: %d ms average of %d. Connection reused: %d ms average of %d\n",
+            new_avg_ms, http_stats.new_done, reused_avg_ms, http_stats.reused_done);
+}
 
-    char *token;
-    if (*line == '"')
+// An index written is valid until the next revalidation. An index that failed is removed
+static void update_catalog_index(const char *index_path, bool indexed)
+{
+    if (indexed)
     {
-        // Token starts with a quote, find the closing quote
-        token = ++line;
-        while (*line && (*line != '"' || *(line + 1) == '"'))
-        {
-            if (*line == '"' && *(line + 1) == '"')
-            {
-                // Handle escaped quote
-                memmove(line, line + 1, strlen(line));
-            }
-            line++;
-        }
-        if (*line == '"')
-        {
-            *line = '\0';
-            line++;
-            if (*line == ',')
-                line++;
-        }
+        catalog_index_validated(index_path);
     }
     else
     {
-        // Token does not start with a quote, find the next comma
-        token = line;
-        while (*line && *line != ',')
-        {
-            line++;
-        }
-        if (*line)
-        {
-            *line = '\0';
-            line++;
-        }
+        DPRINTF("Cannot write the index %s\n", index_path);
+        f_unlink(index_path);
     }
-
-    // Trim leading spaces in the next token
-    while (isspace(*line))
-        line++;
-
-    *line_ptr = line;
-    return token;
 }
 
-err_t get_rom_catalog_file(RomInfo **items, int *itemCount, const char *url)
+/**
+ * @brief Gets a catalog from its index in the microSD card, or from the server.
+ *
+ * The index is used as it is if it was validated in the last CATALOG_REVALIDATE_MINUTES.
+ * Otherwise the server is asked with the validators of the index, and the index is used if the
+ * catalog has not changed (304) or the server can not be reached.
+ *
+ * @param url The URL of the catalog.
+ * @param index_path The path of the index.
+ * @param parser The parser of the catalog downloaded.
+ * @param index_parser The parser of the index, with the same callbacks.
+ * @param reset_fn Discards the records of a download that failed before reading the index.
+ * @param fetch The validators of the catalog downloaded, and if it was downloaded.
+ *
+ * @return ERR_OK if the catalog was read. Otherwise, the HTTP status or the lwIP error.
+ */
+static err_t fetch_catalog(const char *url, const char *index_path, CatalogParser *parser,
+                           CatalogParser *index_parser, void (*reset_fn)(void), CatalogFetch *fetch)
 {
-    char buff[32768] = {0};
-    uint32_t buff_pos = 0;
-    httpc_state_t *connection;
-    volatile bool complete = false;
-    volatile err_t callback_error = ERR_OK; // If any error found in the callback and cannot be returned, store it here
+    CatalogIndexHeader header;
     UrlParts parts;
-    u32_t content_len = 0;
+    volatile bool complete = false;
+    volatile u32_t status = 0;
+    volatile httpc_result_t httpc_result = HTTPC_RESULT_OK;
+    char conditions[2 * CATALOG_VALIDATOR_SIZE + 48] = {0};
 
-    err_t headers(httpc_state_t * connection, void *arg,
-                  struct pbuf *hdr, u16_t hdr_len, u32_t content_len)
+    memset(fetch, 0, sizeof(CatalogFetch));
+    bool indexed = catalog_index_header(index_path, url, &header);
+    if (indexed && catalog_index_fresh(index_path))
     {
-        return ERR_OK;
+        DPRINTF("Catalog %s read from %s\n", url, index_path);
+        return catalog_index_load(index_path, index_parser) ? ERR_OK : ERR_VAL;
     }
 
-    void result(void *arg, httpc_result_t httpc_result,
-                u32_t rx_content_len, u32_t srv_res, err_t err)
-
+    void header_received(const char *name, const char *value)
     {
-        content_len = rx_content_len;
-        complete = true;
-        if (srv_res != 200)
+        if (strcasecmp(name, "ETag") == 0)
         {
-            DPRINTF("JSON something went wrong. HTTP error: %d\n", srv_res);
-            callback_error = srv_res == 0 ? ERR_TIMEOUT : srv_res;
+            strncpy(fetch->etag, value, CATALOG_VALIDATOR_SIZE - 1);
         }
-        else
+        else if (strcasecmp(name, "Last-Modified") == 0)
         {
-            DPRINTF("JSON Transfer complete. %d transfered.\n", rx_content_len);
+            strncpy(fetch->last_modified, value, CATALOG_VALIDATOR_SIZE - 1);
         }
     }
 
-    err_t body(void *arg, struct altcp_pcb *conn,
-               struct pbuf *p, err_t err)
+    void headers_done(u32_t srv_res, s32_t content_length)
+    {
+        status = srv_res;
+    }
+
+    void result(void *arg, httpc_result_t res, u32_t rx_content_len, u32_t srv_res, err_t err)
+    {
+        httpc_result = res;
+        status = srv_res;
+        complete = true;
+        DPRINTF("Catalog request complete. Status: %d. %d bytes transfered.\n", srv_res, rx_content_len);
+    }
+
+    err_t body(void *arg, struct altcp_pcb *conn, struct pbuf *p, err_t err)
     {
-        // DPRINTF("Body received. ");
-        // DPRINTF("Buffer size:%d\n", p->tot_len);
-        // fflush(stdout);
-        pbuf_copy_partial(p, (buff + buff_pos), p->tot_len, 0);
-        buff_pos += p->tot_len;
-        tcp_recved(conn, p->tot_len);
-        if (p != NULL)
+        // The catalog is parsed as it arrives. Nothing is buffered
+        if (status == 200)
         {
-            DPRINTF("pbuf ref count before free: %d\n", p->ref);
-            pbuf_free(p);
+            for (struct pbuf *q = p; q != NULL; q = q->next)
+            {
+                catalog_parser_feed(parser, (const char *)q->payload, q->len);
+            }
         }
-
+        http_recved(p->tot_len);
+        pbuf_free(p);
         return ERR_OK;
     }
 
-    DPRINTF("Downloading CSV file from %s\n", url);
+    DPRINTF("Downloading catalog from %s\n", url);
     if (split_url(url, &parts) != 0)
     {
         DPRINTF("Failed to split URL\n");
         return -1;
     }
 
-    DPRINTF("Protocol %s\n", parts.protocol);
-    DPRINTF("Domain %s\n", parts.domain);
-    DPRINTF("URI %s\n", parts.uri);
-
-    httpc_connection_t settings;
-    settings.result_fn = result;
-    settings.headers_done_fn = headers;
-    settings.use_proxy = false;
+    if (indexed)
+    {
+        int len = 0;
+        if (header.etag[0] != '\0')
+        {
+            len += snprintf(conditions + len, sizeof(conditions) - len, "If-None-Match: %s\r\n", header.etag);
+        }
+        if (header.last_modified[0] != '\0')
+        {
+            snprintf(conditions + len, sizeof(conditions) - len, "If-Modified-Since: %s\r\n", header.last_modified);
+        }
+    }
+    HttpRequest request = {
+        .headers = conditions,
+        .header_fn = header_received,
+        .headers_done_fn = headers_done,
+        .body_fn = body,
+        .result_fn = result,
+    };
 
-    complete = false;
     cyw43_arch_lwip_begin();
-    err_t err = httpc_get_file_dns(
-        parts.domain,
-        LWIP_IANA_PORT_HTTP,
-        parts.uri,
-        &settings,
-        body,
-        NULL,
-        NULL);
+    err_t err = http_get(parts.domain, parts.port, parts.uri, &request);
     cyw43_arch_lwip_end();
+    free_url_parts(&parts);
 
-    if (err != ERR_OK)
+    if (err == ERR_OK)
+    {
+        uint64_t start_time = time_us_64();
+        uint64_t timeout = DOWNLOAD_LISTS_TIMEOUT * 1000000; // N seconds timeout in microseconds
+        while (!complete)
+        {
+#if PICO_CYW43_ARCH_POLL
+            network_safe_poll();
+            cyw43_arch_wait_for_work_until(make_timeout_time_ms(100));
+#endif
+            if (time_us_64() - start_time > timeout)
+            {
+                DPRINTF("Download timed out\n");
+                cyw43_arch_lwip_begin();
+                http_abort();
+                cyw43_arch_lwip_end();
+                httpc_result = HTTPC_RESULT_ERR_TIMEOUT;
+                status = 0;
+                break;
+            }
+        }
+    }
+    else
     {
         DPRINTF("HTTP GET failed: %d\n", err);
-        free_url_parts(&parts);
-        return -1;
     }
+    log_http_client_stats();
 
-    uint64_t start_time = time_us_64();
-    uint64_t timeout = DOWNLOAD_LISTS_TIMEOUT * 1000000; // N seconds timeout in microseconds
-    while (!complete)
+    if ((err == ERR_OK) && (httpc_result == HTTPC_RESULT_OK) && (status == 200))
     {
-#if PICO_CYW43_ARCH_POLL
-        network_safe_poll();
-        cyw43_arch_wait_for_work_until(make_timeout_time_ms(100));
-#endif
-        if (time_us_64() - start_time > timeout)
+        catalog_parser_finish(parser);
+        fetch->downloaded = true;
+        return ERR_OK;
+    }
+    if (indexed && (err == ERR_OK) && (httpc_result == HTTPC_RESULT_OK) && (status == 304))
+    {
+        DPRINTF("Catalog not modified. Read from %s\n", index_path);
+        catalog_index_validated(index_path);
+        return catalog_index_load(index_path, index_parser) ? ERR_OK : ERR_VAL;
+    }
+    if (indexed)
+    {
+        // Offline, or the server failed. The index is better than nothing
+        DPRINTF("Catalog not available. Status: %d. Read from %s\n", status, index_path);
+        reset_fn();
+        return catalog_index_load(index_path, index_parser) ? ERR_OK : ERR_VAL;
+    }
+    if (err != ERR_OK)
+    {
+        return -1;
+    }
+    DPRINTF("Catalog something went wrong. HTTP error: %d\n", status);
+    return ((status == 0) || (status == 200)) ? ERR_TIMEOUT : status;
+}
+
+err_t get_rom_catalog_file(RomInfo **items, int *itemCount, const char *url)
+{
+    CatalogArena arena;
+    CatalogParser parser;
+    RomInfo *last = NULL;      // Last record of the list
+    RomInfo *current = NULL;   // Record being read
+    uint32_t record_start = 0; // Bytes of the arena used before the record being read
+    bool arena_full = false;
+    int skipped = 0;
+    CatalogParser index_parser;
+    CatalogFetch fetch;
+    char index_path[CATALOG_INDEX_PATH_SIZE];
+
+    *items = NULL;
+    *itemCount = 0;
+
+    // Columns: url, name, description, tags, size in KB. The first line is the header
+    void field(uint8_t field, const char *value, uint16_t len)
+    {
+        if (arena_full)
         {
-            DPRINTF("Download timed out\n");
-            return ERR_TIMEOUT;
+            return;
+        }
+        if (current == NULL)
+        {
+            record_start = arena.used;
+            current = catalog_arena_alloc(&arena, sizeof(RomInfo));
+            if (current == NULL)
+            {
+                arena_full = true;
+                return;
+            }
+        }
+        switch (field)
+        {
+        case 0:
+            current->url = catalog_arena_strndup(&arena, value, len);
+            arena_full = (current->url == NULL);
+            break;
+        case 1:
+            current->name = catalog_arena_strndup(&arena, value, len);
+            arena_full = (current->name == NULL);
+            break;
+            // Ignore the description, we don't use it for now
+        case 3:
+            current->tags = catalog_arena_strndup(&arena, value, len);
+            arena_full = (current->tags == NULL);
+            break;
+        case 4:
+            current->size_kb = atoi(value);
+            break;
+        default:
+            break;
         }
     }
 
-    free_url_parts(&parts);
-
-    if (callback_error != ERR_OK)
+    void record(uint8_t fields)
     {
-        return callback_error;
+        if (arena_full || (current == NULL) || (current->url == NULL) || (current->name == NULL))
+        {
+            // Incomplete, or no room left. Give back its memory
+            arena.used = record_start;
+            skipped++;
+        }
+        else
+        {
+            if (last == NULL)
+            {
+                *items = current;
+            }
+            else
+            {
+                last->next = current;
+            }
+            last = current;
+            (*itemCount)++;
+        }
+        current = NULL;
     }
 
-    // First, count the number of entries
-    int count = 0;
-    const char *p = buff;
-    for (int i = 0; i < content_len; i++)
+    void reset(void)
     {
-        if (*p == '\n')
-            count++;
-        p++;
+        *items = NULL;
+        *itemCount = 0;
+        last = NULL;
+        current = NULL;
+        arena.used = 0;
+        arena_full = false;
+        skipped = 0;
     }
-    *itemCount = count - 1; // The first line is the header
 
-    DPRINTF("Found %d entries\n", *itemCount);
-    if (*itemCount == 0)
+    if (!catalog_arena_init(&arena, CATALOG_ARENA_SIZE))
     {
-        // If no entries found, short circuit and return
+        DPRINTF("Failed to allocate memory for the ROM catalog\n");
         return -1;
     }
+    catalog_parser_init(&parser, ',', 0, true, field, record);
+    catalog_parser_init(&index_parser, CATALOG_INDEX_SEPARATOR, 0, false, field, record);
+    catalog_index_path(index_path, "roms");
 
-    RomInfo *current = NULL;
-    // Allocate memory for the first RomInfo structure
-    *items = malloc(sizeof(RomInfo));
-    if (*items == NULL)
+    err_t err = fetch_catalog(url, index_path, &parser, &index_parser, reset, &fetch);
+    if ((err != ERR_OK) || (*itemCount == 0))
     {
-        DPRINTF("Failed to allocate memory for RomInfo\n");
-        return -1;
+        // If no entries found, short circuit and return
+        DPRINTF("Found %d entries\n", *itemCount);
+        free(arena.base);
+        *items = NULL;
+        *itemCount = 0;
+        return err != ERR_OK ? err : -1;
     }
-
-    current = *items; // Point to the first RomInfo structure
-    char *buff_parse = buff;
-    char *line = NULL;
-    // Skip the first line
-    line = strtok(buff_parse, "\n");
-    if (line == NULL)
+    DPRINTF("Parsing complete. %d bytes of %d used\n", arena.used, arena.size);
+    if (skipped > 0)
     {
-        DPRINTF("No lines found. Empty file.\n");
-        return -1;
+        DPRINTF("WARNING: %d entries incomplete or not fitting in memory\n", skipped);
     }
-    // Increment the buff structure position after the line
-    buff_parse += strlen(line) + 1;
-    DPRINTF("Header: %s\n", line);
-    line = strtok(buff_parse, "\n");
-    for (size_t items_count = 0; items_count < *itemCount; items_count++)
-    {
-        if (line == NULL)
-            break; // Ensure line is valid
-        buff_parse += strlen(line) + 1;
-        DPRINTF("Line: %s\n", line);
-        for (size_t token_count = 0; token_count < 5; token_count++)
-        {
-            // Parse the line splitting by comma
-            char *token = next_token(&line);
-            if (!token)
-                break;
-            // DPRINTF("Token(%d): %s\n", token_count, token);
-            switch (token_count)
-            {
-            case 0:
-                current->url = strdup(token);
-                break;
-            case 1:
-                current->name = strdup(token);
-                break;
-                // Ignore the description, we don't use it for now
-                //            case 2:
-                //
-                //                current->description = strdup(token);
-                // break;
-            case 3:
-                current->tags = strdup(token);
-                break;
-            case 4:
-                current->size_kb = atoi(token);
-                break;
-            default:
-                break;
-            }
-            // Increment the buff structure position after the token
-        }
-        // Allocate memory for the next RomInfo structure
-        if (items_count < *itemCount - 1)
+
+    if (fetch.downloaded)
+    {
+        // Same columns as the catalog, without the description
+        CatalogIndexWriter *writer = malloc(sizeof(CatalogIndexWriter));
+        bool indexed = (writer != NULL) && catalog_index_create(writer, index_path, url, fetch.etag, fetch.last_modified);
+        if (indexed)
         {
-            RomInfo *next = malloc(sizeof(RomInfo));
-            if (!next)
+            char size_kb[12];
+            for (RomInfo *item = *items; item != NULL; item = item->next)
             {
-                DPRINTF("Memory allocation failed\n");
-                return -1;
+                snprintf(size_kb, sizeof(size_kb), "%d", item->size_kb);
+                catalog_index_field(writer, item->url);
+                catalog_index_field(writer, item->name);
+                catalog_index_field(writer, NULL);
+                catalog_index_field(writer, item->tags);
+                catalog_index_field(writer, size_kb);
+                catalog_index_end_record(writer);
             }
-            *next = (RomInfo){0};
-            current->next = next;
-            current = next;
+            indexed = catalog_index_close(writer);
         }
-        else
-        {
-            current->next = NULL;
-        }
-        line = strtok(buff_parse, "\n");
+        update_catalog_index(index_path, indexed);
+        free(writer);
     }
-    DPRINTF("Parsing complete\n");
 
     DPRINTF("Returning %d items\n", *itemCount);
-    return callback_error;
+    return ERR_OK;
+}
+
+/**
+ * @brief Releases the ROM catalog returned by get_rom_catalog_file().
+ *
+ * The records and their strings share one block, starting with the first record.
+ */
+void free_rom_catalog(RomInfo *items)
+{
+    free(items);
 }
 
 int download_rom(const char *url, uint32_t rom_load_offset)
 {
-    const int FLASH_BUFFER_SIZE = 4096;
-    uint8_t *flash_buff = malloc(FLASH_BUFFER_SIZE);
-    if (flash_buff == NULL)
+    // The sector being written. 32 bit aligned for the swap
+    uint32_t *sector_buff = malloc(FLASH_SECTOR_SIZE);
+    if (sector_buff == NULL)
     {
         DPRINTF("Failed to allocate memory for flash buffer\n");
         return -1;
     }
 
-    uint32_t flash_buff_pos = 0;
-    bool first_chunk = true;
+    // The lwIP body callback only queues the pbufs. The download loop reads them, inflated if
+    // the image is compressed, and erases, swaps and programs a sector at a time. The data is
+    // acknowledged when it is read, so the TCP window is the only limit of the queue
+    struct pbuf *queue = NULL;
     bool is_steem = false;
     volatile bool complete = false;
-    volatile err_t callback_error = ERR_OK; // If any error found in the callback and cannot be returned, store it here
+    volatile u32_t status = 0;
+    volatile httpc_result_t httpc_result = HTTPC_RESULT_OK;
+    err_t callback_error = ERR_OK; // If any error found in the callback and cannot be returned, store it here
+    int8_t encoding = -1;          // ZIP_FORMAT_* of the body. -1 if it is not compressed
+    ZipStream *stream = NULL;
     UrlParts parts;
     uint32_t dest_address = rom_load_offset; // Initialize pointer to the ROM address
+    uint32_t rom_end_address = rom_load_offset + ROM_SIZE_BYTES * 2; // Two banks of 64K
+    uint64_t download_start = 0;
+    uint64_t download_end = 0;
+    uint64_t last_data = 0;
+    uint32_t downloaded = 0;
+    uint64_t program_us = 0;
 
-    err_t headers(httpc_state_t * connection, void *arg,
-                  struct pbuf *hdr, u16_t hdr_len, u32_t content_len)
+    void header_received(const char *name, const char *value)
     {
-        return ERR_OK;
+        if (strcasecmp(name, "Content-Encoding") == 0)
+        {
+            encoding = (strcasecmp(value, "gzip") == 0) ? ZIP_FORMAT_GZIP : (strcasecmp(value, "deflate") == 0) ? ZIP_FORMAT_ZLIB : -1;
+        }
     }
 
-    void result(void *arg, httpc_result_t httpc_result,
-                u32_t rx_content_len, u32_t srv_res, err_t err)
+    void headers_done(u32_t srv_res, s32_t content_length)
+    {
+        status = srv_res;
+        download_start = time_us_64();
+    }
 
+    void result(void *arg, httpc_result_t res, u32_t rx_content_len, u32_t srv_res, err_t err)
     {
+        httpc_result = res;
+        status = srv_res;
         complete = true;
-        if (srv_res != 200)
+        download_end = time_us_64();
+        DPRINTF("ROM image request complete. Status: %d. %d transfered.\n", srv_res, rx_content_len);
+    }
+
+    err_t body(void *arg, struct altcp_pcb *conn, struct pbuf *p, err_t err)
+    {
+        if (status != 200)
         {
-            DPRINTF("ROM image download something went wrong. HTTP error: %d\n", srv_res);
-            callback_error = srv_res == 0 ? ERR_TIMEOUT : srv_res;
+            // Error page. Discarded
+            http_recved(p->tot_len);
+            pbuf_free(p);
+            return ERR_OK;
+        }
+        downloaded += p->tot_len;
+        if (queue == NULL)
+        {
+            queue = p;
         }
         else
         {
-            DPRINTF("ROM image transfer complete. %d transfered.\n", rx_content_len);
-            DPRINTF("Pending bytes to write: %d\n", flash_buff_pos);
+            pbuf_cat(queue, p);
         }
+        return ERR_OK;
     }
 
-    err_t body(void *arg, struct altcp_pcb *conn,
-               struct pbuf *p, err_t err)
+    // Read the body as it was sent. The network is polled until there is data in the queue.
+    // 0 at the end of the body, -1 if the download stalled or the connection dropped
+    int read_body(uint8_t *buf, uint16_t len)
     {
-        // DPRINTF("Body received. ");
-        // DPRINTF("Buffer size:%d. ", p->tot_len);
-        // DPRINTF("Copying to address: %p\n", dest_address);
-        // fflush(stdout);
-
-        // Transform buffer's words from little endian to big endian inline
-        if (p == NULL)
+        while (queue == NULL)
         {
-            DPRINTF("Received NULL pbuf\n");
-            return ERR_VAL;
-        }
-        uint8_t *buffer = (uint8_t *)p->payload;
-        uint16_t total_bytes_copy = p->tot_len;
-        int steem_offset = 0;
-        if (is_steem && first_chunk)
-        {
-            // Check if the first 4 bytes are 0x0000
-            if (buffer[0] == 0x00 && buffer[1] == 0x00 && buffer[2] == 0x00 && buffer[3] == 0x00)
+            if (complete && (httpc_result != HTTPC_RESULT_OK))
             {
-                DPRINTF("Skipping first 4 bytes. Looks like a STEEM cartridge image.\n");
-                steem_offset = 4;
+                DPRINTF("Download interrupted. Result: %d\n", httpc_result);
+                callback_error = ERR_CONN;
+                return -1;
             }
-            first_chunk = false;
-        }
-        uint16_t flash_buffer_current_size = FLASH_BUFFER_SIZE - flash_buff_pos - steem_offset;
-        if (flash_buffer_current_size <= 0)
-        {
-            DPRINTF("Invalid flash buffer size calculation\n");
-            return ERR_VAL;
-        }
-        if (total_bytes_copy < flash_buffer_current_size)
-        {
-            // DPRINTF("Copying %d bytes to address: %p...", (total_bytes_copy - steem_offset), (flash_buff + flash_buff_pos));
-            // THere is room in the flash_buff to copy the whole buffer
-            pbuf_copy_partial(p, (flash_buff + flash_buff_pos), (total_bytes_copy - steem_offset), steem_offset);
-            // increment the flash buffer position
-            flash_buff_pos += (total_bytes_copy - steem_offset);
-            // DPRINTF("Done.\n");
+            if (complete)
+            {
+                return 0;
+            }
+            if (time_us_64() - last_data > DOWNLOAD_FILES_TIMEOUT * 1000000)
+            {
+                DPRINTF("Download timed out\n");
+                callback_error = ERR_TIMEOUT;
+                return -1;
+            }
+#if PICO_CYW43_ARCH_POLL
+            network_safe_poll();
+#endif
         }
-        else
-        {
-            // DPRINTF("Copying %d bytes to address: %p...", flash_buffer_current_size, (flash_buff + flash_buff_pos));
-            // There is no room, so we have to fill it first, invert, write to flash and continue
-            pbuf_copy_partial(p, (flash_buff + flash_buff_pos), flash_buffer_current_size, 0);
-            // DPRINTF("Done.\n");
+        last_data = time_us_64();
+        uint16_t n = MIN(len, queue->tot_len);
+        pbuf_copy_partial(queue, buf, n, 0);
+        cyw43_arch_lwip_begin();
+        queue = pbuf_free_header(queue, n);
+        http_recved(n);
+        cyw43_arch_lwip_end();
+        return n;
+    }
 
-            // Change to big endian
-            for (int j = 0; j < FLASH_BUFFER_SIZE; j += 2)
+    // Read len bytes of the image, inflated if needed. Less than len only at the end. -1 on error
+    int read_image(uint8_t *buf, uint32_t len)
+    {
+        uint32_t total = 0;
+        while (total < len)
+        {
+            int n = (stream != NULL) ? zip_stream_read(stream, buf + total, len - total) : read_body(buf + total, MIN(len - total, 0xFFFF));
+            if (n < 0)
             {
-                uint8_t temp = flash_buff[j];
-                flash_buff[j] = flash_buff[j + 1];
-                flash_buff[j + 1] = temp;
+                if (callback_error == ERR_OK)
+                {
+                    callback_error = ERR_VAL; // Corrupted compressed data
+                }
+                return -1;
             }
-
-            // Write chunk to flash
-            DPRINTF("Writing %d bytes to address: %p...", flash_buff_pos + flash_buffer_current_size, dest_address);
-            uint32_t ints = save_and_disable_interrupts();
-            flash_range_program(dest_address, flash_buff, FLASH_BUFFER_SIZE);
-            restore_interrupts(ints);
-            dest_address += FLASH_BUFFER_SIZE;
-            // Reset the flash buffer position
-            flash_buff_pos = 0;
-            DPRINTF("Done.\n");
-
-            // we have total_bytes - flash_buffer_current_size left to copy!
-            uint16_t bytes_left = total_bytes_copy - flash_buffer_current_size;
-            if (bytes_left > 0)
+            if (n == 0)
             {
-                // DPRINTF("Copying pending %d bytes to address: %p...", bytes_left, (flash_buff + flash_buff_pos));
-                pbuf_copy_partial(p, (flash_buff + flash_buff_pos), bytes_left, flash_buffer_current_size);
-                flash_buff_pos += bytes_left;
-                // DPRINTF("Done.\n");
+                break;
             }
+            total += n;
         }
+        return total;
+    }
 
-        tcp_recved(conn, p->tot_len);
-
-        if (p != NULL)
+    // Write a sector to the flash. The sector is erased just before it is programmed
+    void program_sector(uint32_t len)
+    {
+        if (dest_address + len > rom_end_address)
         {
-            DPRINTF("pbuf ref count before free: %d\n", p->ref);
-            pbuf_free(p);
+            // Keep reading until the end, but do not write out of the ROM banks
+            DPRINTF("ROM image too big. Ignoring %d bytes\n", len);
+            callback_error = ERR_MEM;
+            return;
         }
-        return ERR_OK;
+        uint64_t start = time_us_64();
+        // The flash is programmed in pages. The rest of the last page stays erased
+        uint32_t program_len = (len + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+        memset((uint8_t *)sector_buff + len, 0xFF, program_len - len);
+        CHANGE_ENDIANESS_BLOCK32(sector_buff, program_len);
+        flash_write_erase(dest_address, FLASH_SECTOR_SIZE);
+        flash_write_program(dest_address, (uint8_t *)sector_buff, program_len);
+        program_us += time_us_64() - start;
+        dest_address += FLASH_SECTOR_SIZE;
     }
+
     DPRINTF("Downloading ROM image from %s\n", url);
     fflush(stdout);
     if (split_url(url, &parts) != 0)
     {
         DPRINTF("Failed to split URL\n");
+        free(sector_buff);
         return -1;
     }
 
@@ -1508,39 +1589,23 @@ int download_rom(const char *url, uint32_t rom_load_offset)
 
     is_steem = check_STEEM_extension(parts);
 
-    // Erase the content before loading the new file. It seems that
-    // overwriting it's not enough
-    DPRINTF("Erasing FLASH ROM image area at address: %p...\n", rom_load_offset);
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(rom_load_offset, ROM_SIZE_BYTES * 2); // Two banks of 64K
-    restore_interrupts(ints);
-    DPRINTF("Erased.\n");
+    HttpRequest request = {
+        .headers = "Accept-Encoding: " DOWNLOAD_ACCEPT_ENCODING "\r\n",
+        .header_fn = header_received,
+        .headers_done_fn = headers_done,
+        .body_fn = body,
+        .result_fn = result,
+    };
 
-    httpc_connection_t settings;
-    memset(&settings, 0, sizeof(settings));
-
-    settings.result_fn = result;
-    settings.headers_done_fn = headers;
-    settings.use_proxy = false;
-
-    complete = false;
     cyw43_arch_lwip_begin();
-    DPRINTF("Downloading ROM image from %s\n", url);
-    err_t err = httpc_get_file_dns(
-        parts.domain,
-        LWIP_IANA_PORT_HTTP,
-        parts.uri,
-        &settings,
-        body,
-        NULL,
-        NULL);
+    err_t err = http_get(parts.domain, parts.port, parts.uri, &request);
     cyw43_arch_lwip_end();
 
     if (err != ERR_OK)
     {
         DPRINTF("HTTP GET failed: %d\n", err);
         free_url_parts(&parts);
-        free(flash_buff);
+        free(sector_buff);
         return -1;
     }
     else
@@ -1548,14 +1613,14 @@ int download_rom(const char *url, uint32_t rom_load_offset)
         DPRINTF("HTTP GET sent\n");
     }
 
-    uint64_t start_time = time_us_64();
-    uint64_t timeout = DOWNLOAD_FILES_TIMEOUT * 1000000; // N seconds timeout in microseconds
-    while (!complete)
+    // Wait for the headers. They tell if the body is compressed
+    last_data = time_us_64();
+    while ((status == 0) && !complete)
     {
 #if PICO_CYW43_ARCH_POLL
         network_safe_poll();
 #endif
-        if (time_us_64() - start_time > timeout)
+        if (time_us_64() - last_data > DOWNLOAD_FILES_TIMEOUT * 1000000)
         {
             DPRINTF("Download timed out\n");
             callback_error = ERR_TIMEOUT;
@@ -1563,289 +1628,545 @@ int download_rom(const char *url, uint32_t rom_load_offset)
         }
     }
 
-    free_url_parts(&parts);
-    free(flash_buff);
-    return callback_error;
-}
-
-err_t get_floppy_db_files(FloppyImageInfo **items, int *itemCount, const char *url)
-{
-    size_t BUFFER_SIZE = 32768;
-    char *buff = malloc(BUFFER_SIZE);
-    uint32_t buff_pos = 0;
-    httpc_state_t *connection;
-    volatile bool complete = false;
-    volatile err_t callback_error = ERR_OK; // If any error found in the callback and cannot be returned, store it here
-    UrlParts parts;
-    u32_t content_len = 0;
-
-    err_t headers(httpc_state_t * connection, void *arg,
-                  struct pbuf *hdr, u16_t hdr_len, u32_t rx_content_len)
+    if ((callback_error == ERR_OK) && (status == 200))
     {
-        return ERR_OK;
-    }
-
-    void result(void *arg, httpc_result_t httpc_result,
-                u32_t rx_content_len, u32_t srv_res, err_t err)
-
-    {
-        content_len = rx_content_len;
-        complete = true;
-        if (srv_res != 200)
+        if ((encoding < 0) && check_gzip_extension(parts))
         {
-            DPRINTF("Floppy images db something went wrong. HTTP error: %d\n", srv_res);
-            callback_error = srv_res == 0 ? ERR_TIMEOUT : srv_res;
+            encoding = ZIP_FORMAT_GZIP;
         }
-        else
+        if (encoding >= 0)
         {
-            DPRINTF("Floppy images db Transfer complete. %d transfered.\n", rx_content_len);
+            DPRINTF("Compressed ROM image. Format: %d\n", encoding);
+            stream = malloc(sizeof(ZipStream));
+            if ((stream == NULL) || (zip_stream_open_source(stream, read_body, encoding) != FR_OK))
+            {
+                callback_error = (callback_error != ERR_OK) ? callback_error : (stream == NULL) ? ERR_MEM : ERR_VAL;
+                free(stream);
+                stream = NULL;
+            }
         }
-    }
 
-    err_t body(void *arg, struct altcp_pcb *conn,
-               struct pbuf *p, err_t err)
-    {
-        // DPRINTF("Body received. ");
-        // DPRINTF("Buffer size:%d\n", p->tot_len);
-        // fflush(stdout);
-        pbuf_copy_partial(p, (buff + buff_pos), p->tot_len, 0);
-        buff_pos += p->tot_len;
-        tcp_recved(conn, p->tot_len);
-        if (p != NULL)
+        uint32_t len = 0;
+        if ((callback_error == ERR_OK) && is_steem)
         {
-            DPRINTF("pbuf ref count before free: %d\n", p->ref);
-            pbuf_free(p);
+            // Check if the first 4 bytes are 0x0000
+            int n = read_image((uint8_t *)sector_buff, 4);
+            uint8_t *buffer = (uint8_t *)sector_buff;
+            if ((n == 4) && buffer[0] == 0x00 && buffer[1] == 0x00 && buffer[2] == 0x00 && buffer[3] == 0x00)
+            {
+                DPRINTF("Skipping first 4 bytes. Looks like a STEEM cartridge image.\n");
+            }
+            else
+            {
+                len = (n > 0) ? n : 0;
+            }
+        }
+        bool end = (callback_error != ERR_OK);
+        while (!end)
+        {
+            int n = read_image((uint8_t *)sector_buff + len, FLASH_SECTOR_SIZE - len);
+            if (n < 0)
+            {
+                break;
+            }
+            len += n;
+            end = (len < FLASH_SECTOR_SIZE);
+            if (len > 0)
+            {
+                program_sector(len);
+            }
+            len = 0;
         }
-
-        return ERR_OK;
     }
 
-    DPRINTF("Downloading Floppy images db file from %s\n", url);
-    if (split_url(url, &parts) != 0)
+    if (!complete)
     {
-        DPRINTF("Failed to split URL\n");
-        return -1;
+        cyw43_arch_lwip_begin();
+        http_abort();
+        cyw43_arch_lwip_end();
+    }
+    if (queue != NULL)
+    {
+        pbuf_free(queue);
+    }
+    if (stream != NULL)
+    {
+        zip_stream_close(stream);
+        free(stream);
+    }
+    if ((callback_error == ERR_OK) && (status != 200))
+    {
+        DPRINTF("ROM image download something went wrong. HTTP error: %d\n", status);
+        callback_error = status == 0 ? ERR_TIMEOUT : status;
+    }
+    else if ((callback_error == ERR_OK) && (httpc_result != HTTPC_RESULT_OK))
+    {
+        DPRINTF("ROM image download interrupted. Result: %d\n", httpc_result);
+        callback_error = ERR_CONN;
     }
 
-    DPRINTF("Protocol %s\n", parts.protocol);
-    DPRINTF("Domain %s\n", parts.domain);
-    DPRINTF("URI %s\n", parts.uri);
+    // Erase what is left of a previous, bigger ROM
+    if (dest_address < rom_end_address)
+    {
+        flash_write_erase(dest_address, rom_end_address - dest_address);
+    }
 
-    httpc_connection_t settings;
-    settings.result_fn = result;
-    settings.headers_done_fn = headers;
-    settings.use_proxy = false;
+    uint32_t programmed = dest_address - rom_load_offset;
+    uint32_t download_ms = (uint32_t)(((complete ? download_end : time_us_64()) - download_start) / 1000);
+    uint32_t program_ms = (uint32_t)(program_us / 1000);
+    DPRINTF("Downloaded %d bytes in %d ms (%d KB/s)\n", downloaded, download_ms, download_ms > 0 ? downloaded / download_ms : 0);
+    log_http_client_stats();
+    DPRINTF("Programmed %d bytes in %d ms (%d KB/s)\n", programmed, program_ms, program_ms > 0 ? programmed / program_ms : 0);
+    flash_write_report("ROM download");
 
-    complete = false;
-    cyw43_arch_lwip_begin();
-    err_t err = httpc_get_file_dns(
-        parts.domain,
-        LWIP_IANA_PORT_HTTP,
-        parts.uri,
-        &settings,
-        body,
-        NULL,
-        NULL);
-    cyw43_arch_lwip_end();
+    free_url_parts(&parts);
+    free(sector_buff);
+    return callback_error;
+}
 
-    if (err != ERR_OK)
-    {
-        DPRINTF("HTTP GET failed: %d\n", err);
-        free_url_parts(&parts);
-        free(buff);
-        return -1;
+err_t get_floppy_db_files(FloppyImageInfo **items, int *itemCount, const char *url)
+{
+    CatalogArena arena;
+    CatalogParser parser;
+    FloppyImageInfo *last = NULL;    // Last record of the list
+    FloppyImageInfo *current = NULL; // Record being read
+    uint32_t record_start = 0;       // Bytes of the arena used before the record being read
+    bool arena_full = false;
+    int skipped = 0;
+    CatalogParser index_parser;
+    CatalogFetch fetch;
+    char index_path[CATALOG_INDEX_PATH_SIZE];
+
+    *items = NULL;
+    *itemCount = 0;
+
+    // Six quoted values: name, status, description, tags, extra, url
+    void field(uint8_t field, const char *value, uint16_t len)
+    {
+        if (arena_full)
+        {
+            return;
+        }
+        if (current == NULL)
+        {
+            record_start = arena.used;
+            current = catalog_arena_alloc(&arena, sizeof(FloppyImageInfo));
+            if (current == NULL)
+            {
+                arena_full = true;
+                return;
+            }
+        }
+        switch (field)
+        {
+        case 0:
+            current->name = catalog_arena_strndup(&arena, value, len);
+            arena_full = (current->name == NULL);
+            break;
+            // The status, description and tags are not shown. Not stored
+        case 4:
+            current->extra = catalog_arena_strndup(&arena, value, len);
+            arena_full = (current->extra == NULL);
+            break;
+        case 5:
+            current->url = catalog_arena_strndup(&arena, value, len);
+            arena_full = (current->url == NULL);
+            break;
+        default:
+            break;
+        }
     }
 
-    uint64_t start_time = time_us_64();
-    uint64_t timeout = DOWNLOAD_LISTS_TIMEOUT * 1000000; // N seconds timeout in microseconds
-    while (!complete)
+    void record(uint8_t fields)
     {
-#if PICO_CYW43_ARCH_POLL
-        network_safe_poll();
-        cyw43_arch_wait_for_work_until(make_timeout_time_ms(100));
-#endif
-        if (time_us_64() - start_time > timeout)
+        if (arena_full || (current == NULL) || (fields < 6))
         {
-            DPRINTF("Download timed out\n");
-            callback_error = ERR_TIMEOUT;
-            break;
+            // Incomplete, or no room left. Give back its memory
+            arena.used = record_start;
+            skipped++;
+        }
+        else
+        {
+            if (last == NULL)
+            {
+                *items = current;
+            }
+            else
+            {
+                last->next = current;
+            }
+            last = current;
+            (*itemCount)++;
         }
+        current = NULL;
     }
 
-    free_url_parts(&parts);
-
-    if (callback_error != ERR_OK)
+    void reset(void)
     {
-        if (buff != NULL)
-            free(buff);
-        return callback_error;
+        *items = NULL;
+        *itemCount = 0;
+        last = NULL;
+        current = NULL;
+        arena.used = 0;
+        arena_full = false;
+        skipped = 0;
     }
 
-    bool inside_quotes = false;
-    char *start = NULL;
-    int items_count = 0;
+    if (!catalog_arena_init(&arena, CATALOG_ARENA_SIZE))
+    {
+        DPRINTF("Failed to allocate memory for the floppy images db\n");
+        return -1;
+    }
+    catalog_parser_init(&parser, ';', 6, false, field, record);
+    catalog_parser_init(&index_parser, CATALOG_INDEX_SEPARATOR, 0, false, field, record);
 
-    // First, count the number of entries
-    int count = 0;
-    const char *p = buff;
-    for (int i = 0; i < content_len; i++)
+    // One index per page of the db: floppy_a for /db/a.csv
+    char index_name[CATALOG_INDEX_PATH_SIZE / 2];
+    const char *page = strrchr(url, '/');
+    snprintf(index_name, sizeof(index_name), "floppy_%s", page ? page + 1 : url);
+    char *extension = strrchr(index_name, '.');
+    if (extension != NULL)
     {
-        if (*p == ';')
-            count++;
-        p++;
+        *extension = '\0';
     }
-    *itemCount = (count / 5);
+    catalog_index_path(index_path, index_name);
 
+    err_t err = fetch_catalog(url, index_path, &parser, &index_parser, reset, &fetch);
     DPRINTF("Found %d entries\n", *itemCount);
-
-    if (*itemCount == 0)
+    if ((err != ERR_OK) || (*itemCount == 0))
     {
         // If no entries found, short circuit and return
-        if (buff != NULL)
-            free(buff);
-        return -1;
+        free(arena.base);
+        *items = NULL;
+        *itemCount = 0;
+        return err != ERR_OK ? err : -1;
     }
-
-    FloppyImageInfo *current = NULL;
-
-    // Allocate memory for the first FloppyImageInfo structure
-    *items = malloc(sizeof(FloppyImageInfo));
-    if (!*items)
+    DPRINTF("%d bytes of %d used\n", arena.used, arena.size);
+    if (skipped > 0)
     {
-        DPRINTF("Memory allocation failed\n");
-        free(buff);
-        return -1;
+        DPRINTF("WARNING: %d entries incomplete or not fitting in memory\n", skipped);
     }
-    char *buff_iter = buff;
-    current = *items; // Set current to the first allocated FloppyImageInfo structure
 
-    while (*buff_iter)
+    if (fetch.downloaded)
     {
-        if (*buff_iter == '"')
+        // Same columns as the db. The status, description and tags are left empty
+        CatalogIndexWriter *writer = malloc(sizeof(CatalogIndexWriter));
+        bool indexed = (writer != NULL) && catalog_index_create(writer, index_path, url, fetch.etag, fetch.last_modified);
+        if (indexed)
         {
-            inside_quotes = !inside_quotes;
-
-            if (inside_quotes)
+            for (FloppyImageInfo *item = *items; item != NULL; item = item->next)
             {
-                start = buff_iter + 1; // Start of a new value
-            }
-            else
-            {
-                char *value = strndup(start, buff_iter - start);
-                switch (items_count % 6)
-                {
-                case 0:
-                    current->name = value;
-                    break;
-                case 1:
-                    current->status = value;
-                    break;
-                case 2:
-                    current->description = value;
-                    break;
-                case 3:
-                    current->tags = value;
-                    break;
-                case 4:
-                    current->extra = value;
-                    break;
-                case 5:
-                    current->url = value;
-                    break;
-                }
-
-                items_count++;
-                if (items_count % 6 == 0 && *(buff_iter + 1) != '\0')
-                {
-                    // Allocate memory for the next FloppyImageInfo structure
-                    FloppyImageInfo *next = malloc(sizeof(FloppyImageInfo));
-                    if (!next)
-                    {
-                        DPRINTF("Memory allocation failed\n");
-                        return -1;
-                    }
-                    // Initialize the newly allocated structure
-                    *next = (FloppyImageInfo){0};
-
-                    current->next = next; // Link the current structure to the next one
-                    current = next;       // Move the current pointer to the next structure
-                }
+                catalog_index_field(writer, item->name);
+                catalog_index_field(writer, NULL);
+                catalog_index_field(writer, NULL);
+                catalog_index_field(writer, NULL);
+                catalog_index_field(writer, item->extra);
+                catalog_index_field(writer, item->url);
+                catalog_index_end_record(writer);
             }
+            indexed = catalog_index_close(writer);
         }
-        buff_iter++;
-    }
-    if (buff != NULL)
-    {
-        free(buff);
+        update_catalog_index(index_path, indexed);
+        free(writer);
     }
-    return callback_error;
+    return ERR_OK;
+}
+
+/**
+ * @brief Releases the floppy images returned by get_floppy_db_files().
+ *
+ * The records and their strings share one block, starting with the first record.
+ */
+void free_floppy_db_files(FloppyImageInfo *items)
+{
+    free(items);
 }
 
 int download_floppy(const char *url, const char *folder, const char *dest_filename, bool overwrite_flag)
 {
-    const int BUFFER_SIZE = 16384;
-    uint8_t *buff = malloc(BUFFER_SIZE);
-    uint32_t buff_pos = 0;
-    httpc_state_t *connection;
-    bool complete = false;
+    uint8_t *chunks[2] = {NULL, NULL}; // Double buffer: one is filled by lwIP while the other is written
+    uint8_t fill = 0;                  // Buffer being filled
+    uint32_t fill_len = 0;             // Bytes in the buffer being filled
+    uint32_t fill_size = 0;            // Bytes of the buffer being filled when it is full. Ends at a chunk boundary
+    int8_t ready = -1;                 // Buffer full and waiting to be written. -1 if none
+    uint32_t ready_len = 0;            // Bytes of the buffer full
+    uint32_t chunk_size = DOWNLOAD_CHUNK_SIZE;
+    struct pbuf *held = NULL;     // Received data that does not fit in the buffers. Not acknowledged yet
+    volatile bool complete = false;
+    volatile u32_t status = 0;
+    volatile httpc_result_t httpc_result = HTTPC_RESULT_OK;
     err_t callback_error = ERR_OK; // If any error found in the callback and cannot be returned, store it here
-    UrlParts parts;
+    uint32_t offset = 0;           // Bytes of the image in the .part file when the request is sent
+    volatile bool discard_part = false; // The main loop empties the .part file
+    int32_t range_start = -1;      // Start of the Content-Range of the response
+    int32_t range_total = -1;      // Size of the image in the Content-Range of the response
+    uint32_t received = 0;         // Bytes received in this call
+    uint32_t written = 0;          // Bytes written in this call
+    uint64_t write_us = 0;         // Time writing to the microSD card
+    uint32_t inflated = 0;         // Bytes inflated in this call, if the image is compressed
+    int8_t encoding = -1;          // ZIP_FORMAT_* of the body. -1 if it is not compressed
+    bool gz_url = false;           // The URL is a .gz file. Decompressed, so it can not be resumed
+
+    char etag[DOWNLOAD_VALIDATOR_SIZE] = "";          // Strong ETag of the response
+    char last_modified[DOWNLOAD_VALIDATOR_SIZE] = ""; // Last-Modified of the response
+    char validator[DOWNLOAD_VALIDATOR_SIZE] = "";     // Validator of the image in the .part file. Empty if it can not be resumed
 
     FRESULT fr;    // FatFS function common result code
     FIL dest_file; // File object
     UINT bw;       // File read/write count
     FILINFO fno;
 
-    err_t headers(httpc_state_t * connection, void *arg,
-                  struct pbuf *hdr, u16_t hdr_len, u32_t content_len)
+    void header_received(const char *name, const char *value)
     {
-        return ERR_OK;
+        // Content-Range: bytes start-end/total, or bytes */total
+        if ((strcasecmp(name, "Content-Range") == 0) && (strncasecmp(value, "bytes ", 6) == 0))
+        {
+            const char *total = strchr(value, '/');
+            range_start = (value[6] == '*') ? -1 : strtol(value + 6, NULL, 10);
+            range_total = (total != NULL) && (total[1] != '*') ? strtol(total + 1, NULL, 10) : -1;
+        }
+        else if (strcasecmp(name, "Content-Encoding") == 0)
+        {
+            encoding = (strcasecmp(value, "gzip") == 0) ? ZIP_FORMAT_GZIP : (strcasecmp(value, "deflate") == 0) ? ZIP_FORMAT_ZLIB : -1;
+        }
+        else if ((strcasecmp(name, "ETag") == 0) && (strncmp(value, "W/", 2) != 0))
+        {
+            // If-Range only accepts strong ETags
+            snprintf(etag, sizeof(etag), "%s", value);
+        }
+        else if (strcasecmp(name, "Last-Modified") == 0)
+        {
+            snprintf(last_modified, sizeof(last_modified), "%s", value);
+        }
     }
 
-    void result(void *arg, httpc_result_t httpc_result,
-                u32_t rx_content_len, u32_t srv_res, err_t err)
+    void headers_done(u32_t srv_res, s32_t content_length)
+    {
+        status = srv_res;
+        if ((srv_res == 200) && (encoding < 0) && gz_url)
+        {
+            encoding = ZIP_FORMAT_GZIP;
+        }
+        if ((srv_res == 206) && (encoding >= 0))
+        {
+            DPRINTF("Compressed range. It can not be resumed\n");
+            callback_error = ERR_VAL;
+        }
+        if ((srv_res == 200) && (offset > 0))
+        {
+            // The server ignored the range. Start again from the beginning. The file is not
+            // touched from lwIP: the main loop empties it before writing the first chunk
+            DPRINTF("Range not supported. Downloading the whole image\n");
+            discard_part = true;
+            offset = 0;
+            fill_size = chunk_size;
+        }
+        else if ((srv_res == 206) && (range_start != (int32_t)offset))
+        {
+            DPRINTF("Unexpected Content-Range start: %d\n", range_start);
+            callback_error = ERR_VAL;
+        }
+    }
 
+    void result(void *arg, httpc_result_t res, u32_t rx_content_len, u32_t srv_res, err_t err)
     {
+        httpc_result = res;
+        status = srv_res;
         complete = true;
-        if (srv_res != 200)
+        DPRINTF("Floppy image request complete. Status: %d. %d transfered.\n", srv_res, rx_content_len);
+    }
+
+    // Copy the data received to the buffers. The data that does not fit stays in held, and it
+    // is not acknowledged until it fits. Then the server waits for the microSD card
+    void receive(void)
+    {
+        if (encoding >= 0)
         {
-            DPRINTF("Floppy image download something went wrong. HTTP error: %d\n", srv_res);
-            callback_error = srv_res == 0 ? ERR_TIMEOUT : srv_res;
+            return; // Compressed. The inflater reads held
         }
-        else
+        while (held != NULL)
         {
-            DPRINTF("Floppy image transfer complete. %d transfered.\n", rx_content_len);
-            DPRINTF("Pending bytes to write: %d\n", buff_pos);
+            if (fill_len == fill_size)
+            {
+                if (ready >= 0)
+                {
+                    return; // Both buffers are full
+                }
+                ready = fill;
+                ready_len = fill_len;
+                fill ^= 1;
+                fill_len = 0;
+                fill_size = chunk_size;
+            }
+            u16_t n = MIN(held->tot_len, fill_size - fill_len);
+            pbuf_copy_partial(held, chunks[fill] + fill_len, n, 0);
+            fill_len += n;
+            received += n;
+            held = pbuf_free_header(held, n);
+            http_recved(n);
         }
     }
 
-    err_t body(void *arg, struct altcp_pcb *conn,
-               struct pbuf *p, err_t err)
+    err_t body(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err)
     {
+        if (((status != 200) && (status != 206)) || (callback_error != ERR_OK))
+        {
+            // Error page, or wrong range. Discarded
+            http_recved(p->tot_len);
+            pbuf_free(p);
+            return ERR_OK;
+        }
+        if (held == NULL)
+        {
+            held = p;
+        }
+        else
+        {
+            pbuf_cat(held, p);
+        }
+        receive();
+        return ERR_OK;
+    }
 
-        pbuf_copy_partial(p, buff, p->tot_len, 0);
-
-        fr = f_write(&dest_file, buff, p->tot_len, &bw); // Write it to the destination file
-        if (fr != FR_OK)
+    // Read the compressed body from held. The network is polled until there is data.
+    // 0 at the end of the body, -1 if the download stalled or the connection dropped
+    int read_held(uint8_t *buf, uint16_t len)
+    {
+        uint64_t start = time_us_64();
+        while (held == NULL)
+        {
+            if (complete && (httpc_result != HTTPC_RESULT_OK))
+            {
+                DPRINTF("Download interrupted. Result: %d\n", httpc_result);
+                callback_error = ERR_CONN;
+                return -1;
+            }
+            if (complete)
+            {
+                return 0;
+            }
+            if (time_us_64() - start > DOWNLOAD_FILES_TIMEOUT * 1000000)
+            {
+                DPRINTF("Download timed out\n");
+                callback_error = ERR_TIMEOUT;
+                return -1;
+            }
+#if PICO_CYW43_ARCH_POLL
+            network_safe_poll();
+#endif
+        }
+        uint16_t n = MIN(len, held->tot_len);
+        pbuf_copy_partial(held, buf, n, 0);
+        received += n;
+        cyw43_arch_lwip_begin();
+        held = pbuf_free_header(held, n);
+        http_recved(n);
+        cyw43_arch_lwip_end();
+        return n;
+    }
+
+    // Write a buffer to the .part file. Called from the main loop, never from lwIP
+    bool write_chunk(uint8_t *data, uint32_t len)
+    {
+        uint64_t start_us = time_us_64();
+        fr = f_write(&dest_file, data, len, &bw);
+        write_us += time_us_64() - start_us;
+        written += bw;
+        if ((fr != FR_OK) || (bw != len))
         {
             DPRINTF("f_write error: %s (%d)\n", FRESULT_str(fr), fr);
+            return false;
         }
-        // Write chunk to flash
-        DPRINTF("Writing %d bytes to file: %s...\n", p->tot_len, dest_filename);
-
-        tcp_recved(conn, p->tot_len);
+        if ((written % (DOWNLOAD_CHUNK_SIZE * DOWNLOAD_SYNC_CHUNKS)) < len)
+        {
+            f_sync(&dest_file); // The .part file keeps its progress if the power goes off
+        }
+        return true;
+    }
 
-        if (p != NULL)
+    // Inflate the body into the buffer being filled, and write the buffer each time it is full
+    void inflate_body(void)
+    {
+        ZipStream *stream = malloc(sizeof(ZipStream));
+        if ((stream == NULL) || (zip_stream_open_source(stream, read_held, encoding) != FR_OK))
         {
-            DPRINTF("pbuf ref count before free: %d\n", p->ref);
-            pbuf_free(p);
+            callback_error = (callback_error != ERR_OK) ? callback_error : (stream == NULL) ? ERR_MEM : ERR_VAL;
+            free(stream);
+            return;
         }
-        return ERR_OK;
+        int n;
+        while ((n = zip_stream_read(stream, chunks[fill] + fill_len, fill_size - fill_len)) > 0)
+        {
+            fill_len += n;
+            inflated += n;
+            if (fill_len == fill_size)
+            {
+                if (!write_chunk(chunks[fill], fill_len))
+                {
+                    callback_error = FR_CANNOT_OPEN_FILE_FOR_WRITE;
+                    break;
+                }
+                fill_len = 0;
+                fill_size = chunk_size;
+            }
+        }
+        if ((n < 0) && (callback_error == ERR_OK))
+        {
+            callback_error = ERR_VAL; // Corrupted compressed data
+        }
+        zip_stream_close(stream);
+        free(stream);
     }
 
     // Create full paths for source and destination files
     char dest_path[256];
-    sprintf(dest_path, "%s/%s", folder, dest_filename);
+    char part_path[256 + sizeof(DOWNLOAD_PART_EXTENSION)];
+    char validator_path[sizeof(part_path) + sizeof(DOWNLOAD_VALIDATOR_EXTENSION)];
+    snprintf(dest_path, sizeof(dest_path), "%s/%s", folder, dest_filename);
+    snprintf(part_path, sizeof(part_path), "%s%s", dest_path, DOWNLOAD_PART_EXTENSION);
+    snprintf(validator_path, sizeof(validator_path), "%s%s", part_path, DOWNLOAD_VALIDATOR_EXTENSION);
+
+    // Read the validator of the .part file. Empty if the file is missing or it was downloaded from another URL
+    void load_validator(void)
+    {
+        FIL file;
+        char line[DOWNLOAD_VALIDATOR_URL_SIZE];
+        validator[0] = '\0';
+        if (f_open(&file, validator_path, FA_READ) != FR_OK)
+        {
+            return;
+        }
+        // First line the URL, second line the validator
+        if ((f_gets(line, sizeof(line), &file) != NULL) && (strncmp(line, url, strcspn(line, "\n")) == 0) &&
+            (url[strcspn(line, "\n")] == '\0') && (f_gets(validator, sizeof(validator), &file) != NULL))
+        {
+            validator[strcspn(validator, "\n")] = '\0';
+        }
+        else
+        {
+            validator[0] = '\0';
+        }
+        f_close(&file);
+    }
+
+    // Keep the URL and the validator of the image the .part file starts to receive
+    void save_validator(void)
+    {
+        FIL file;
+        snprintf(validator, sizeof(validator), "%s", etag[0] != '\0' ? etag : last_modified);
+        if ((validator[0] == '\0') || (strlen(url) >= DOWNLOAD_VALIDATOR_URL_SIZE - 1))
+        {
+            // Without a validator a changed image could be mixed with the .part file
+            validator[0] = '\0';
+            f_unlink(validator_path);
+            return;
+        }
+        if (f_open(&file, validator_path, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK)
+        {
+            f_printf(&file, "%s\n%s\n", url, validator);
+            f_close(&file);
+        }
+    }
 
     // Check if the destination file exists
     fr = f_stat(dest_path, &fno);
@@ -1855,75 +2176,268 @@ int download_floppy(const char *url, const char *folder, const char *dest_filena
         return FR_FILE_EXISTS; // Destination file exists and overwrite_flag is false, cancel the operation
     }
 
-    // Create and open the destination file
-    fr = f_open(&dest_file, dest_path, FA_CREATE_ALWAYS | FA_WRITE);
+    // Open the partial download, or create it
+    fr = f_open(&dest_file, part_path, FA_OPEN_ALWAYS | FA_WRITE);
     if (fr != FR_OK)
     {
         DPRINTF("f_open error: %s (%d)\n", FRESULT_str(fr), fr);
-        f_close(&dest_file); // Close the source file if it was opened successfully
         return FR_CANNOT_OPEN_FILE_FOR_WRITE;
     }
+    load_validator();
+
+    // The chunks are as big as a cluster, up to DOWNLOAD_CHUNK_SIZE. Both are powers of two, so
+    // a chunk written at a chunk boundary never crosses a cluster
+    uint32_t cluster_size = dest_file.obj.fs->csize * FF_MAX_SS;
+    chunk_size = MIN(cluster_size, DOWNLOAD_CHUNK_SIZE);
+    chunks[0] = malloc(chunk_size);
+    chunks[1] = malloc(chunk_size);
+    if ((chunks[0] == NULL) || (chunks[1] == NULL))
+    {
+        DPRINTF("Failed to allocate the download buffers\n");
+        f_close(&dest_file);
+        free(chunks[0]);
+        free(chunks[1]);
+        return -1;
+    }
 
     DPRINTF("Downloading Floppy image from %s\n", url);
+    UrlParts parts;
     if (split_url(url, &parts) != 0)
     {
         DPRINTF("Failed to split URL\n");
+        f_close(&dest_file);
+        free(chunks[0]);
+        free(chunks[1]);
         return -1;
     }
 
     DPRINTF("Protocol %s\n", parts.protocol);
     DPRINTF("Domain %s\n", parts.domain);
     DPRINTF("URI %s\n", parts.uri);
+    gz_url = check_gzip_extension(parts);
 
-    httpc_connection_t settings;
-    memset(&settings, 0, sizeof(settings));
-
-    settings.result_fn = result;
-    settings.headers_done_fn = headers;
-    settings.use_proxy = false;
+    uint64_t download_start = time_us_64();
+    bool done = false;
+    for (int attempt = 0; (attempt < DOWNLOAD_FLOPPY_ATTEMPTS) && !done; attempt++)
+    {
+        if ((f_size(&dest_file) > 0) && (gz_url || (validator[0] == '\0')))
+        {
+            // The ranges of a .gz file are compressed bytes, and without a validator nothing tells
+            // the .part file has the same image. Start again from the beginning
+            DPRINTF("The .part file can not be resumed. Discarding it\n");
+            f_lseek(&dest_file, 0);
+            f_truncate(&dest_file);
+        }
+        // Resume from the end of the .part file
+        offset = f_size(&dest_file);
+        f_lseek(&dest_file, offset);
+        fill = 0;
+        fill_len = 0;
+        fill_size = chunk_size - (offset % chunk_size); // The next chunks start at a chunk boundary
+        ready = -1;
+        range_start = -1;
+        range_total = -1;
+        discard_part = false;
+        status = 0;
+        httpc_result = HTTPC_RESULT_OK;
+        callback_error = ERR_OK;
+        complete = false;
+        encoding = -1;
+        etag[0] = '\0';
+        last_modified[0] = '\0';
+
+        // A resumed download asks for the image as it is, because the ranges of a
+        // compressed body can not be inflated. If-Range makes the server send the whole
+        // image if it changed since the .part file was started
+        char range[48 + DOWNLOAD_VALIDATOR_SIZE] = "Accept-Encoding: " DOWNLOAD_ACCEPT_ENCODING "\r\n";
+        if (offset > 0)
+        {
+            DPRINTF("Resuming the download at %d bytes\n", offset);
+            snprintf(range, sizeof(range), "Range: bytes=%lu-\r\nIf-Range: %s\r\n", (unsigned long)offset, validator);
+        }
+        HttpRequest request = {
+            .headers = range,
+            .header_fn = header_received,
+            .headers_done_fn = headers_done,
+            .body_fn = body,
+            .result_fn = result,
+        };
+
+        cyw43_arch_lwip_begin();
+        err_t err = http_get(parts.domain, parts.port, parts.uri, &request);
+        cyw43_arch_lwip_end();
+        if (err != ERR_OK)
+        {
+            DPRINTF("HTTP GET failed: %d\n", err);
+            callback_error = -1;
+            break;
+        }
 
-    complete = false;
-    cyw43_arch_lwip_begin();
-    err_t err = httpc_get_file_dns(
-        parts.domain,
-        LWIP_IANA_PORT_HTTP,
-        parts.uri,
-        &settings,
-        body,
-        NULL,
-        NULL);
-    cyw43_arch_lwip_end();
+        // Wait for the headers. They tell if the body is compressed
+        uint64_t last_data = time_us_64();
+        while ((status == 0) && !complete && (callback_error == ERR_OK))
+        {
+#if PICO_CYW43_ARCH_POLL
+            network_safe_poll();
+#endif
+            if (time_us_64() - last_data > DOWNLOAD_FILES_TIMEOUT * 1000000)
+            {
+                DPRINTF("Download timed out\n");
+                callback_error = ERR_TIMEOUT;
+            }
+        }
+        if (discard_part)
+        {
+            // Nothing was written yet: the buffers are written from this loop
+            f_lseek(&dest_file, 0);
+            f_truncate(&dest_file);
+            discard_part = false;
+        }
 
-    if (err != ERR_OK)
-    {
-        DPRINTF("HTTP GET failed: %d\n", err);
-        free_url_parts(&parts);
-        return -1;
-    }
-    else
-    {
-        DPRINTF("HTTP GET sent\n");
-    }
+        if ((callback_error == ERR_OK) && (status == 200))
+        {
+            // The .part file starts again with this image
+            save_validator();
+        }
 
-    uint64_t start_time = time_us_64();
-    uint64_t timeout = DOWNLOAD_FILES_TIMEOUT * 1000000; // N seconds timeout in microseconds
-    while (!complete)
-    {
+        if ((callback_error == ERR_OK) && (status == 200) && (encoding >= 0))
+        {
+            // Compressed. The inflater polls the network when it needs more data
+            DPRINTF("Compressed floppy image. Format: %d\n", encoding);
+            inflate_body();
+            if ((callback_error == ERR_OK) && !complete)
+            {
+                // The inflater found the end of the data. Nothing else to read
+                cyw43_arch_lwip_begin();
+                http_abort();
+                cyw43_arch_lwip_end();
+                complete = true;
+            }
+        }
+        else if (callback_error == ERR_OK)
+        {
+            // The main loop writes the full buffers while lwIP fills the other one. The timeout
+            // counts from the last data received, so a slow but steady download never expires
+            last_data = time_us_64();
+            uint32_t last_received = received;
+            while (!complete || (held != NULL) || (ready >= 0))
+            {
 #if PICO_CYW43_ARCH_POLL
-        network_safe_poll();
+                network_safe_poll();
 #endif
-        if (time_us_64() - start_time > timeout)
+                if (ready >= 0)
+                {
+                    bool ok = write_chunk(chunks[ready], ready_len);
+                    ready = -1;
+                    if (!ok)
+                    {
+                        callback_error = FR_CANNOT_OPEN_FILE_FOR_WRITE;
+                        break;
+                    }
+                }
+                cyw43_arch_lwip_begin();
+                receive();
+                cyw43_arch_lwip_end();
+                if (callback_error != ERR_OK)
+                {
+                    break;
+                }
+                if (received != last_received)
+                {
+                    last_received = received;
+                    last_data = time_us_64();
+                }
+                else if (!complete && (time_us_64() - last_data > DOWNLOAD_FILES_TIMEOUT * 1000000))
+                {
+                    DPRINTF("Download timed out\n");
+                    callback_error = ERR_TIMEOUT;
+                    break;
+                }
+            }
+        }
+
+        if (callback_error != ERR_OK)
         {
-            DPRINTF("Download timed out\n");
-            callback_error = ERR_TIMEOUT;
+            // Close the connection and drop the data not written. The .part file is kept
+            cyw43_arch_lwip_begin();
+            http_abort();
+            if (held != NULL)
+            {
+                pbuf_free(held);
+                held = NULL;
+            }
+            cyw43_arch_lwip_end();
+            if ((callback_error != ERR_TIMEOUT) && (callback_error != ERR_CONN))
+            {
+                break;
+            }
+            continue;
+        }
+
+        // Write the data of the last, partial, chunk
+        if ((fill_len > 0) && !write_chunk(chunks[fill], fill_len))
+        {
+            callback_error = FR_CANNOT_OPEN_FILE_FOR_WRITE;
+            break;
+        }
+
+        if ((status == 416) && (offset > 0) && (range_total == (int32_t)offset))
+        {
+            DPRINTF("The .part file already had the whole image\n");
+            done = true;
+        }
+        else if ((status == 200) || (status == 206))
+        {
+            done = (httpc_result == HTTPC_RESULT_OK);
+            if (!done)
+            {
+                // The connection dropped. Resume from where it was left
+                DPRINTF("Floppy image download interrupted at %d bytes. Result: %d\n", f_tell(&dest_file), httpc_result);
+                callback_error = ERR_CONN;
+            }
+        }
+        else
+        {
+            DPRINTF("Floppy image download something went wrong. HTTP error: %d\n", status);
+            callback_error = status == 0 ? ERR_TIMEOUT : status;
+            if (status == 416)
+            {
+                // The .part file does not match the image. Discard it
+                f_lseek(&dest_file, 0);
+                f_truncate(&dest_file);
+            }
             break;
         }
     }
 
+    uint32_t download_ms = (uint32_t)((time_us_64() - download_start) / 1000);
+    uint32_t write_ms = (uint32_t)(write_us / 1000);
+    DPRINTF("Downloaded %d bytes in %d ms (%d KB/s)\n", received, download_ms, download_ms > 0 ? received / download_ms : 0);
+    log_http_client_stats();
+    DPRINTF("Written %d bytes in %d ms (%d KB/s). Chunks of %d bytes\n", written, write_ms, write_ms > 0 ? written / write_ms : 0, chunk_size);
+    if (inflated > 0)
+    {
+        DPRINTF("Inflated %d bytes. %d%% of them downloaded\n", inflated, (int)((uint64_t)received * 100 / inflated));
+    }
+
     // Close open file
     f_close(&dest_file);
+    if (done)
+    {
+        // The image is complete. It replaces the previous one, if any
+        callback_error = ERR_OK;
+        f_unlink(validator_path);
+        f_unlink(dest_path);
+        fr = f_rename(part_path, dest_path);
+        if (fr != FR_OK)
+        {
+            DPRINTF("f_rename error: %s (%d)\n", FRESULT_str(fr), fr);
+            callback_error = FR_CANNOT_OPEN_FILE_FOR_WRITE;
+        }
+    }
 
     free_url_parts(&parts);
-    free(buff);
+    free(chunks[0]);
+    free(chunks[1]);
     return callback_error;
 }
@@ -59,6 +59,10 @@ static bool disconnect_network = false;
 static bool restart_network = false;
 static bool get_rom_catalog = false;
 
+// Polling times. The configurator can change them while the loop runs
+static uint32_t wifi_scan_poll_polling_ms = 0;
+static uint32_t network_status_polling_ms = 0;
+
 // ROMs in network variables
 static int rom_network_selected = -1;
 static char *rom_rescue_mode_file_content = NULL;
@@ -100,9 +104,7 @@ static void update_sd_status(FATFS *fs, SdCardData *sd_data_ptr)
         return;
     }
 
-    ConfigEntry *is_fcount_enabled_conf = find_entry(PARAM_FILE_COUNT_ENABLED);
-    bool is_fcount_enabled = (is_fcount_enabled_conf->value[0] == 't' || is_fcount_enabled_conf->value[0] == 'T') ? true : false;
-    get_sdcard_data(fs, sd_data_local, sd_data_ptr, is_fcount_enabled);
+    get_sdcard_data(fs, sd_data_local, sd_data_ptr, config_bool(CONFIG_KEY_FILE_COUNT_ENABLED));
 
     // Copy the content of sd_data_local to sd_data_ptr
     memcpy(sd_data_ptr, sd_data_local, sizeof(SdCardData));
@@ -431,7 +433,7 @@ void __not_in_flash_func(dma_irq_handler_lookup_callback)(void)
 
     // Avoid priting anything inside an IRQ handled function
     // DPRINTF("DMA LOOKUP: $%x\n", addr);
-    if (addr >= ROM3_START_ADDRESS)
+    if (addr >= protocol_rom3_start_address)
     {
         parse_protocol((uint16_t)(addr & 0xFFFF), handle_protocol_command);
     }
@@ -440,12 +442,19 @@ void __not_in_flash_func(dma_irq_handler_lookup_callback)(void)
     dma_hw->ints1 = 1u << lookup_data_rom_dma_channel;
 }
 
+// Called from the protocol IRQ when the configurator changes a polling time
+static void polling_times_changed(ConfigKey key)
+{
+    wifi_scan_poll_polling_ms = get_wifi_scan_poll_secs() * 1000;
+    network_status_polling_ms = get_network_status_polling_ms();
+}
+
 int delete_FLASH(void)
 {
     // Erase the content before loading the new file. It seems that
     // overwriting it's not enough
     DPRINTF("Erasing FLASH...\n");
-    flash_range_erase(FLASH_ROM_LOAD_OFFSET, (ROM_SIZE_BYTES * 2) - 1); // Two banks of 64K
+    flash_write_erase(FLASH_ROM_LOAD_OFFSET, ROM_SIZE_BYTES * 2); // Two banks of 64K
     DPRINTF("FLASH erased.\n");
     return 0;
 }
@@ -456,6 +465,8 @@ int init_firmware()
     // IRQ handler callback to read the commands in ROM3, and NOT copy the FLASH ROMs to RAM
     // and start the state machine
     init_romemul(NULL, dma_irq_handler_lookup_callback, false);
+    // The DMA IRQ handler is RAM resident, so it keeps running while the flash is written
+    flash_write_keep_protocol_irq(true);
 
     // Copy the firmware to RAM
     COPY_FIRMWARE_TO_RAM((uint16_t *)firmwareROM, firmwareROM_length);
@@ -514,9 +525,10 @@ int init_firmware()
     // The structure is a list of chars separated with a 0x00 byte. The end of the list is marked with
     // two 0x00 bytes.
 
-    // Configure polling times
-    u_int16_t wifi_scan_poll_polling_ms = get_wifi_scan_poll_secs() * 1000;
-    u_int32_t network_status_polling_ms = get_network_status_polling_ms();
+    // Configure polling times, and follow the changes
+    polling_times_changed(CONFIG_KEY_NETWORK_STATUS_SEC);
+    config_subscribe(CONFIG_KEY_NETWORK_STATUS_SEC, polling_times_changed);
+    config_subscribe(CONFIG_KEY_WIFI_SCAN_SECONDS, polling_times_changed);
 
     SdCardData sd_data = {0}; // Lazy initalization
     if (microsd_mounted)
@@ -641,7 +653,7 @@ int init_firmware()
         if (time_passed(&network_poll_counter, network_status_polling_ms))
         {
             network_poll_counter = make_timeout_time_ms(0);
-            if (strlen(find_entry(PARAM_WIFI_SSID)->value) > 0)
+            if (strlen(config_string(CONFIG_KEY_WIFI_SSID)) > 0)
             {
                 // Only display when changes status to avoid flooding the console
                 ConnectionStatus previous_status = get_previous_connection_status();
@@ -660,12 +672,7 @@ int init_firmware()
                             print_ipv4(get_netmask()),
                             print_mac(get_mac_address()));
 #endif
-                    ConfigEntry *dhcp_enabled_conf = find_entry(PARAM_WIFI_DHCP);
-                    bool dhcp_enabled = false;
-                    if (dhcp_enabled_conf != NULL)
-                    {
-                        dhcp_enabled = (dhcp_enabled_conf->value[0] == 't' || dhcp_enabled_conf->value[0] == 'T') ? true : false;
-                    }
+                    bool dhcp_enabled = config_bool(CONFIG_KEY_WIFI_DHCP);
                     if (!version_checked && ((current_status == CONNECTED_WIFI_IP) || ((current_status == CONNECTED_WIFI_NO_IP) && !dhcp_enabled)))
                     {
                         version_checked = true;
@@ -712,6 +719,12 @@ int init_firmware()
             }
         }
 
+        // Count the files of the folders without blocking the loop
+        if (microsd_mounted)
+        {
+            folder_count_task(FOLDER_COUNT_BUDGET_MS);
+        }
+
         // Poll the storage status in the SD card
         if (time_passed(&storage_poll_counter, STORAGE_POLL_INTERVAL))
         {
@@ -790,45 +803,7 @@ int init_firmware()
             if (filtered_num_network_files > 0)
             {
                 DPRINTF("Freeing network files...\n");
-                RomInfo *current = network_files;
-
-                // Free dynamically allocated memory for each node in the list
-                while (current != NULL)
-                {
-                    // Free each dynamically allocated field, if non-NULL
-                    if (current->url)
-                    {
-                        free(current->url);
-                        current->url = NULL;
-                    }
-                    if (current->name)
-                    {
-                        free(current->name);
-                        current->name = NULL;
-                    }
-                    // Description not used
-                    // if (current->description)
-                    // {
-                    //     free(current->description);
-                    //     current->description = NULL;
-                    // }
-                    if (current->tags)
-                    {
-                        free(current->tags);
-                        current->tags = NULL;
-                    }
-
-                    // Store the next node before freeing the current one
-                    RomInfo *next = current->next;
-
-                    // Free the current node and move to the next
-                    if (current != NULL) {
-                        free(current);
-                    }
-                    current = next;
-                }
-
-                // Optional: Reset the head pointer if you’re done with the list
+                free_rom_catalog(network_files);
                 network_files = NULL;
             }
 
@@ -836,8 +811,8 @@ int init_firmware()
             memset(memory_area + RANDOM_SEED_SIZE, 0, CONFIGURATOR_SHARED_MEMORY_SIZE_BYTES - RANDOM_SEED_SIZE);
 
             // Get the URL from the configuration
-            // char *url = find_entry(PARAM_ROMS_YAML_URL)->value;
-            char *url = find_entry(PARAM_ROMS_CSV_URL)->value;
+            // const char *url = config_string(CONFIG_KEY_ROMS_YAML_URL);
+            const char *url = config_string(CONFIG_KEY_ROMS_CSV_URL);
 
             DPRINTF("URL: %s\n", url);
             // The the JSON file info
@@ -890,7 +865,7 @@ int init_firmware()
         {
             list_roms = false;
             // Show the root directory content (ls command)
-            char *dir = find_entry(PARAM_ROMS_FOLDER)->value;
+            const char *dir = config_string(CONFIG_KEY_ROMS_FOLDER);
             if (strlen(dir) == 0)
             {
                 dir = "";
@@ -900,6 +875,8 @@ int init_firmware()
 
             // Remove hidden files from the list
             const char *allowed_extensions[] = {"img", "bin", "stc", "rom"};
+            // Show the ROM images inside the ZIP archives too
+            zip_expand_file_list(dir, &file_list, &num_files, allowed_extensions, 4);
 
             filtered_local_list = filter(file_list, num_files, &filtered_num_local_files, allowed_extensions, 4);
             // Sort remaining valid filenames lexicographically
@@ -915,7 +892,7 @@ int init_firmware()
         {
             list_floppies = false;
             // Show the root directory content (ls command)
-            char *dir = find_entry(PARAM_FLOPPIES_FOLDER)->value;
+            const char *dir = config_string(CONFIG_KEY_FLOPPIES_FOLDER);
             if (strlen(dir) == 0)
             {
                 dir = "";
@@ -926,6 +903,8 @@ int init_firmware()
 
             // Remove hidden files from the list
             const char *allowed_extensions[] = {"st", "msa", "rw"};
+            // Show the floppy images inside the ZIP archives too
+            zip_expand_file_list(dir, &file_list, &num_files, allowed_extensions, 3);
             filtered_local_list = filter(file_list, num_files, &filtered_num_local_files, allowed_extensions, 3);
             // Sort remaining valid filenames lexicographically
             qsort(filtered_local_list, filtered_num_local_files, sizeof(char *), compare_strings);
@@ -941,30 +920,13 @@ int init_firmware()
             query_floppy_db = false;
 
             // Free dynamically allocated memory first
-            while (floppy_images_files != NULL)
-            {
-                FloppyImageInfo *current = floppy_images_files;
-
-                // Free each dynamically allocated string in the structure
-                free(current->name);
-                free(current->status);
-                free(current->description);
-                free(current->tags);
-                free(current->extra);
-                free(current->url);
-
-                // Free the current structure
-                free(current);
-
-                // Move to the next item
-                floppy_images_files = floppy_images_files->next; // Move to the next item before freeing the current one
-            }
+            free_floppy_db_files(floppy_images_files);
             floppy_images_files = NULL;
 
             dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, false);
 
             // Get the URL from the configuration
-            char *base_url = find_entry(PARAM_FLOPPY_DB_URL)->value;
+            const char *base_url = config_string(CONFIG_KEY_FLOPPY_DB_URL);
 
             // Ensure that the buffer is large enough for the original URL, the `/db/`, the letter, `.csv`, and the null terminator.
             char url[256]; // Adjust the size as needed based on the maximum length of base_url.
@@ -1041,7 +1003,7 @@ int init_firmware()
             }
             strcpy(dest_ptr, ".st.rw");
             DPRINTF("Floppy file to create: %s\n", floppy_header.floppy_name);
-            char *dir = find_entry(PARAM_FLOPPIES_FOLDER)->value;
+            const char *dir = config_string(CONFIG_KEY_FLOPPIES_FOLDER);
             DPRINTF("Floppy folder: %s\n", dir);
             FRESULT err = create_blank_ST_image(dir,
                                                 floppy_header.floppy_name,
@@ -1086,10 +1048,18 @@ int init_firmware()
 
             char full_url[512];
             // Get the URL from the configuration
-            char *base_url = find_entry("FLOPPY_DB_URL")->value;
-
-            char *dest_filename = extract_filename(remote.url);
-            char *dir = find_entry(PARAM_FLOPPIES_FOLDER)->value;
+            const char *base_url = config_string(CONFIG_KEY_FLOPPY_DB_URL);
+
+            // A compressed image is stored inflated, without the .gz extension
+            char dest_filename[256];
+            snprintf(dest_filename, sizeof(dest_filename), "%s", extract_filename(remote.url));
+            size_t dest_len = strlen(dest_filename);
+            size_t gz_len = strlen(ZIP_GZIP_EXTENSION);
+            if ((dest_len > gz_len) && (strcasecmp(dest_filename + dest_len - gz_len, ZIP_GZIP_EXTENSION) == 0))
+            {
+                dest_filename[dest_len - gz_len] = '\0';
+            }
+            const char *dir = config_string(CONFIG_KEY_FLOPPIES_FOLDER);
 
             if (strncmp(remote_uri, "http", 4) == 0)
             { // Check if remote_uri starts with "http"
@@ -1111,6 +1081,11 @@ int init_firmware()
                 // Directory exists
                 DPRINTF("Directory exists: %s\n", dir);
 
+                char dest_path[512];
+                snprintf(dest_path, sizeof(dest_path), "%s/%s", dir, dest_filename);
+                FILINFO fno;
+                bool dest_exists = (f_stat(dest_path, &fno) == FR_OK);
+
                 err_t err = download_floppy(&full_url[0], dir, dest_filename, true);
 
                 if (err != ERR_OK)
@@ -1120,6 +1095,10 @@ int init_firmware()
                 }
                 else
                 {
+                    if (!dest_exists)
+                    {
+                        folder_count_adjust(dest_path, 1);
+                    }
                     // When downloading a floppy image, the floppy image B is cleared
                     // to avoid conflicts
                     put_string(PARAM_FLOPPY_IMAGE_A, dest_filename);
@@ -1154,13 +1133,50 @@ int init_firmware()
 
                 char *old_floppy = NULL;
                 char *filename = NULL;
-                char *dir = find_entry(PARAM_FLOPPIES_FOLDER)->value;
+                const char *dir = config_string(CONFIG_KEY_FLOPPIES_FOLDER);
                 filename = filtered_local_list[floppy_file_selected - 1];
 
                 size_t filename_length = strlen(filename);
                 bool is_msa = filename_length > 4 &&
                               (strcasecmp(&filename[filename_length - 4], ".MSA") == 0);
 
+                // Images inside a ZIP archive look like "archive.zip/image.st"
+                char zip_fullpath[ZIP_MAX_PATH_LENGTH];
+                char zip_path[ZIP_MAX_PATH_LENGTH];
+                const char *entry_name = NULL;
+                const char *entry_basename = NULL;
+                char *extracted_msa = NULL;
+                snprintf(zip_fullpath, sizeof(zip_fullpath), "%s/%s", dir, filename);
+                bool in_zip = zip_split_path(zip_fullpath, zip_path, sizeof(zip_path), &entry_name);
+                if (in_zip)
+                {
+                    entry_basename = strrchr(entry_name, '/') != NULL ? strrchr(entry_name, '/') + 1 : entry_name;
+                }
+                if (in_zip && is_msa)
+                {
+                    // MSA_to_ST needs a file, so the MSA image is extracted from the archive first.
+                    // The file is temporary: one left by a power off is replaced
+                    char dest_path[ZIP_MAX_PATH_LENGTH];
+                    snprintf(dest_path, sizeof(dest_path), "%s/%s" MSA_EXTRACT_EXTENSION, dir, entry_basename);
+                    dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, false);
+                    FRESULT err = zip_extract(zip_path, entry_name, dest_path, true);
+                    dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, true);
+                    if (err != FR_OK)
+                    {
+                        DPRINTF("ZIP extract error: %d\n", err);
+                        is_msa = false;
+                        filename = NULL;
+                    }
+                    else
+                    {
+                        extracted_msa = malloc(strlen(entry_basename) + strlen(MSA_EXTRACT_EXTENSION) + 1);
+                        sprintf(extracted_msa, "%s" MSA_EXTRACT_EXTENSION, entry_basename);
+                        filename = extracted_msa;
+                        filename_length = strlen(entry_basename); // The ST image is named after the MSA image
+                        in_zip = false;
+                    }
+                }
+
                 DPRINTF("Floppy drive: %c\n", floppy_drive == 0 ? 'A' : 'B');
                 DPRINTF("Floppy folder: %s\n", dir);
                 DPRINTF("Floppy file: %s\n", filename);
@@ -1171,7 +1187,7 @@ int init_firmware()
                 {
                     // Create a filename and change the extension to .ST
                     char *stFilename = malloc(filename_length + 1);
-                    strcpy(stFilename, filename);
+                    memcpy(stFilename, filename, filename_length - 4);
                     strcpy(&stFilename[filename_length - 4], ".ST");
                     DPRINTF("MSA to ST: %s -> %s\n", filename, stFilename);
                     dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, false);
@@ -1190,14 +1206,38 @@ int init_firmware()
                 {
                     old_floppy = filename;
                 }
+                if (extracted_msa != NULL)
+                {
+                    char tmp_path[ZIP_MAX_PATH_LENGTH];
+                    snprintf(tmp_path, sizeof(tmp_path), "%s/%s", dir, extracted_msa);
+                    f_unlink(tmp_path);
+                    free(extracted_msa);
+                }
 
                 if (old_floppy != NULL)
                 {
                     DPRINTF("Load file: %s\n", old_floppy);
                     char *new_floppy = NULL;
                     // Check if old_floppy ends with ".rw"
-                    bool use_existing_rw = (strlen(old_floppy) > 3 && strcmp(&old_floppy[strlen(old_floppy) - 3], ".rw") == 0);
-                    if (floppy_read_write && !use_existing_rw)
+                    bool use_existing_rw = !in_zip && (strlen(old_floppy) > 3 && strcmp(&old_floppy[strlen(old_floppy) - 3], ".rw") == 0);
+                    if (floppy_read_write && in_zip)
+                    {
+                        // The images inside ZIP archives are read only. Extract a copy to write on it
+                        new_floppy = malloc(strlen(entry_basename) + strlen(".rw") + 1);
+                        sprintf(new_floppy, "%s.rw", entry_basename);
+                        char dest_path[ZIP_MAX_PATH_LENGTH];
+                        snprintf(dest_path, sizeof(dest_path), "%s/%s", dir, new_floppy);
+                        dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, false);
+                        FRESULT result = zip_extract(zip_path, entry_name, dest_path, false); // Keep the copy if it exists
+                        dma_channel_set_irq1_enabled(lookup_data_rom_dma_channel, true);
+                        if ((result != FR_OK) && (result != FR_EXIST))
+                        {
+                            DPRINTF("ZIP extract error: %d\n", result);
+                            free(new_floppy);
+                            new_floppy = NULL;
+                        }
+                    }
+                    else if (floppy_read_write && !use_existing_rw)
                     {
                         new_floppy = malloc(strlen(old_floppy) + strlen(".rw") + 1); // Allocate space for the old string, the new suffix, and the null terminator
                         sprintf(new_floppy, "%s.rw", old_floppy);                    // Create the new string with the .rw suffix
@@ -1211,16 +1251,24 @@ int init_firmware()
                     }
                     DPRINTF("Floppy Read/Write: %s\n", floppy_read_write ? "true" : "false");
 
-                    if (floppy_drive == 0)
+                    if (new_floppy == NULL)
                     {
-                        put_string(PARAM_FLOPPY_IMAGE_A, new_floppy);
+                        // The image to write could not be created. Keep the current configuration
+                        DPRINTF("ERROR: Could not extract the floppy image. Not loaded\n");
                     }
                     else
                     {
-                        put_string(PARAM_FLOPPY_IMAGE_B, new_floppy);
+                        if (floppy_drive == 0)
+                        {
+                            put_string(PARAM_FLOPPY_IMAGE_A, new_floppy);
+                        }
+                        else
+                        {
+                            put_string(PARAM_FLOPPY_IMAGE_B, new_floppy);
+                        }
+                        put_string(PARAM_BOOT_FEATURE, "FLOPPY_EMULATOR");
+                        write_all_entries();
                     }
-                    put_string(PARAM_BOOT_FEATURE, "FLOPPY_EMULATOR");
-                    write_all_entries();
 
                     free(new_floppy);
                     fflush(stdout);
@@ -1240,10 +1288,8 @@ int init_firmware()
 
         // Erase the content before loading the new file. It seems that
         // overwriting it's not enough
-        uint32_t ints = save_and_disable_interrupts();
-        flash_range_erase(FLASH_ROM_LOAD_OFFSET, ROM_SIZE_BYTES * 2); // Two banks of 64K
-        restore_interrupts(ints);
-        int res = load_rom_from_fs(find_entry(PARAM_ROMS_FOLDER)->value, filtered_local_list[rom_file_selected - 1], FLASH_ROM_LOAD_OFFSET);
+        flash_write_erase(FLASH_ROM_LOAD_OFFSET, ROM_SIZE_BYTES * 2); // Two banks of 64K
+        int res = load_rom_from_fs(config_string(CONFIG_KEY_ROMS_FOLDER), filtered_local_list[rom_file_selected - 1], FLASH_ROM_LOAD_OFFSET);
 
         if (res != FR_OK)
             DPRINTF("f_open error: %s (%d)\n", FRESULT_str(res), res);
@@ -1263,10 +1309,8 @@ int init_firmware()
 
         // Erase the content before loading the new file. It seems that
         // overwriting it's not enough
-        uint32_t ints = save_and_disable_interrupts();
-        flash_range_erase(FLASH_ROM_LOAD_OFFSET, ROM_SIZE_BYTES * 2); // Two banks of 64K
-        restore_interrupts(ints);
-        int res = load_rom_from_fs(find_entry(PARAM_ROMS_FOLDER)->value, rom_rescue_mode_file_content, FLASH_ROM_LOAD_OFFSET);
+        flash_write_erase(FLASH_ROM_LOAD_OFFSET, ROM_SIZE_BYTES * 2); // Two banks of 64K
+        int res = load_rom_from_fs(config_string(CONFIG_KEY_ROMS_FOLDER), rom_rescue_mode_file_content, FLASH_ROM_LOAD_OFFSET);
 
         if (res != FR_OK)
             DPRINTF("f_open error: %s (%d)\n", FRESULT_str(res), res);
@@ -1294,7 +1338,7 @@ int init_firmware()
             DPRINTF("Error: selected index is out of bounds\n");
         }
         else {
-            const char *url = find_entry(PARAM_ROMS_CSV_URL)->value;
+            const char *url = config_string(CONFIG_KEY_ROMS_CSV_URL);
             // Split the url in parts
             UrlParts url_parts;
             int url_parts_err = split_url(url, &url_parts);
@@ -1308,8 +1352,15 @@ int init_firmware()
             else
             {
                 // Use sprintf to format and concatenate strings
-                full_url = malloc(strlen(url_parts.protocol) + strlen(url_parts.domain) + strlen(current->url) + 5);
-                sprintf(full_url, "%s://%s/%s", url_parts.protocol, url_parts.domain, current->url);
+                full_url = malloc(strlen(url_parts.protocol) + strlen(url_parts.domain) + strlen(current->url) + 11);
+                if (url_parts.port != HTTP_CLIENT_PORT)
+                {
+                    sprintf(full_url, "%s://%s:%u/%s", url_parts.protocol, url_parts.domain, url_parts.port, current->url);
+                }
+                else
+                {
+                    sprintf(full_url, "%s://%s/%s", url_parts.protocol, url_parts.domain, current->url);
+                }
             }
             err_t res = download_rom(full_url, FLASH_ROM_LOAD_OFFSET);
             DPRINTF("Download ROM result: %d\n", res);
@@ -32,7 +32,7 @@ static bool reentry_unlocked = false;
 static datetime_t rtc_time = {0};
 static NTP_TIME net_time;
 static long utc_offset_seconds = 0;
-static char *ntp_server_host = NULL;
+static const char *ntp_server_host = NULL;
 static int ntp_server_port = NTP_DEFAULT_PORT;
 
 // Dallas RTC variables
@@ -490,15 +490,18 @@ void __not_in_flash_func(rtcemul_dma_irq_handler_lookup_callback)(void)
 
     // Read the address to process
     uint32_t addr = (uint32_t)dma_hw->ch[lookup_data_rom_dma_channel].al3_read_addr_trig;
-    switch (rtc_type)
+    // No switch here: the case tables of the M0 call libgcc helpers that live in the flash.
+    // The SIDECART path is RAM safe and can run while the flash is written. The DALLAS path
+    // is not, so its IRQ is masked during the flash writes
+    if (rtc_type == RTC_SIDECART)
     {
-    case RTC_SIDECART:
-        if (addr >= ROM3_START_ADDRESS)
+        if (addr >= protocol_rom3_start_address)
         {
             parse_protocol((uint16_t)(addr & 0xFFFF), handle_protocol_command);
         }
-        break;
-    case RTC_DALLAS:
+    }
+    else if (rtc_type == RTC_DALLAS)
+    {
         if (addr >= dallasClock.rom_address)
         {
             // Reset counter
@@ -561,9 +564,6 @@ void __not_in_flash_func(rtcemul_dma_irq_handler_lookup_callback)(void)
                 }
             }
         }
-        break;
-    default:
-        break;
     }
 }
 
@@ -580,22 +580,13 @@ int init_rtcemul(bool safe_config_reboot)
     FRESULT fr;
     FATFS fs;
 
-    ConfigEntry *y2k_patch = find_entry(PARAM_RTC_Y2K_PATCH);
-    if (y2k_patch != NULL)
-    {
-        char *str = y2k_patch->value;
-        y2k_patch_enabled = ((y2k_patch!=NULL) && (strlen(y2k_patch->value)) && ((str[0] == 'T') || (str[0] == 't'))) ? true : false;
-    }
-    else {
-        y2k_patch_enabled = true;
-        DPRINTF("Y2K patch enabled by default\n");
-    }
+    y2k_patch_enabled = config_bool(CONFIG_KEY_RTC_Y2K_PATCH);
     DPRINTF("Y2K patch enabled: %s\n", y2k_patch_enabled ? "true" : "false");
     *((volatile uint32_t *)(memory_shared_address + RTCEMUL_Y2K_PATCH)) = y2k_patch_enabled ? 0xFFFFFFFF : 0;
 
 
     srand(time(0));
-    char *rtc_type_str = find_entry(PARAM_RTC_TYPE)->value;
+    const char *rtc_type_str = config_string(CONFIG_KEY_RTC_TYPE);
     if (strcmp(rtc_type_str, "DALLAS") == 0)
     {
         DPRINTF("RTC type: DALLAS\n");
@@ -619,6 +610,7 @@ int init_rtcemul(bool safe_config_reboot)
     {
         DPRINTF("RTC type: SIDECART\n");
         rtc_type = RTC_SIDECART;
+        flash_write_keep_protocol_irq(true);
     }
     else
     {
@@ -661,7 +653,7 @@ int init_rtcemul(bool safe_config_reboot)
 
     uint32_t rtc_timeout_sec = 45;
     // Only try to get the datetime from the network if the wifi is configured
-    if (strlen(find_entry(PARAM_WIFI_SSID)->value) > 0)
+    if (strlen(config_string(CONFIG_KEY_WIFI_SSID)) > 0)
     {
         cyw43_arch_deinit();
 
@@ -674,7 +666,7 @@ int init_rtcemul(bool safe_config_reboot)
         uint32_t wifi_timeout_sec = rtc_timeout_sec;
 
         // Wait until timeout
-        while ((!network_ready) && (wifi_timeout_sec > 0) && (strlen(find_entry(PARAM_WIFI_SSID)->value) > 0))
+        while ((!network_ready) && (wifi_timeout_sec > 0) && (strlen(config_string(CONFIG_KEY_WIFI_SSID)) > 0))
         {
             *((volatile uint32_t *)(memory_shared_address + RTCEMUL_RANDOM_TOKEN_SEED)) = rand() % 0xFFFFFFFF;
 #if PICO_CYW43_ARCH_POLL
@@ -764,13 +756,13 @@ int init_rtcemul(bool safe_config_reboot)
             // Start the internal RTC
             rtc_init();
 
-            ntp_server_host = find_entry(PARAM_RTC_NTP_SERVER_HOST)->value;
-            ntp_server_port = atoi(find_entry(PARAM_RTC_NTP_SERVER_PORT)->value);
+            ntp_server_host = config_string(CONFIG_KEY_RTC_NTP_SERVER_HOST);
+            ntp_server_port = config_int(CONFIG_KEY_RTC_NTP_SERVER_PORT);
 
             DPRINTF("NTP server host: %s\n", ntp_server_host);
             DPRINTF("NTP server port: %d\n", ntp_server_port);
 
-            char *utc_offset_entry = find_entry(PARAM_RTC_UTC_OFFSET)->value;
+            const char *utc_offset_entry = config_string(CONFIG_KEY_RTC_UTC_OFFSET);
             if (strlen(utc_offset_entry) > 0)
             {
                 // The offset can be in decimal format
@@ -17,6 +17,18 @@ TPParseStep nextTPstep = HEADER_DETECTION;
 // Placeholder structure for parsed data
 TransmissionProtocol transmission;
 
+uint32_t protocol_rom3_start_address = 0xFFFFFFFF;
+
+// Commands completed while the flash is erased or programmed. The callbacks can be in flash
+volatile bool protocol_deferred = false;
+TransmissionProtocol deferred_commands[PROTOCOL_DEFERRED_COMMANDS];
+ProtocolCallback deferred_callbacks[PROTOCOL_DEFERRED_COMMANDS];
+uint16_t deferred_payloads[PROTOCOL_DEFERRED_PAYLOAD_SIZE / 2];
+uint16_t deferred_count = 0;
+uint16_t deferred_payload_used = 0;
+uint32_t deferred_total = 0;
+uint32_t deferred_dropped = 0;
+
 // Placeholder functions for each step
 inline static void __not_in_flash_func(detect_header)(uint16_t data)
 {
@@ -67,6 +79,7 @@ void init_protocol_parser()
     transmission.payload_size = 0;
     transmission.payload = malloc(MAX_PROTOCOL_PAYLOAD_SIZE);
     transmission.bytes_read = 0;
+    protocol_rom3_start_address = ROM3_START_ADDRESS;
 }
 
 void terminate_protocol_parser()
@@ -78,6 +91,57 @@ void terminate_protocol_parser()
     }
 }
 
+// Copy the command to the queue. No memcpy: it could be in flash
+void __not_in_flash_func(defer_command)(ProtocolCallback callback)
+{
+    uint16_t words = (transmission.payload_size + 1) / 2;
+    if ((deferred_count >= PROTOCOL_DEFERRED_COMMANDS) || (deferred_payload_used + words > PROTOCOL_DEFERRED_PAYLOAD_SIZE / 2))
+    {
+        deferred_dropped++;
+        return;
+    }
+    uint16_t *src = (uint16_t *)transmission.payload;
+    uint16_t *dest = &deferred_payloads[deferred_payload_used];
+    for (uint16_t i = 0; i < words; i++)
+    {
+        dest[i] = src[i];
+    }
+    TransmissionProtocol *command = &deferred_commands[deferred_count];
+    command->command_id = transmission.command_id;
+    command->payload_size = transmission.payload_size;
+    command->payload = (unsigned char *)dest;
+    command->bytes_read = transmission.bytes_read;
+    deferred_callbacks[deferred_count] = callback;
+    deferred_count++;
+    deferred_payload_used += words;
+    deferred_total++;
+}
+
+void defer_protocol_commands(bool defer)
+{
+    protocol_deferred = defer;
+}
+
+// Run the callbacks of the commands queued, in the order they came
+void dispatch_deferred_protocol_commands()
+{
+    for (uint16_t i = 0; i < deferred_count; i++)
+    {
+        if (deferred_callbacks[i])
+        {
+            deferred_callbacks[i](&deferred_commands[i]);
+        }
+    }
+    deferred_count = 0;
+    deferred_payload_used = 0;
+}
+
+void deferred_protocol_stats(uint32_t *deferred, uint32_t *dropped)
+{
+    *deferred = deferred_total;
+    *dropped = deferred_dropped;
+}
+
 inline void __not_in_flash_func(process_command)(ProtocolCallback callback)
 {
 #if defined(_DEBUG) && (_DEBUG != 0) && defined(SHOW_COMMANDS) && (SHOW_COMMANDS != 0)
@@ -92,7 +156,11 @@ inline void __not_in_flash_func(process_command)(ProtocolCallback callback)
     // Here should pass the transmission message to a function that will handle the different commands
     // I think a good aproach would be to have a callback to custom functions that will handle the different commands
 
-    if (callback)
+    if (protocol_deferred)
+    {
+        defer_command(callback);
+    }
+    else if (callback)
     {
         callback(&transmission);
     }
@@ -112,29 +180,28 @@ inline void __not_in_flash_func(parse_protocol)(uint16_t data, ProtocolCallback
     {
         nextTPstep = HEADER_DETECTION;
     }
-    switch (nextTPstep)
+    // No switch: the case tables of libgcc are in flash, and this runs while the flash is written
+    if (nextTPstep == HEADER_DETECTION)
     {
-    case HEADER_DETECTION:
         detect_header(data);
         last_header_found = new_header_found;
-        break;
-
-    case COMMAND_READ:
+    }
+    else if (nextTPstep == COMMAND_READ)
+    {
         read_command(data);
-        break;
-
-    case PAYLOAD_SIZE_READ:
+    }
+    else if (nextTPstep == PAYLOAD_SIZE_READ)
+    {
         read_payload_size(data);
         // If PAYLOAD_READ_END here, means we've finished reading the payload
         if (nextTPstep == PAYLOAD_READ_END)
         {
             process_command(callback);
         }
-        break;
-
-    case PAYLOAD_READ_START:
-    case PAYLOAD_READ_INPROGRESS:
-    case PAYLOAD_READ_END:
+    }
+    else
+    {
+        // PAYLOAD_READ_START, PAYLOAD_READ_INPROGRESS and PAYLOAD_READ_END
         if (transmission.bytes_read < transmission.payload_size)
         {
             read_payload(data);
@@ -144,6 +211,5 @@ inline void __not_in_flash_func(parse_protocol)(uint16_t data, ProtocolCallback
         {
             process_command(callback);
         }
-        break;
     }
 }
@@ -11,12 +11,22 @@
 static DWORD sz_drv;
 static DWORD sz_sect = 0;
 
+// Sectors read ahead and sectors waiting to be written. Allocated when the USB mass storage starts
+static uint8_t *read_ahead_buffer = NULL;
+static uint32_t read_ahead_lba = 0;
+static uint32_t read_ahead_count = 0;
+static uint32_t read_next_lba = 0xFFFFFFFF; // Sector after the last read. Detects sequential reads
+static uint8_t *write_back_buffer = NULL;
+static uint32_t write_back_lba = 0;
+static uint32_t write_back_count = 0;
+static uint32_t write_back_ms = 0;     // Time of the last sector gathered
+static bool write_back_failed = false; // A write in the background failed. Reported in the next command
+
 void cdc_task(void);
 
 void usb_mass_init()
 {
-    ConfigEntry *sd_card_mass_storage_enabled = find_entry(PARAM_SD_MASS_STORAGE);
-    if ((sd_card_mass_storage_enabled != NULL) && (sd_card_mass_storage_enabled->value[0] == 't' || sd_card_mass_storage_enabled->value[0] == 'T'))
+    if (config_bool(CONFIG_KEY_SD_MASS_STORAGE))
     {
         DPRINTF("USB Mass storage flag set to enabled\n");
         DPRINTF("TUD_OPT_HIGH_SPEED: %s\n", TUD_OPT_HIGH_SPEED ? "true" : "false");
@@ -43,8 +53,57 @@ void usb_mass_init()
     }
 }
 
+// Write the sectors gathered to the card with a single multi-block write.
+// The sectors stay in the buffer if the write fails, to try again later
+static bool usb_mass_flush(void)
+{
+    if (write_back_count == 0)
+    {
+        return true;
+    }
+    DPRINTF("Flush LBA %lu, sectors %lu\n", write_back_lba, write_back_count);
+    DRESULT res = disk_write(0, write_back_buffer, write_back_lba, write_back_count);
+    if (res != RES_OK)
+    {
+        DPRINTF("disk_write failed: %d\n", res);
+        return false;
+    }
+    write_back_count = 0;
+    return true;
+}
+
+// Write the sectors gathered when the host stops writing
+static void usb_mass_flush_idle(void)
+{
+    if ((write_back_count > 0) && (to_ms_since_boot(get_absolute_time()) - write_back_ms >= USB_MASS_WRITE_BACK_IDLE_MS))
+    {
+        if (!usb_mass_flush())
+        {
+            // No command to fail now. Do it in the next one and wait before trying again
+            write_back_failed = true;
+            write_back_ms = to_ms_since_boot(get_absolute_time());
+        }
+    }
+}
+
+// Set the MEDIUM ERROR sense if a write in the background failed since the last command
+static bool usb_mass_write_back_error(uint8_t lun)
+{
+    if (!write_back_failed)
+    {
+        return false;
+    }
+    write_back_failed = false;
+    tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0c, 0x00);
+    return true;
+}
+
 void usb_mass_start(void)
 {
+    // Without buffers the sectors are read and written as the host sends them
+    read_ahead_buffer = malloc(USB_MASS_READ_AHEAD_SECTORS * FF_MAX_SS);
+    write_back_buffer = malloc(USB_MASS_WRITE_BACK_SECTORS * FF_MAX_SS);
+
     // Init USB
     DPRINTF("Init USB\n");
     // init device stack on configured roothub port
@@ -60,6 +119,7 @@ void usb_mass_start(void)
     {
         tud_task(); // tinyusb device task
         cdc_task();
+        usb_mass_flush_idle();
     }
     reboot();
     while (1)
@@ -104,28 +164,14 @@ void tud_resume_cb(void)
 //--------------------------------------------------------------------+
 // USB CDC
 //--------------------------------------------------------------------+
+// whether host does safe-eject
+static bool ejected = false;
+
 void cdc_task(void)
 {
-    // connected() check for DTR bit
-    // Most but not all terminal client set this when making connection
-    // if ( tud_cdc_connected() )
-    {
-        // connected and there are data available
-        if (tud_cdc_available())
-        {
-            // read data
-            char buf[64];
-            uint32_t count = tud_cdc_read(buf, sizeof(buf));
-            (void)count;
-
-            // Echo back
-            // Note: Skip echo by commenting out write() and write_flush()
-            // for throughput test e.g
-            //    $ dd if=/dev/zero of=/dev/ttyACM0 count=10000
-            tud_cdc_write(buf, count);
-            tud_cdc_write_flush();
-        }
-    }
+    // The CDC interface carries the transfers of ROMs and images. The microSD card can be
+    // written only after the host has ejected it
+    usb_transfer_task(ejected);
 }
 
 // Invoked when cdc when line state changed e.g connected/disconnected
@@ -151,9 +197,6 @@ void tud_cdc_rx_cb(uint8_t itf)
     (void)itf;
 }
 
-// whether host does safe-eject
-static bool ejected = false;
-
 // Invoked when received SCSI_CMD_INQUIRY
 // Application fill vendor id, product id and revision with string up to 8, 16, 4 characters respectively
 void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4])
@@ -240,6 +283,7 @@ bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, boo
         {
             // unload disk storage
             DPRINTF("UNLOAD DISK STORAGE\n");
+            usb_mass_flush();
             ejected = true;
         }
     }
@@ -249,23 +293,68 @@ bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, boo
 
 // Callback invoked when received READ10 command.
 // Copy disk's data to buffer (up to bufsize) and return number of copied bytes.
+// Sequential reads are served from a buffer filled with a single multi-block read.
 int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize)
 {
     (void)lun;
 
     if (offset != 0)
         return -1;
-    if (bufsize != sz_sect)
+    if ((bufsize == 0) || (bufsize % sz_sect != 0))
         return -1;
-    if (lba >= sz_drv)
+    uint32_t count = bufsize / sz_sect;
+    if ((lba >= sz_drv) || (count > sz_drv - lba))
         return -1;
 
     DPRINTF("Read10 LBA %lu, bufsize %lu, offset %lu\n", lba, bufsize, offset);
 
-    DRESULT res = disk_read(0, buffer, lba, 1);
+    if (usb_mass_write_back_error(lun))
+    {
+        return -1;
+    }
+
+    // The sectors waiting to be written must reach the card before reading them
+    if ((write_back_count > 0) && (lba < write_back_lba + write_back_count) && (write_back_lba < lba + count))
+    {
+        if (!usb_mass_flush())
+        {
+            tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0c, 0x00);
+            return -1;
+        }
+    }
+
+    bool sequential = (lba == read_next_lba);
+    read_next_lba = lba + count;
+    if ((read_ahead_count > 0) && (lba >= read_ahead_lba) && (lba + count <= read_ahead_lba + read_ahead_count))
+    {
+        memcpy(buffer, read_ahead_buffer + (lba - read_ahead_lba) * sz_sect, bufsize);
+        return (int32_t)bufsize;
+    }
+
+    DRESULT res;
+    if (sequential && (read_ahead_buffer != NULL) && (count < USB_MASS_READ_AHEAD_SECTORS))
+    {
+        uint32_t ahead = (sz_drv - lba < USB_MASS_READ_AHEAD_SECTORS) ? sz_drv - lba : USB_MASS_READ_AHEAD_SECTORS;
+        read_ahead_count = 0;
+        res = disk_read(0, read_ahead_buffer, lba, ahead);
+        if (res == RES_OK)
+        {
+            read_ahead_lba = lba;
+            read_ahead_count = ahead;
+            memcpy(buffer, read_ahead_buffer, bufsize);
+        }
+    }
+    else
+    {
+        res = disk_read(0, buffer, lba, count);
+    }
 
     if (res != RES_OK)
-        return res;
+    {
+        DPRINTF("disk_read failed: %d\n", res);
+        tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x11, 0x00);
+        return -1;
+    }
 
     return (int32_t)bufsize;
 }
@@ -276,24 +365,60 @@ bool tud_msc_is_writable_cb(uint8_t lun)
     return !USBDRIVE_READ_ONLY;
 }
 
+// Consecutive sectors are gathered and written with a single multi-block write when the
+// host writes somewhere else, reads them, synchronizes the cache or stops writing.
 int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
 {
     (void)lun;
 
     if (offset != 0)
         return -1;
-    if (bufsize != sz_sect)
+    if ((bufsize == 0) || (bufsize % sz_sect != 0))
         return -1;
-    if (lba >= sz_drv)
+    uint32_t count = bufsize / sz_sect;
+    if ((lba >= sz_drv) || (count > sz_drv - lba))
         return -1;
 
     DPRINTF("Write10 LBA %lu, Offset %lu, Size %lu\n", lba, offset, bufsize);
 
-    DRESULT res = disk_write(0, buffer, lba, 1);
-    if (res != RES_OK)
-        return res;
+    if (usb_mass_write_back_error(lun))
+    {
+        return -1;
+    }
+
+    if ((read_ahead_count > 0) && (lba < read_ahead_lba + read_ahead_count) && (read_ahead_lba < lba + count))
+    {
+        read_ahead_count = 0;
+    }
 
-    int32_t status = 0;
+    if ((write_back_count > 0) && ((lba != write_back_lba + write_back_count) || (write_back_count + count > USB_MASS_WRITE_BACK_SECTORS)))
+    {
+        if (!usb_mass_flush())
+        {
+            tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0c, 0x00);
+            return -1;
+        }
+    }
+
+    if ((write_back_buffer == NULL) || (count >= USB_MASS_WRITE_BACK_SECTORS))
+    {
+        DRESULT res = disk_write(0, buffer, lba, count);
+        if (res != RES_OK)
+        {
+            DPRINTF("disk_write failed: %d\n", res);
+            tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0c, 0x00);
+            return -1;
+        }
+        return (int32_t)bufsize;
+    }
+
+    if (write_back_count == 0)
+    {
+        write_back_lba = lba;
+    }
+    memcpy(write_back_buffer + write_back_count * sz_sect, buffer, bufsize);
+    write_back_count += count;
+    write_back_ms = to_ms_since_boot(get_absolute_time());
 
     return (int32_t)bufsize;
 }
@@ -319,6 +444,23 @@ int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void *buffer, u
         // Host is about to read/write etc ... better not to disconnect disk
         resplen = 0;
         break;
+    case SCSI_CMD_SYNCHRONIZE_CACHE_10:
+        // Write the sectors gathered and wait until the card has written them
+        DPRINTF("Synchronize cache\n");
+        if (usb_mass_write_back_error(lun))
+        {
+            resplen = -1;
+        }
+        else if (!usb_mass_flush() || (disk_ioctl(0, CTRL_SYNC, NULL) != RES_OK))
+        {
+            tud_msc_set_sense(lun, SCSI_SENSE_MEDIUM_ERROR, 0x0c, 0x00);
+            resplen = -1;
+        }
+        else
+        {
+            resplen = 0;
+        }
+        break;
     default:
         // Set Sense = Invalid Command Operation
         tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
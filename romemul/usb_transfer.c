@@ -0,0 +1,366 @@
+/**
+ * File: usb_transfer.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Receive ROMs and images through the USB CDC interface, without removing the microSD card
+ */
+
+#include "include/usb_transfer.h"
+
+// Allocated when the first byte arrives
+static UsbTransfer *transfer = NULL;
+
+static void usb_transfer_reply(uint8_t command, uint8_t flags)
+{
+    UsbTransferHeader reply = {
+        .magic = USB_TRANSFER_MAGIC,
+        .command = command,
+        .flags = flags,
+        .offset = transfer->done,
+        .length = 0,
+        .crc32 = transfer->crc};
+    tud_cdc_write(&reply, sizeof(reply));
+    tud_cdc_write_flush();
+}
+
+// Close the file being received. The part file is kept to resume the transfer
+static void usb_transfer_close()
+{
+    if (transfer->target == USB_TRANSFER_TARGET_FILE)
+    {
+        f_close(&transfer->file);
+        f_unmount("0:");
+        free(transfer->fs);
+        transfer->fs = NULL;
+    }
+    transfer->target = USB_TRANSFER_TARGET_NONE;
+}
+
+// Erase the flash sector of the chunk and program the chunk swapped, as load_rom_from_fs does
+static bool usb_transfer_program_rom(uint8_t *data, uint32_t len)
+{
+    uint32_t dest_address = FLASH_ROM_LOAD_OFFSET + transfer->done;
+    // The flash is programmed in pages. The rest of the last page stays erased
+    uint32_t program_len = (len + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+    memset(data + len, 0xFF, program_len - len);
+    CHANGE_ENDIANESS_BLOCK16(data, program_len);
+
+    flash_write_erase(dest_address, FLASH_SECTOR_SIZE);
+    flash_write_program(dest_address, data, program_len);
+    return true;
+}
+
+static uint8_t usb_transfer_open_rom(const UsbTransferHeader *header)
+{
+    if (header->offset > ROM_SIZE_BYTES * ROM_BANKS)
+    {
+        return USB_TRANSFER_E_SIZE;
+    }
+    bool resume = (transfer->target == USB_TRANSFER_TARGET_ROM) && (transfer->size == header->offset) &&
+                  !(header->flags & USB_TRANSFER_FLAG_RESTART);
+    if (!resume)
+    {
+        usb_transfer_close();
+        transfer->target = USB_TRANSFER_TARGET_ROM;
+        transfer->size = header->offset;
+        transfer->done = 0;
+        transfer->crc = 0;
+    }
+    DPRINTF("ROM transfer of %lu bytes. Resuming at %lu\n", transfer->size, transfer->done);
+    return 0;
+}
+
+static uint8_t usb_transfer_open_file(const UsbTransferHeader *header, const uint8_t *payload, bool card_ejected)
+{
+    // FatFs and the host must not share the card
+    if (!card_ejected)
+    {
+        return USB_TRANSFER_E_BUSY;
+    }
+    if ((header->length == 0) || (header->length + sizeof(USB_TRANSFER_PART_EXTENSION) > USB_TRANSFER_PATH_LENGTH))
+    {
+        return USB_TRANSFER_E_SIZE;
+    }
+    char path[USB_TRANSFER_PATH_LENGTH];
+    memcpy(path, payload, header->length);
+    path[header->length] = '\0';
+    bool resume = (transfer->target == USB_TRANSFER_TARGET_FILE) && (transfer->size == header->offset) &&
+                  (strcmp(transfer->path, path) == 0) && !(header->flags & USB_TRANSFER_FLAG_RESTART);
+    if (resume)
+    {
+        return 0;
+    }
+
+    usb_transfer_close();
+    transfer->fs = malloc(sizeof(FATFS));
+    if ((transfer->fs == NULL) || (f_mount(transfer->fs, "0:", 1) != FR_OK))
+    {
+        free(transfer->fs);
+        transfer->fs = NULL;
+        return USB_TRANSFER_E_IO;
+    }
+    strcpy(transfer->path, path);
+    char part_path[USB_TRANSFER_PATH_LENGTH];
+    snprintf(part_path, sizeof(part_path), "%s%s", path, USB_TRANSFER_PART_EXTENSION);
+    FRESULT fr = f_open(&transfer->file, part_path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not open %s (%d)\n", part_path, fr);
+        f_unmount("0:");
+        free(transfer->fs);
+        transfer->fs = NULL;
+        return USB_TRANSFER_E_IO;
+    }
+    transfer->target = USB_TRANSFER_TARGET_FILE;
+    transfer->size = header->offset;
+    transfer->done = 0;
+    transfer->crc = 0;
+
+    // The data of an interrupted transfer is kept if the host agrees with its CRC32
+    if ((header->flags & USB_TRANSFER_FLAG_RESTART) || (f_size(&transfer->file) > transfer->size))
+    {
+        fr = f_truncate(&transfer->file);
+    }
+    else
+    {
+        UINT br = 0;
+        uint8_t *buffer = transfer->frame + USB_TRANSFER_HEADER_SIZE;
+        while ((fr == FR_OK) && (transfer->done < f_size(&transfer->file)))
+        {
+            fr = f_read(&transfer->file, buffer, USB_TRANSFER_CHUNK_SIZE, &br);
+            if ((fr == FR_OK) && (br == 0))
+            {
+                break;
+            }
+            transfer->crc = zip_crc32(transfer->crc, buffer, br);
+            transfer->done += br;
+        }
+    }
+    if (fr != FR_OK)
+    {
+        usb_transfer_close();
+        return USB_TRANSFER_E_IO;
+    }
+    DPRINTF("File transfer of %lu bytes to %s. Resuming at %lu\n", transfer->size, transfer->path, transfer->done);
+    return 0;
+}
+
+static uint8_t usb_transfer_data(const UsbTransferHeader *header, uint8_t *payload)
+{
+    if (transfer->target == USB_TRANSFER_TARGET_NONE)
+    {
+        return USB_TRANSFER_E_STATE;
+    }
+    if (header->offset != transfer->done)
+    {
+        return USB_TRANSFER_E_OFFSET;
+    }
+    if (header->length > transfer->size - transfer->done)
+    {
+        return USB_TRANSFER_E_SIZE;
+    }
+    uint32_t crc = zip_crc32(transfer->crc, payload, header->length);
+    if (transfer->target == USB_TRANSFER_TARGET_ROM)
+    {
+        // One flash sector per chunk. Only the last one can be shorter
+        if ((header->length != USB_TRANSFER_CHUNK_SIZE) && (transfer->done + header->length != transfer->size))
+        {
+            return USB_TRANSFER_E_SIZE;
+        }
+        if (!usb_transfer_program_rom(payload, header->length))
+        {
+            return USB_TRANSFER_E_IO;
+        }
+    }
+    else
+    {
+        UINT bw = 0;
+        FRESULT fr = f_write(&transfer->file, payload, header->length, &bw);
+        if ((fr != FR_OK) || (bw != header->length))
+        {
+            DPRINTF("ERROR: Could not write %s (%d)\n", transfer->path, fr);
+            return USB_TRANSFER_E_IO;
+        }
+    }
+    transfer->crc = crc;
+    transfer->done += header->length;
+    return 0;
+}
+
+static uint8_t usb_transfer_end(const UsbTransferHeader *header, const uint8_t *payload)
+{
+    if (transfer->target == USB_TRANSFER_TARGET_NONE)
+    {
+        return USB_TRANSFER_E_STATE;
+    }
+    uint32_t image_crc = 0;
+    if (header->length == sizeof(image_crc))
+    {
+        memcpy(&image_crc, payload, sizeof(image_crc));
+    }
+    if ((transfer->done != transfer->size) || (header->length != sizeof(image_crc)) || (image_crc != transfer->crc))
+    {
+        return USB_TRANSFER_E_CRC;
+    }
+    if (transfer->target == USB_TRANSFER_TARGET_ROM)
+    {
+        // Erase what is left of a previous, bigger ROM
+        uint32_t erased = (transfer->size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+        if (erased < ROM_SIZE_BYTES * ROM_BANKS)
+        {
+            flash_write_erase(FLASH_ROM_LOAD_OFFSET + erased, ROM_SIZE_BYTES * ROM_BANKS - erased);
+        }
+        put_string(PARAM_BOOT_FEATURE, "ROM_EMULATOR");
+        write_all_entries();
+        transfer->target = USB_TRANSFER_TARGET_NONE;
+        DPRINTF("ROM of %lu bytes flashed\n", transfer->size);
+        return 0;
+    }
+    char part_path[USB_TRANSFER_PATH_LENGTH];
+    snprintf(part_path, sizeof(part_path), "%s%s", transfer->path, USB_TRANSFER_PART_EXTENSION);
+    char backup_path[USB_TRANSFER_PATH_LENGTH];
+    snprintf(backup_path, sizeof(backup_path), "%s%s", transfer->path, USB_TRANSFER_BACKUP_EXTENSION);
+    FRESULT fr = f_close(&transfer->file);
+    bool replaced = false;
+    if (fr == FR_OK)
+    {
+        // Move the old image aside. It's restored if the new one can't take its name
+        f_unlink(backup_path);
+        fr = f_rename(transfer->path, backup_path);
+        replaced = (fr == FR_OK);
+        if (fr == FR_NO_FILE)
+        {
+            fr = FR_OK;
+        }
+    }
+    if (fr == FR_OK)
+    {
+        fr = f_rename(part_path, transfer->path);
+        if (fr != FR_OK)
+        {
+            // The part file is kept, so the image can be committed again
+            if (replaced && (f_rename(backup_path, transfer->path) != FR_OK))
+            {
+                DPRINTF("ERROR: Could not restore %s from %s\n", transfer->path, backup_path);
+            }
+        }
+        else if (replaced)
+        {
+            f_unlink(backup_path);
+        }
+        else
+        {
+            folder_count_adjust(transfer->path, 1);
+        }
+    }
+    f_unmount("0:");
+    free(transfer->fs);
+    transfer->fs = NULL;
+    transfer->target = USB_TRANSFER_TARGET_NONE;
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not commit %s (%d)\n", transfer->path, fr);
+        return USB_TRANSFER_E_IO;
+    }
+    DPRINTF("File %s of %lu bytes written\n", transfer->path, transfer->size);
+    return 0;
+}
+
+static void usb_transfer_command(bool card_ejected)
+{
+    UsbTransferHeader header;
+    memcpy(&header, transfer->frame, sizeof(header));
+    uint8_t *payload = transfer->frame + USB_TRANSFER_HEADER_SIZE;
+    uint8_t error = 0;
+    bool boot = false;
+
+    if (zip_crc32(0, payload, header.length) != header.crc32)
+    {
+        error = USB_TRANSFER_E_CRC;
+    }
+    else
+    {
+        switch (header.command)
+        {
+        case USB_TRANSFER_OPEN_ROM:
+            error = usb_transfer_open_rom(&header);
+            break;
+        case USB_TRANSFER_OPEN_FILE:
+            error = usb_transfer_open_file(&header, payload, card_ejected);
+            break;
+        case USB_TRANSFER_DATA:
+            error = usb_transfer_data(&header, payload);
+            break;
+        case USB_TRANSFER_END:
+            boot = (transfer->target == USB_TRANSFER_TARGET_ROM) && (header.flags & USB_TRANSFER_FLAG_BOOT);
+            error = usb_transfer_end(&header, payload);
+            break;
+        case USB_TRANSFER_ABORT:
+            usb_transfer_close();
+            break;
+        default:
+            error = USB_TRANSFER_E_STATE;
+        }
+    }
+    usb_transfer_reply(error ? USB_TRANSFER_NAK : USB_TRANSFER_ACK, error);
+    if (boot && !error)
+    {
+        // Give the host time to read the reply
+        sleep_ms(100);
+        reboot();
+    }
+}
+
+/**
+ * @brief Receives the frames of the transfer protocol from the USB CDC interface.
+ *
+ * Called from the USB loop. Bytes before a valid header are dropped, so the host can
+ * always send a new frame after an error.
+ *
+ * @param card_ejected The host has ejected the microSD card, so FatFs can use it.
+ */
+void usb_transfer_task(bool card_ejected)
+{
+    if (!tud_cdc_available())
+    {
+        return;
+    }
+    if (transfer == NULL)
+    {
+        transfer = calloc(1, sizeof(UsbTransfer));
+        if (transfer == NULL)
+        {
+            DPRINTF("Not enough memory for the USB transfers\n");
+            return;
+        }
+    }
+    while (tud_cdc_available())
+    {
+        uint32_t needed = USB_TRANSFER_HEADER_SIZE;
+        if (transfer->frame_len >= USB_TRANSFER_HEADER_SIZE)
+        {
+            UsbTransferHeader header;
+            memcpy(&header, transfer->frame, sizeof(header));
+            needed += header.length;
+        }
+        transfer->frame_len += tud_cdc_read(transfer->frame + transfer->frame_len, needed - transfer->frame_len);
+        if (transfer->frame_len < USB_TRANSFER_HEADER_SIZE)
+        {
+            continue;
+        }
+        UsbTransferHeader header;
+        memcpy(&header, transfer->frame, sizeof(header));
+        if ((header.magic != USB_TRANSFER_MAGIC) || (header.length > USB_TRANSFER_CHUNK_SIZE))
+        {
+            // Resynchronize one byte later
+            memmove(transfer->frame, transfer->frame + 1, --transfer->frame_len);
+            continue;
+        }
+        if (transfer->frame_len == USB_TRANSFER_HEADER_SIZE + header.length)
+        {
+            usb_transfer_command(card_ejected);
+            transfer->frame_len = 0;
+        }
+    }
+}
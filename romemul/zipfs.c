@@ -0,0 +1,1391 @@
+/**
+ * File: zipfs.c
+ * Author: Diego Parrilla Santamaría
+ * Date: October 2024
+ * Copyright: 2024 - GOODDATA LABS SL
+ * Description: Read ZIP archives from the microSD card. The entries are decompressed
+ * while they are read, so the archives are never fully loaded in RAM.
+ * The inflate code follows the structure of puff.c from the zlib distribution.
+ */
+
+#include "include/zipfs.h"
+
+#define ZIP_LOCAL_HEADER_SIGNATURE 0x04034b50
+#define ZIP_CENTRAL_HEADER_SIGNATURE 0x02014b50
+#define ZIP_EOCD_SIGNATURE 0x06054b50
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_EOCD_SIZE 22
+
+// States of the deflate stream
+#define ZIP_INFLATE_HEADER 0  // Next thing to read is the header of a block
+#define ZIP_INFLATE_STORED 1  // Inside a stored block
+#define ZIP_INFLATE_HUFFMAN 2 // Inside a block with fixed or dynamic codes
+#define ZIP_INFLATE_DONE 3    // Last block finished
+#define ZIP_INFLATE_ERROR 4   // Corrupted stream
+#define ZIP_INFLATE_END 5     // Trailer of a stream read from a source checked
+
+// gzip header (RFC 1952)
+#define ZIP_GZIP_ID1 0x1f
+#define ZIP_GZIP_ID2 0x8b
+#define ZIP_GZIP_FHCRC 0x02
+#define ZIP_GZIP_FEXTRA 0x04
+#define ZIP_GZIP_FNAME 0x08
+#define ZIP_GZIP_FCOMMENT 0x10
+
+static const uint16_t zip_length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                             35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t zip_length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                             3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t zip_dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                           257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t zip_dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                           7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t zip_code_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// CRC32 (IEEE 802.3) four bits at a time. The table is small enough to stay in flash
+static const uint32_t zip_crc_table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+/**
+ * @brief Updates a CRC32 (IEEE 802.3, as in ZIP archives) with more data.
+ *
+ * @param crc The CRC32 of the previous data. 0 to start.
+ * @param data Pointer to the data.
+ * @param len Number of bytes of data.
+ * @return The CRC32 of the previous data followed by the new data.
+ */
+uint32_t zip_crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ zip_crc_table[crc & 0x0F];
+        crc = (crc >> 4) ^ zip_crc_table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+static uint16_t zip_read16(const uint8_t *p)
+{
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t zip_read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Splits a path to a file inside a ZIP archive.
+ *
+ * A path like "/floppies/games.zip/disks/game.st" refers to the entry "disks/game.st" of the
+ * archive "/floppies/games.zip". The first component ending with ".zip" is the archive.
+ *
+ * @param fullpath The path to split.
+ * @param zip_path Buffer for the path of the archive.
+ * @param zip_path_len Size of the zip_path buffer.
+ * @param entry_name Set to the name of the entry inside fullpath.
+ * @return true if the path points inside a ZIP archive, false otherwise.
+ */
+bool zip_split_path(const char *fullpath, char *zip_path, size_t zip_path_len, const char **entry_name)
+{
+    size_t ext_len = strlen(ZIP_EXTENSION);
+    for (const char *p = fullpath; *p != '\0'; p++)
+    {
+        if ((p[ext_len] == '/') && (p - fullpath > 0) && (strncasecmp(p, ZIP_EXTENSION, ext_len) == 0))
+        {
+            size_t len = (p - fullpath) + ext_len;
+            if (len >= zip_path_len)
+            {
+                return false;
+            }
+            memcpy(zip_path, fullpath, len);
+            zip_path[len] = '\0';
+            *entry_name = p + ext_len + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Opens a ZIP archive and builds the index of its central directory.
+ *
+ * Only the stored and deflated entries can be decompressed later. ZIP64 archives
+ * and archives split in several files are rejected.
+ *
+ * @param zip The archive to open.
+ * @param path The path of the archive in the microSD card.
+ * @return FR_OK if the archive is open, FR_INVALID_OBJECT if it's not a valid ZIP archive
+ *         or other FatFs error code. On error the archive is closed.
+ */
+FRESULT zip_open(ZipArchive *zip, const char *path)
+{
+    zip->count = 0;
+    zip->entries = NULL;
+    FRESULT fr = f_open(&zip->file, path, FA_READ);
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not open ZIP archive %s (%d)\n", path, fr);
+        return fr;
+    }
+    uint32_t size = f_size(&zip->file);
+    uint8_t buffer[ZIP_INPUT_BUFFER_SIZE];
+    UINT br = 0;
+
+    // Search the end of central directory record backwards. Blocks overlap to find records split between blocks
+    uint32_t eocd = 0xFFFFFFFF;
+    uint32_t search_start = (size > ZIP_EOCD_SEARCH_SIZE) ? (size - ZIP_EOCD_SEARCH_SIZE) : 0;
+    uint32_t block_end = size;
+    while ((eocd == 0xFFFFFFFF) && (block_end > search_start) && (block_end - search_start >= ZIP_EOCD_SIZE))
+    {
+        uint32_t block_start = (block_end - search_start > sizeof(buffer)) ? (block_end - sizeof(buffer)) : search_start;
+        fr = f_lseek(&zip->file, block_start);
+        if (fr == FR_OK)
+        {
+            fr = f_read(&zip->file, buffer, block_end - block_start, &br);
+        }
+        if (fr != FR_OK)
+        {
+            f_close(&zip->file);
+            return fr;
+        }
+        for (int i = (int)br - ZIP_EOCD_SIZE; i >= 0; i--)
+        {
+            if (zip_read32(&buffer[i]) == ZIP_EOCD_SIGNATURE)
+            {
+                eocd = block_start + i;
+                memmove(buffer, &buffer[i], ZIP_EOCD_SIZE);
+                break;
+            }
+        }
+        block_end = block_start + ZIP_EOCD_SIZE - 1;
+        if (block_start == search_start)
+        {
+            break;
+        }
+    }
+    if (eocd == 0xFFFFFFFF)
+    {
+        DPRINTF("ERROR: %s is not a ZIP archive\n", path);
+        f_close(&zip->file);
+        return FR_INVALID_OBJECT;
+    }
+    uint16_t disk = zip_read16(&buffer[4]);
+    uint16_t total = zip_read16(&buffer[10]);
+    uint32_t cd_offset = zip_read32(&buffer[16]);
+    if ((disk != 0) || (total == 0xFFFF) || (cd_offset == 0xFFFFFFFF) || (cd_offset >= eocd))
+    {
+        DPRINTF("ERROR: ZIP archive %s is split or ZIP64\n", path);
+        f_close(&zip->file);
+        return FR_INVALID_OBJECT;
+    }
+    if (total > ZIP_MAX_ENTRIES)
+    {
+        DPRINTF("WARNING: Only the first %d entries of %s are indexed\n", ZIP_MAX_ENTRIES, path);
+        total = ZIP_MAX_ENTRIES;
+    }
+    zip->entries = calloc(total > 0 ? total : 1, sizeof(ZipEntry));
+    if (zip->entries == NULL)
+    {
+        f_close(&zip->file);
+        return FR_NOT_ENOUGH_CORE;
+    }
+
+    // Walk the central directory
+    uint32_t pos = cd_offset;
+    for (uint16_t i = 0; i < total; i++)
+    {
+        fr = f_lseek(&zip->file, pos);
+        if (fr == FR_OK)
+        {
+            fr = f_read(&zip->file, buffer, ZIP_CENTRAL_HEADER_SIZE, &br);
+        }
+        if ((fr == FR_OK) && ((br < ZIP_CENTRAL_HEADER_SIZE) || (zip_read32(buffer) != ZIP_CENTRAL_HEADER_SIGNATURE)))
+        {
+            fr = FR_INVALID_OBJECT;
+        }
+        if (fr != FR_OK)
+        {
+            DPRINTF("ERROR: Bad central directory in %s (%d)\n", path, fr);
+            zip_close(zip);
+            return fr;
+        }
+        uint16_t name_len = zip_read16(&buffer[28]);
+        uint16_t extra_len = zip_read16(&buffer[30]);
+        uint16_t comment_len = zip_read16(&buffer[32]);
+        ZipEntry *entry = &zip->entries[zip->count];
+        entry->method = zip_read16(&buffer[10]);
+        entry->crc32 = zip_read32(&buffer[16]);
+        entry->compressed_size = zip_read32(&buffer[20]);
+        entry->uncompressed_size = zip_read32(&buffer[24]);
+        entry->local_header_offset = zip_read32(&buffer[42]);
+        entry->name = malloc(name_len + 1);
+        if (entry->name == NULL)
+        {
+            zip_close(zip);
+            return FR_NOT_ENOUGH_CORE;
+        }
+        fr = f_read(&zip->file, entry->name, name_len, &br);
+        if ((fr != FR_OK) || (br < name_len))
+        {
+            free(entry->name);
+            zip_close(zip);
+            return (fr != FR_OK) ? fr : FR_INVALID_OBJECT;
+        }
+        entry->name[name_len] = '\0';
+        zip->count++;
+        pos += ZIP_CENTRAL_HEADER_SIZE + name_len + extra_len + comment_len;
+    }
+    DPRINTF("ZIP archive %s opened with %d entries\n", path, zip->count);
+    return FR_OK;
+}
+
+/**
+ * @brief Closes a ZIP archive and frees its index.
+ *
+ * @param zip The archive to close.
+ */
+void zip_close(ZipArchive *zip)
+{
+    if (zip->entries != NULL)
+    {
+        for (uint16_t i = 0; i < zip->count; i++)
+        {
+            free(zip->entries[i].name);
+        }
+        free(zip->entries);
+        zip->entries = NULL;
+        f_close(&zip->file);
+    }
+    zip->count = 0;
+}
+
+/**
+ * @brief Finds an entry in the index of a ZIP archive. The names are compared ignoring the case.
+ *
+ * @param zip The archive.
+ * @param name The name of the entry.
+ * @return The index of the entry, or -1 if not found.
+ */
+int zip_find(const ZipArchive *zip, const char *name)
+{
+    for (uint16_t i = 0; i < zip->count; i++)
+    {
+        if (strcasecmp(zip->entries[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Next compressed byte. -1 if there are no more bytes or the card failed
+static int zip_next_byte(ZipStream *stream)
+{
+    if (stream->in_idx == stream->in_len)
+    {
+        if (stream->in_left == 0)
+        {
+            return -1;
+        }
+        if (stream->source != NULL)
+        {
+            int n = stream->source(stream->in_buf, ZIP_INPUT_BUFFER_SIZE);
+            if (n <= 0)
+            {
+                stream->in_left = 0;
+                return -1;
+            }
+            stream->in_len = n;
+            stream->in_idx = 0;
+            return stream->in_buf[stream->in_idx++];
+        }
+        UINT br = 0;
+        uint32_t chunk = (stream->in_left > ZIP_INPUT_BUFFER_SIZE) ? ZIP_INPUT_BUFFER_SIZE : stream->in_left;
+        FRESULT fr = f_lseek(&stream->zip->file, stream->in_pos);
+        if (fr == FR_OK)
+        {
+            fr = f_read(&stream->zip->file, stream->in_buf, chunk, &br);
+        }
+        if ((fr != FR_OK) || (br == 0))
+        {
+            DPRINTF("ERROR: Could not read the ZIP archive (%d)\n", fr);
+            return -1;
+        }
+        stream->in_pos += br;
+        stream->in_left -= br;
+        stream->in_len = br;
+        stream->in_idx = 0;
+    }
+    return stream->in_buf[stream->in_idx++];
+}
+
+// Next need bits of the deflate stream, least significant bit first. -1 if the input ended
+static int zip_bits(ZipStream *stream, int need)
+{
+    uint32_t val = stream->bit_buf;
+    while (stream->bit_count < need)
+    {
+        int b = zip_next_byte(stream);
+        if (b < 0)
+        {
+            return -1;
+        }
+        val |= (uint32_t)b << stream->bit_count;
+        stream->bit_count += 8;
+    }
+    stream->bit_buf = val >> need;
+    stream->bit_count -= need;
+    return (int)(val & ((1UL << need) - 1));
+}
+
+// Decode a symbol with a canonical Huffman code, one bit at a time. -1 if the input ended or the code is invalid
+static int zip_decode(ZipStream *stream, const ZipHuffman *h)
+{
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len < 16; len++)
+    {
+        int b = zip_bits(stream, 1);
+        if (b < 0)
+        {
+            return -1;
+        }
+        code |= b;
+        int count = h->count[len];
+        if (code - count < first)
+        {
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// Build the decoding table of the code lengths. 0 if the code is complete, negative if oversubscribed,
+// positive if incomplete
+static int zip_construct(ZipHuffman *h, const uint8_t *length, int n)
+{
+    uint16_t offs[16];
+    for (int len = 0; len < 16; len++)
+    {
+        h->count[len] = 0;
+    }
+    for (int symbol = 0; symbol < n; symbol++)
+    {
+        h->count[length[symbol]]++;
+    }
+    if (h->count[0] == n)
+    {
+        return 0;
+    }
+    int left = 1;
+    for (int len = 1; len < 16; len++)
+    {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0)
+        {
+            return left;
+        }
+    }
+    offs[1] = 0;
+    for (int len = 1; len < 15; len++)
+    {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+    for (int symbol = 0; symbol < n; symbol++)
+    {
+        if (length[symbol] != 0)
+        {
+            h->symbol[offs[length[symbol]]++] = symbol;
+        }
+    }
+    return left;
+}
+
+// Codes of a block with fixed Huffman codes
+static void zip_fixed_codes(ZipStream *stream)
+{
+    uint8_t lengths[288];
+    int symbol = 0;
+    for (; symbol < 144; symbol++)
+    {
+        lengths[symbol] = 8;
+    }
+    for (; symbol < 256; symbol++)
+    {
+        lengths[symbol] = 9;
+    }
+    for (; symbol < 280; symbol++)
+    {
+        lengths[symbol] = 7;
+    }
+    for (; symbol < 288; symbol++)
+    {
+        lengths[symbol] = 8;
+    }
+    zip_construct(&stream->lencode, lengths, 288);
+    for (symbol = 0; symbol < 30; symbol++)
+    {
+        lengths[symbol] = 5;
+    }
+    zip_construct(&stream->distcode, lengths, 30);
+}
+
+// Codes of a block with dynamic Huffman codes. false if the header of the block is invalid
+static bool zip_dynamic_codes(ZipStream *stream)
+{
+    uint8_t lengths[288 + 30];
+    int nlen = zip_bits(stream, 5);
+    int ndist = zip_bits(stream, 5);
+    int ncode = zip_bits(stream, 4);
+    if ((nlen < 0) || (ndist < 0) || (ncode < 0))
+    {
+        return false;
+    }
+    nlen += 257;
+    ndist += 1;
+    ncode += 4;
+    if ((nlen > 286) || (ndist > 30))
+    {
+        return false;
+    }
+    int index = 0;
+    for (; index < ncode; index++)
+    {
+        int len = zip_bits(stream, 3);
+        if (len < 0)
+        {
+            return false;
+        }
+        lengths[zip_code_order[index]] = len;
+    }
+    for (; index < 19; index++)
+    {
+        lengths[zip_code_order[index]] = 0;
+    }
+    // The code lengths are decoded with the lencode table, and then it's built again with the literal/length codes
+    if (zip_construct(&stream->lencode, lengths, 19) != 0)
+    {
+        return false;
+    }
+    index = 0;
+    while (index < nlen + ndist)
+    {
+        int symbol = zip_decode(stream, &stream->lencode);
+        if (symbol < 0)
+        {
+            return false;
+        }
+        if (symbol < 16)
+        {
+            lengths[index++] = symbol;
+            continue;
+        }
+        int len = 0;
+        int repeat = 0;
+        if (symbol == 16)
+        {
+            if (index == 0)
+            {
+                return false;
+            }
+            len = lengths[index - 1];
+            repeat = zip_bits(stream, 2);
+            repeat = (repeat < 0) ? -1 : 3 + repeat;
+        }
+        else if (symbol == 17)
+        {
+            repeat = zip_bits(stream, 3);
+            repeat = (repeat < 0) ? -1 : 3 + repeat;
+        }
+        else
+        {
+            repeat = zip_bits(stream, 7);
+            repeat = (repeat < 0) ? -1 : 11 + repeat;
+        }
+        if ((repeat < 0) || (index + repeat > nlen + ndist))
+        {
+            return false;
+        }
+        while (repeat--)
+        {
+            lengths[index++] = len;
+        }
+    }
+    // The end of block code is mandatory
+    if (lengths[256] == 0)
+    {
+        return false;
+    }
+    int err = zip_construct(&stream->lencode, lengths, nlen);
+    if ((err < 0) || ((err > 0) && (nlen - stream->lencode.count[0] != 1)))
+    {
+        return false;
+    }
+    err = zip_construct(&stream->distcode, lengths + nlen, ndist);
+    if ((err < 0) || ((err > 0) && (ndist - stream->distcode.count[0] != 1)))
+    {
+        return false;
+    }
+    return true;
+}
+
+// Read the header of the next block. false if the block is invalid
+static bool zip_block_header(ZipStream *stream)
+{
+    int final = zip_bits(stream, 1);
+    int type = zip_bits(stream, 2);
+    if ((final < 0) || (type < 0))
+    {
+        return false;
+    }
+    stream->final = (final == 1);
+    if (type == 0)
+    {
+        // Stored blocks start at a byte boundary
+        stream->bit_buf = 0;
+        stream->bit_count = 0;
+        int b0 = zip_next_byte(stream);
+        int b1 = zip_next_byte(stream);
+        int b2 = zip_next_byte(stream);
+        int b3 = zip_next_byte(stream);
+        if ((b0 < 0) || (b1 < 0) || (b2 < 0) || (b3 < 0))
+        {
+            return false;
+        }
+        uint16_t len = (uint16_t)(b0 | (b1 << 8));
+        if (len != (uint16_t)~(b2 | (b3 << 8)))
+        {
+            return false;
+        }
+        stream->stored_left = len;
+        stream->state = ZIP_INFLATE_STORED;
+        return true;
+    }
+    if (type == 1)
+    {
+        zip_fixed_codes(stream);
+    }
+    else if ((type != 2) || !zip_dynamic_codes(stream))
+    {
+        return false;
+    }
+    stream->state = ZIP_INFLATE_HUFFMAN;
+    return true;
+}
+
+/**
+ * @brief Opens an entry of a ZIP archive to decompress it with zip_stream_read.
+ *
+ * Only one stream of each archive can be read at a time, because all of them
+ * share the file of the archive. Deflated entries allocate a window of ZIP_WINDOW_SIZE bytes.
+ *
+ * @param stream The stream to open.
+ * @param zip The archive.
+ * @param index The index of the entry in the archive.
+ * @return FR_OK if the stream is open, FR_INVALID_OBJECT if the entry is not supported,
+ *         FR_NOT_ENOUGH_CORE if there is no memory for the window or other FatFs error code.
+ */
+FRESULT zip_stream_open(ZipStream *stream, ZipArchive *zip, int index)
+{
+    memset(stream, 0, sizeof(ZipStream));
+    if ((index < 0) || (index >= zip->count))
+    {
+        return FR_NO_FILE;
+    }
+    const ZipEntry *entry = &zip->entries[index];
+    if ((entry->method != ZIP_METHOD_STORED) && (entry->method != ZIP_METHOD_DEFLATED))
+    {
+        DPRINTF("ERROR: Compression method %d of %s not supported\n", entry->method, entry->name);
+        return FR_INVALID_OBJECT;
+    }
+    // The local header has its own name and extra field lengths
+    uint8_t header[ZIP_LOCAL_HEADER_SIZE];
+    UINT br = 0;
+    FRESULT fr = f_lseek(&zip->file, entry->local_header_offset);
+    if (fr == FR_OK)
+    {
+        fr = f_read(&zip->file, header, ZIP_LOCAL_HEADER_SIZE, &br);
+    }
+    if (fr != FR_OK)
+    {
+        return fr;
+    }
+    if ((br < ZIP_LOCAL_HEADER_SIZE) || (zip_read32(header) != ZIP_LOCAL_HEADER_SIGNATURE))
+    {
+        DPRINTF("ERROR: Bad local header of %s\n", entry->name);
+        return FR_INVALID_OBJECT;
+    }
+    if (entry->method == ZIP_METHOD_DEFLATED)
+    {
+        stream->window = malloc(ZIP_WINDOW_SIZE);
+        if (stream->window == NULL)
+        {
+            DPRINTF("ERROR: Not enough memory to decompress %s\n", entry->name);
+            return FR_NOT_ENOUGH_CORE;
+        }
+    }
+    stream->zip = zip;
+    stream->entry = entry;
+    stream->in_pos = entry->local_header_offset + ZIP_LOCAL_HEADER_SIZE + zip_read16(&header[26]) + zip_read16(&header[28]);
+    stream->in_left = entry->compressed_size;
+    stream->state = ZIP_INFLATE_HEADER;
+    return FR_OK;
+}
+
+// Skip a zero terminated string of the gzip header. false if the data ended
+static bool zip_skip_string(ZipStream *stream)
+{
+    int b;
+    while ((b = zip_next_byte(stream)) > 0)
+    {
+    }
+    return b == 0;
+}
+
+// Read the gzip or zlib header of a stream read from a source. false if the header is invalid
+static bool zip_source_header(ZipStream *stream)
+{
+    if (stream->format == ZIP_FORMAT_ZLIB)
+    {
+        int cmf = zip_next_byte(stream);
+        int flg = zip_next_byte(stream);
+        // Deflate, no preset dictionary
+        return (cmf >= 0) && (flg >= 0) && ((cmf & 0x0F) == ZIP_METHOD_DEFLATED) && !(flg & 0x20) && ((cmf * 256 + flg) % 31 == 0);
+    }
+    if (stream->format == ZIP_FORMAT_GZIP)
+    {
+        uint8_t header[10];
+        for (int i = 0; i < 10; i++)
+        {
+            int b = zip_next_byte(stream);
+            if (b < 0)
+            {
+                return false;
+            }
+            header[i] = b;
+        }
+        if ((header[0] != ZIP_GZIP_ID1) || (header[1] != ZIP_GZIP_ID2) || (header[2] != ZIP_METHOD_DEFLATED))
+        {
+            return false;
+        }
+        uint8_t flags = header[3];
+        if (flags & ZIP_GZIP_FEXTRA)
+        {
+            int lo = zip_next_byte(stream);
+            int hi = zip_next_byte(stream);
+            if ((lo < 0) || (hi < 0))
+            {
+                return false;
+            }
+            for (int i = lo | (hi << 8); i > 0; i--)
+            {
+                if (zip_next_byte(stream) < 0)
+                {
+                    return false;
+                }
+            }
+        }
+        if (((flags & ZIP_GZIP_FNAME) && !zip_skip_string(stream)) || ((flags & ZIP_GZIP_FCOMMENT) && !zip_skip_string(stream)))
+        {
+            return false;
+        }
+        if ((flags & ZIP_GZIP_FHCRC) && ((zip_next_byte(stream) < 0) || (zip_next_byte(stream) < 0)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read the trailer of a stream read from a source. false if it does not match the data decompressed
+static bool zip_source_trailer(ZipStream *stream)
+{
+    // The trailer starts at a byte boundary. The bits left of the last byte are padding
+    stream->bit_buf = 0;
+    stream->bit_count = 0;
+    int len = (stream->format == ZIP_FORMAT_GZIP) ? 8 : (stream->format == ZIP_FORMAT_ZLIB) ? 4 : 0;
+    uint8_t trailer[8];
+    for (int i = 0; i < len; i++)
+    {
+        int b = zip_next_byte(stream);
+        if (b < 0)
+        {
+            return false;
+        }
+        trailer[i] = b;
+    }
+    // The Adler-32 of zlib is not checked. gzip has the CRC32 and the size
+    return (stream->format != ZIP_FORMAT_GZIP) ||
+           ((zip_read32(trailer) == stream->crc) && (zip_read32(trailer + 4) == stream->out_total));
+}
+
+/**
+ * @brief Opens a deflate stream whose compressed bytes come from a callback, not from an archive.
+ *
+ * The size of the data is not known until the end. zip_stream_read() returns 0 once the
+ * last block has been decompressed and the trailer checked. The header is read here, so
+ * the source must be able to provide its first bytes.
+ *
+ * @param stream The stream to open.
+ * @param source The callback that reads the compressed bytes.
+ * @param format ZIP_FORMAT_DEFLATE, ZIP_FORMAT_ZLIB or ZIP_FORMAT_GZIP.
+ * @return FR_OK if the stream is open, FR_INVALID_OBJECT if the header is not valid or
+ *         FR_NOT_ENOUGH_CORE if there is no memory for the window.
+ */
+FRESULT zip_stream_open_source(ZipStream *stream, ZipSourceCallback source, uint8_t format)
+{
+    memset(stream, 0, sizeof(ZipStream));
+    stream->window = malloc(ZIP_WINDOW_SIZE);
+    if (stream->window == NULL)
+    {
+        DPRINTF("ERROR: Not enough memory to decompress the stream\n");
+        return FR_NOT_ENOUGH_CORE;
+    }
+    stream->source = source;
+    stream->format = format;
+    stream->source_entry.name = "stream";
+    stream->source_entry.method = ZIP_METHOD_DEFLATED;
+    stream->source_entry.uncompressed_size = UINT32_MAX;
+    stream->entry = &stream->source_entry;
+    stream->in_left = UINT32_MAX;
+    stream->state = ZIP_INFLATE_HEADER;
+    if (!zip_source_header(stream))
+    {
+        DPRINTF("ERROR: Bad header of the compressed stream\n");
+        zip_stream_close(stream);
+        return FR_INVALID_OBJECT;
+    }
+    return FR_OK;
+}
+
+/**
+ * @brief Decompresses the next bytes of an entry of a ZIP archive.
+ *
+ * The CRC32 of the entry is checked when the last byte is decompressed. The trailer of a
+ * stream opened with zip_stream_open_source() is checked after its last block.
+ *
+ * @param stream The stream opened with zip_stream_open.
+ * @param out Buffer for the decompressed bytes.
+ * @param len Bytes to decompress.
+ * @return The bytes decompressed, less than len only at the end of the entry, or -1 if the entry is corrupted.
+ */
+int zip_stream_read(ZipStream *stream, uint8_t *out, uint32_t len)
+{
+    if (stream->state == ZIP_INFLATE_ERROR)
+    {
+        return -1;
+    }
+    if (stream->state == ZIP_INFLATE_END)
+    {
+        return 0;
+    }
+    uint32_t remaining = stream->entry->uncompressed_size - stream->out_total;
+    if (len > remaining)
+    {
+        len = remaining;
+    }
+    uint32_t produced = 0;
+    if (stream->entry->method == ZIP_METHOD_STORED)
+    {
+        while (produced < len)
+        {
+            int b = zip_next_byte(stream);
+            if (b < 0)
+            {
+                stream->state = ZIP_INFLATE_ERROR;
+                break;
+            }
+            out[produced++] = b;
+        }
+    }
+    else
+    {
+        while ((produced < len) && (stream->state != ZIP_INFLATE_ERROR))
+        {
+            int b = -1;
+            if (stream->copy_len > 0)
+            {
+                // Back reference pending to copy from the window
+                b = stream->window[(uint16_t)(stream->window_pos - stream->copy_dist) & (ZIP_WINDOW_SIZE - 1)];
+                stream->copy_len--;
+            }
+            else if (stream->state == ZIP_INFLATE_HEADER)
+            {
+                if (!zip_block_header(stream))
+                {
+                    stream->state = ZIP_INFLATE_ERROR;
+                }
+                continue;
+            }
+            else if (stream->state == ZIP_INFLATE_STORED)
+            {
+                if (stream->stored_left == 0)
+                {
+                    stream->state = stream->final ? ZIP_INFLATE_DONE : ZIP_INFLATE_HEADER;
+                    continue;
+                }
+                b = zip_next_byte(stream);
+                stream->stored_left--;
+            }
+            else if (stream->state == ZIP_INFLATE_HUFFMAN)
+            {
+                int symbol = zip_decode(stream, &stream->lencode);
+                if (symbol == 256)
+                {
+                    stream->state = stream->final ? ZIP_INFLATE_DONE : ZIP_INFLATE_HEADER;
+                    continue;
+                }
+                if ((symbol > 256) && (symbol < 286))
+                {
+                    symbol -= 257;
+                    int extra = zip_bits(stream, zip_length_extra[symbol]);
+                    int dist = zip_decode(stream, &stream->distcode);
+                    if ((extra < 0) || (dist < 0) || (dist >= 30))
+                    {
+                        stream->state = ZIP_INFLATE_ERROR;
+                        continue;
+                    }
+                    int dist_extra = zip_bits(stream, zip_dist_extra[dist]);
+                    if (dist_extra < 0)
+                    {
+                        stream->state = ZIP_INFLATE_ERROR;
+                        continue;
+                    }
+                    stream->copy_len = zip_length_base[symbol] + extra;
+                    stream->copy_dist = zip_dist_base[dist] + dist_extra;
+                    if (stream->copy_dist > stream->out_total)
+                    {
+                        // Distance too far back
+                        stream->state = ZIP_INFLATE_ERROR;
+                    }
+                    continue;
+                }
+                b = (symbol < 256) ? symbol : -1;
+            }
+            else if (stream->source != NULL)
+            {
+                // The size of a stream read from a source is only known at the end
+                break;
+            }
+            else
+            {
+                // The last block ended before the size of the entry
+                b = -1;
+            }
+            if (b < 0)
+            {
+                stream->state = ZIP_INFLATE_ERROR;
+                continue;
+            }
+            stream->window[stream->window_pos] = b;
+            stream->window_pos = (stream->window_pos + 1) & (ZIP_WINDOW_SIZE - 1);
+            stream->out_total++;
+            out[produced++] = b;
+        }
+    }
+    if (stream->entry->method == ZIP_METHOD_STORED)
+    {
+        stream->out_total += produced;
+    }
+    stream->crc = zip_crc32(stream->crc, out, produced);
+    if ((stream->source != NULL) && (stream->state == ZIP_INFLATE_DONE))
+    {
+        stream->state = zip_source_trailer(stream) ? ZIP_INFLATE_END : ZIP_INFLATE_ERROR;
+    }
+    if (stream->state == ZIP_INFLATE_ERROR)
+    {
+        DPRINTF("ERROR: Corrupted data in %s\n", stream->entry->name);
+        return -1;
+    }
+    if ((stream->out_total == stream->entry->uncompressed_size) && (stream->crc != stream->entry->crc32))
+    {
+        DPRINTF("ERROR: Bad CRC32 of %s\n", stream->entry->name);
+        stream->state = ZIP_INFLATE_ERROR;
+        return -1;
+    }
+    return produced;
+}
+
+/**
+ * @brief Closes a stream and frees its window.
+ *
+ * @param stream The stream to close.
+ */
+void zip_stream_close(ZipStream *stream)
+{
+    if (stream->window != NULL)
+    {
+        free(stream->window);
+        stream->window = NULL;
+    }
+    stream->entry = NULL;
+}
+
+/**
+ * @brief Extracts an entry of a ZIP archive to a file.
+ *
+ * @param zip_path The path of the archive.
+ * @param entry_name The name of the entry in the archive.
+ * @param dest_path The path of the file to create.
+ * @param overwrite If false, the extraction fails with FR_EXIST when the file exists.
+ * @return FR_OK if the entry was extracted, or a FatFs error code. FR_INT_ERR if the entry is corrupted.
+ */
+FRESULT zip_extract(const char *zip_path, const char *entry_name, const char *dest_path, bool overwrite)
+{
+    ZipArchive zip;
+    FRESULT fr = zip_open(&zip, zip_path);
+    if (fr != FR_OK)
+    {
+        return fr;
+    }
+    ZipStream *stream = malloc(sizeof(ZipStream));
+    uint8_t *buffer = malloc(ZIP_INPUT_BUFFER_SIZE * 8);
+    if ((stream == NULL) || (buffer == NULL))
+    {
+        free(stream);
+        free(buffer);
+        zip_close(&zip);
+        return FR_NOT_ENOUGH_CORE;
+    }
+    fr = zip_stream_open(stream, &zip, zip_find(&zip, entry_name));
+    FIL dest;
+    if (fr == FR_OK)
+    {
+        fr = f_open(&dest, dest_path, FA_WRITE | (overwrite ? FA_CREATE_ALWAYS : FA_CREATE_NEW));
+        if (fr == FR_OK)
+        {
+            while (fr == FR_OK)
+            {
+                int bytes = zip_stream_read(stream, buffer, ZIP_INPUT_BUFFER_SIZE * 8);
+                if (bytes <= 0)
+                {
+                    fr = (bytes < 0) ? FR_INT_ERR : FR_OK;
+                    break;
+                }
+                UINT bw = 0;
+                fr = f_write(&dest, buffer, bytes, &bw);
+                if ((fr == FR_OK) && (bw < (UINT)bytes))
+                {
+                    fr = FR_DENIED; // Disk full
+                }
+            }
+            FRESULT fr_close = f_close(&dest);
+            fr = (fr == FR_OK) ? fr_close : fr;
+            if (fr != FR_OK)
+            {
+                f_unlink(dest_path);
+            }
+        }
+        zip_stream_close(stream);
+    }
+    DPRINTF("Extract %s from %s to %s: %d\n", entry_name, zip_path, dest_path, fr);
+    free(buffer);
+    free(stream);
+    zip_close(&zip);
+    return fr;
+}
+
+// Delete the oldest cache files of the folder until they fit in ZIP_CACHE_MAX_SIZE with a new one
+// of new_size bytes. The cache file keep is in use and it's never deleted. The one open by the other
+// drive can't be deleted either, so the next oldest goes instead
+static void zip_cache_evict(const char *folder, const char *keep, uint32_t new_size)
+{
+    size_t ext_len = strlen(ZIP_CACHE_EXTENSION);
+    bool skip = false;
+    uint32_t skip_stamp = 0; // Files this old or older could not be deleted
+    while (true)
+    {
+        DIR dir;
+        FILINFO fno;
+        uint64_t total = new_size;
+        uint32_t oldest_stamp = 0xFFFFFFFF;
+        char oldest[FF_LFN_BUF + 1] = {0};
+        if (f_opendir(&dir, (folder[0] != '\0') ? folder : "/") != FR_OK)
+        {
+            return;
+        }
+        while ((f_readdir(&dir, &fno) == FR_OK) && (fno.fname[0] != '\0'))
+        {
+            size_t len = strlen(fno.fname);
+            if ((fno.fattrib & AM_DIR) || (len <= ext_len) || (strcasecmp(fno.fname + len - ext_len, ZIP_CACHE_EXTENSION) != 0) ||
+                (strcasecmp(fno.fname, keep) == 0))
+            {
+                continue;
+            }
+            total += fno.fsize;
+            uint32_t stamp = ((uint32_t)fno.fdate << 16) | fno.ftime;
+            if ((!skip || (stamp > skip_stamp)) && (stamp < oldest_stamp))
+            {
+                oldest_stamp = stamp;
+                strcpy(oldest, fno.fname);
+            }
+        }
+        f_closedir(&dir);
+        if ((total <= ZIP_CACHE_MAX_SIZE) || (oldest[0] == '\0'))
+        {
+            return;
+        }
+        char path[ZIP_MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s/%s", folder, oldest);
+        FRESULT fr = f_unlink(path);
+        DPRINTF("Cache file %s deleted: %d\n", path, fr);
+        if (fr == FR_LOCKED)
+        {
+            skip = true;
+            skip_stamp = oldest_stamp;
+        }
+        else if (fr != FR_OK)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Opens an image stored inside a ZIP archive for random access.
+ *
+ * The image is decompressed on demand into a cache file next to the archive, named after the
+ * CRC32 and size of the image. The sectors are read from the cache file once zip_image_fill
+ * has decompressed them. A complete cache file is reused, so the image is only decompressed once.
+ * The cache files of a folder are kept under ZIP_CACHE_MAX_SIZE bytes, deleting the least recently
+ * used ones before decompressing a new image.
+ *
+ * @param image The image to open.
+ * @param fullpath The path of the image, like "/floppies/games.zip/game.st".
+ * @param cache File object for the cache file. It's open for read and write until zip_image_close.
+ * @return FR_OK if the image is open, or a FatFs error code.
+ */
+FRESULT zip_image_open(ZipImage *image, const char *fullpath, FIL *cache)
+{
+    char zip_path[ZIP_MAX_PATH_LENGTH];
+    const char *entry_name = NULL;
+    image->active = false;
+    if (!zip_split_path(fullpath, zip_path, sizeof(zip_path), &entry_name))
+    {
+        return FR_INVALID_NAME;
+    }
+    FRESULT fr = zip_open(&image->zip, zip_path);
+    if (fr != FR_OK)
+    {
+        return fr;
+    }
+    int index = zip_find(&image->zip, entry_name);
+    if (index < 0)
+    {
+        zip_close(&image->zip);
+        return FR_NO_FILE;
+    }
+    const ZipEntry *entry = &image->zip.entries[index];
+
+    // The cache file lives in the folder of the archive
+    char folder[ZIP_MAX_PATH_LENGTH];
+    char cache_name[32];
+    char cache_path[ZIP_MAX_PATH_LENGTH];
+    char *slash = strrchr(zip_path, '/');
+    int folder_len = (slash != NULL) ? (slash - zip_path) : 0;
+    snprintf(folder, sizeof(folder), "%.*s", folder_len, zip_path);
+    snprintf(cache_name, sizeof(cache_name), "%08lx-%lu" ZIP_CACHE_EXTENSION, (unsigned long)entry->crc32,
+             (unsigned long)entry->uncompressed_size);
+    snprintf(cache_path, sizeof(cache_path), "%s/%s", folder, cache_name);
+    FILINFO fno;
+    if ((f_stat(cache_path, &fno) == FR_OK) && (fno.fsize == entry->uncompressed_size))
+    {
+        // Used now: the date of the cache file orders the eviction
+        DWORD now = get_fattime();
+        fno.fdate = (WORD)(now >> 16);
+        fno.ftime = (WORD)(now & 0xFFFF);
+        f_utime(cache_path, &fno);
+    }
+    else
+    {
+        zip_cache_evict(folder, cache_name, entry->uncompressed_size);
+    }
+    fr = f_open(cache, cache_path, FA_READ | FA_WRITE | FA_OPEN_ALWAYS);
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not open the cache file %s (%d)\n", cache_path, fr);
+        zip_close(&image->zip);
+        return fr;
+    }
+    image->cache = cache;
+    image->size = entry->uncompressed_size;
+    image->stream.entry = NULL;
+    image->stream.window = NULL;
+    if (f_size(cache) == image->size)
+    {
+        DPRINTF("Cache file %s of %s is complete\n", cache_path, fullpath);
+        image->cached = image->size;
+    }
+    else
+    {
+        // A partial cache file can't be resumed without the state of the stream
+        fr = f_truncate(cache);
+        if (fr == FR_OK)
+        {
+            fr = zip_stream_open(&image->stream, &image->zip, index);
+        }
+        if (fr != FR_OK)
+        {
+            f_close(cache);
+            zip_close(&image->zip);
+            return fr;
+        }
+        image->cached = 0;
+    }
+    image->active = true;
+    return FR_OK;
+}
+
+/**
+ * @brief Decompresses the image into its cache file until it covers the given offset.
+ *
+ * The file pointer of the cache file is moved, so seek it again before reading.
+ *
+ * @param image The image opened with zip_image_open.
+ * @param end The offset of the image that must be in the cache file.
+ * @return FR_OK if the cache file covers the offset or the whole image, or a FatFs error code.
+ */
+FRESULT zip_image_fill(ZipImage *image, uint32_t end)
+{
+    if (!image->active || (image->cached >= end) || (image->cached >= image->size))
+    {
+        return FR_OK;
+    }
+    uint8_t buffer[ZIP_INPUT_BUFFER_SIZE];
+    FRESULT fr = f_lseek(image->cache, image->cached);
+    while ((fr == FR_OK) && (image->cached < end) && (image->cached < image->size))
+    {
+        int bytes = zip_stream_read(&image->stream, buffer, sizeof(buffer));
+        if (bytes <= 0)
+        {
+            fr = FR_INT_ERR;
+            break;
+        }
+        UINT bw = 0;
+        fr = f_write(image->cache, buffer, bytes, &bw);
+        if ((fr == FR_OK) && (bw < (UINT)bytes))
+        {
+            fr = FR_DENIED; // Disk full
+        }
+        image->cached += bw;
+    }
+    if (fr == FR_OK)
+    {
+        fr = f_sync(image->cache);
+    }
+    if (image->cached >= image->size)
+    {
+        // The whole image is in the cache file. The window is not needed anymore
+        zip_stream_close(&image->stream);
+    }
+    if (fr != FR_OK)
+    {
+        DPRINTF("ERROR: Could not decompress the image (%d)\n", fr);
+    }
+    return fr;
+}
+
+/**
+ * @brief Closes an image opened with zip_image_open. The cache file is closed too.
+ *
+ * @param image The image to close.
+ */
+void zip_image_close(ZipImage *image)
+{
+    if (image->active)
+    {
+        zip_stream_close(&image->stream);
+        zip_close(&image->zip);
+        f_close(image->cache);
+        image->active = false;
+    }
+}
+
+// Lists of entries of the last archives listed. An archive is opened again only if it changed
+static ZipListCache zip_list_cache[ZIP_LIST_CACHE_ARCHIVES];
+static uint8_t zip_list_cache_next = 0; // Slot replaced by the next archive listed
+
+// Hash of the extensions allowed, so a list filtered for other extensions is not used
+static uint32_t zip_list_extensions_hash(const char **allowed_extensions, size_t num_extensions)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < num_extensions; i++)
+    {
+        for (const char *c = allowed_extensions[i]; *c != '\0'; c++)
+        {
+            hash = (hash ^ (uint8_t)*c) * 16777619u;
+        }
+        hash = (hash ^ ',') * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Reads the names of the entries of an archive with an allowed extension.
+ *
+ * @param zip_path The path of the archive.
+ * @param allowed_extensions The extensions of the entries to keep, in lowercase and without the dot.
+ * @param num_extensions The number of allowed extensions.
+ * @param count The number of names read.
+ * @param size The bytes of the names read.
+ * @return The names, each one ending with '\0', or NULL if the archive can not be read. Must be freed.
+ */
+static char *zip_list_read(const char *zip_path, const char **allowed_extensions, size_t num_extensions, uint16_t *count, size_t *size)
+{
+    ZipArchive zip;
+    if (zip_open(&zip, zip_path) != FR_OK)
+    {
+        return NULL;
+    }
+    bool *keep = malloc(zip.count > 0 ? zip.count * sizeof(bool) : 1);
+    if (keep == NULL)
+    {
+        zip_close(&zip);
+        return NULL;
+    }
+    *count = 0;
+    *size = 0;
+    for (uint16_t j = 0; j < zip.count; j++)
+    {
+        const char *ext = strrchr(zip.entries[j].name, '.');
+        keep[j] = false;
+        for (size_t k = 0; (ext != NULL) && (k < num_extensions); k++)
+        {
+            keep[j] = keep[j] || (strcasecmp(ext + 1, allowed_extensions[k]) == 0);
+        }
+        if (keep[j])
+        {
+            (*count)++;
+            *size += strlen(zip.entries[j].name) + 1;
+        }
+    }
+    char *names = malloc(*size > 0 ? *size : 1);
+    char *next = names;
+    for (uint16_t j = 0; (names != NULL) && (j < zip.count); j++)
+    {
+        if (keep[j])
+        {
+            strcpy(next, zip.entries[j].name);
+            next += strlen(next) + 1;
+        }
+    }
+    free(keep);
+    zip_close(&zip);
+    return names;
+}
+
+/**
+ * @brief Adds the entries of the ZIP archives of a folder to a list of files.
+ *
+ * Each entry with an allowed extension is added as "archive.zip/entry", so the
+ * lists of images show the images inside the archives too. The archives themselves stay
+ * in the list and are removed later by the filter of extensions. The entries of the last
+ * archives listed are kept, and an archive is only opened again if its size or date changed.
+ *
+ * @param dir The folder of the files.
+ * @param file_list The list of files returned by show_dir_files. It's reallocated.
+ * @param num_files The number of files in the list. It's updated.
+ * @param allowed_extensions The extensions of the entries to add, in lowercase and without the dot.
+ * @param num_extensions The number of allowed extensions.
+ */
+void zip_expand_file_list(const char *dir, char ***file_list, int *num_files, const char **allowed_extensions, size_t num_extensions)
+{
+    int count = *num_files;
+    size_t ext_len = strlen(ZIP_EXTENSION);
+    uint32_t extensions = zip_list_extensions_hash(allowed_extensions, num_extensions);
+    for (int i = 0; i < count; i++)
+    {
+        const char *name = (*file_list)[i];
+        size_t name_len = strlen(name);
+        if ((name[0] == '.') || (name_len <= ext_len) || (strcasecmp(name + name_len - ext_len, ZIP_EXTENSION) != 0))
+        {
+            continue;
+        }
+        char zip_path[ZIP_MAX_PATH_LENGTH];
+        snprintf(zip_path, sizeof(zip_path), "%s/%s", dir, name);
+        FILINFO fno;
+        if (f_stat(zip_path, &fno) != FR_OK)
+        {
+            continue;
+        }
+
+        ZipListCache *cached = NULL;
+        for (int c = 0; (c < ZIP_LIST_CACHE_ARCHIVES) && (cached == NULL); c++)
+        {
+            ZipListCache *slot = &zip_list_cache[c];
+            if ((slot->names != NULL) && (slot->size == fno.fsize) && (slot->date == fno.fdate) &&
+                (slot->time == fno.ftime) && (slot->extensions == extensions) && (strcmp(slot->path, zip_path) == 0))
+            {
+                cached = slot;
+            }
+        }
+        uint16_t names_count;
+        char *names;
+        char *owned = NULL; // Names read now and not kept in the cache
+        if (cached != NULL)
+        {
+            names_count = cached->count;
+            names = cached->names;
+        }
+        else
+        {
+            size_t size;
+            names = zip_list_read(zip_path, allowed_extensions, num_extensions, &names_count, &size);
+            if (names == NULL)
+            {
+                continue;
+            }
+            if (size <= ZIP_LIST_CACHE_MAX_SIZE)
+            {
+                ZipListCache *slot = &zip_list_cache[zip_list_cache_next];
+                zip_list_cache_next = (zip_list_cache_next + 1) % ZIP_LIST_CACHE_ARCHIVES;
+                free(slot->names);
+                strcpy(slot->path, zip_path);
+                slot->size = fno.fsize;
+                slot->date = fno.fdate;
+                slot->time = fno.ftime;
+                slot->extensions = extensions;
+                slot->count = names_count;
+                slot->names = names;
+            }
+            else
+            {
+                owned = names;
+            }
+        }
+
+        const char *entry_name = names;
+        for (uint16_t j = 0; j < names_count; j++, entry_name += strlen(entry_name) + 1)
+        {
+            char **list = realloc(*file_list, sizeof(char *) * (*num_files + 1));
+            char *full_name = malloc(name_len + strlen(entry_name) + 2);
+            if ((list == NULL) || (full_name == NULL))
+            {
+                DPRINTF("Memory allocation failed\n");
+                free(full_name);
+                if (list != NULL)
+                {
+                    *file_list = list;
+                }
+                free(owned);
+                return;
+            }
+            sprintf(full_name, "%s/%s", name, entry_name);
+            list[*num_files] = full_name;
+            *file_list = list;
+            (*num_files)++;
+        }
+        free(owned);
+    }
+}